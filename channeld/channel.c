@@ -1,7 +1,7 @@
 /* Main channel operation daemon: runs from funding_locked to shutdown_complete.
  *
- * We're fairly synchronous: our main loop looks for gossip, master or
- * peer requests and services them synchronously.
+ * We're fairly synchronous: our main loop waits for gossip, master or
+ * peer requests and services all that have arrived, synchronously.
  *
  * The exceptions are:
  * 1. When we've asked the master something: in that case, we queue
@@ -12,12 +12,14 @@
  */
 #include <bitcoin/privkey.h>
 #include <bitcoin/script.h>
+#include <ccan/array_size/array_size.h>
 #include <ccan/cast/cast.h>
 #include <ccan/container_of/container_of.h>
 #include <ccan/crypto/hkdf_sha256/hkdf_sha256.h>
 #include <ccan/crypto/shachain/shachain.h>
 #include <ccan/err/err.h>
 #include <ccan/fdpass/fdpass.h>
+#include <ccan/ilog/ilog.h>
 #include <ccan/mem/mem.h>
 #include <ccan/structeq/structeq.h>
 #include <ccan/take/take.h>
@@ -25,14 +27,18 @@
 #include <ccan/time/time.h>
 #include <channeld/commit_tx.h>
 #include <channeld/full_channel.h>
+#include <channeld/htlc_sigs.h>
 #include <channeld/gen_channel_wire.h>
 #include <common/crypto_sync.h>
+#include <common/cryptomsg.h>
 #include <common/derive_basepoints.h>
 #include <common/dev_disconnect.h>
 #include <common/htlc_tx.h>
+#include <common/inbuf.h>
 #include <common/io_debug.h>
 #include <common/key_derive.h>
 #include <common/msg_queue.h>
+#include <common/parallel.h>
 #include <common/peer_billboard.h>
 #include <common/peer_failed.h>
 #include <common/ping.h>
@@ -50,8 +56,10 @@
 #include <gossipd/routing.h>
 #include <hsmd/gen_hsm_client_wire.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <secp256k1.h>
 #include <stdio.h>
+#include <sys/epoll.h>
 #include <wire/gen_onion_wire.h>
 #include <wire/peer_wire.h>
 #include <wire/wire.h>
@@ -70,6 +78,27 @@ struct commit_sigs {
 	secp256k1_ecdsa_signature *htlc_sigs;
 };
 
+/* How we've been batching updates into commitments. */
+struct commit_stats {
+	/* Commitments we've sent, and the updates in them. */
+	u64 commits, updates;
+
+	/* Total time from the first update to its commitment_signed, and
+	 * from commitment_signed to revoke_and_ack. */
+	u64 latency_usec, revoke_wait_usec;
+
+	/* Recent updates per commitment, and round trip, times 8. */
+	u64 batch8, rtt_usec8;
+
+	/* When the first update not yet committed arrived. */
+	struct timemono first_update;
+	bool have_first_update;
+
+	/* When we sent the commitment_signed we want revoked. */
+	struct timemono commit_sent;
+	bool commit_in_flight;
+};
+
 struct peer {
 	struct crypto_state cs;
 	struct channel_config conf[NUM_SIDES];
@@ -109,18 +138,32 @@ struct peer {
 	/* Pending msgs to send (not encrypted) */
 	struct msg_queue peer_out;
 
-	/* Current msg to send, and offset (encrypted) */
-	const u8 *peer_outmsg;
-	size_t peer_outoff;
+	/* How many commitment changes master hasn't acked saving yet, and
+	 * the msgs to send once it has. */
+	size_t acks_pending;
+	struct msg_queue peer_out_held;
+
+	/* Encrypted msgs to send, how many bytes, and how far we are:
+	 * we reuse the buffer for each batch. */
+	u8 *peer_outbuf;
+	size_t peer_outlen, peer_outoff;
 
 	/* Messages from master / gossipd: we queue them since we
 	 * might be waiting for a specific reply. */
 	struct msg_queue from_master, from_gossipd;
 
+	/* What we've read from master, gossipd and peer, but not handled. */
+	struct inbuf *master_in, *gossip_in, *peer_in;
+
+	/* Our epoll set (-1 until main loop), and our events for PEER_FD. */
+	int epoll_fd;
+	u32 peer_events;
+
 	struct timers timers;
 	struct oneshot *commit_timer;
-	u64 commit_timer_attempts;
+	/* Longest we'll wait for more updates before committing. */
 	u32 commit_msec;
+	struct commit_stats commit_stats;
 
 	/* Don't accept a pong we didn't ping for. */
 	size_t num_pings_outstanding;
@@ -167,6 +210,9 @@ struct peer {
 
 	/* Make sure timestamps move forward. */
 	u32 last_update_timestamp;
+
+	/* How many threads to sign and check HTLC txs with. */
+	size_t sig_threads;
 };
 
 static u8 *create_channel_announcement(const tal_t *ctx, struct peer *peer);
@@ -226,47 +272,98 @@ static void *tal_arr_append_(void **p, size_t size)
 }
 #define tal_arr_append(p) tal_arr_append_((void **)(p), sizeof(**(p)))
 
-static void do_peer_write(struct peer *peer)
+/* Returns false if it would block. */
+static bool do_peer_write(struct peer *peer)
 {
 	int r;
-	size_t len = tal_len(peer->peer_outmsg);
 
-	r = write(PEER_FD, peer->peer_outmsg + peer->peer_outoff,
-		  len - peer->peer_outoff);
-	if (r < 0)
+	r = write(PEER_FD, peer->peer_outbuf + peer->peer_outoff,
+		  peer->peer_outlen - peer->peer_outoff);
+	if (r < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return false;
 		peer_failed_connection_lost();
+	}
 
 	peer->peer_outoff += r;
-	if (peer->peer_outoff == len)
-		peer->peer_outmsg = tal_free(peer->peer_outmsg);
+	if (peer->peer_outoff == peer->peer_outlen)
+		peer->peer_outoff = peer->peer_outlen = 0;
+	return true;
 }
 
 static bool peer_write_pending(struct peer *peer)
 {
 	const u8 *msg;
 
-	if (peer->peer_outmsg)
+	if (peer->peer_outlen)
 		return true;
 
-	msg = msg_dequeue(&peer->peer_out);
-	if (!msg)
-		return false;
+	/* Encrypt as many as we can, to go out in one write. */
+	while (peer->peer_outlen < CRYPTOMSG_BATCH_MAX
+	       && (msg = msg_dequeue(&peer->peer_out)) != NULL) {
+		status_io(LOG_IO_OUT, msg);
+		peer->peer_outlen = cryptomsg_encrypt_into(&peer->cs, take(msg),
+							   &peer->peer_outbuf,
+							   peer->peer_outlen);
+	}
+	return peer->peer_outlen != 0;
+}
 
-	status_io(LOG_IO_OUT, msg);
-	peer->peer_outmsg = cryptomsg_encrypt_msg(peer, &peer->cs, take(msg));
-	peer->peer_outoff = 0;
-	return true;
+/* Write out as much as we can without blocking. */
+static void write_peer_out(struct peer *peer)
+{
+	while (peer_write_pending(peer)) {
+		if (!do_peer_write(peer))
+			break;
+	}
 }
 
 /* Synchronous flush of all pending packets. */
 static void flush_peer_out(struct peer *peer)
 {
-	while (peer_write_pending(peer))
-		do_peer_write(peer);
+	struct pollfd pfd;
+
+	pfd.fd = PEER_FD;
+	pfd.events = POLLOUT;
+	while (peer_write_pending(peer)) {
+		if (!do_peer_write(peer))
+			poll(&pfd, 1, -1);
+	}
 }
 
+#if DEVELOPER
+/* dev_disconnect replaced PEER_FD: set the new one up like the old. */
+static void peer_fd_replaced(struct peer *peer)
+{
+	struct epoll_event ev;
+
+	inbuf_reset(peer->peer_in);
+	if (peer->epoll_fd == -1)
+		return;
+
+	if (!io_fd_block(PEER_FD, false))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "NONBLOCK failed: %s", strerror(errno));
+
+	/* Closing the old one took it out of the epoll set. */
+	ev.events = peer->peer_events;
+	ev.data.fd = PEER_FD;
+	if (epoll_ctl(peer->epoll_fd, EPOLL_CTL_ADD, PEER_FD, &ev) != 0
+	    && (errno != EEXIST
+		|| epoll_ctl(peer->epoll_fd, EPOLL_CTL_MOD, PEER_FD, &ev) != 0))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "epoll_ctl failed: %s", strerror(errno));
+}
+#endif /* DEVELOPER */
+
 static void enqueue_peer_msg(struct peer *peer, const u8 *msg TAKES)
 {
+	/* Not until master has saved what it commits us to. */
+	if (peer->acks_pending) {
+		msg_enqueue(&peer->peer_out_held, msg);
+		return;
+	}
+
 #if DEVELOPER
 	enum dev_disconnect d = dev_disconnect(fromwire_peektype(msg));
 
@@ -278,6 +375,7 @@ static void enqueue_peer_msg(struct peer *peer, const u8 *msg TAKES)
 	case DEV_DISCONNECT_BEFORE:
 		/* Fail immediately. */
 		dev_sabotage_fd(PEER_FD);
+		peer_fd_replaced(peer);
 		msg_enqueue(&peer->peer_out, msg);
 		flush_peer_out(peer);
 		/* Should not return */
@@ -286,15 +384,18 @@ static void enqueue_peer_msg(struct peer *peer, const u8 *msg TAKES)
 		tal_free(msg);
 		/* Fail next time we try to do something. */
 		dev_sabotage_fd(PEER_FD);
+		peer_fd_replaced(peer);
 		return;
 	case DEV_DISCONNECT_AFTER:
 		msg_enqueue(&peer->peer_out, msg);
 		flush_peer_out(peer);
 		dev_sabotage_fd(PEER_FD);
+		peer_fd_replaced(peer);
 		return;
 	case DEV_DISCONNECT_BLACKHOLE:
 		msg_enqueue(&peer->peer_out, msg);
 		dev_blackhole_fd(PEER_FD);
+		peer_fd_replaced(peer);
 		return;
 	case DEV_DISCONNECT_NORMAL:
 		break;
@@ -596,35 +697,55 @@ static void handle_peer_announcement_signatures(struct peer *peer, const u8 *msg
 		announce_channel(peer);
 }
 
-static bool get_shared_secret(const struct htlc *htlc,
-			      struct secret *shared_secret)
+/* One round trip to the HSM for all of them, rather than one each. */
+static void get_shared_secrets(struct htlc **htlcs)
 {
-	tal_t *tmpctx = tal_tmpctx(htlc);
-	struct pubkey ephemeral;
-	struct onionpacket *op;
+	const tal_t *tmpctx = tal_tmpctx(NULL);
+	struct pubkey *ephemerals = tal_arr(tmpctx, struct pubkey, 0);
+	struct htlc **unwrapped = tal_arr(tmpctx, struct htlc *, 0);
+	struct secret *ss;
 	u8 *msg;
 
-	/* We unwrap the onion now. */
-	op = parse_onionpacket(tmpctx, htlc->routing, TOTAL_PACKET_SIZE);
-	if (!op) {
-		/* Return an invalid shared secret. */
-		memset(shared_secret, 0, sizeof(*shared_secret));
+	for (size_t i = 0; i < tal_count(htlcs); i++) {
+		struct onionpacket *op;
+		struct pubkey *ephemeral;
+		struct htlc **htlc;
+
+		htlcs[i]->shared_secret = tal(htlcs[i], struct secret);
+
+		/* We unwrap the onion now. */
+		op = parse_onionpacket(tmpctx, htlcs[i]->routing,
+				       TOTAL_PACKET_SIZE);
+		if (!op) {
+			/* Return an invalid shared secret. */
+			memset(htlcs[i]->shared_secret, 0,
+			       sizeof(*htlcs[i]->shared_secret));
+			continue;
+		}
+		/* Because wire takes struct pubkey. */
+		ephemeral = tal_arr_append(&ephemerals);
+		ephemeral->pubkey = op->ephemeralkey;
+		htlc = tal_arr_append(&unwrapped);
+		*htlc = htlcs[i];
+	}
+
+	if (tal_count(unwrapped) == 0) {
 		tal_free(tmpctx);
-		return false;
+		return;
 	}
 
-	/* Because wire takes struct pubkey. */
-	ephemeral.pubkey = op->ephemeralkey;
-	msg = towire_hsm_ecdh_req(tmpctx, &ephemeral);
+	msg = towire_hsm_ecdh_batch_req(tmpctx, ephemerals);
 	if (!wire_sync_write(HSM_FD, msg))
-		status_failed(STATUS_FAIL_HSM_IO, "Writing ecdh req");
+		status_failed(STATUS_FAIL_HSM_IO, "Writing ecdh batch req");
 	msg = wire_sync_read(tmpctx, HSM_FD);
-	/* Gives all-zero shares_secret if it was invalid. */
-	if (!msg || !fromwire_hsm_ecdh_resp(msg, shared_secret))
-		status_failed(STATUS_FAIL_HSM_IO, "Reading ecdh response");
-	tal_free(tmpctx);
+	/* Gives all-zero shared secrets for any which were invalid. */
+	if (!msg || !fromwire_hsm_ecdh_batch_resp(tmpctx, msg, &ss)
+	    || tal_count(ss) != tal_count(unwrapped))
+		status_failed(STATUS_FAIL_HSM_IO, "Reading ecdh batch response");
 
-	return !memeqzero(shared_secret, sizeof(*shared_secret));
+	for (size_t i = 0; i < tal_count(unwrapped); i++)
+		*unwrapped[i]->shared_secret = ss[i];
+	tal_free(tmpctx);
 }
 
 static void handle_peer_add_htlc(struct peer *peer, const u8 *msg)
@@ -656,10 +777,8 @@ static void handle_peer_add_htlc(struct peer *peer, const u8 *msg)
 			    "Bad peer_add_htlc: %s",
 			    channel_add_err_name(add_err));
 
-	/* If this is wrong, we don't complain yet; when it's confirmed we'll
-	 * send it to the master which handles all HTLC failures. */
-	htlc->shared_secret = tal(htlc, struct secret);
-	get_shared_secret(htlc, htlc->shared_secret);
+	/* We don't need the shared secret until they commit to it: we get
+	 * them all at once then, in handle_peer_commit_sig(). */
 }
 
 static void handle_peer_feechange(struct peer *peer, const u8 *msg)
@@ -758,7 +877,9 @@ static bool shutdown_complete(const struct peer *peer)
 		&& peer->shutdown_sent[REMOTE]
 		&& num_channel_htlcs(peer->channel) == 0
 		/* We could be awaiting revoke-and-ack for a feechange */
-		&& peer->revocations_received == peer->next_index[REMOTE] - 1;
+		&& peer->revocations_received == peer->next_index[REMOTE] - 1
+		/* Or holding msgs until master has saved the commitment. */
+		&& !peer->acks_pending;
 
 }
 
@@ -792,15 +913,16 @@ static void maybe_send_shutdown(struct peer *peer)
 static u8 *wait_sync_reply(const tal_t *ctx,
 			   const u8 *msg,
 			   int replytype,
-			   int fd,
+			   struct inbuf *in,
 			   struct msg_queue *queue,
 			   const char *who)
 {
 	u8 *reply;
+	bool failed;
 
 	status_trace("Sending %s %u", who, fromwire_peektype(msg));
 
-	if (!wire_sync_write(fd, msg))
+	if (!wire_sync_write(in->fd, msg))
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
 			      "Could not set sync write to %s: %s",
 			      who, strerror(errno));
@@ -808,11 +930,14 @@ static u8 *wait_sync_reply(const tal_t *ctx,
 	status_trace("... , awaiting %u", replytype);
 
 	for (;;) {
-		reply = wire_sync_read(ctx, fd);
-		if (!reply)
+		reply = inbuf_wire_msg(ctx, in, &failed);
+		if (!reply) {
+			if (!failed && inbuf_fill(in, true))
+				continue;
 			status_failed(STATUS_FAIL_INTERNAL_ERROR,
 				      "Could not set sync read from %s: %s",
 				      who, strerror(errno));
+		}
 		if (fromwire_peektype(reply) == replytype) {
 			status_trace("Got it!");
 			break;
@@ -825,12 +950,18 @@ static u8 *wait_sync_reply(const tal_t *ctx,
 	return reply;
 }
 
-static u8 *master_wait_sync_reply(const tal_t *ctx,
-				  struct peer *peer, const u8 *msg,
-				  enum channel_wire_type replytype)
+/* Tell master about a commitment change.  We don't wait for it to save
+ * it: we keep handling the peer, but hold what we send them until it
+ * acks (handle_master_ack), since that can commit us to this change. */
+static void master_send_needs_ack(struct peer *peer, const u8 *msg TAKES)
 {
-	return wait_sync_reply(ctx, msg, replytype,
-			       MASTER_FD, &peer->from_master, "master");
+	status_trace("Sending master %s, not sending to peer until acked",
+		     channel_wire_type_name(fromwire_peektype(msg)));
+	if (!wire_sync_write(MASTER_FD, msg))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Could not write to master: %s",
+			      strerror(errno));
+	peer->acks_pending++;
 }
 
 static u8 *gossipd_wait_sync_reply(const tal_t *ctx,
@@ -838,7 +969,7 @@ static u8 *gossipd_wait_sync_reply(const tal_t *ctx,
 				   enum gossip_wire_type replytype)
 {
 	return wait_sync_reply(ctx, msg, replytype,
-			       GOSSIP_FD, &peer->from_gossipd, "gossipd");
+			       peer->gossip_in, &peer->from_gossipd, "gossipd");
 }
 
 static struct commit_sigs *calc_commitsigs(const tal_t *ctx,
@@ -904,12 +1035,11 @@ static struct commit_sigs *calc_commitsigs(const tal_t *ctx,
 	commit_sigs->htlc_sigs = tal_arr(commit_sigs, secp256k1_ecdsa_signature,
 					 tal_count(txs) - 1);
 
-	for (i = 0; i < tal_count(commit_sigs->htlc_sigs); i++) {
-		sign_tx_input(txs[1 + i], 0,
-			      NULL,
-			      wscripts[1 + i],
-			      &local_htlcsecretkey, &local_htlckey,
-			      &commit_sigs->htlc_sigs[i]);
+	sign_htlc_txs(txs + 1, wscripts + 1, tal_count(commit_sigs->htlc_sigs),
+		      &local_htlcsecretkey, &local_htlckey,
+		      commit_sigs->htlc_sigs, peer->sig_threads);
+
+	for (i = 0; i < tal_count(commit_sigs->htlc_sigs); i++)
 		status_trace("Creating HTLC signature %s for tx %s wscript %s key %s",
 			     type_to_string(trc, secp256k1_ecdsa_signature,
 					    &commit_sigs->htlc_sigs[i]),
@@ -917,20 +1047,67 @@ static struct commit_sigs *calc_commitsigs(const tal_t *ctx,
 			     tal_hex(trc, wscripts[1+i]),
 			     type_to_string(trc, struct pubkey,
 					    &local_htlckey));
-		assert(check_tx_sig(txs[1+i], 0, NULL, wscripts[1+i],
-				    &local_htlckey,
-				    &commit_sigs->htlc_sigs[i]));
-	}
+
+#if DEVELOPER
+	/* This doubles the work, so only when developing. */
+	assert(check_htlc_txs(txs + 1, wscripts + 1,
+			      tal_count(commit_sigs->htlc_sigs),
+			      &local_htlckey, commit_sigs->htlc_sigs,
+			      peer->sig_threads, &i));
+#endif
 
 	tal_free(tmpctx);
 	return commit_sigs;
 }
 
+static bool awaiting_revoke(const struct peer *peer)
+{
+	return peer->revocations_received != peer->next_index[REMOTE] - 1;
+}
+
+/* Moving average, times 8. */
+static void update_avg8(u64 *avg8, u64 val)
+{
+	*avg8 = *avg8 - *avg8 / 8 + val;
+}
+
+static void commit_sent(struct peer *peer, size_t num_updates)
+{
+	struct commit_stats *s = &peer->commit_stats;
+	struct timemono now = time_mono();
+
+	s->commits++;
+	s->updates += num_updates;
+	update_avg8(&s->batch8, num_updates);
+	if (s->have_first_update)
+		s->latency_usec += time_to_usec(timemono_between(now,
+							s->first_update));
+	s->have_first_update = false;
+	s->commit_sent = now;
+	s->commit_in_flight = true;
+}
+
+static void revoke_received(struct peer *peer)
+{
+	struct commit_stats *s = &peer->commit_stats;
+	u64 usec;
+
+	/* Not if we sent it before we restarted. */
+	if (!s->commit_in_flight)
+		return;
+
+	usec = time_to_usec(timemono_between(time_mono(), s->commit_sent));
+	s->revoke_wait_usec += usec;
+	update_avg8(&s->rtt_usec8, usec);
+	s->commit_in_flight = false;
+}
+
 static void send_commit(struct peer *peer)
 {
 	tal_t *tmpctx = tal_tmpctx(peer);
 	u8 *msg;
 	const struct htlc **changed_htlcs;
+	size_t num_updates = 0;
 
 #if DEVELOPER
 	/* Hack to suppress all commit sends if dev_disconnect says to */
@@ -942,20 +1119,10 @@ static void send_commit(struct peer *peer)
 #endif
 
 	/* FIXME: Document this requirement in BOLT 2! */
-	/* We can't send two commits in a row. */
-	if (peer->revocations_received != peer->next_index[REMOTE] - 1) {
-		assert(peer->revocations_received
-		       == peer->next_index[REMOTE] - 2);
-		peer->commit_timer_attempts++;
-		/* Only report this in extreme cases */
-		if (peer->commit_timer_attempts % 100 == 0)
-			status_trace("Can't send commit:"
-				     " waiting for revoke_and_ack with %"
-				     PRIu64" attempts",
-				     peer->commit_timer_attempts);
-		/* Mark this as done and try again. */
+	/* We can't send two commits in a row: revoke_and_ack restarts us. */
+	if (awaiting_revoke(peer)) {
+		status_trace("Can't send commit: waiting for revoke_and_ack");
 		peer->commit_timer = NULL;
-		start_commit_timer(peer);
 		tal_free(tmpctx);
 		return;
 	}
@@ -994,6 +1161,7 @@ static void send_commit(struct peer *peer)
 
 		msg = towire_update_fee(peer, &peer->channel_id, feerate);
 		enqueue_peer_msg(peer, take(msg));
+		num_updates++;
 	}
 
 	/* BOLT #2:
@@ -1008,6 +1176,7 @@ static void send_commit(struct peer *peer)
 		/* Covers the case where we've just been told to shutdown. */
 		maybe_send_shutdown(peer);
 
+		peer->commit_stats.have_first_update = false;
 		peer->commit_timer = NULL;
 		tal_free(tmpctx);
 		return;
@@ -1017,15 +1186,14 @@ static void send_commit(struct peer *peer)
 						 peer->next_index[REMOTE]);
 
 	status_trace("Telling master we're about to commit...");
-	/* Tell master to save this next commit to database, then wait. */
+	/* Tell master to save this next commit to database: commit_sig
+	 * goes out once it has. */
 	msg = sending_commitsig_msg(tmpctx, peer->next_index[REMOTE],
 				    channel_feerate(peer->channel, REMOTE),
 				    changed_htlcs,
 				    &peer->next_commit_sigs->commit_sig,
 				    peer->next_commit_sigs->htlc_sigs);
-	/* Message is empty; receiving it is the point. */
-	master_wait_sync_reply(tmpctx, peer, take(msg),
-			       WIRE_CHANNEL_SENDING_COMMITSIG_REPLY);
+	master_send_needs_ack(peer, take(msg));
 
 	status_trace("Sending commit_sig with %zu htlc sigs",
 		     tal_count(peer->next_commit_sigs->htlc_sigs));
@@ -1037,24 +1205,58 @@ static void send_commit(struct peer *peer)
 				       peer->next_commit_sigs->htlc_sigs);
 	enqueue_peer_msg(peer, take(msg));
 	peer->next_commit_sigs = tal_free(peer->next_commit_sigs);
+	commit_sent(peer, num_updates + tal_count(changed_htlcs));
 
 	maybe_send_shutdown(peer);
 
-	/* Timer now considered expired, you can add a new one. */
+	/* Timer now considered expired: revoke_and_ack will add a new one. */
 	peer->commit_timer = NULL;
-	start_commit_timer(peer);
 	tal_free(tmpctx);
 }
 
+/* How long to wait for more updates before committing.
+ *
+ * If updates trickle in, each commitment carries one anyway, and waiting
+ * only adds latency: we commit as soon as we've handled everything which
+ * arrived with this wakeup.  If they come in bursts, a fraction of the
+ * round trip lets one commitment carry the rest of the burst: longer for
+ * bigger bursts, but never more than commit_msec.  (While waiting for
+ * revoke_and_ack we can't commit at all, so everything which arrives
+ * meanwhile goes into the next one.) */
+static u32 commit_delay_msec(const struct peer *peer)
+{
+	const struct commit_stats *s = &peer->commit_stats;
+	u64 msec;
+
+	if (s->batch8 < 2 * 8)
+		return 0;
+
+	/* A quarter of the round trip for each doubling of the batch. */
+	msec = s->rtt_usec8 / 8 / 1000 / 4 * (ilog64(s->batch8 / 8) - 1);
+	if (msec > peer->commit_msec)
+		msec = peer->commit_msec;
+	return msec;
+}
+
 static void start_commit_timer(struct peer *peer)
 {
+	struct commit_stats *s = &peer->commit_stats;
+
+	if (!s->have_first_update) {
+		s->first_update = time_mono();
+		s->have_first_update = true;
+	}
+
 	/* Already armed? */
 	if (peer->commit_timer)
 		return;
 
-	peer->commit_timer_attempts = 0;
+	/* handle_peer_revoke_and_ack will call us again. */
+	if (awaiting_revoke(peer))
+		return;
+
 	peer->commit_timer = new_reltimer(&peer->timers, peer,
-					  time_from_msec(peer->commit_msec),
+					  time_from_msec(commit_delay_msec(peer)),
 					  send_commit, peer);
 }
 
@@ -1192,6 +1394,7 @@ static void handle_peer_commit_sig(struct peer *peer, const u8 *msg)
 	struct pubkey remote_htlckey, point;
 	struct bitcoin_tx **txs;
 	const struct htlc **htlc_map, **changed_htlcs;
+	struct htlc **added;
 	const u8 **wscripts;
 	size_t i;
 
@@ -1281,30 +1484,39 @@ static void handle_peer_commit_sig(struct peer *peer, const u8 *msg)
 	 * the channel if any `htlc_signature` is not valid for the
 	 * corresponding HTLC transaction.
 	 */
-	for (i = 0; i < tal_count(htlc_sigs); i++) {
-		if (!check_tx_sig(txs[1+i], 0, NULL, wscripts[1+i],
-				  &remote_htlckey, &htlc_sigs[i]))
-			peer_failed(&peer->cs,
-				    peer->gossip_index,
-				    &peer->channel_id,
-				    "Bad commit_sig signature %s for htlc %s wscript %s key %s",
-				    type_to_string(msg, secp256k1_ecdsa_signature, &htlc_sigs[i]),
-				    type_to_string(msg, struct bitcoin_tx, txs[1+i]),
-				    tal_hex(msg, wscripts[1+i]),
-				    type_to_string(msg, struct pubkey,
-						   &remote_htlckey));
-	}
+	if (!check_htlc_txs(txs + 1, wscripts + 1, tal_count(htlc_sigs),
+			    &remote_htlckey, htlc_sigs, peer->sig_threads, &i))
+		peer_failed(&peer->cs,
+			    peer->gossip_index,
+			    &peer->channel_id,
+			    "Bad commit_sig signature %s for htlc %s wscript %s key %s",
+			    type_to_string(msg, secp256k1_ecdsa_signature, &htlc_sigs[i]),
+			    type_to_string(msg, struct bitcoin_tx, txs[1+i]),
+			    tal_hex(msg, wscripts[1+i]),
+			    type_to_string(msg, struct pubkey,
+					   &remote_htlckey));
 
 	status_trace("Received commit_sig with %zu htlc sigs",
 		     tal_count(htlc_sigs));
 
-	/* Tell master daemon, then wait for ack. */
+	/* If any new HTLCs are wrong, we don't complain yet; we send them to
+	 * the master which handles all HTLC failures. */
+	added = tal_arr(tmpctx, struct htlc *, 0);
+	for (i = 0; i < tal_count(changed_htlcs); i++) {
+		struct htlc **a;
+
+		if (changed_htlcs[i]->state != RCVD_ADD_COMMIT)
+			continue;
+		a = tal_arr_append(&added);
+		*a = cast_const(struct htlc *, changed_htlcs[i]);
+	}
+	get_shared_secrets(added);
+
+	/* Tell master daemon: revocation goes out once it acks. */
 	msg = got_commitsig_msg(tmpctx, peer->next_index[LOCAL],
 				channel_feerate(peer->channel, LOCAL),
 				&commit_sig, htlc_sigs, changed_htlcs, txs[0]);
-
-	master_wait_sync_reply(tmpctx, peer, take(msg),
-			       WIRE_CHANNEL_GOT_COMMITSIG_REPLY);
+	master_send_needs_ack(peer, take(msg));
 	tal_free(tmpctx);
 	return send_revocation(peer);
 }
@@ -1359,6 +1571,7 @@ static void handle_peer_revoke_and_ack(struct peer *peer, const u8 *msg)
 			    &peer->channel_id,
 			    "Unexpected revoke_and_ack");
 	}
+	revoke_received(peer);
 
 	/* BOLT #2:
 	 *
@@ -1392,12 +1605,12 @@ static void handle_peer_revoke_and_ack(struct peer *peer, const u8 *msg)
 	else
 		status_trace("No commits outstanding after recv revoke_and_ack");
 
-	/* Tell master about things this locks in, wait for response */
+	/* Tell master about things this locks in: our next commit_sig
+	 * would implicitly ack it, so that waits until it's saved. */
 	msg = got_revoke_msg(tmpctx, peer->revocations_received++,
 			     &old_commit_secret, &next_per_commit,
 			     changed_htlcs);
-	master_wait_sync_reply(tmpctx, peer, take(msg),
-			       WIRE_CHANNEL_GOT_REVOKE_REPLY);
+	master_send_needs_ack(peer, take(msg));
 
 	peer->old_remote_per_commit = peer->remote_per_commit;
 	peer->remote_per_commit = next_per_commit;
@@ -1808,6 +2021,7 @@ static bool channeld_send_reply(struct crypto_state *cs UNUSED,
 	return true;
 }
 
+/* Only for peer_reconnect, before main() makes PEER_FD non-blocking. */
 static u8 *channeld_read_peer_msg(struct peer *peer)
 {
 	return read_peer_msg(peer, &peer->cs, peer->gossip_index,
@@ -2399,6 +2613,39 @@ static void handle_shutdown_cmd(struct peer *peer, const u8 *inmsg)
 	start_commit_timer(peer);
 }
 
+static void handle_master_ack(struct peer *peer, const u8 *inmsg)
+{
+	const u8 *msg;
+
+	/* Message is empty; receiving it is the point. */
+	if (!peer->acks_pending)
+		master_badmsg(fromwire_peektype(inmsg), inmsg);
+
+	if (--peer->acks_pending)
+		return;
+
+	/* It's all on disk now: send what we held, in order. */
+	while ((msg = msg_dequeue(&peer->peer_out_held)) != NULL)
+		enqueue_peer_msg(peer, take(msg));
+}
+
+static void handle_commit_stats(struct peer *peer, const u8 *inmsg)
+{
+	const struct commit_stats *s = &peer->commit_stats;
+
+	if (!fromwire_channel_commit_stats(inmsg))
+		master_badmsg(WIRE_CHANNEL_COMMIT_STATS, inmsg);
+
+	wire_sync_write(MASTER_FD,
+			take(towire_channel_commit_stats_reply(peer,
+							s->commits,
+							s->updates,
+							s->latency_usec,
+							s->revoke_wait_usec,
+							s->rtt_usec8 / 8,
+							commit_delay_msec(peer))));
+}
+
 #if DEVELOPER
 static void handle_dev_reenable_commit(struct peer *peer)
 {
@@ -2439,6 +2686,14 @@ static void req_in(struct peer *peer, const u8 *msg)
 	case WIRE_CHANNEL_SEND_SHUTDOWN:
 		handle_shutdown_cmd(peer, msg);
 		return;
+	case WIRE_CHANNEL_COMMIT_STATS:
+		handle_commit_stats(peer, msg);
+		return;
+	case WIRE_CHANNEL_SENDING_COMMITSIG_REPLY:
+	case WIRE_CHANNEL_GOT_COMMITSIG_REPLY:
+	case WIRE_CHANNEL_GOT_REVOKE_REPLY:
+		handle_master_ack(peer, msg);
+		return;
 	case WIRE_CHANNEL_DEV_REENABLE_COMMIT:
 #if DEVELOPER
 		handle_dev_reenable_commit(peer);
@@ -2451,13 +2706,11 @@ static void req_in(struct peer *peer, const u8 *msg)
 	case WIRE_CHANNEL_SENDING_COMMITSIG:
 	case WIRE_CHANNEL_GOT_COMMITSIG:
 	case WIRE_CHANNEL_GOT_REVOKE:
-	case WIRE_CHANNEL_SENDING_COMMITSIG_REPLY:
-	case WIRE_CHANNEL_GOT_COMMITSIG_REPLY:
-	case WIRE_CHANNEL_GOT_REVOKE_REPLY:
 	case WIRE_CHANNEL_GOT_FUNDING_LOCKED:
 	case WIRE_CHANNEL_GOT_SHUTDOWN:
 	case WIRE_CHANNEL_SHUTDOWN_COMPLETE:
 	case WIRE_CHANNEL_DEV_REENABLE_COMMIT_REPLY:
+	case WIRE_CHANNEL_COMMIT_STATS_REPLY:
 		break;
 	}
 	master_badmsg(-1, msg);
@@ -2467,17 +2720,20 @@ static void init_shared_secrets(struct channel *channel,
 				const struct added_htlc *htlcs,
 				const enum htlc_state *hstates)
 {
+	struct htlc **theirs = tal_arr(channel, struct htlc *, 0);
+
 	for (size_t i = 0; i < tal_count(htlcs); i++) {
-		struct htlc *htlc;
+		struct htlc **htlc;
 
 		/* We only derive this for HTLCs *they* added. */
 		if (htlc_state_owner(hstates[i]) != REMOTE)
 			continue;
 
-		htlc = channel_get_htlc(channel, REMOTE, htlcs[i].id);
-		htlc->shared_secret = tal(htlc, struct secret);
-		get_shared_secret(htlc, htlc->shared_secret);
+		htlc = tal_arr_append(&theirs);
+		*htlc = channel_get_htlc(channel, REMOTE, htlcs[i].id);
 	}
+	get_shared_secrets(theirs);
+	tal_free(theirs);
 }
 
 /* We do this synchronously. */
@@ -2629,6 +2885,11 @@ static void send_shutdown_complete(struct peer *peer)
 	/* Push out any incomplete messages to peer. */
 	flush_peer_out(peer);
 
+	/* Whoever gets it next expects it to block. */
+	if (!io_fd_block(PEER_FD, true))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "NONBLOCK unset failed: %s", strerror(errno));
+
 	/* Now we can tell master shutdown is complete. */
 	wire_sync_write(MASTER_FD,
 			take(towire_channel_shutdown_complete(peer,
@@ -2639,10 +2900,119 @@ static void send_shutdown_complete(struct peer *peer)
 	close(MASTER_FD);
 }
 
+/* Handle everything master has sent us. */
+static void master_drain(struct peer *peer)
+{
+	const u8 *msg;
+	bool failed;
+
+	if (!inbuf_fill(peer->master_in, false))
+		status_failed(STATUS_FAIL_MASTER_IO,
+			      "Can't read command: %s", strerror(errno));
+
+	while (!shutdown_complete(peer)) {
+		/* Anything we deferred arrived before these. */
+		msg = msg_dequeue(&peer->from_master);
+		if (!msg) {
+			msg = inbuf_wire_msg(peer, peer->master_in, &failed);
+			if (failed)
+				status_failed(STATUS_FAIL_MASTER_IO,
+					      "Can't read command: %s",
+					      strerror(errno));
+			if (!msg)
+				break;
+		}
+		req_in(peer, msg);
+		tal_free(msg);
+	}
+}
+
+/* Handle everything gossipd has sent us. */
+static void gossip_drain(struct peer *peer)
+{
+	const u8 *msg;
+	bool failed;
+
+	if (!inbuf_fill(peer->gossip_in, false))
+		status_failed(STATUS_FAIL_GOSSIP_IO,
+			      "Can't read command: %s", strerror(errno));
+
+	while (!shutdown_complete(peer)) {
+		msg = msg_dequeue(&peer->from_gossipd);
+		if (!msg) {
+			msg = inbuf_wire_msg(peer, peer->gossip_in, &failed);
+			if (failed)
+				status_failed(STATUS_FAIL_GOSSIP_IO,
+					      "Can't read command: %s",
+					      strerror(errno));
+			if (!msg)
+				break;
+		}
+		gossip_in(peer, msg);
+		tal_free(msg);
+	}
+}
+
+/* Handle every complete message the peer has sent us. */
+static void peer_drain(struct peer *peer)
+{
+	u8 *msg;
+	bool failed;
+
+	if (!inbuf_fill(peer->peer_in, false))
+		peer_conn_broken(peer);
+
+	/* Once shutdown is complete, the rest is for closingd. */
+	while (!shutdown_complete(peer)) {
+		msg = inbuf_crypto_msg(peer, peer->peer_in, &peer->cs, &failed);
+		if (failed)
+			peer_conn_broken(peer);
+		if (!msg)
+			break;
+
+		msg = handle_peer_msg(msg, &peer->cs, peer->gossip_index,
+				      &peer->channel_id,
+				      channeld_send_reply,
+				      channeld_io_error,
+				      peer);
+		if (msg)
+			peer_in(peer, msg);
+		tal_free(msg);
+	}
+}
+
+static void epoll_add(struct peer *peer, int fd)
+{
+	struct epoll_event ev;
+
+	/* Edge-triggered: a partial message doesn't wake us until more
+	 * arrives, and the drain functions take everything there is. */
+	ev.events = EPOLLIN|EPOLLET;
+	ev.data.fd = fd;
+	if (epoll_ctl(peer->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "epoll_ctl add %i failed: %s", fd, strerror(errno));
+}
+
+/* Only ask to hear about PEER_FD being writable if we're waiting on it. */
+static void set_peer_events(struct peer *peer, u32 events)
+{
+	struct epoll_event ev;
+
+	if (peer->peer_events == events)
+		return;
+
+	ev.events = events;
+	ev.data.fd = PEER_FD;
+	if (epoll_ctl(peer->epoll_fd, EPOLL_CTL_MOD, PEER_FD, &ev) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "epoll_ctl failed: %s", strerror(errno));
+	peer->peer_events = events;
+}
+
 int main(int argc, char *argv[])
 {
-	int i, nfds;
-	fd_set fds_in, fds_out;
+	int i;
 	struct peer *peer;
 
 	subdaemon_setup(argc, argv);
@@ -2651,13 +3021,21 @@ int main(int argc, char *argv[])
 	peer->num_pings_outstanding = 0;
 	timers_init(&peer->timers, time_mono());
 	peer->commit_timer = NULL;
+	memset(&peer->commit_stats, 0, sizeof(peer->commit_stats));
+	peer->sig_threads = parallel_default_threads();
 	peer->have_sigs[LOCAL] = peer->have_sigs[REMOTE] = false;
 	peer->announce_depth_reached = false;
 	msg_queue_init(&peer->from_master, peer);
 	msg_queue_init(&peer->from_gossipd, peer);
 	msg_queue_init(&peer->peer_out, peer);
-	peer->peer_outmsg = NULL;
-	peer->peer_outoff = 0;
+	msg_queue_init(&peer->peer_out_held, peer);
+	peer->acks_pending = 0;
+	peer->master_in = new_inbuf(peer, MASTER_FD);
+	peer->gossip_in = new_inbuf(peer, GOSSIP_FD);
+	peer->peer_in = new_inbuf(peer, PEER_FD);
+	peer->epoll_fd = -1;
+	peer->peer_outbuf = tal_arr(peer, u8, CRYPTOMSG_BATCH_MAX);
+	peer->peer_outlen = peer->peer_outoff = 0;
 	peer->next_commit_sigs = NULL;
 	peer->shutdown_sent[LOCAL] = false;
 	peer->last_update_timestamp = 0;
@@ -2674,24 +3052,31 @@ int main(int argc, char *argv[])
 	/* Read init_channel message sync. */
 	init_channel(peer);
 
-	FD_ZERO(&fds_in);
-	FD_SET(MASTER_FD, &fds_in);
-	FD_SET(PEER_FD, &fds_in);
-	FD_SET(GOSSIP_FD, &fds_in);
+	/* From now on we never block on the peer: we keep what we can't
+	 * write yet, and only take complete messages. */
+	if (!io_fd_block(PEER_FD, false))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "NONBLOCK failed: %s", strerror(errno));
 
-	FD_ZERO(&fds_out);
-	FD_SET(PEER_FD, &fds_out);
-	nfds = GOSSIP_FD+1;
+	peer->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (peer->epoll_fd < 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "epoll_create failed: %s", strerror(errno));
+	epoll_add(peer, MASTER_FD);
+	epoll_add(peer, GOSSIP_FD);
+	epoll_add(peer, PEER_FD);
+	peer->peer_events = EPOLLIN|EPOLLET;
 
 	while (!shutdown_complete(peer)) {
+		struct epoll_event events[3];
 		struct timemono first;
-		fd_set rfds = fds_in, wfds, *wptr;
-		struct timeval timeout, *tptr;
 		struct timer *expired;
+		int n, timeout;
 		const u8 *msg;
 		struct timemono now = time_mono();
 
-		/* For simplicity, we process one event at a time. */
+		/* Deferred requests first: they arrived before anything
+		 * still in the fds. */
 		msg = msg_dequeue(&peer->from_master);
 		if (msg) {
 			status_trace("Now dealing with deferred %s",
@@ -2717,65 +3102,43 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
-		if (timer_earliest(&peer->timers, &first)) {
-			timeout = timespec_to_timeval(
-				timemono_between(first, now).ts);
-			tptr = &timeout;
-		} else
-			tptr = NULL;
+		/* Write what we can now; only wait for the rest. */
+		write_peer_out(peer);
+		if (peer_write_pending(peer))
+			set_peer_events(peer, EPOLLIN|EPOLLOUT|EPOLLET);
+		else
+			set_peer_events(peer, EPOLLIN|EPOLLET);
 
-		if (peer_write_pending(peer)) {
-			wfds = fds_out;
-			wptr = &wfds;
+		if (timer_earliest(&peer->timers, &first)) {
+			/* Round up, so we don't wake before it's due. */
+			timeout = (time_to_usec(timemono_between(first, now))
+				   + 999) / 1000;
 		} else
-			wptr = NULL;
+			timeout = -1;
 
-		if (select(nfds, &rfds, wptr, NULL, tptr) < 0) {
+		n = epoll_wait(peer->epoll_fd, events, ARRAY_SIZE(events),
+			       timeout);
+		if (n < 0) {
 			/* Signals OK, eg. SIGUSR1 */
 			if (errno == EINTR)
 				continue;
 			status_failed(STATUS_FAIL_INTERNAL_ERROR,
-				      "select failed: %s", strerror(errno));
+				      "epoll_wait failed: %s", strerror(errno));
 		}
 
-		/* Try writing out encrypted packet if any (don't block!) */
-		if (wptr && FD_ISSET(PEER_FD, wptr)) {
-			if (!io_fd_block(PEER_FD, false))
-				status_failed(STATUS_FAIL_INTERNAL_ERROR,
-					      "NONBLOCK failed: %s",
-					      strerror(errno));
-			do_peer_write(peer);
-			if (!io_fd_block(PEER_FD, true))
-				status_failed(STATUS_FAIL_INTERNAL_ERROR,
-					      "NONBLOCK unset failed: %s",
-					      strerror(errno));
-			continue;
-		}
-
-		if (FD_ISSET(MASTER_FD, &rfds)) {
-			msg = wire_sync_read(peer, MASTER_FD);
-
-			if (!msg)
-				status_failed(STATUS_FAIL_MASTER_IO,
-					      "Can't read command: %s",
-					      strerror(errno));
-			req_in(peer, msg);
-		} else if (FD_ISSET(GOSSIP_FD, &rfds)) {
-			msg = wire_sync_read(peer, GOSSIP_FD);
+		/* Handle everything which has arrived, not just one. */
+		for (i = 0; i < n && !shutdown_complete(peer); i++) {
+			/* Errors and hangups show up when we read. */
+			if (!(events[i].events & ~EPOLLOUT))
+				continue;
 
-			if (!msg)
-				status_failed(STATUS_FAIL_GOSSIP_IO,
-					      "Can't read command: %s",
-					      strerror(errno));
-			gossip_in(peer, msg);
-		} else if (FD_ISSET(PEER_FD, &rfds)) {
-			/* This could take forever, but who cares? */
-			msg = channeld_read_peer_msg(peer);
-			if (msg)
-				peer_in(peer, msg);
-		} else
-			msg = NULL;
-		tal_free(msg);
+			if (events[i].data.fd == MASTER_FD)
+				master_drain(peer);
+			else if (events[i].data.fd == GOSSIP_FD)
+				gossip_drain(peer);
+			else
+				peer_drain(peer);
+		}
 	}
 
 	/* We only exit when shutdown is complete. */
@@ -22,6 +22,16 @@
   /* Needs to be at end, since it doesn't include its own hdrs */
   #include "gen_full_channel_error_names.h"
 
+/* Everything for one side's commitment which depends only on the
+ * per-commitment point. */
+struct commit_keys {
+	bool valid;
+	struct pubkey per_commitment_point;
+	struct keyset keyset;
+	/* What all the HTLC txs pay to. */
+	u8 *htlc_scriptpubkey;
+};
+
 struct channel *new_full_channel(const tal_t *ctx,
 				 const struct bitcoin_txid *funding_txid,
 				 unsigned int funding_txout,
@@ -54,6 +64,8 @@ struct channel *new_full_channel(const tal_t *ctx,
 		channel->htlcs = tal(channel, struct htlc_map);
 		htlc_map_init(channel->htlcs);
 		tal_add_destructor(channel->htlcs, htlc_map_clear);
+		channel->commit_keys = tal_arrz(channel, struct commit_keys,
+						NUM_SIDES);
 	}
 	return channel;
 }
@@ -177,12 +189,13 @@ static void add_htlcs(struct bitcoin_tx ***txs,
 		      const u8 ***wscripts,
 		      const struct htlc **htlcmap,
 		      const struct channel *channel,
-		      const struct keyset *keyset,
+		      const struct commit_keys *keys,
 		      enum side side)
 {
 	size_t i, n;
 	struct bitcoin_txid txid;
 	u32 feerate_per_kw = channel->view[side].feerate_per_kw;
+	const struct keyset *keyset = &keys->keyset;
 
 	/* Get txid of commitment transaction */
 	bitcoin_txid((*txs)[0], &txid);
@@ -196,23 +209,21 @@ static void add_htlcs(struct bitcoin_tx ***txs,
 			continue;
 
 		if (htlc_owner(htlc) == side) {
-			tx = htlc_timeout_tx(*txs, &txid, i,
-					     htlc->msatoshi,
-					     htlc->expiry.locktime,
-					     to_self_delay(channel, side),
-					     feerate_per_kw,
-					     keyset);
+			tx = htlc_timeout_tx_to(*txs, &txid, i,
+						htlc->msatoshi,
+						htlc->expiry.locktime,
+						feerate_per_kw,
+						keys->htlc_scriptpubkey);
 			wscript	= bitcoin_wscript_htlc_offer(*wscripts,
 						     &keyset->self_htlc_key,
 						     &keyset->other_htlc_key,
 						     &htlc->rhash,
 						     &keyset->self_revocation_key);
 		} else {
-			tx = htlc_success_tx(*txs, &txid, i,
-					     htlc->msatoshi,
-					     to_self_delay(channel, side),
-					     feerate_per_kw,
-					     keyset);
+			tx = htlc_success_tx_to(*txs, &txid, i,
+						htlc->msatoshi,
+						feerate_per_kw,
+						keys->htlc_scriptpubkey);
 			wscript	= bitcoin_wscript_htlc_receive(*wscripts,
 						       &htlc->expiry,
 						       &keyset->self_htlc_key,
@@ -232,7 +243,39 @@ static void add_htlcs(struct bitcoin_tx ***txs,
 	}
 }
 
-/* FIXME: We could cache these. */
+/* Every commitment has a new per-commitment point, so this only saves
+ * work when we rebuild one (eg. retransmitting after reconnect); but
+ * the HTLC txs within a commitment all share the htlc_scriptpubkey. */
+static const struct commit_keys *get_commit_keys(const struct channel *channel,
+						 const struct pubkey *point,
+						 enum side side)
+{
+	struct commit_keys *keys = &channel->commit_keys[side];
+
+	if (keys->valid && pubkey_eq(&keys->per_commitment_point, point))
+		return keys;
+
+	keys->valid = false;
+	keys->htlc_scriptpubkey = tal_free(keys->htlc_scriptpubkey);
+	if (!derive_keyset(point,
+			   &channel->basepoints[side].payment,
+			   &channel->basepoints[!side].payment,
+			   &channel->basepoints[side].htlc,
+			   &channel->basepoints[!side].htlc,
+			   &channel->basepoints[side].delayed_payment,
+			   &channel->basepoints[!side].revocation,
+			   &keys->keyset))
+		return NULL;
+
+	keys->per_commitment_point = *point;
+	keys->htlc_scriptpubkey
+		= htlc_tx_scriptpubkey(channel->commit_keys,
+				       to_self_delay(channel, side),
+				       &keys->keyset);
+	keys->valid = true;
+	return keys;
+}
+
 struct bitcoin_tx **channel_txs(const tal_t *ctx,
 				const struct htlc ***htlcmap,
 				const u8 ***wscripts,
@@ -243,16 +286,10 @@ struct bitcoin_tx **channel_txs(const tal_t *ctx,
 {
 	struct bitcoin_tx **txs;
 	const struct htlc **committed;
-	struct keyset keyset;
+	const struct commit_keys *keys;
 
-	if (!derive_keyset(per_commitment_point,
-			   &channel->basepoints[side].payment,
-			   &channel->basepoints[!side].payment,
-			   &channel->basepoints[side].htlc,
-			   &channel->basepoints[!side].htlc,
-			   &channel->basepoints[side].delayed_payment,
-			   &channel->basepoints[!side].revocation,
-			   &keyset))
+	keys = get_commit_keys(channel, per_commitment_point, side);
+	if (!keys)
 		return NULL;
 
 	/* Figure out what @side will already be committed to. */
@@ -264,7 +301,7 @@ struct bitcoin_tx **channel_txs(const tal_t *ctx,
 		       channel->funding_msat / 1000,
 		       channel->funder,
 		       to_self_delay(channel, side),
-		       &keyset,
+		       &keys->keyset,
 		       channel->view[side].feerate_per_kw,
 		       dust_limit_satoshis(channel, side),
 		       channel->view[side].owed_msat[side],
@@ -279,7 +316,7 @@ struct bitcoin_tx **channel_txs(const tal_t *ctx,
 					     &channel->funding_pubkey[side],
 					     &channel->funding_pubkey[!side]);
 
-	add_htlcs(&txs, wscripts, *htlcmap, channel, &keyset, side);
+	add_htlcs(&txs, wscripts, *htlcmap, channel, keys, side);
 
 	tal_free(committed);
 	return txs;
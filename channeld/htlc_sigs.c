@@ -0,0 +1,73 @@
+#include <bitcoin/signature.h>
+#include <ccan/cast/cast.h>
+#include <ccan/tal/tal.h>
+#include <channeld/htlc_sigs.h>
+#include <common/parallel.h>
+
+/* Starting a thread costs about as much as a few signatures: don't bother
+ * unless each has at least this many to do. */
+#define HTLC_SIGS_MIN_PER_THREAD 16
+
+struct htlc_sigs {
+	struct bitcoin_tx **txs;
+	const u8 **wscripts;
+	const struct privkey *privkey;
+	const struct pubkey *key;
+	secp256k1_ecdsa_signature *sigs;
+	bool *valid;
+};
+
+/* Each HTLC tx is only touched by one thread, and signing only reads the
+ * global secp256k1_ctx, so these are thread-safe. */
+static void sign_one(size_t i, struct htlc_sigs *h)
+{
+	sign_tx_input(h->txs[i], 0, NULL, h->wscripts[i],
+		      h->privkey, h->key, &h->sigs[i]);
+}
+
+static void check_one(size_t i, struct htlc_sigs *h)
+{
+	h->valid[i] = check_tx_sig(h->txs[i], 0, NULL, h->wscripts[i],
+				   h->key, &h->sigs[i]);
+}
+
+void sign_htlc_txs(struct bitcoin_tx **txs, const u8 **wscripts, size_t num,
+		   const struct privkey *privkey, const struct pubkey *key,
+		   secp256k1_ecdsa_signature *sigs, size_t num_threads)
+{
+	struct htlc_sigs h;
+
+	h.txs = txs;
+	h.wscripts = wscripts;
+	h.privkey = privkey;
+	h.key = key;
+	h.sigs = sigs;
+	h.valid = NULL;
+	parallel_for(num, num_threads, HTLC_SIGS_MIN_PER_THREAD, sign_one, &h);
+}
+
+bool check_htlc_txs(struct bitcoin_tx **txs, const u8 **wscripts, size_t num,
+		    const struct pubkey *key,
+		    const secp256k1_ecdsa_signature *sigs, size_t num_threads,
+		    size_t *bad)
+{
+	struct htlc_sigs h;
+	size_t i;
+
+	h.txs = txs;
+	h.wscripts = wscripts;
+	h.privkey = NULL;
+	h.key = key;
+	h.sigs = cast_const(secp256k1_ecdsa_signature *, sigs);
+	h.valid = tal_arr(NULL, bool, num);
+	parallel_for(num, num_threads, HTLC_SIGS_MIN_PER_THREAD, check_one, &h);
+
+	for (i = 0; i < num; i++) {
+		if (!h.valid[i]) {
+			*bad = i;
+			break;
+		}
+	}
+	tal_free(h.valid);
+	return i == num;
+}
@@ -0,0 +1,39 @@
+#ifndef LIGHTNING_CHANNELD_HTLC_SIGS_H
+#define LIGHTNING_CHANNELD_HTLC_SIGS_H
+#include "config.h"
+#include <bitcoin/privkey.h>
+#include <bitcoin/pubkey.h>
+#include <bitcoin/tx.h>
+#include <secp256k1.h>
+#include <stdbool.h>
+
+/**
+ * sign_htlc_txs: sign the HTLC transactions for a commitment.
+ * @txs: the HTLC transactions (txs[1..] from channel_txs()).
+ * @wscripts: the witness script for each.
+ * @num: how many of them.
+ * @privkey: our htlc secret key.
+ * @key: our htlckey.
+ * @sigs: the signatures, filled in (@num of them).
+ * @num_threads: most threads to use, including this one.
+ *
+ * With 483 HTLCs each way, this is the bulk of the work for a
+ * commitment_signed, so we split it between threads.
+ */
+void sign_htlc_txs(struct bitcoin_tx **txs, const u8 **wscripts, size_t num,
+		   const struct privkey *privkey, const struct pubkey *key,
+		   secp256k1_ecdsa_signature *sigs, size_t num_threads);
+
+/**
+ * check_htlc_txs: check signatures on the HTLC transactions for a commitment.
+ * @txs, @wscripts, @num: as for sign_htlc_txs().
+ * @key: the htlckey they should be signed with.
+ * @sigs: the signatures to check.
+ * @num_threads: most threads to use, including this one.
+ * @bad: set to the index of the first bad signature, if any.
+ */
+bool check_htlc_txs(struct bitcoin_tx **txs, const u8 **wscripts, size_t num,
+		    const struct pubkey *key,
+		    const secp256k1_ecdsa_signature *sigs, size_t num_threads,
+		    size_t *bad);
+#endif /* LIGHTNING_CHANNELD_HTLC_SIGS_H */
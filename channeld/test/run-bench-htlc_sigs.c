@@ -0,0 +1,116 @@
+#include "../../common/parallel.c"
+#include "../htlc_sigs.c"
+#include <assert.h>
+#include <bitcoin/script.h>
+#include <ccan/err/err.h>
+#include <ccan/mem/mem.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+/* The most HTLCs a commitment can have each way. */
+#define MAX_HTLCS 483
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+/* Each spends a different commitment output, like the real HTLC txs. */
+static struct bitcoin_tx **make_txs(const tal_t *ctx, size_t num,
+				    const struct pubkey *key,
+				    const u8 ***wscripts)
+{
+	struct bitcoin_tx **txs = tal_arr(ctx, struct bitcoin_tx *, num);
+	size_t i;
+
+	*wscripts = tal_arr(ctx, const u8 *, num);
+	for (i = 0; i < num; i++) {
+		txs[i] = bitcoin_tx(txs, 1, 1);
+		memset(&txs[i]->input[0].txid, 1, sizeof(txs[i]->input[0].txid));
+		txs[i]->input[0].index = i;
+		txs[i]->input[0].amount = tal(txs[i], u64);
+		*txs[i]->input[0].amount = 10000 + i;
+		txs[i]->output[0].amount = 9000 + i;
+		txs[i]->output[0].script = tal_arrz(txs[i], u8, 22);
+		(*wscripts)[i] = bitcoin_redeem_2of2(*wscripts, key, key);
+	}
+	return txs;
+}
+
+static void bench_threads(struct bitcoin_tx **txs, const u8 **wscripts,
+			  const struct privkey *privkey,
+			  const struct pubkey *key,
+			  secp256k1_ecdsa_signature *sigs,
+			  size_t runs, size_t num_threads)
+{
+	struct timemono start, mid, end;
+	size_t i, num = tal_count(txs), bad;
+	u64 sign_usec, check_usec;
+
+	start = time_mono();
+	for (i = 0; i < runs; i++)
+		sign_htlc_txs(txs, wscripts, num, privkey, key, sigs,
+			      num_threads);
+	mid = time_mono();
+	for (i = 0; i < runs; i++)
+		if (!check_htlc_txs(txs, wscripts, num, key, sigs, num_threads,
+				    &bad))
+			errx(1, "Signature %zu failed", bad);
+	end = time_mono();
+
+	sign_usec = time_to_usec(timemono_between(mid, start));
+	check_usec = time_to_usec(timemono_between(end, mid));
+	printf("%zu threads: %zu x %zu HTLC txs, sign %"PRIu64" usec,"
+	       " check %"PRIu64" usec per commitment\n",
+	       num_threads, runs, num, sign_usec / runs, check_usec / runs);
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+	size_t runs = 20, num = MAX_HTLCS;
+	size_t t, max_threads = parallel_default_threads();
+	struct bitcoin_tx **txs;
+	const u8 **wscripts;
+	secp256k1_ecdsa_signature *sigs, *serial;
+	struct privkey privkey;
+	struct pubkey key;
+	size_t bad;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		runs = atoi(argv[1]);
+	if (argc > 2)
+		max_threads = atoi(argv[2]);
+	if (argc > 3)
+		opt_usage_and_exit("[runs [max_threads]]");
+
+	memset(&privkey, 1, sizeof(privkey));
+	if (!pubkey_from_privkey(&privkey, &key))
+		abort();
+	txs = make_txs(ctx, num, &key, &wscripts);
+	sigs = tal_arr(ctx, secp256k1_ecdsa_signature, num);
+	serial = tal_arr(ctx, secp256k1_ecdsa_signature, num);
+
+	/* A single thread is what we used to do, inline. */
+	sign_htlc_txs(txs, wscripts, num, &privkey, &key, serial, 1);
+	for (t = 1; t <= max_threads; t *= 2) {
+		bench_threads(txs, wscripts, &privkey, &key, sigs, runs, t);
+		assert(memeq(sigs, tal_len(sigs), serial, tal_len(serial)));
+	}
+
+	/* A bad signature must not pass. */
+	sigs[num - 1] = sigs[0];
+	assert(!check_htlc_txs(txs, wscripts, num, &key, sigs, max_threads,
+			       &bad));
+	assert(bad == num - 1);
+
+	tal_free(ctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
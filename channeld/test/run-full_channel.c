@@ -5,6 +5,8 @@
 #include "../../common/initial_commit_tx.c"
 #include "../../channeld/commit_tx.c"
 #include "../../common/htlc_tx.c"
+#include "../../common/parallel.c"
+#include "../../channeld/htlc_sigs.c"
 #include <bitcoin/preimage.h>
 #include <bitcoin/privkey.h>
 #include <bitcoin/pubkey.h>
@@ -169,6 +171,69 @@ static const struct htlc **include_htlcs(struct channel *channel, enum side side
 	return htlcs;
 }
 
+/* A channel full of HTLCs is the worst case for commitment_signed: check
+ * threaded signing gives the same answers. */
+static void test_htlc_sigs(struct channel *channel,
+			   const struct pubkey *per_commitment_point)
+{
+	const tal_t *tmpctx = tal_tmpctx(channel);
+	u8 *dummy_routing = tal_arr(tmpctx, u8, TOTAL_PACKET_SIZE);
+	const struct htlc **changed_htlcs, **htlc_map;
+	struct bitcoin_tx **txs;
+	const u8 **wscripts;
+	struct privkey privkey;
+	struct pubkey key;
+	secp256k1_ecdsa_signature *sigs, *sigs_threaded;
+	size_t i, n, bad, num_threads = parallel_default_threads();
+
+	for (i = 0; i < 483; i++) {
+		struct preimage preimage;
+		struct sha256 hash;
+
+		memset(&preimage, 0, sizeof(preimage));
+		memcpy(&preimage, &i, sizeof(i));
+		sha256(&hash, &preimage, sizeof(preimage));
+		assert(channel_add_htlc(channel, LOCAL, i, 10000000, 600 + i,
+					&hash, dummy_routing, NULL)
+		       == CHANNEL_ERR_ADD_OK);
+	}
+
+	changed_htlcs = tal_arr(tmpctx, const struct htlc *, 0);
+	assert(channel_sending_commit(channel, &changed_htlcs));
+	assert(channel_rcvd_revoke_and_ack(channel, &changed_htlcs));
+	assert(channel_rcvd_commit(channel, &changed_htlcs));
+
+	txs = channel_txs(tmpctx, &htlc_map, &wscripts,
+			  channel, per_commitment_point, 43, LOCAL);
+	n = tal_count(txs) - 1;
+	assert(n == 483);
+
+	memset(&privkey, 1, sizeof(privkey));
+	if (!pubkey_from_privkey(&privkey, &key))
+		abort();
+	sigs = tal_arr(tmpctx, secp256k1_ecdsa_signature, n);
+	sigs_threaded = tal_arr(tmpctx, secp256k1_ecdsa_signature, n);
+
+	sign_htlc_txs(txs + 1, wscripts + 1, n, &privkey, &key, sigs, 1);
+	assert(check_htlc_txs(txs + 1, wscripts + 1, n, &key, sigs, 1, &bad));
+
+	sign_htlc_txs(txs + 1, wscripts + 1, n, &privkey, &key, sigs_threaded,
+		      num_threads);
+	assert(check_htlc_txs(txs + 1, wscripts + 1, n, &key, sigs_threaded,
+			      num_threads, &bad));
+
+	/* Signatures are deterministic. */
+	assert(memeq(sigs, tal_len(sigs), sigs_threaded, tal_len(sigs_threaded)));
+
+	/* A bad signature is caught, wherever it is. */
+	sigs_threaded[n - 1] = sigs_threaded[0];
+	assert(!check_htlc_txs(txs + 1, wscripts + 1, n, &key, sigs_threaded,
+			       num_threads, &bad));
+	assert(bad == n - 1);
+
+	tal_free(tmpctx);
+}
+
 static struct pubkey pubkey_from_hex(const char *hex)
 {
 	struct pubkey pubkey;
@@ -324,7 +389,7 @@ int main(void)
 	tal_t *tmpctx = tal_tmpctx(NULL);
 	struct bitcoin_txid funding_txid;
 	/* We test from both sides. */
-	struct channel *lchannel, *rchannel;
+	struct channel *lchannel, *rchannel, *fullchannel;
 	u64 funding_amount_satoshi;
 	u32 *feerate_per_kw = tal_arr(tmpctx, u32, NUM_SIDES);
 	unsigned int funding_output_index;
@@ -624,6 +689,20 @@ int main(void)
 		txs_must_be_eq(txs, txs2);
 	}
 
+	/* Low enough feerate that none of the HTLCs are trimmed. */
+	feerate_per_kw[LOCAL] = feerate_per_kw[REMOTE] = 253;
+	fullchannel = new_full_channel(tmpctx, &funding_txid,
+				       funding_output_index,
+				       funding_amount_satoshi, 7000000000,
+				       feerate_per_kw,
+				       local_config,
+				       remote_config,
+				       &localbase, &remotebase,
+				       &local_funding_pubkey,
+				       &remote_funding_pubkey,
+				       LOCAL);
+	test_htlc_sigs(fullchannel, &local_per_commitment_point);
+
 	/* No memory leaks please */
 	secp256k1_context_destroy(secp256k1_ctx);
 	tal_free(tmpctx);
@@ -50,7 +50,7 @@ bool sync_crypto_write(struct crypto_state *cs, int fd, const void *msg TAKES)
 
 u8 *sync_crypto_read(const tal_t *ctx, struct crypto_state *cs, int fd)
 {
-	u8 hdr[18], *enc, *dec;
+	u8 hdr[18], *dec;
 	u16 len;
 
 	if (!read_all(fd, hdr, sizeof(hdr))) {
@@ -63,18 +63,19 @@ u8 *sync_crypto_read(const tal_t *ctx, struct crypto_state *cs, int fd)
 		return NULL;
 	}
 
-	enc = tal_arr(ctx, u8, len + 16);
-	if (!read_all(fd, enc, tal_len(enc))) {
+	/* We decrypt in place, then trim off the MAC. */
+	dec = tal_arr(ctx, u8, len + 16);
+	if (!read_all(fd, dec, tal_len(dec))) {
 		status_trace("Failed reading body: %s", strerror(errno));
-		return tal_free(enc);
+		return tal_free(dec);
 	}
 
-	dec = cryptomsg_decrypt_body(ctx, cs, enc);
-	tal_free(enc);
-	if (!dec)
+	if (!cryptomsg_decrypt_inplace(cs, dec, tal_len(dec))) {
 		status_trace("Failed body decrypt with rn=%"PRIu64, cs->rn-2);
-	else
-		status_io(LOG_IO_IN, dec);
+		return tal_free(dec);
+	}
+	tal_resize(&dec, len);
+	status_io(LOG_IO_IN, dec);
 
 	return dec;
 }
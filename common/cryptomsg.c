@@ -90,17 +90,13 @@ static void le64_nonce(unsigned char *npub, u64 nonce)
 	memcpy(npub + zerolen, &le_nonce, sizeof(le_nonce));
 }
 
-u8 *cryptomsg_decrypt_body(const tal_t *ctx,
-			   struct crypto_state *cs, const u8 *in)
+bool cryptomsg_decrypt_inplace(struct crypto_state *cs, u8 *in, size_t inlen)
 {
 	unsigned char npub[crypto_aead_chacha20poly1305_ietf_NPUBBYTES];
 	unsigned long long mlen;
-	size_t inlen = tal_count(in);
-	u8 *decrypted;
 
 	if (inlen < 16)
-		return NULL;
-	decrypted = tal_arr(ctx, u8, inlen - 16);
+		return false;
 
 	le64_nonce(npub, cs->rn++);
 
@@ -111,18 +107,37 @@ u8 *cryptomsg_decrypt_body(const tal_t *ctx,
 	 *
 	 *   * The nonce `rn` MUST be incremented after this step.
 	 */
-	if (crypto_aead_chacha20poly1305_ietf_decrypt(decrypted,
+	/* libsodium checks the MAC before it decrypts, so this can be
+	 * done in place. */
+	if (crypto_aead_chacha20poly1305_ietf_decrypt(in,
 						      &mlen, NULL,
 						      memcheck(in, inlen),
 						      inlen,
 						      NULL, 0,
 						      npub, cs->rk.data) != 0) {
 		/* FIXME: Report error! */
-		return tal_free(decrypted);
+		return false;
 	}
-	assert(mlen == tal_count(decrypted));
+	assert(mlen == inlen - 16);
 
 	maybe_rotate_key(&cs->rn, &cs->rk, &cs->r_ck);
+	return true;
+}
+
+u8 *cryptomsg_decrypt_body(const tal_t *ctx,
+			   struct crypto_state *cs, const u8 *in)
+{
+	size_t inlen = tal_count(in);
+	u8 *decrypted;
+
+	if (inlen < 16)
+		return NULL;
+
+	decrypted = tal_dup_arr(ctx, u8, in, inlen, 0);
+	if (!cryptomsg_decrypt_inplace(cs, decrypted, inlen))
+		return tal_free(decrypted);
+
+	tal_resize(&decrypted, inlen - 16);
 	return decrypted;
 }
 
@@ -130,14 +145,20 @@ static struct io_plan *peer_decrypt_body(struct io_conn *conn,
 					 struct peer_crypto_state *pcs)
 {
 	struct io_plan *plan;
-	u8 *in, *decrypted;
+	size_t len = pcs->inlen - 16;
+	u8 *decrypted;
+	tal_t *tmp;
 
 	pcs->reading_body = false;
 
-	decrypted = cryptomsg_decrypt_body(pcs->in, &pcs->cs, pcs->in);
-	if (!decrypted)
+	if (!cryptomsg_decrypt_inplace(&pcs->cs, pcs->in, pcs->inlen))
 		return io_close(conn);
 
+	/* Handlers want a message of their own: it's freed after next_in,
+	 * unless they steal it. */
+	tmp = tal(NULL, char);
+	decrypted = tal_dup_arr(tmp, u8, pcs->in, len, 0);
+
 	status_io(LOG_IO_IN, decrypted);
 
 	/* BOLT #1:
@@ -146,21 +167,29 @@ static struct io_plan *peer_decrypt_body(struct io_conn *conn,
 	 * is odd.
 	 */
 	if (unlikely(is_unknown_msg_discardable(decrypted))) {
-		pcs->in = tal_free(pcs->in);
+		tal_free(tmp);
 		return peer_read_message(conn, pcs, pcs->next_in);
 	}
 
-	/* Steal cs->in: we free it after, and decrypted too unless
-	 * they steal but be careful not to touch anything after
-	 * next_in (could free itself) */
-	in = tal_steal(NULL, pcs->in);
-	pcs->in = NULL;
-
+	/* Be careful not to touch anything after next_in (could free
+	 * itself) */
 	plan = pcs->next_in(conn, pcs->peer, decrypted);
-	tal_free(in);
+	tal_free(tmp);
 	return plan;
 }
 
+/* We read header and body into the same buffer, which we keep. */
+static u8 *peer_in_buffer(struct io_conn *conn,
+			  struct peer_crypto_state *pcs, size_t len)
+{
+	if (!pcs->in)
+		pcs->in = tal_arr(conn, u8, CRYPTOMSG_IN_MIN);
+	if (tal_count(pcs->in) < len)
+		tal_resize(&pcs->in, len);
+	pcs->inlen = len;
+	return pcs->in;
+}
+
 bool cryptomsg_decrypt_header(struct crypto_state *cs, u8 hdr[18], u16 *lenp)
 {
 	unsigned char npub[crypto_aead_chacha20poly1305_ietf_NPUBBYTES];
@@ -200,8 +229,6 @@ static struct io_plan *peer_decrypt_header(struct io_conn *conn,
 	if (!cryptomsg_decrypt_header(&pcs->cs, pcs->in, &len))
 		return io_close(conn);
 
-	tal_free(pcs->in);
-
 	pcs->reading_body = true;
 
 	/* BOLT #8:
@@ -209,9 +236,8 @@ static struct io_plan *peer_decrypt_header(struct io_conn *conn,
 	 * * Read _exactly_ `l+16` bytes from the network buffer, let
 	 *   the bytes be known as `c`.
 	 */
-	pcs->in = tal_arr(conn, u8, (u32)len + 16);
-	return io_read(conn, pcs->in, tal_count(pcs->in), peer_decrypt_body,
-		       pcs);
+	return io_read(conn, peer_in_buffer(conn, pcs, (u32)len + 16),
+		       (u32)len + 16, peer_decrypt_body, pcs);
 }
 
 struct io_plan *peer_read_message(struct io_conn *conn,
@@ -220,7 +246,6 @@ struct io_plan *peer_read_message(struct io_conn *conn,
 							  struct peer *,
 							  u8 *msg))
 {
-	assert(!pcs->in);
 	/* BOLT #8:
 	 *
 	 * ### Decrypting Messages
@@ -231,21 +256,22 @@ struct io_plan *peer_read_message(struct io_conn *conn,
 	 *  * Read _exactly_ `18-bytes` from the network buffer.
 	 */
 	pcs->reading_body = false;
-	pcs->in = tal_arr(conn, u8, 18);
 	pcs->next_in = next;
-	return io_read(conn, pcs->in, 18, peer_decrypt_header, pcs);
+	return io_read(conn, peer_in_buffer(conn, pcs, 18), 18,
+		       peer_decrypt_header, pcs);
 }
 
 static struct io_plan *peer_write_done(struct io_conn *conn,
 				       struct peer_crypto_state *pcs)
 {
-	pcs->out = tal_free(pcs->out);
+	/* We keep the buffer for next time. */
+	pcs->outlen = 0;
 	return pcs->next_out(conn, pcs->peer);
 }
 
-u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
-			  struct crypto_state *cs,
-			  const u8 *msg TAKES)
+size_t cryptomsg_encrypt_into(struct crypto_state *cs,
+			      const u8 *msg TAKES,
+			      u8 **outp, size_t off)
 {
 	unsigned char npub[crypto_aead_chacha20poly1305_ietf_NPUBBYTES];
 	unsigned long long clen, mlen = tal_count(msg);
@@ -253,7 +279,9 @@ u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
 	int ret;
 	u8 *out;
 
-	out = tal_arr(ctx, u8, sizeof(l) + 16 + mlen + 16);
+	if (tal_count(*outp) < off + CRYPTOMSG_OVERHEAD + mlen)
+		tal_resize(outp, off + CRYPTOMSG_OVERHEAD + mlen);
+	out = *outp + off;
 
 	/* BOLT #8:
 	 *
@@ -321,10 +349,21 @@ u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
 		     tal_hexstr(trc, out + 18, clen));
 #endif
 
+	/* Before the next message, even if it's going in the same write. */
 	maybe_rotate_key(&cs->sn, &cs->sk, &cs->s_ck);
 
 	if (taken(msg))
 		tal_free(msg);
+	return off + CRYPTOMSG_OVERHEAD + mlen;
+}
+
+u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
+			  struct crypto_state *cs,
+			  const u8 *msg TAKES)
+{
+	u8 *out = tal_arr(ctx, u8, CRYPTOMSG_OVERHEAD + tal_count(msg));
+
+	cryptomsg_encrypt_into(cs, msg, &out, 0);
 	return out;
 }
 
@@ -332,45 +371,77 @@ u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
 static struct io_plan *peer_write_postclose(struct io_conn *conn,
 					    struct peer_crypto_state *pcs)
 {
-	pcs->out = tal_free(pcs->out);
+	pcs->outlen = 0;
+	pcs->out_dev = DEV_DISCONNECT_NORMAL;
 	dev_sabotage_fd(io_conn_fd(conn));
 	return pcs->next_out(conn, pcs->peer);
 }
+
+/* Write out the rest, once we've broken the fd. */
+static struct io_plan *peer_write_dev_before(struct io_conn *conn,
+					     struct peer_crypto_state *pcs)
+{
+	if (pcs->out_dev == DEV_DISCONNECT_BEFORE)
+		dev_sabotage_fd(io_conn_fd(conn));
+	else
+		dev_blackhole_fd(io_conn_fd(conn));
+	pcs->out_dev = DEV_DISCONNECT_NORMAL;
+
+	return io_write(conn, pcs->out + pcs->out_dev_off,
+			pcs->outlen - pcs->out_dev_off,
+			peer_write_done, pcs);
+}
 #endif
 
-struct io_plan *peer_write_message(struct io_conn *conn,
-				   struct peer_crypto_state *pcs,
-				   const u8 *msg,
-				   struct io_plan *(*next)(struct io_conn *,
-							   struct peer *))
+bool peer_queue_message(struct io_conn *conn,
+			struct peer_crypto_state *pcs,
+			const u8 *msg TAKES)
 {
-	struct io_plan *(*post)(struct io_conn *, struct peer_crypto_state *);
 #if DEVELOPER
-	int type = fromwire_peektype(msg);
+	enum dev_disconnect d = dev_disconnect(fromwire_peektype(msg));
 #endif
 
-	assert(!pcs->out);
+	if (!pcs->out)
+		pcs->out = tal_arr(conn, u8, CRYPTOMSG_BATCH_MAX);
 
-	/* Important: this doesn't take msg! */
 	status_io(LOG_IO_OUT, msg);
-	pcs->out = cryptomsg_encrypt_msg(conn, &pcs->cs, msg);
-	pcs->next_out = next;
+#if DEVELOPER
+	pcs->out_dev_off = pcs->outlen;
+#endif
+	pcs->outlen = cryptomsg_encrypt_into(&pcs->cs, msg,
+					     &pcs->out, pcs->outlen);
 
-	post = peer_write_done;
+#if DEVELOPER
+	/* This one has to be last in the write. */
+	if (d != DEV_DISCONNECT_NORMAL) {
+		pcs->out_dev = d;
+		/* We still encrypted it, as we used to. */
+		if (d == DEV_DISCONNECT_DROPPKT)
+			pcs->outlen = pcs->out_dev_off;
+		return false;
+	}
+#endif
+	return pcs->outlen < CRYPTOMSG_BATCH_MAX;
+}
+
+struct io_plan *peer_write_queued(struct io_conn *conn,
+				  struct peer_crypto_state *pcs,
+				  struct io_plan *(*next)(struct io_conn *,
+							  struct peer *))
+{
+	pcs->next_out = next;
 
 #if DEVELOPER
-	switch (dev_disconnect(type)) {
+	switch (pcs->out_dev) {
 	case DEV_DISCONNECT_BEFORE:
-		dev_sabotage_fd(io_conn_fd(conn));
-		break;
+	case DEV_DISCONNECT_BLACKHOLE:
+		/* The ones before it go out normally. */
+		return io_write(conn, pcs->out, pcs->out_dev_off,
+				peer_write_dev_before, pcs);
 	case DEV_DISCONNECT_DROPPKT:
-		pcs->out = NULL; /* FALL THRU */
 	case DEV_DISCONNECT_AFTER:
-		post = peer_write_postclose;
-		break;
-	case DEV_DISCONNECT_BLACKHOLE:
-		dev_blackhole_fd(io_conn_fd(conn));
-		break;
+		return io_write(conn, pcs->out, pcs->outlen,
+				peer_write_postclose, pcs);
 	case DEV_DISCONNECT_NORMAL:
 		break;
 	}
@@ -379,7 +450,17 @@ struct io_plan *peer_write_message(struct io_conn *conn,
 	/* BOLT #8:
 	 *   * Send `lc || c` over the network buffer.
 	 */
-	return io_write(conn, pcs->out, tal_count(pcs->out), post, pcs);
+	return io_write(conn, pcs->out, pcs->outlen, peer_write_done, pcs);
+}
+
+struct io_plan *peer_write_message(struct io_conn *conn,
+				   struct peer_crypto_state *pcs,
+				   const u8 *msg TAKES,
+				   struct io_plan *(*next)(struct io_conn *,
+							   struct peer *))
+{
+	peer_queue_message(conn, pcs, msg);
+	return peer_write_queued(conn, pcs, next);
 }
 
 /* We read in two parts, so we might have started body. */
@@ -393,5 +474,9 @@ void init_peer_crypto_state(struct peer *peer, struct peer_crypto_state *pcs)
 {
 	pcs->peer = peer;
 	pcs->out = pcs->in = NULL;
+	pcs->outlen = pcs->inlen = 0;
+#if DEVELOPER
+	pcs->out_dev = DEV_DISCONNECT_NORMAL;
+#endif
 	pcs->reading_body = false;
 }
@@ -4,6 +4,16 @@
 #include <ccan/short_types/short_types.h>
 #include <ccan/tal/tal.h>
 #include <common/crypto_state.h>
+#include <common/dev_disconnect.h>
+
+/* What encryption adds to each message: encrypted length, and two MACs. */
+#define CRYPTOMSG_OVERHEAD (2 + 16 + 16)
+
+/* We write out once we've encrypted this much. */
+#define CRYPTOMSG_BATCH_MAX 32768
+
+/* Our input buffer starts this big: most messages fit. */
+#define CRYPTOMSG_IN_MIN 2048
 
 struct io_conn;
 struct peer;
@@ -19,6 +29,18 @@ struct peer_crypto_state {
 
 	/* Output and input buffers. */
 	u8 *out, *in;
+
+	/* How much of out is queued: we reuse it for each write. */
+	size_t outlen;
+
+	/* How much of in we're reading into: we reuse it too. */
+	size_t inlen;
+#if DEVELOPER
+	/* What dev_disconnect said about the last message queued, and
+	 * where it starts in out. */
+	enum dev_disconnect out_dev;
+	size_t out_dev_off;
+#endif
 	struct io_plan *(*next_in)(struct io_conn *, struct peer *, u8 *);
 	struct io_plan *(*next_out)(struct io_conn *, struct peer *);
 };
@@ -37,18 +59,37 @@ struct io_plan *peer_read_message(struct io_conn *conn,
 bool peer_in_started(const struct io_conn *conn,
 		     const struct peer_crypto_state *cs);
 
-/* Sends message: frees if taken(msg). */
+/* Sends message (after any queued): frees if taken(msg). */
 struct io_plan *peer_write_message(struct io_conn *conn,
 				   struct peer_crypto_state *cs,
-				   const u8 *msg,
+				   const u8 *msg TAKES,
 				   struct io_plan *(*next)(struct io_conn *,
 							   struct peer *));
 
+/* Encrypts message into the output buffer, to go out with the next
+ * peer_write_queued: frees if taken(msg).  Returns false if you should
+ * write now rather than queue more. */
+bool peer_queue_message(struct io_conn *conn,
+			struct peer_crypto_state *cs,
+			const u8 *msg TAKES);
+
+/* Sends everything peer_queue_message queued, in one write. */
+struct io_plan *peer_write_queued(struct io_conn *conn,
+				  struct peer_crypto_state *cs,
+				  struct io_plan *(*next)(struct io_conn *,
+							  struct peer *));
+
 /* Low-level functions for sync comms: doesn't discard unknowns! */
 u8 *cryptomsg_encrypt_msg(const tal_t *ctx,
 			  struct crypto_state *cs,
-			  const u8 *msg);
+			  const u8 *msg TAKES);
+/* Encrypts msg into *out at off (growing it if needed), returns new end. */
+size_t cryptomsg_encrypt_into(struct crypto_state *cs,
+			      const u8 *msg TAKES,
+			      u8 **out, size_t off);
 bool cryptomsg_decrypt_header(struct crypto_state *cs, u8 hdr[18], u16 *lenp);
 u8 *cryptomsg_decrypt_body(const tal_t *ctx,
 			   struct crypto_state *cs, const u8 *in);
+/* Decrypts in (inlen bytes, including MAC) so plaintext is at the start. */
+bool cryptomsg_decrypt_inplace(struct crypto_state *cs, u8 *in, size_t inlen);
 #endif /* LIGHTNING_COMMON_CRYPTOMSG_H */
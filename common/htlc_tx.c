@@ -8,14 +8,11 @@ static struct bitcoin_tx *htlc_tx(const tal_t *ctx,
 				  const struct bitcoin_txid *commit_txid,
 				  unsigned int commit_output_number,
 				  u64 msatoshi,
-				  u16 to_self_delay,
-				  const struct pubkey *revocation_pubkey,
-				  const struct pubkey *local_delayedkey,
+				  const u8 *scriptpubkey TAKES,
 				  u64 htlc_fee_satoshi,
 				  u32 locktime)
 {
 	struct bitcoin_tx *tx = bitcoin_tx(ctx, 1, 1);
-	u8 *wscript;
 	u64 amount;
 
 	/* BOLT #3:
@@ -63,14 +60,53 @@ static struct bitcoin_tx *htlc_tx(const tal_t *ctx,
 	 *       below.
 	 */
 	tx->output[0].amount = amount - htlc_fee_satoshi;
-	wscript = bitcoin_wscript_htlc_tx(tx, to_self_delay,
-					  revocation_pubkey, local_delayedkey);
-	tx->output[0].script = scriptpubkey_p2wsh(tx, wscript);
-	tal_free(wscript);
+	tx->output[0].script = tal_dup_arr(tx, u8, scriptpubkey,
+					   tal_len(scriptpubkey), 0);
 
 	return tx;
 }
 
+u8 *htlc_tx_scriptpubkey(const tal_t *ctx,
+			 u16 to_self_delay,
+			 const struct keyset *keyset)
+{
+	u8 *wscript, *script;
+
+	wscript = bitcoin_wscript_htlc_tx(NULL, to_self_delay,
+					  &keyset->self_revocation_key,
+					  &keyset->self_delayed_payment_key);
+	script = scriptpubkey_p2wsh(ctx, wscript);
+	tal_free(wscript);
+	return script;
+}
+
+struct bitcoin_tx *htlc_success_tx_to(const tal_t *ctx,
+				      const struct bitcoin_txid *commit_txid,
+				      unsigned int commit_output_number,
+				      u64 htlc_msatoshi,
+				      u32 feerate_per_kw,
+				      const u8 *scriptpubkey TAKES)
+{
+	/* BOLT #3:
+	 * * locktime: `0` for HTLC-Success, `cltv_expiry` for HTLC-Timeout.
+	 */
+	return htlc_tx(ctx, commit_txid, commit_output_number, htlc_msatoshi,
+		       scriptpubkey, htlc_success_fee(feerate_per_kw), 0);
+}
+
+struct bitcoin_tx *htlc_timeout_tx_to(const tal_t *ctx,
+				      const struct bitcoin_txid *commit_txid,
+				      unsigned int commit_output_number,
+				      u64 htlc_msatoshi,
+				      u32 cltv_expiry,
+				      u32 feerate_per_kw,
+				      const u8 *scriptpubkey TAKES)
+{
+	return htlc_tx(ctx, commit_txid, commit_output_number, htlc_msatoshi,
+		       scriptpubkey, htlc_timeout_fee(feerate_per_kw),
+		       cltv_expiry);
+}
+
 struct bitcoin_tx *htlc_success_tx(const tal_t *ctx,
 				   const struct bitcoin_txid *commit_txid,
 				   unsigned int commit_output_number,
@@ -79,14 +115,10 @@ struct bitcoin_tx *htlc_success_tx(const tal_t *ctx,
 				   u32 feerate_per_kw,
 				   const struct keyset *keyset)
 {
-	/* BOLT #3:
-	 * * locktime: `0` for HTLC-Success, `cltv_expiry` for HTLC-Timeout.
-	 */
-	return htlc_tx(ctx, commit_txid, commit_output_number, htlc_msatoshi,
-		       to_self_delay,
-		       &keyset->self_revocation_key,
-		       &keyset->self_delayed_payment_key,
-		       htlc_success_fee(feerate_per_kw), 0);
+	return htlc_success_tx_to(ctx, commit_txid, commit_output_number,
+				  htlc_msatoshi, feerate_per_kw,
+				  take(htlc_tx_scriptpubkey(NULL, to_self_delay,
+							    keyset)));
 }
 
 /* Fill in the witness for HTLC-success tx produced above. */
@@ -125,15 +157,10 @@ struct bitcoin_tx *htlc_timeout_tx(const tal_t *ctx,
 				   u32 feerate_per_kw,
 				   const struct keyset *keyset)
 {
-	/* BOLT #3:
-	 * * locktime: `0` for HTLC-Success, `cltv_expiry` for HTLC-Timeout.
-	 */
-	return htlc_tx(ctx, commit_txid, commit_output_number, htlc_msatoshi,
-		       to_self_delay,
-		       &keyset->self_revocation_key,
-		       &keyset->self_delayed_payment_key,
-		       htlc_timeout_fee(feerate_per_kw),
-		       cltv_expiry);
+	return htlc_timeout_tx_to(ctx, commit_txid, commit_output_number,
+				  htlc_msatoshi, cltv_expiry, feerate_per_kw,
+				  take(htlc_tx_scriptpubkey(NULL, to_self_delay,
+							    keyset)));
 }
 
 /* Fill in the witness for HTLC-timeout tx produced above. */
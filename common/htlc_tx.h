@@ -1,6 +1,7 @@
 #ifndef LIGHTNING_COMMON_HTLC_TX_H
 #define LIGHTNING_COMMON_HTLC_TX_H
 #include "config.h"
+#include <ccan/take/take.h>
 #include <common/htlc.h>
 
 struct keyset;
@@ -72,6 +73,27 @@ void htlc_timeout_tx_add_witness(struct bitcoin_tx *htlc_timeout,
 				 const secp256k1_ecdsa_signature *remotesig);
 
 
+/* Every HTLC tx for a commitment tx pays to the same scriptpubkey: when
+ * making many, make it once with this and use the _to() variants. */
+u8 *htlc_tx_scriptpubkey(const tal_t *ctx,
+			 u16 to_self_delay,
+			 const struct keyset *keyset);
+
+struct bitcoin_tx *htlc_success_tx_to(const tal_t *ctx,
+				      const struct bitcoin_txid *commit_txid,
+				      unsigned int commit_output_number,
+				      u64 htlc_msatoshi,
+				      u32 feerate_per_kw,
+				      const u8 *scriptpubkey TAKES);
+
+struct bitcoin_tx *htlc_timeout_tx_to(const tal_t *ctx,
+				      const struct bitcoin_txid *commit_txid,
+				      unsigned int commit_output_number,
+				      u64 htlc_msatoshi,
+				      u32 cltv_expiry,
+				      u32 feerate_per_kw,
+				      const u8 *scriptpubkey TAKES);
+
 /* Generate the witness script for an HTLC the other side offered:
  * scriptpubkey_p2wsh(ctx, wscript) gives the scriptpubkey */
 u8 *htlc_received_wscript(const tal_t *ctx,
@@ -0,0 +1,182 @@
+#include <ccan/read_write_all/read_write_all.h>
+#include <common/crypto_state.h>
+#include <common/cryptomsg.h>
+#include <common/inbuf.h>
+#include <common/status.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <wire/wire_io.h>
+
+/* Enough for a good burst of peer messages. */
+#define INBUF_MIN_SIZE 65536
+
+/* Encrypted length, and its MAC. */
+#define CRYPTO_HDR_SIZE 18
+#define CRYPTO_MAC_SIZE 16
+
+struct inbuf *new_inbuf(const tal_t *ctx, int fd)
+{
+	struct inbuf *in = tal(ctx, struct inbuf);
+
+	in->fd = fd;
+	in->buf = tal_arr(in, u8, INBUF_MIN_SIZE);
+	in->len = in->off = in->taken = 0;
+	in->need = 1;
+	in->syscalls = in->msgs = 0;
+	return in;
+}
+
+void inbuf_reset(struct inbuf *in)
+{
+	in->len = in->off = in->taken = 0;
+	in->need = 1;
+}
+
+bool inbuf_fill(struct inbuf *in, bool block)
+{
+	size_t have, want;
+	ssize_t r;
+
+	/* Everything before off is gone: keep what we've already read past
+	 * it, and peek again at the rest. */
+	have = in->taken - in->off;
+	memmove(in->buf, in->buf + in->off, have);
+	in->len = in->taken = have;
+	in->off = 0;
+
+	/* If we're waiting, wait for all of the next message; otherwise
+	 * take everything which is there. */
+	if (block)
+		want = in->need;
+	else if (in->need > tal_count(in->buf))
+		want = in->need;
+	else
+		want = tal_count(in->buf);
+
+	for (;;) {
+		if (tal_count(in->buf) < want)
+			tal_resize(&in->buf, want);
+
+		in->syscalls++;
+		r = recv(in->fd, in->buf + have, want - have,
+			 MSG_PEEK | (block ? 0 : MSG_DONTWAIT));
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return !block && (errno == EAGAIN || errno == EWOULDBLOCK);
+		if (r == 0) {
+			errno = 0;
+			return false;
+		}
+		in->len = have + r;
+
+		/* A peek won't wait for the rest (MSG_WAITALL doesn't, on
+		 * unix sockets), so read it: it's all ours anyway. */
+		if (block && in->len < want) {
+			in->syscalls++;
+			errno = 0;
+			if (!read_all(in->fd, in->buf + have, want - have))
+				return false;
+			in->len = in->taken = want;
+			return true;
+		}
+
+		/* Callers may not be told again about what we leave. */
+		if (block || in->len < want)
+			return true;
+		want *= 2;
+	}
+}
+
+/* We already have these bytes: this just takes them off the socket. */
+static bool consume(struct inbuf *in, size_t len)
+{
+	size_t end = in->off + len;
+
+	/* A blocking fill may have read some of it already. */
+	if (end > in->taken) {
+		in->syscalls++;
+		if (!read_all(in->fd, in->buf + in->taken, end - in->taken))
+			return false;
+		in->taken = end;
+	}
+	in->off = end;
+	in->msgs++;
+	return true;
+}
+
+u8 *inbuf_wire_msg(const tal_t *ctx, struct inbuf *in, bool *failed)
+{
+	wire_len_t hdr;
+	size_t len;
+	u8 *msg;
+
+	*failed = false;
+	in->need = sizeof(hdr);
+	if (in->len - in->off < in->need)
+		return NULL;
+
+	memcpy(&hdr, in->buf + in->off, sizeof(hdr));
+	len = wirelen_to_cpu(hdr);
+	if (len >= WIRE_LEN_LIMIT) {
+		errno = E2BIG;
+		*failed = true;
+		return NULL;
+	}
+
+	in->need += len;
+	if (in->len - in->off < in->need)
+		return NULL;
+
+	msg = tal_dup_arr(ctx, u8, in->buf + in->off + sizeof(hdr), len, 0);
+	if (!consume(in, in->need)) {
+		*failed = true;
+		return tal_free(msg);
+	}
+	return msg;
+}
+
+u8 *inbuf_crypto_msg(const tal_t *ctx, struct inbuf *in,
+		     struct crypto_state *cs, bool *failed)
+{
+	struct crypto_state next = *cs;
+	u8 hdr[CRYPTO_HDR_SIZE], *body, *dec;
+	u16 len;
+
+	*failed = false;
+	in->need = sizeof(hdr);
+	if (in->len - in->off < in->need)
+		return NULL;
+
+	/* We only update cs once we have the whole thing. */
+	memcpy(hdr, in->buf + in->off, sizeof(hdr));
+	if (!cryptomsg_decrypt_header(&next, hdr, &len)) {
+		status_trace("Failed hdr decrypt with rn=%"PRIu64, next.rn-1);
+		*failed = true;
+		return NULL;
+	}
+
+	in->need += len + CRYPTO_MAC_SIZE;
+	if (in->len - in->off < in->need)
+		return NULL;
+
+	body = in->buf + in->off + sizeof(hdr);
+	if (!consume(in, in->need)) {
+		status_trace("Failed reading body: %s", strerror(errno));
+		*failed = true;
+		return NULL;
+	}
+
+	/* It's off the socket now, so we can decrypt it where it is. */
+	if (!cryptomsg_decrypt_inplace(&next, body, len + CRYPTO_MAC_SIZE)) {
+		status_trace("Failed body decrypt with rn=%"PRIu64, next.rn-1);
+		*failed = true;
+		return NULL;
+	}
+
+	*cs = next;
+	dec = tal_dup_arr(ctx, u8, body, len, 0);
+	status_io(LOG_IO_IN, dec);
+	return dec;
+}
@@ -0,0 +1,71 @@
+#ifndef LIGHTNING_COMMON_INBUF_H
+#define LIGHTNING_COMMON_INBUF_H
+#include "config.h"
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+
+struct crypto_state;
+
+/* Buffered input from a socket.
+ *
+ * We peek at everything which is there in one syscall, and only consume
+ * each message as we hand it out: whoever gets the fd after us (we pass
+ * peer and gossip fds back to the master) sees exactly the bytes we didn't
+ * handle, as they would with wire_sync_read/sync_crypto_read. */
+struct inbuf {
+	int fd;
+
+	/* What we last peeked at: buf[off] is the next byte for our caller,
+	 * and everything before buf[taken] is already off the socket (a
+	 * blocking fill reads, rather than peeks). */
+	u8 *buf;
+	size_t len, off, taken;
+
+	/* How many bytes from off we need for the next message. */
+	size_t need;
+
+	/* For statistics. */
+	u64 syscalls, msgs;
+};
+
+struct inbuf *new_inbuf(const tal_t *ctx, int fd);
+
+/**
+ * inbuf_fill - peek at what's in the socket.
+ * @in: the inbuf.
+ * @block: wait until there's enough for the next message?
+ *
+ * Returns false on error or EOF (errno is 0 for EOF).  If @block is false
+ * and nothing is available, that's not an error.  Don't @block on a
+ * non-blocking fd.
+ */
+bool inbuf_fill(struct inbuf *in, bool block);
+
+/**
+ * inbuf_wire_msg - get the next length-prefixed message (as wire_sync_read).
+ * @ctx: context to allocate the message from.
+ * @in: the inbuf.
+ * @failed: set to true if it's too long (errno is E2BIG) or can't be read.
+ *
+ * Returns NULL if we don't have all of it yet (call inbuf_fill), or
+ * @failed.  Otherwise it's consumed from the socket.
+ */
+u8 *inbuf_wire_msg(const tal_t *ctx, struct inbuf *in, bool *failed);
+
+/**
+ * inbuf_crypto_msg - get the next encrypted message (as sync_crypto_read).
+ * @ctx: context to allocate the message from.
+ * @in: the inbuf.
+ * @cs: the cryptostate (updated only if we return a message).
+ * @failed: set to true if it can't be decrypted or read.
+ *
+ * Returns NULL if we don't have all of it yet (call inbuf_fill), or
+ * @failed.  Otherwise it's consumed from the socket.
+ */
+u8 *inbuf_crypto_msg(const tal_t *ctx, struct inbuf *in,
+		     struct crypto_state *cs, bool *failed);
+
+/* Forget what we peeked at (eg. if the fd has been replaced). */
+void inbuf_reset(struct inbuf *in);
+
+#endif /* LIGHTNING_COMMON_INBUF_H */
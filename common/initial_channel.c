@@ -38,6 +38,7 @@ struct channel *new_initial_channel(const tal_t *ctx,
 	channel->funding_pubkey[LOCAL] = *local_funding_pubkey;
 	channel->funding_pubkey[REMOTE] = *remote_funding_pubkey;
 	channel->htlcs = NULL;
+	channel->commit_keys = NULL;
 	channel->changes_pending[LOCAL] = channel->changes_pending[REMOTE]
 		= false;
 
@@ -57,6 +57,10 @@ struct channel {
 
 	/* What it looks like to each side. */
 	struct channel_view view[NUM_SIDES];
+
+	/* What channel_txs() derived last time for each side (NULL for
+	 * an initial_channel). */
+	struct commit_keys *commit_keys;
 };
 
 /* Some requirements are self-specified (eg. my dust limit), others
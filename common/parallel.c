@@ -0,0 +1,133 @@
+#include <ccan/compiler/compiler.h>
+#include <ccan/tal/tal.h>
+#include <common/parallel.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* No point having more than this. */
+#define PARALLEL_MAX_THREADS 8
+
+/* The part of the work one thread does. */
+struct parallel_range {
+	void (*fn)(size_t i, void *arg);
+	void *arg;
+	size_t start, end;
+};
+
+/* What parallel_for_() has handed out: ranges[next..num) are still to do. */
+struct parallel_job {
+	struct parallel_range *ranges;
+	size_t num, next, done;
+};
+
+/* Workers outlive each call: gossipd checks a batch of signatures every
+ * few msec during initial sync, and starting and joining threads for each
+ * one costs more than a small batch. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Workers wait on this for a job with ranges left. */
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+/* parallel_for_() waits on this for the last range to finish. */
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct parallel_job *pool_job;
+static size_t pool_workers;
+
+static void do_range(const struct parallel_range *r)
+{
+	size_t i;
+
+	for (i = r->start; i < r->end; i++)
+		r->fn(i, r->arg);
+}
+
+/* Called with pool_lock held; returns with it held. */
+static void do_next_range(struct parallel_job *job)
+{
+	const struct parallel_range *r = &job->ranges[job->next++];
+
+	pthread_mutex_unlock(&pool_lock);
+	do_range(r);
+	pthread_mutex_lock(&pool_lock);
+	if (++job->done == job->num)
+		pthread_cond_signal(&done_cond);
+}
+
+static void *parallel_worker(void *unused UNUSED)
+{
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (!pool_job || pool_job->next == pool_job->num)
+			pthread_cond_wait(&work_cond, &pool_lock);
+		do_next_range(pool_job);
+	}
+	return NULL;
+}
+
+/* Called with pool_lock held. */
+static void add_workers(size_t num)
+{
+	pthread_t thread;
+
+	while (pool_workers < num) {
+		/* If we can't, this thread does their share. */
+		if (pthread_create(&thread, NULL, parallel_worker, NULL) != 0)
+			break;
+		pthread_detach(thread);
+		pool_workers++;
+	}
+}
+
+void parallel_for_(size_t n, size_t num_threads, size_t min_per_thread,
+		   void (*fn)(size_t i, void *arg), void *arg)
+{
+	struct parallel_job job;
+	size_t i;
+
+	if (min_per_thread && num_threads > n / min_per_thread)
+		num_threads = n / min_per_thread;
+	if (num_threads > PARALLEL_MAX_THREADS)
+		num_threads = PARALLEL_MAX_THREADS;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	job.ranges = tal_arr(NULL, struct parallel_range, num_threads);
+	job.num = num_threads;
+	job.next = job.done = 0;
+	for (i = 0; i < num_threads; i++) {
+		job.ranges[i].fn = fn;
+		job.ranges[i].arg = arg;
+		job.ranges[i].start = n * i / num_threads;
+		job.ranges[i].end = n * (i + 1) / num_threads;
+	}
+
+	/* Not worth waking anyone for one range. */
+	if (num_threads == 1) {
+		do_range(&job.ranges[0]);
+		tal_free(job.ranges);
+		return;
+	}
+
+	/* We take ranges too, so we need one fewer worker. */
+	pthread_mutex_lock(&pool_lock);
+	add_workers(num_threads - 1);
+	pool_job = &job;
+	pthread_cond_broadcast(&work_cond);
+	while (job.next < job.num)
+		do_next_range(&job);
+	while (job.done < job.num)
+		pthread_cond_wait(&done_cond, &pool_lock);
+	pool_job = NULL;
+	pthread_mutex_unlock(&pool_lock);
+
+	tal_free(job.ranges);
+}
+
+size_t parallel_default_threads(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n < 1)
+		return 1;
+	if (n > PARALLEL_MAX_THREADS)
+		return PARALLEL_MAX_THREADS;
+	return n;
+}
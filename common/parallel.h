@@ -0,0 +1,33 @@
+#ifndef LIGHTNING_COMMON_PARALLEL_H
+#define LIGHTNING_COMMON_PARALLEL_H
+#include "config.h"
+#include <ccan/typesafe_cb/typesafe_cb.h>
+#include <stddef.h>
+
+/**
+ * parallel_for - call fn(i, arg) for every i in [0, n), in threads.
+ * @n: how many calls.
+ * @num_threads: most threads to use, including this one.
+ * @min_per_thread: don't start a thread for fewer calls than this.
+ * @fn: the callback: it must not use tal, or anything else which isn't
+ *      thread-safe.
+ * @arg: the argument to @fn.
+ *
+ * Returns once every call is done.  The worker threads are started the
+ * first time they're needed and kept for later calls; if one can't be
+ * started, its share is done in this thread.  Only one thread may be in
+ * parallel_for() at a time.
+ */
+#define parallel_for(n, num_threads, min_per_thread, fn, arg)		\
+	parallel_for_((n), (num_threads), (min_per_thread),		\
+		      typesafe_cb_preargs(void, void *, (fn), (arg),	\
+					  size_t),			\
+		      (arg))
+
+void parallel_for_(size_t n, size_t num_threads, size_t min_per_thread,
+		   void (*fn)(size_t i, void *arg), void *arg);
+
+/* How many threads are worth using on this machine. */
+size_t parallel_default_threads(void);
+
+#endif /* LIGHTNING_COMMON_PARALLEL_H */
@@ -48,12 +48,26 @@ u8 *read_peer_msg_(const tal_t *ctx,
 		   void *arg)
 {
 	u8 *msg;
-	struct channel_id chanid;
 
 	msg = sync_crypto_read(ctx, cs, peer_fd);
 	if (!msg)
 		io_error(arg);
 
+	return handle_peer_msg_(msg, peer_fd, gossip_fd, cs, gossip_index,
+				channel, send_reply, io_error, arg);
+}
+
+u8 *handle_peer_msg_(u8 *msg,
+		     int peer_fd, int gossip_fd,
+		     struct crypto_state *cs, u64 gossip_index,
+		     const struct channel_id *channel,
+		     bool (*send_reply)(struct crypto_state *cs, int fd,
+					const u8 *TAKES,  void *arg),
+		     void (*io_error)(void *arg),
+		     void *arg)
+{
+	struct channel_id chanid;
+
 	if (is_gossip_msg(msg)) {
 		/* Forward to gossip daemon */
 		wire_sync_write(gossip_fd, take(msg));
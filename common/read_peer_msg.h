@@ -31,6 +31,29 @@ struct channel_id;
 		       typesafe_cb(void, void *, (io_error), (arg)),	\
 		       arg)
 
+/**
+ * handle_peer_msg - handle common messages we've already read from peer.
+ * @msg: the decrypted message.
+ * @cs: the cryptostate
+ * @gossip_index: the gossip_index
+ * @chanid: the channel id (for identifying errors)
+ * @send_reply: the way to send a reply packet (eg. sync_crypto_write_arg)
+ * @io_error: what to do if there's an IO error (eg. status_fail_io)
+ *            (MUST NOT RETURN!)
+ *
+ * As read_peer_msg, but for callers which do their own reading: returns
+ * NULL (and frees @msg) if it handled the message, otherwise @msg.
+ */
+#define handle_peer_msg(msg, cs, gossip_index, chanid, send_reply,	\
+			io_error, arg)					\
+	handle_peer_msg_((msg), PEER_FD, GOSSIP_FD, (cs), (gossip_index), \
+			 (chanid),					\
+			 typesafe_cb_preargs(bool, void *, (send_reply), (arg), \
+					     struct crypto_state *, int, \
+					     const u8 *),		\
+			 typesafe_cb(void, void *, (io_error), (arg)),	\
+			 arg)
+
 /* Helper: sync_crypto_write, with extra args it ignores */
 bool sync_crypto_write_arg(struct crypto_state *cs, int fd, const u8 *TAKES,
 			   void *unused);
@@ -47,4 +70,13 @@ u8 *read_peer_msg_(const tal_t *ctx,
 		   void (*io_error)(void *arg),
 		   void *arg);
 
+u8 *handle_peer_msg_(u8 *msg,
+		     int peer_fd, int gossip_fd,
+		     struct crypto_state *cs, u64 gossip_index,
+		     const struct channel_id *channel,
+		     bool (*send_reply)(struct crypto_state *cs, int fd,
+					const u8 *TAKES,  void *arg),
+		     void (*io_error)(void *arg),
+		     void *arg);
+
 #endif /* LIGHTNING_COMMON_READ_PEER_MSG_H */
@@ -0,0 +1,161 @@
+#include "../cryptomsg.c"
+#include <assert.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+void status_fmt(enum log_level level UNNEEDED, const char *fmt UNNEEDED, ...)
+{
+}
+
+void status_io(enum log_level iodir UNNEEDED, const u8 *p UNNEEDED)
+{
+}
+
+#if DEVELOPER
+enum dev_disconnect dev_disconnect(int pkt_type UNNEEDED)
+{
+	return DEV_DISCONNECT_NORMAL;
+}
+
+void dev_sabotage_fd(int fd UNNEEDED)
+{
+	abort();
+}
+
+void dev_blackhole_fd(int fd UNNEEDED)
+{
+	abort();
+}
+#endif
+
+int fromwire_peektype(const u8 *cursor UNNEEDED)
+{
+	abort();
+}
+
+bool is_unknown_msg_discardable(const u8 *cursor UNNEEDED)
+{
+	abort();
+}
+
+static void init_cs(struct crypto_state *cs)
+{
+	memset(cs, 0, sizeof(*cs));
+	memset(&cs->sk, 1, sizeof(cs->sk));
+	memset(&cs->rk, 1, sizeof(cs->rk));
+	memset(&cs->s_ck, 2, sizeof(cs->s_ck));
+	memset(&cs->r_ck, 2, sizeof(cs->r_ck));
+}
+
+/* One connection's worth of traffic, as it would arrive. */
+static u8 *make_stream(const tal_t *ctx, size_t num, size_t msglen)
+{
+	struct crypto_state cs;
+	u8 *stream = tal_arr(ctx, u8, 0), *msg = tal_arrz(ctx, u8, msglen);
+	size_t i, len = 0;
+
+	init_cs(&cs);
+	for (i = 0; i < num; i++) {
+		msg[i % msglen]++;
+		len = cryptomsg_encrypt_into(&cs, msg, &stream, len);
+	}
+	assert(len == tal_count(stream));
+	return stream;
+}
+
+/* How we used to do it: a buffer for the body, another to decrypt into. */
+static u64 decrypt_alloc(const u8 *stream, size_t num)
+{
+	struct crypto_state cs;
+	struct timemono start;
+	const u8 *p = stream;
+	u8 hdr[18], *enc, *dec;
+	size_t i;
+	u16 len;
+
+	init_cs(&cs);
+	start = time_mono();
+	for (i = 0; i < num; i++) {
+		memcpy(hdr, p, sizeof(hdr));
+		if (!cryptomsg_decrypt_header(&cs, hdr, &len))
+			abort();
+		p += sizeof(hdr);
+		enc = tal_dup_arr(NULL, u8, p, len + 16, 0);
+		p += len + 16;
+		dec = cryptomsg_decrypt_body(NULL, &cs, enc);
+		if (!dec)
+			abort();
+		tal_free(enc);
+		tal_free(dec);
+	}
+	return time_to_usec(timemono_between(time_mono(), start));
+}
+
+/* How we do it now: in the connection's buffer, copying out plaintext. */
+static u64 decrypt_inplace(u8 *stream, size_t num)
+{
+	struct crypto_state cs;
+	struct timemono start;
+	u8 *p = stream, *dec;
+	size_t i;
+	u16 len;
+
+	init_cs(&cs);
+	start = time_mono();
+	for (i = 0; i < num; i++) {
+		if (!cryptomsg_decrypt_header(&cs, p, &len))
+			abort();
+		p += 18;
+		if (!cryptomsg_decrypt_inplace(&cs, p, len + 16))
+			abort();
+		dec = tal_dup_arr(NULL, u8, p, len, 0);
+		p += len + 16;
+		tal_free(dec);
+	}
+	return time_to_usec(timemono_between(time_mono(), start));
+}
+
+static void bench(const tal_t *ctx, size_t num, size_t msglen)
+{
+	u8 *stream = make_stream(ctx, num, msglen);
+	u64 usec[2];
+	size_t i;
+
+	usec[0] = decrypt_alloc(stream, num);
+	usec[1] = decrypt_inplace(stream, num);
+
+	for (i = 0; i < 2; i++)
+		printf("%zu x %zu byte messages, %s: %"PRIu64" msec,"
+		       " %"PRIu64" messages/sec, %"PRIu64" MB/sec\n",
+		       num, msglen,
+		       i == 0 ? "2 allocations each" : "in place",
+		       usec[i] / 1000,
+		       usec[i] ? num * 1000000 / usec[i] : 0,
+		       usec[i] ? tal_count(stream) / usec[i] : 0);
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+	size_t num = 20000;
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num = atoi(argv[1]);
+	if (argc > 2)
+		opt_usage_and_exit("[num_messages]");
+
+	/* Gossip-sized, then update_add_htlc-sized. */
+	bench(ctx, num, 130);
+	bench(ctx, num, 1452);
+
+	tal_free(ctx);
+	opt_free_table();
+	return 0;
+}
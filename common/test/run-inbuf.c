@@ -0,0 +1,257 @@
+#include "../inbuf.c"
+#include "../crypto_sync.c"
+#include "../cryptomsg.c"
+#include "../../wire/wire_sync.c"
+#include <assert.h>
+#include <common/utils.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+/* We don't care about logging. */
+void status_fmt(enum log_level level UNNEEDED, const char *fmt UNNEEDED, ...)
+{
+}
+
+void status_io(enum log_level iodir UNNEEDED, const u8 *p UNNEEDED)
+{
+}
+
+#if DEVELOPER
+enum dev_disconnect dev_disconnect(int pkt_type UNNEEDED)
+{
+	return DEV_DISCONNECT_NORMAL;
+}
+
+void dev_sabotage_fd(int fd UNNEEDED)
+{
+	abort();
+}
+
+void dev_blackhole_fd(int fd UNNEEDED)
+{
+	abort();
+}
+#endif
+
+/* Our test messages are always long enough. */
+int fromwire_peektype(const u8 *cursor)
+{
+	return be16_to_cpu(*(be16 *)cursor);
+}
+
+bool is_unknown_msg_discardable(const u8 *cursor UNNEEDED)
+{
+	abort();
+}
+
+/* About the size of update_add_htlc. */
+#define MSG_SIZE 1452
+
+static u8 *test_msg(const tal_t *ctx, u16 type, size_t len)
+{
+	u8 *msg = tal_arrz(ctx, u8, len);
+
+	*(be16 *)msg = cpu_to_be16(type);
+	memset(msg + 2, type, len - 2);
+	return msg;
+}
+
+static void check_msg(const u8 *msg, u16 type, size_t len)
+{
+	size_t i;
+
+	assert(tal_len(msg) == len);
+	assert(fromwire_peektype(msg) == type);
+	for (i = 2; i < len; i++)
+		assert(msg[i] == (u8)type);
+}
+
+static void init_cs(struct crypto_state *cs)
+{
+	memset(cs, 0, sizeof(*cs));
+	memset(&cs->sk, 1, sizeof(cs->sk));
+	memset(&cs->rk, 1, sizeof(cs->rk));
+	memset(&cs->s_ck, 2, sizeof(cs->s_ck));
+	memset(&cs->r_ck, 2, sizeof(cs->r_ck));
+}
+
+static void test_wire(const tal_t *ctx)
+{
+	int fds[2];
+	struct inbuf *in;
+	u8 *msg, *full;
+	bool failed;
+	size_t i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		abort();
+	in = new_inbuf(ctx, fds[0]);
+
+	/* Nothing there: not an error. */
+	assert(inbuf_fill(in, false));
+	assert(!inbuf_wire_msg(ctx, in, &failed));
+	assert(!failed);
+
+	for (i = 0; i < 3; i++)
+		assert(wire_sync_write(fds[1], take(test_msg(NULL, i, 100))));
+
+	/* Half of the next one. */
+	full = tal_arr(ctx, u8, sizeof(wire_len_t) + 100);
+	*(wire_len_t *)full = cpu_to_wirelen(100);
+	memcpy(full + sizeof(wire_len_t), test_msg(ctx, 3, 100), 100);
+	assert(write(fds[1], full, 50) == 50);
+
+	/* We get all the complete ones, from one peek. */
+	assert(inbuf_fill(in, false));
+	for (i = 0; i < 3; i++) {
+		msg = inbuf_wire_msg(ctx, in, &failed);
+		check_msg(msg, i, 100);
+	}
+	assert(!inbuf_wire_msg(ctx, in, &failed));
+	assert(!failed);
+	assert(in->need == sizeof(wire_len_t) + 100);
+	assert(in->msgs == 3);
+	assert(in->syscalls == 2 + 3);
+
+	/* The rest arrives. */
+	assert(write(fds[1], full + 50, tal_len(full) - 50)
+	       == tal_len(full) - 50);
+	assert(wire_sync_write(fds[1], take(test_msg(NULL, 4, 100))));
+	assert(inbuf_fill(in, false));
+	msg = inbuf_wire_msg(ctx, in, &failed);
+	check_msg(msg, 3, 100);
+
+	/* We only consumed what we handed out: the rest is still there. */
+	msg = wire_sync_read(ctx, fds[0]);
+	check_msg(msg, 4, 100);
+
+	/* Blocking fill waits for a whole message. */
+	assert(wire_sync_write(fds[1], take(test_msg(NULL, 5, 100))));
+	inbuf_reset(in);
+	while (!(msg = inbuf_wire_msg(ctx, in, &failed))) {
+		assert(!failed);
+		assert(inbuf_fill(in, true));
+	}
+	check_msg(msg, 5, 100);
+
+	/* Even if it's only partly there when we start waiting. */
+	*(wire_len_t *)full = cpu_to_wirelen(100);
+	memcpy(full + sizeof(wire_len_t), test_msg(ctx, 7, 100), 100);
+	assert(write(fds[1], full, 2) == 2);
+	switch (fork()) {
+	case -1:
+		abort();
+	case 0:
+		assert(write(fds[1], full + 2, tal_len(full) - 2)
+		       == tal_len(full) - 2);
+		assert(wire_sync_write(fds[1], take(test_msg(NULL, 8, 100))));
+		exit(0);
+	}
+	while (!(msg = inbuf_wire_msg(ctx, in, &failed))) {
+		assert(!failed);
+		assert(inbuf_fill(in, true));
+	}
+	check_msg(msg, 7, 100);
+	assert(wait(NULL) != -1);
+
+	/* Still only what we handed out. */
+	msg = wire_sync_read(ctx, fds[0]);
+	check_msg(msg, 8, 100);
+
+	/* Bigger than our buffer is fine. */
+	assert(wire_sync_write(fds[1], take(test_msg(NULL, 6, 100000))));
+	msg = NULL;
+	while (!msg) {
+		assert(inbuf_fill(in, false));
+		msg = inbuf_wire_msg(ctx, in, &failed);
+		assert(!failed);
+	}
+	check_msg(msg, 6, 100000);
+
+	/* EOF */
+	close(fds[1]);
+	assert(!inbuf_fill(in, false));
+	assert(errno == 0);
+	close(fds[0]);
+}
+
+static void test_crypto(const tal_t *ctx)
+{
+	struct crypto_state cs_out, cs_in, cs_check;
+	int fds[2];
+	struct inbuf *in;
+	u8 *msg, *enc;
+	bool failed;
+	size_t i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		abort();
+	init_cs(&cs_out);
+	init_cs(&cs_in);
+	in = new_inbuf(ctx, fds[0]);
+
+	for (i = 0; i < 3; i++)
+		assert(sync_crypto_write(&cs_out, fds[1],
+					 take(test_msg(NULL, i, MSG_SIZE))));
+
+	/* Half the next one. */
+	enc = cryptomsg_encrypt_msg(ctx, &cs_out, test_msg(ctx, 3, MSG_SIZE));
+	assert(write(fds[1], enc, 10) == 10);
+
+	assert(inbuf_fill(in, false));
+	for (i = 0; i < 3; i++) {
+		msg = inbuf_crypto_msg(ctx, in, &cs_in, &failed);
+		check_msg(msg, i, MSG_SIZE);
+	}
+
+	/* Not even a whole header: cs untouched. */
+	cs_check = cs_in;
+	assert(!inbuf_crypto_msg(ctx, in, &cs_in, &failed));
+	assert(!failed);
+	assert(memcmp(&cs_check, &cs_in, sizeof(cs_in)) == 0);
+
+	/* Header but not body: cs still untouched. */
+	assert(write(fds[1], enc + 10, 100) == 100);
+	assert(inbuf_fill(in, false));
+	assert(!inbuf_crypto_msg(ctx, in, &cs_in, &failed));
+	assert(!failed);
+	assert(memcmp(&cs_check, &cs_in, sizeof(cs_in)) == 0);
+	assert(in->need == tal_len(enc));
+
+	assert(write(fds[1], enc + 110, tal_len(enc) - 110)
+	       == tal_len(enc) - 110);
+	assert(sync_crypto_write(&cs_out, fds[1],
+				 take(test_msg(NULL, 4, MSG_SIZE))));
+	assert(inbuf_fill(in, false));
+	msg = inbuf_crypto_msg(ctx, in, &cs_in, &failed);
+	check_msg(msg, 3, MSG_SIZE);
+
+	/* The one we didn't take is still there for sync_crypto_read. */
+	msg = sync_crypto_read(ctx, &cs_in, fds[0]);
+	check_msg(msg, 4, MSG_SIZE);
+
+	/* Corrupt header fails. */
+	enc = cryptomsg_encrypt_msg(ctx, &cs_out, test_msg(ctx, 5, MSG_SIZE));
+	enc[0] ^= 1;
+	assert(write(fds[1], enc, tal_len(enc)) == tal_len(enc));
+	assert(inbuf_fill(in, false));
+	assert(!inbuf_crypto_msg(ctx, in, &cs_in, &failed));
+	assert(failed);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(void)
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+
+	test_wire(ctx);
+	test_crypto(ctx);
+
+	tal_free(ctx);
+	return 0;
+}
@@ -426,3 +426,18 @@ class LightningRpc(UnixDomainSocketRpc):
             "id": peer_id,
         }
         return self.call("disconnect", payload)
+
+    def commitstats(self, peer_id):
+        """
+        Show how updates with peer {peer_id} are being batched into commitments
+        """
+        payload = {
+            "id": peer_id,
+        }
+        return self.call("commitstats", payload)
+
+    def dbstats(self):
+        """
+        Show how many database transactions are sharing each commit
+        """
+        return self.call("dbstats")
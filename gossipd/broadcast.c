@@ -1,10 +1,47 @@
+#include <ccan/crypto/siphash24/siphash24.h>
+#include <ccan/htable/htable_type.h>
 #include <ccan/mem/mem.h>
+#include <common/pseudorand.h>
 #include <gossipd/broadcast.h>
 
+static const struct broadcast_key *
+broadcast_keyof(const struct queued_message *msg)
+{
+	return &msg->key;
+}
+
+static size_t broadcast_key_hash(const struct broadcast_key *key)
+{
+	struct siphash24_ctx ctx;
+
+	siphash24_init(&ctx, siphash_seed());
+	siphash24_u32(&ctx, key->type);
+	siphash24_update(&ctx, key->tag, tal_len(key->tag));
+	return siphash24_done(&ctx);
+}
+
+static bool broadcast_key_eq(const struct queued_message *msg,
+			     const struct broadcast_key *key)
+{
+	return msg->type == key->type
+		&& memeq(msg->tag, tal_len(msg->tag), key->tag, tal_len(key->tag));
+}
+
+HTABLE_DEFINE_TYPE(struct queued_message, broadcast_keyof,
+		   broadcast_key_hash, broadcast_key_eq, broadcast_map);
+
+static void destroy_broadcast_map(struct broadcast_map *map)
+{
+	broadcast_map_clear(map);
+}
+
 struct broadcast_state *new_broadcast_state(tal_t *ctx)
 {
 	struct broadcast_state *bstate = tal(ctx, struct broadcast_state);
 	uintmap_init(&bstate->broadcasts);
+	bstate->index = tal(bstate, struct broadcast_map);
+	broadcast_map_init(bstate->index);
+	tal_add_destructor(bstate->index, destroy_broadcast_map);
 	/* Skip 0 because we initialize peers with 0 */
 	bstate->next_index = 1;
 	return bstate;
@@ -18,29 +55,65 @@ static struct queued_message *new_queued_message(tal_t *ctx,
 	struct queued_message *msg = tal(ctx, struct queued_message);
 	msg->type = type;
 	msg->tag = tal_dup_arr(msg, u8, tag, tal_len(tag), 0);
-	msg->payload = tal_dup_arr(msg, u8, payload, tal_len(payload), 0);
+	msg->payload = payload;
+	msg->key.type = type;
+	msg->key.tag = msg->tag;
 	return msg;
 }
 
-bool replace_broadcast(struct broadcast_state *bstate, u64 *index,
-		       const int type, const u8 *tag, const u8 *payload)
+static void remove_broadcast(struct broadcast_state *bstate,
+			     struct queued_message *msg)
+{
+	broadcast_map_del(bstate->index, msg);
+	uintmap_del(&bstate->broadcasts, msg->index);
+	tal_free(msg);
+}
+
+/* Drop any queued message with this type and tag: returns its index,
+ * or 0 if there wasn't one. */
+static u64 evict_broadcast(struct broadcast_state *bstate,
+			   const int type, const u8 *tag)
+{
+	struct broadcast_key key;
+	struct queued_message *msg;
+	u64 index;
+
+	key.type = type;
+	key.tag = tag;
+	msg = broadcast_map_get(bstate->index, &key);
+	if (!msg)
+		return 0;
+
+	index = msg->index;
+	remove_broadcast(bstate, msg);
+	return index;
+}
+
+/* Add the message to the top of the queue, returning its index. */
+static u64 add_broadcast(struct broadcast_state *bstate,
+			 const int type, const u8 *tag, const u8 *payload)
 {
 	struct queued_message *msg;
-	bool evicted = false;
-
-	msg = uintmap_get(&bstate->broadcasts, *index);
-	if (msg && msg->type == type &&
-	    memeq(msg->tag, tal_len(msg->tag), tag, tal_len(tag))) {
-		uintmap_del(&bstate->broadcasts, *index);
-		tal_free(msg);
-		evicted = true;
-	}
-
-	*index = bstate->next_index;
-	/* Now add the message to the queue */
+
 	msg = new_queued_message(bstate, type, tag, payload);
-	uintmap_add(&bstate->broadcasts, *index, msg);
-	bstate->next_index++;
+	msg->index = bstate->next_index++;
+	uintmap_add(&bstate->broadcasts, msg->index, msg);
+	broadcast_map_add(bstate->index, msg);
+	return msg->index;
+}
+
+bool replace_broadcast(struct broadcast_state *bstate, u64 *index,
+		       const int type, const u8 *tag, const u8 *payload)
+{
+	bool evicted;
+	u64 old;
+
+	/* There's only one of each type and tag in the queue, so this is
+	 * normally what *index pointed to; if it wasn't (eg. the old owner
+	 * was pruned), we still drop it, but don't count it as replaced. */
+	old = evict_broadcast(bstate, type, tag);
+	evicted = (old != 0 && old == *index);
+	*index = add_broadcast(bstate, type, tag, payload);
 	return evicted;
 }
 
@@ -49,33 +122,27 @@ bool queue_broadcast(struct broadcast_state *bstate,
 		     const u8 *tag,
 		     const u8 *payload)
 {
-	struct queued_message *msg;
-	u64 index;
-	bool evicted = false;
+	bool evicted;
 
 	memcheck(tag, tal_len(tag));
 
 	/* Remove any tag&type collisions */
-	for (msg = uintmap_first(&bstate->broadcasts, &index);
-	     msg;
-	     msg = uintmap_after(&bstate->broadcasts, &index)) {
-		if (msg->type == type &&
-		    memeq(msg->tag, tal_len(msg->tag), tag, tal_len(tag))) {
-			uintmap_del(&bstate->broadcasts, index);
-			tal_free(msg);
-			evicted = true;
-			break;
-		}
-	}
-
-	/* Now add the message to the queue */
-	msg = new_queued_message(bstate, type, tag, payload);
-	uintmap_add(&bstate->broadcasts, bstate->next_index, msg);
-	bstate->next_index += 1;
+	evicted = (evict_broadcast(bstate, type, tag) != 0);
+	add_broadcast(bstate, type, tag, payload);
 	return evicted;
 }
 
-struct queued_message *next_broadcast_message(struct broadcast_state *bstate, u64 last_index)
+void broadcast_del(struct broadcast_state *bstate, u64 index,
+		   const u8 *payload)
+{
+	struct queued_message *msg = uintmap_get(&bstate->broadcasts, index);
+
+	if (msg && msg->payload == payload)
+		remove_broadcast(bstate, msg);
+}
+
+struct queued_message *next_broadcast_message(struct broadcast_state *bstate,
+					      u64 *last_index)
 {
-	return uintmap_after(&bstate->broadcasts, &last_index);
+	return uintmap_after(&bstate->broadcasts, last_index);
 }
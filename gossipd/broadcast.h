@@ -9,19 +9,35 @@
 
 /* Common functionality to implement staggered broadcasts with replacement. */
 
+/* There's only ever one queued message with each type and tag. */
+struct broadcast_key {
+	int type;
+	const u8 *tag;
+};
+
 struct queued_message {
 	int type;
 
 	/* Unique tag specifying the msg origin */
 	void *tag;
 
-	/* Serialized payload */
-	u8 *payload;
+	/* Serialized payload: not ours, see queue_broadcast(). */
+	const u8 *payload;
+
+	/* Where we are in broadcast_state->broadcasts */
+	u64 index;
+
+	/* Our entry in broadcast_state->index */
+	struct broadcast_key key;
 };
 
+struct broadcast_map;
+
 struct broadcast_state {
 	u32 next_index;
 	UINTMAP(struct queued_message *) broadcasts;
+	/* The same messages, by type and tag, for replacement. */
+	struct broadcast_map *index;
 };
 
 struct broadcast_state *new_broadcast_state(tal_t *ctx);
@@ -30,7 +46,11 @@ struct broadcast_state *new_broadcast_state(tal_t *ctx);
  * broadcast. Replacement is done by comparing the `type` and the
  * `tag`, if both match the old message is dropped from the queue. The
  * new message is added to the top of the broadcast queue. Returns
- * true if a previous entry with the same tag has been evicted. */
+ * true if a previous entry with the same tag has been evicted.
+ *
+ * The payload isn't copied: it belongs to whoever queued it (eg. the
+ * struct chan), who must replace or delete the message before freeing
+ * it. */
 bool queue_broadcast(struct broadcast_state *bstate,
 			     const int type,
 			     const u8 *tag,
@@ -46,7 +66,12 @@ bool replace_broadcast(struct broadcast_state *bstate,
 		       const u8 *tag,
 		       const u8 *payload);
 
+/* Remove the message at @index, if it's still this payload's. */
+void broadcast_del(struct broadcast_state *bstate, u64 index,
+		   const u8 *payload);
 
-struct queued_message *next_broadcast_message(struct broadcast_state *bstate, u64 last_index);
+/* Next message after *last_index, which is updated to it. */
+struct queued_message *next_broadcast_message(struct broadcast_state *bstate,
+					      u64 *last_index);
 
 #endif /* LIGHTNING_LIGHTNINGD_GOSSIP_BROADCAST_H */
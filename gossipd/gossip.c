@@ -18,6 +18,7 @@
 #include <common/cryptomsg.h>
 #include <common/daemon_conn.h>
 #include <common/io_debug.h>
+#include <common/parallel.h>
 #include <common/ping.h>
 #include <common/status.h>
 #include <common/subdaemon.h>
@@ -31,8 +32,10 @@
 #include <fcntl.h>
 #include <gossipd/broadcast.h>
 #include <gossipd/gen_gossip_wire.h>
+#include <gossipd/gossip_store.h>
 #include <gossipd/handshake.h>
 #include <gossipd/routing.h>
+#include <gossipd/sigcheck.h>
 #include <hsmd/client.h>
 #include <hsmd/gen_hsm_client_wire.h>
 #include <inttypes.h>
@@ -83,8 +86,20 @@ struct daemon {
 
 	/* To make sure our node_announcement timestamps increase */
 	u32 last_announce_timestamp;
+
+	/* Gossip from peers, waiting for its signatures to be checked. */
+	u8 **gossip_batch;
+	struct oneshot *gossip_batch_timer;
+
+	/* How many threads sigcheck_batch() should use. */
+	size_t sigcheck_threads;
 };
 
+/* We collect gossip for up to this long before checking signatures... */
+#define GOSSIP_BATCH_MSEC 10
+/* ... or until we have this many messages. */
+#define GOSSIP_BATCH_MAX 256
+
 /* Peers we're trying to reach. */
 struct reaching {
 	struct daemon *daemon;
@@ -486,6 +501,62 @@ static void handle_gossip_msg(struct daemon *daemon, u8 *msg)
 	}
 }
 
+/* Check all the batched gossip's signatures at once, then handle the
+ * messages in the order they arrived. */
+static void flush_gossip_batch(struct daemon *daemon)
+{
+	const tal_t *tmpctx;
+	struct routing_state *rstate = daemon->rstate;
+	u8 **batch;
+	size_t i, n = tal_count(daemon->gossip_batch);
+	struct sigcheck *checks;
+	size_t *first;
+
+	if (n == 0)
+		return;
+
+	tmpctx = tal_tmpctx(daemon);
+	batch = tal_steal(tmpctx, daemon->gossip_batch);
+	checks = tal_arr(tmpctx, struct sigcheck, 0);
+	first = tal_arr(tmpctx, size_t, n + 1);
+	daemon->gossip_batch = tal_arr(daemon, u8 *, 0);
+	daemon->gossip_batch_timer = tal_free(daemon->gossip_batch_timer);
+
+	for (i = 0; i < n; i++) {
+		first[i] = tal_count(checks);
+		gossip_sigchecks(rstate, batch[i], &checks);
+	}
+	first[n] = tal_count(checks);
+
+	sigcheck_batch(checks, daemon->sigcheck_threads);
+
+	for (i = 0; i < n; i++) {
+		rstate->preverified = checks + first[i];
+		rstate->num_preverified = first[i+1] - first[i];
+		handle_gossip_msg(daemon, batch[i]);
+	}
+	rstate->preverified = NULL;
+	rstate->num_preverified = 0;
+	tal_free(tmpctx);
+}
+
+static void queue_gossip_msg(struct daemon *daemon, const u8 *msg)
+{
+	size_t n = tal_count(daemon->gossip_batch);
+
+	tal_resize(&daemon->gossip_batch, n + 1);
+	daemon->gossip_batch[n] = tal_dup_arr(daemon->gossip_batch, u8,
+					      msg, tal_len(msg), 0);
+
+	if (n + 1 >= GOSSIP_BATCH_MAX)
+		flush_gossip_batch(daemon);
+	else if (!daemon->gossip_batch_timer)
+		daemon->gossip_batch_timer
+			= new_reltimer(&daemon->timers, daemon,
+				       time_from_msec(GOSSIP_BATCH_MSEC),
+				       flush_gossip_batch, daemon);
+}
+
 static void handle_ping(struct peer *peer, u8 *ping)
 {
 	u8 *pong;
@@ -580,7 +651,7 @@ static struct io_plan *peer_msgin(struct io_conn *conn,
 	case WIRE_CHANNEL_ANNOUNCEMENT:
 	case WIRE_NODE_ANNOUNCEMENT:
 	case WIRE_CHANNEL_UPDATE:
-		handle_gossip_msg(peer->daemon, msg);
+		queue_gossip_msg(peer->daemon, msg);
 		return peer_next_in(conn, peer);
 
 	case WIRE_PING:
@@ -650,49 +721,52 @@ static void wake_pkt_out(struct peer *peer)
 		msg_wake(&peer->remote->out);
 }
 
-/* Mutual recursion. */
-static struct io_plan *peer_pkt_out(struct io_conn *conn, struct peer *peer);
-
-static struct io_plan *local_gossip_broadcast_done(struct io_conn *conn,
-						   struct peer *peer)
-{
-	peer->broadcast_index++;
-	return peer_pkt_out(conn, peer);
-}
-
 static struct io_plan *peer_pkt_out(struct io_conn *conn, struct peer *peer)
 {
-	/* First priority is queued packets, if any */
-	const u8 *out = msg_dequeue(&peer->local->peer_out);
-	if (out) {
-		if (is_all_channel_error(out))
-			return peer_write_message(conn, &peer->local->pcs,
-						  take(out),
-						  peer_close_after_error);
-		return peer_write_message(conn, &peer->local->pcs, take(out),
-					  peer_pkt_out);
+	struct peer_crypto_state *pcs = &peer->local->pcs;
+	const u8 *out;
+
+	/* First priority is queued packets, if any: we encrypt as many as
+	 * we can (then gossip) to go out in one write. */
+	while ((out = msg_dequeue(&peer->local->peer_out)) != NULL) {
+		if (is_all_channel_error(out)) {
+			peer_queue_message(conn, pcs, take(out));
+			return peer_write_queued(conn, pcs,
+						 peer_close_after_error);
+		}
+		if (!peer_queue_message(conn, pcs, take(out)))
+			return peer_write_queued(conn, pcs, peer_pkt_out);
 	}
 
 	/* Do we want to send this peer to the master daemon? */
 	if (peer->local->return_to_master) {
-		if (!peer_in_started(conn, &peer->local->pcs))
+		if (!pcs->outlen && !peer_in_started(conn, pcs))
 			return ready_for_master(conn, peer);
 	} else if (peer->gossip_sync) {
 		/* If we're supposed to be sending gossip, do so now. */
 		struct queued_message *next;
 
-		next = next_broadcast_message(peer->daemon->rstate->broadcasts,
-					      peer->broadcast_index);
-
-		if (next)
-			return peer_write_message(conn, &peer->local->pcs,
-						  next->payload,
-						  local_gossip_broadcast_done);
+		/* Each message once, even though the queue has gaps where
+		 * messages were replaced. */
+		for (;;) {
+			next = next_broadcast_message(
+				peer->daemon->rstate->broadcasts,
+				&peer->broadcast_index);
 
-		/* Gossip is drained.  Wait for next timer. */
-		peer->gossip_sync = false;
+			/* Gossip is drained.  Wait for next timer. */
+			if (!next) {
+				peer->gossip_sync = false;
+				break;
+			}
+			if (!peer_queue_message(conn, pcs, next->payload))
+				return peer_write_queued(conn, pcs,
+							 peer_pkt_out);
+		}
 	}
 
+	if (pcs->outlen)
+		return peer_write_queued(conn, pcs, peer_pkt_out);
+
 	return msg_queue_wait(conn, &peer->local->peer_out, peer_pkt_out, peer);
 }
 
@@ -777,8 +851,11 @@ static void handle_local_add_channel(struct peer *peer, u8 *msg)
 		return;
 	}
 
-	if (get_channel(rstate, &scid)) {
-		status_broken("Attempted to local_add_channel a known channel");
+	chan = get_channel(rstate, &scid);
+	if (chan) {
+		/* We may already know it's public, from the gossip_store */
+		if (!chan->public)
+			status_broken("Attempted to local_add_channel a known channel");
 		return;
 	}
 
@@ -787,7 +864,7 @@ static void handle_local_add_channel(struct peer *peer, u8 *msg)
 
 	idx = pubkey_idx(&rstate->local_id, &remote_node_id),
 	/* Activate the half_chan from us to them. */
-	set_connection_values(chan, idx,
+	set_connection_values(rstate, chan, idx,
 			      fee_base_msat,
 			      fee_proportional_millionths,
 			      cltv_expiry_delta,
@@ -811,6 +888,9 @@ static struct io_plan *owner_msg_in(struct io_conn *conn,
 	u8 *msg = dc->msg_in;
 
 	int type = fromwire_peektype(msg);
+
+	/* Our channels' own gossip is rare: just keep it in order. */
+	flush_gossip_batch(peer->daemon);
 	if (type == WIRE_CHANNEL_ANNOUNCEMENT || type == WIRE_CHANNEL_UPDATE ||
 	    type == WIRE_NODE_ANNOUNCEMENT) {
 		handle_gossip_msg(peer->daemon, dc->msg_in);
@@ -873,15 +953,6 @@ static bool send_peer_with_fds(struct peer *peer, const u8 *msg)
 	return true;
 }
 
-static struct io_plan *nonlocal_gossip_broadcast_done(struct io_conn *conn,
-						      struct daemon_conn *dc)
-{
-	struct peer *peer = dc->ctx;
-
-	peer->broadcast_index++;
-	return nonlocal_dump_gossip(conn, dc);
-}
-
 /**
  * nonlocal_dump_gossip - catch the nonlocal peer up with the latest gossip.
  *
@@ -902,7 +973,7 @@ static struct io_plan *nonlocal_dump_gossip(struct io_conn *conn, struct daemon_
 				      daemon_conn_write_next, dc);
 
 	next = next_broadcast_message(peer->daemon->rstate->broadcasts,
-				      peer->broadcast_index);
+				      &peer->broadcast_index);
 
 	if (!next) {
 		peer->gossip_sync = false;
@@ -913,7 +984,7 @@ static struct io_plan *nonlocal_dump_gossip(struct io_conn *conn, struct daemon_
 						    peer->broadcast_index,
 						    next->payload);
 		return io_write_wire(conn, take(msg),
-				     nonlocal_gossip_broadcast_done, dc);
+				     nonlocal_dump_gossip, dc);
 	}
 }
 
@@ -1095,6 +1166,73 @@ static struct io_plan *getroute_req(struct io_conn *conn, struct daemon *daemon,
 	return daemon_conn_read_next(conn, &daemon->master);
 }
 
+static struct io_plan *getroutes_req(struct io_conn *conn,
+				     struct daemon *daemon, u8 *msg)
+{
+	tal_t *tmpctx = tal_tmpctx(msg);
+	struct pubkey source, destination;
+	u32 msatoshi, final_cltv;
+	u16 riskfactor, max_routes;
+	bool node_disjoint;
+	u8 *out;
+	struct route_hop **routes, *hops;
+	u16 *route_lens;
+	double fuzz;
+	struct siphash_seed seed;
+	size_t i;
+
+	if (!fromwire_gossip_getroutes_request(msg,
+					       &source, &destination,
+					       &msatoshi, &riskfactor,
+					       &final_cltv, &fuzz, &seed,
+					       &max_routes, &node_disjoint))
+		master_badmsg(WIRE_GOSSIP_GETROUTES_REQUEST, msg);
+	if (max_routes > ROUTING_MAX_ALTERNATES)
+		max_routes = ROUTING_MAX_ALTERNATES;
+
+	status_trace("Trying to find %u routes from %s to %s for %d msatoshi",
+		     max_routes,
+		     pubkey_to_hexstr(tmpctx, &source),
+		     pubkey_to_hexstr(tmpctx, &destination), msatoshi);
+
+	routes = get_routes(tmpctx, daemon->rstate, &source, &destination,
+			    msatoshi, 1, final_cltv,
+			    fuzz, &seed, max_routes, node_disjoint);
+
+	route_lens = tal_arr(tmpctx, u16, tal_count(routes));
+	hops = tal_arr(tmpctx, struct route_hop, 0);
+	for (i = 0; i < tal_count(routes); i++) {
+		size_t n = tal_count(hops);
+		route_lens[i] = tal_count(routes[i]);
+		tal_resize(&hops, n + route_lens[i]);
+		memcpy(hops + n, routes[i], route_lens[i] * sizeof(*hops));
+	}
+
+	out = towire_gossip_getroutes_reply(msg, route_lens, hops);
+	tal_free(tmpctx);
+	daemon_conn_send(&daemon->master, out);
+	return daemon_conn_read_next(conn, &daemon->master);
+}
+
+static struct io_plan *routecache_stats_req(struct io_conn *conn,
+					    struct daemon *daemon,
+					    const u8 *msg)
+{
+	struct route_cache_stats stats;
+
+	if (!fromwire_gossip_routecache_stats(msg))
+		master_badmsg(WIRE_GOSSIP_ROUTECACHE_STATS, msg);
+
+	route_cache_stats(daemon->rstate, &stats);
+	daemon_conn_send(&daemon->master,
+			 take(towire_gossip_routecache_stats_reply(NULL,
+							stats.hits,
+							stats.misses,
+							stats.invalidated,
+							stats.entries)));
+	return daemon_conn_read_next(conn, &daemon->master);
+}
+
 static void append_half_channel(struct gossip_getchannels_entry **entries,
 				const struct chan *chan,
 				int idx)
@@ -1390,6 +1528,7 @@ static void gossip_refresh_network(struct daemon *daemon)
 	}
 
 	route_prune(daemon->rstate);
+	gossip_store_compact(daemon->rstate->store, daemon->rstate);
 }
 
 static struct io_plan *connection_in(struct io_conn *conn, struct daemon *daemon)
@@ -1505,17 +1644,25 @@ static struct io_plan *gossip_init(struct daemon_conn *master,
 	struct bitcoin_blkid chain_hash;
 	u16 port;
 	u32 update_channel_interval;
+	bool bfg_routing;
 
 	if (!fromwire_gossipctl_init(
 		daemon, msg, &daemon->broadcast_interval, &chain_hash,
 		&daemon->id, &port, &daemon->globalfeatures,
 		&daemon->localfeatures, &daemon->wireaddrs, daemon->rgb,
-		daemon->alias, &update_channel_interval)) {
+		daemon->alias, &update_channel_interval, &bfg_routing)) {
 		master_badmsg(WIRE_GOSSIPCTL_INIT, msg);
 	}
 	/* Prune time is twice update time */
 	daemon->rstate = new_routing_state(daemon, &chain_hash, &daemon->id,
 					   update_channel_interval * 2);
+	if (bfg_routing)
+		daemon->rstate->route_engine = ROUTE_ENGINE_BFG;
+
+	/* Pick up where we left off, and tidy up if that was messy. */
+	daemon->rstate->store = gossip_store_new(daemon->rstate);
+	gossip_store_load(daemon->rstate->store, daemon->rstate);
+	gossip_store_compact(daemon->rstate->store, daemon->rstate);
 
 	setup_listeners(daemon, port);
 
@@ -1860,6 +2007,7 @@ static struct io_plan *handle_disable_channel(struct io_conn *conn,
 		     direction, hc->active, active);
 
 	hc->active = active;
+	update_route_graph(daemon->rstate, chan, direction);
 
 	if (!hc->channel_update) {
 		status_trace(
@@ -1970,6 +2118,12 @@ static struct io_plan *recv_req(struct io_conn *conn, struct daemon_conn *master
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
 		return getroute_req(conn, daemon, daemon->master.msg_in);
 
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
+		return getroutes_req(conn, daemon, daemon->master.msg_in);
+
+	case WIRE_GOSSIP_ROUTECACHE_STATS:
+		return routecache_stats_req(conn, daemon, master->msg_in);
+
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 		return getchannels_req(conn, daemon, daemon->master.msg_in);
 
@@ -2011,6 +2165,8 @@ static struct io_plan *recv_req(struct io_conn *conn, struct daemon_conn *master
 	case WIRE_GOSSIPCTL_RELEASE_PEER_REPLYFAIL:
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
+	case WIRE_GOSSIP_ROUTECACHE_STATS_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_GETPEERS_REPLY:
 	case WIRE_GOSSIP_PING_REPLY:
@@ -2055,6 +2211,9 @@ int main(int argc, char *argv[])
 	timers_init(&daemon->timers, time_mono());
 	daemon->broadcast_interval = 30000;
 	daemon->last_announce_timestamp = 0;
+	daemon->gossip_batch = tal_arr(daemon, u8 *, 0);
+	daemon->gossip_batch_timer = NULL;
+	daemon->sigcheck_threads = parallel_default_threads();
 
 	/* stdin == control */
 	daemon_conn_init(daemon, &daemon->master, STDIN_FILENO, recv_req,
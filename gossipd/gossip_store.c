@@ -0,0 +1,301 @@
+#include <ccan/read_write_all/read_write_all.h>
+#include <ccan/time/time.h>
+#include <common/status.h>
+#include <common/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gossipd/gen_gossip_store.h>
+#include <gossipd/gossip_store.h>
+#include <gossipd/routing.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wire/wire.h>
+
+#define GOSSIP_STORE_TEMP_FILENAME GOSSIP_STORE_FILENAME ".tmp"
+
+/* First byte of the file: if it doesn't match, we start afresh. */
+static const u8 gossip_store_version = 1;
+
+/* Don't bother compacting unless we'd drop at least this many records. */
+#define GOSSIP_STORE_COMPACT_MIN 1000
+
+struct gossip_store {
+	int fd;
+
+	/* How many records are in the file (some superseded). */
+	size_t count;
+};
+
+static void destroy_gossip_store(struct gossip_store *gs)
+{
+	close(gs->fd);
+}
+
+/* Each record is a 4-byte length, then the gossip_store message. */
+static bool append_record(int fd, const u8 *msg TAKES)
+{
+	u8 *rec = tal_arr(NULL, u8, 0);
+	bool ok;
+
+	towire_u32(&rec, tal_len(msg));
+	towire(&rec, msg, tal_len(msg));
+	if (taken(msg))
+		tal_free(msg);
+
+	ok = write_all(fd, rec, tal_len(rec));
+	tal_free(rec);
+	return ok;
+}
+
+static void gossip_store_append(struct gossip_store *gs, const u8 *msg TAKES)
+{
+	if (!append_record(gs->fd, msg))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Writing gossip_store: %s", strerror(errno));
+	gs->count++;
+}
+
+struct gossip_store *gossip_store_new(const tal_t *ctx)
+{
+	struct gossip_store *gs = tal(ctx, struct gossip_store);
+	u8 version;
+
+	gs->count = 0;
+	gs->fd = open(GOSSIP_STORE_FILENAME, O_RDWR|O_APPEND|O_CREAT, 0600);
+	if (gs->fd < 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Opening gossip_store: %s", strerror(errno));
+	tal_add_destructor(gs, destroy_gossip_store);
+
+	if (read(gs->fd, &version, sizeof(version)) == sizeof(version)
+	    && version == gossip_store_version)
+		return gs;
+
+	/* Empty, or some format we don't understand. */
+	if (ftruncate(gs->fd, 0) != 0
+	    || !write_all(gs->fd, &gossip_store_version,
+			  sizeof(gossip_store_version)))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Initializing gossip_store: %s", strerror(errno));
+	return gs;
+}
+
+static bool load_record(struct routing_state *rstate, const u8 *msg)
+{
+	const tal_t *tmpctx = tal_tmpctx(rstate);
+	struct short_channel_id scid;
+	u8 *gossip;
+	u64 satoshis;
+	bool ok = false;
+
+	/* These were all checked before we stored them. */
+	switch (fromwire_peektype(msg)) {
+	case WIRE_GOSSIP_STORE_CHANNEL_ANNOUNCEMENT:
+		if (fromwire_gossip_store_channel_announcement(tmpctx, msg,
+							       &gossip,
+							       &satoshis))
+			ok = routing_add_channel_announcement(rstate,
+							      take(gossip),
+							      satoshis);
+		break;
+	case WIRE_GOSSIP_STORE_CHANNEL_UPDATE:
+		if (fromwire_gossip_store_channel_update(tmpctx, msg, &gossip))
+			ok = routing_add_channel_update(rstate, gossip);
+		break;
+	case WIRE_GOSSIP_STORE_NODE_ANNOUNCEMENT:
+		if (fromwire_gossip_store_node_announcement(tmpctx, msg,
+							    &gossip))
+			ok = routing_add_node_announcement(rstate, gossip);
+		break;
+	case WIRE_GOSSIP_STORE_CHANNEL_DELETE:
+		if (fromwire_gossip_store_channel_delete(msg, &scid)) {
+			tal_free(get_channel(rstate, &scid));
+			ok = true;
+		}
+		break;
+	}
+	tal_free(tmpctx);
+	return ok;
+}
+
+void gossip_store_load(struct gossip_store *gs, struct routing_state *rstate)
+{
+	struct timemono start = time_mono();
+	struct stat st;
+	u8 *map;
+	size_t off, loaded = 0;
+
+	if (fstat(gs->fd, &st) != 0)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Reading gossip_store: %s", strerror(errno));
+
+	/* Nothing but the version byte? */
+	if (st.st_size <= sizeof(gossip_store_version))
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, gs->fd, 0);
+	if (map == MAP_FAILED)
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Mapping gossip_store: %s", strerror(errno));
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	off = sizeof(gossip_store_version);
+	while (off < st.st_size) {
+		const u8 *cursor = map + off;
+		size_t max = st.st_size - off;
+		u32 len = fromwire_u32(&cursor, &max);
+		u8 *msg;
+
+		/* We crashed while appending? */
+		if (!cursor || len > max)
+			break;
+
+		msg = tal_dup_arr(gs, u8, cursor, len, 0);
+		if (load_record(rstate, msg))
+			loaded++;
+		tal_free(msg);
+
+		off = cursor + len - map;
+		gs->count++;
+	}
+	munmap(map, st.st_size);
+
+	if (off != st.st_size) {
+		status_unusual("gossip_store: truncating partial record at %zu"
+			       " of %"PRIu64, off, (u64)st.st_size);
+		if (ftruncate(gs->fd, off) != 0)
+			status_failed(STATUS_FAIL_INTERNAL_ERROR,
+				      "Truncating gossip_store: %s",
+				      strerror(errno));
+	}
+
+	status_trace("gossip_store: loaded %zu of %zu records in %"PRIu64" msec",
+		     loaded, gs->count,
+		     time_to_msec(timemono_between(time_mono(), start)));
+}
+
+void gossip_store_add_channel_announcement(struct gossip_store *gs,
+					   const u8 *announce,
+					   u64 satoshis)
+{
+	gossip_store_append(gs,
+			    take(towire_gossip_store_channel_announcement(NULL,
+									 announce,
+									 satoshis)));
+}
+
+void gossip_store_add_channel_update(struct gossip_store *gs,
+				     const u8 *update)
+{
+	gossip_store_append(gs,
+			    take(towire_gossip_store_channel_update(NULL,
+								   update)));
+}
+
+void gossip_store_add_node_announcement(struct gossip_store *gs,
+					const u8 *announce)
+{
+	gossip_store_append(gs,
+			    take(towire_gossip_store_node_announcement(NULL,
+								      announce)));
+}
+
+void gossip_store_add_channel_delete(struct gossip_store *gs,
+				     const struct short_channel_id *scid)
+{
+	gossip_store_append(gs,
+			    take(towire_gossip_store_channel_delete(NULL,
+								   scid)));
+}
+
+/* Write out what we know now, or with fd < 0 just count it. */
+static bool write_current(int fd, struct routing_state *rstate, size_t *count)
+{
+	struct node_map_iter it;
+	struct chan *chan;
+	struct node *node;
+	u64 idx;
+
+	*count = 0;
+	/* Channels first: a node_announcement needs a channel to apply. */
+	for (chan = uintmap_first(&rstate->chanmap, &idx);
+	     chan;
+	     chan = uintmap_after(&rstate->chanmap, &idx)) {
+		if (!chan->public)
+			continue;
+		(*count)++;
+		if (fd >= 0
+		    && !append_record(fd,
+			    take(towire_gossip_store_channel_announcement(NULL,
+					chan->channel_announcement,
+					chan->satoshis))))
+			return false;
+		for (int i = 0; i < 2; i++) {
+			if (!chan->half[i].channel_update)
+				continue;
+			(*count)++;
+			if (fd >= 0
+			    && !append_record(fd,
+				    take(towire_gossip_store_channel_update(NULL,
+						chan->half[i].channel_update))))
+				return false;
+		}
+	}
+
+	for (node = node_map_first(rstate->nodes, &it);
+	     node;
+	     node = node_map_next(rstate->nodes, &it)) {
+		if (!node->node_announcement)
+			continue;
+		(*count)++;
+		if (fd >= 0
+		    && !append_record(fd,
+			    take(towire_gossip_store_node_announcement(NULL,
+					node->node_announcement))))
+			return false;
+	}
+	return true;
+}
+
+bool gossip_store_compact(struct gossip_store *gs,
+			  struct routing_state *rstate)
+{
+	size_t live;
+	int fd, saved_errno;
+
+	write_current(-1, rstate, &live);
+	if (gs->count < live * 2 || gs->count - live < GOSSIP_STORE_COMPACT_MIN)
+		return false;
+
+	fd = open(GOSSIP_STORE_TEMP_FILENAME,
+		  O_RDWR|O_APPEND|O_CREAT|O_TRUNC, 0600);
+	if (fd < 0)
+		goto fail;
+
+	if (!write_all(fd, &gossip_store_version,
+		       sizeof(gossip_store_version))
+	    || !write_current(fd, rstate, &live)
+	    || fsync(fd) != 0
+	    || rename(GOSSIP_STORE_TEMP_FILENAME, GOSSIP_STORE_FILENAME) != 0)
+		goto fail_unlink;
+
+	status_trace("gossip_store: compacted %zu records to %zu",
+		     gs->count, live);
+	close(gs->fd);
+	gs->fd = fd;
+	gs->count = live;
+	return true;
+
+fail_unlink:
+	saved_errno = errno;
+	close(fd);
+	unlink(GOSSIP_STORE_TEMP_FILENAME);
+	errno = saved_errno;
+fail:
+	/* We can keep appending to the old one. */
+	status_broken("gossip_store: compaction failed: %s", strerror(errno));
+	return false;
+}
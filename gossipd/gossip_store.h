@@ -0,0 +1,38 @@
+#ifndef LIGHTNING_GOSSIPD_GOSSIP_STORE_H
+#define LIGHTNING_GOSSIPD_GOSSIP_STORE_H
+#include "config.h"
+#include <bitcoin/short_channel_id.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
+#include <stdbool.h>
+
+/* An append-only file of the gossip we've accepted, so we can rebuild the
+ * routing_state on restart without rechecking signatures or txouts. */
+#define GOSSIP_STORE_FILENAME "gossip_store"
+
+struct gossip_store;
+struct routing_state;
+
+/* Open (or create) the gossip_store in the current directory. */
+struct gossip_store *gossip_store_new(const tal_t *ctx);
+
+/* Replay everything in the store into rstate. */
+void gossip_store_load(struct gossip_store *gs, struct routing_state *rstate);
+
+/* Append validated gossip. */
+void gossip_store_add_channel_announcement(struct gossip_store *gs,
+					   const u8 *announce,
+					   u64 satoshis);
+void gossip_store_add_channel_update(struct gossip_store *gs,
+				     const u8 *update);
+void gossip_store_add_node_announcement(struct gossip_store *gs,
+					const u8 *announce);
+void gossip_store_add_channel_delete(struct gossip_store *gs,
+				     const struct short_channel_id *scid);
+
+/* If most of the store is superseded, rewrite it from rstate.  Returns
+ * true if it did. */
+bool gossip_store_compact(struct gossip_store *gs,
+			  struct routing_state *rstate);
+
+#endif /* LIGHTNING_GOSSIPD_GOSSIP_STORE_H */
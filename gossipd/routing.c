@@ -4,6 +4,7 @@
 #include <bitcoin/script.h>
 #include <ccan/array_size/array_size.h>
 #include <ccan/endian/endian.h>
+#include <ccan/ilog/ilog.h>
 #include <ccan/structeq/structeq.h>
 #include <ccan/tal/str/str.h>
 #include <common/features.h>
@@ -11,6 +12,7 @@
 #include <common/status.h>
 #include <common/type_to_string.h>
 #include <common/wireaddr.h>
+#include <gossipd/gossip_store.h>
 #include <inttypes.h>
 #include <wire/gen_onion_wire.h>
 #include <wire/gen_peer_wire.h>
@@ -31,9 +33,6 @@
 /* We've unpacked and checked its signatures, now we wait for master to tell
  * us the txout to check */
 struct pending_cannouncement {
-	/* Off routing_state->pending_cannouncement */
-	struct list_node list;
-
 	/* Unpacked fields here */
 	struct short_channel_id short_channel_id;
 	struct pubkey node_id_1;
@@ -56,6 +55,8 @@ struct pending_node_announce {
 	struct pubkey nodeid;
 	u8 *node_announcement;
 	u32 timestamp;
+	/* How many pending_cannouncements are for channels to this node */
+	size_t refcount;
 };
 
 static const secp256k1_pubkey *
@@ -74,6 +75,342 @@ HTABLE_DEFINE_TYPE(struct pending_node_announce, pending_node_announce_keyof,
 		   node_map_hash_key, pending_node_announce_eq,
 		   pending_node_map);
 
+/* Temporary data for routefinding, for one node. */
+struct route_scratch {
+	/* Which query this was last reset for. */
+	u64 generation;
+
+	/* Fewest hops of any label settled by the Dijkstra engine
+	 * (ROUTING_MAX_HOPS+1 if none yet). */
+	u8 min_settled_hops;
+
+	struct {
+		/* Total to get to here from target. */
+		u64 total;
+		/* Total risk premium of this route. */
+		u64 risk;
+		/* Where that came from (route_graph edge). */
+		u32 prev;
+	} bfg[ROUTING_MAX_HOPS+1];
+};
+
+/* Scratch space for find_route, indexed by node->index.  Entries are only
+ * reset when a query first touches them, so a query costs nothing for
+ * nodes it never reaches. */
+struct route_search {
+	/* Bumped for each query. */
+	u64 generation;
+
+	/* tal_arr, at least as long as rstate->node_index. */
+	struct route_scratch *scratch;
+
+	/* If non-NULL, edges and nodes (by graph numbering) to avoid. */
+	const bool *excluded_edges, *excluded_nodes;
+};
+
+static struct route_search *new_route_search(const tal_t *ctx)
+{
+	struct route_search *search = tal(ctx, struct route_search);
+
+	search->generation = 0;
+	search->scratch = tal_arr(search, struct route_scratch, 0);
+	search->excluded_edges = search->excluded_nodes = NULL;
+	return search;
+}
+
+/* Compact, read-only copy of the graph for route finding.  Nodes are
+ * numbered by node->index, and the half_chans leading *into* node i are
+ * edges edge_start[i] to edge_start[i+1]-1 (compressed sparse rows).
+ * Each edge field has its own array, so the search only pulls in what it
+ * reads. */
+struct route_graph {
+	/* Nodes or channels were added or removed: rebuild before use. */
+	bool stale;
+
+	/* Bumped by every rebuild and edge update; built is its value at
+	 * the last rebuild. */
+	u64 generation, built;
+
+	/* tal_count() is number of nodes + 1. */
+	u32 *edge_start;
+
+	/* These are all indexed by edge number. */
+	u32 *src;
+	struct chan **chan;
+	struct short_channel_id *scid;
+	u32 *base_fee;
+	u32 *proportional_fee;
+	u32 *delay;
+	bool *active;
+	/* Not yet used to prune routes. */
+	u32 *htlc_minimum_msat;
+	time_t *unroutable_until;
+	/* generation when this edge was last updated (0 if not since built) */
+	u64 *changed;
+};
+
+static struct route_graph *new_route_graph(const tal_t *ctx)
+{
+	struct route_graph *graph = tal(ctx, struct route_graph);
+
+	graph->stale = true;
+	graph->generation = graph->built = 0;
+	graph->edge_start = tal_arr(graph, u32, 1);
+	graph->edge_start[0] = 0;
+	graph->src = tal_arr(graph, u32, 0);
+	graph->chan = tal_arr(graph, struct chan *, 0);
+	graph->scid = tal_arr(graph, struct short_channel_id, 0);
+	graph->base_fee = tal_arr(graph, u32, 0);
+	graph->proportional_fee = tal_arr(graph, u32, 0);
+	graph->delay = tal_arr(graph, u32, 0);
+	graph->active = tal_arr(graph, bool, 0);
+	graph->htlc_minimum_msat = tal_arr(graph, u32, 0);
+	graph->unroutable_until = tal_arr(graph, time_t, 0);
+	graph->changed = tal_arr(graph, u64, 0);
+	return graph;
+}
+
+static void copy_half_chan(struct route_graph *graph, u32 e,
+			   const struct half_chan *c)
+{
+	graph->base_fee[e] = c->base_fee;
+	graph->proportional_fee[e] = c->proportional_fee;
+	graph->delay[e] = c->delay;
+	graph->active[e] = c->active;
+	graph->htlc_minimum_msat[e] = c->htlc_minimum_msat;
+	graph->unroutable_until[e] = c->unroutable_until;
+}
+
+static void rebuild_route_graph(struct routing_state *rstate)
+{
+	struct route_graph *graph = rstate->graph;
+	size_t i, j, num_nodes = tal_count(rstate->node_index);
+	u32 e = 0;
+
+	tal_resize(&graph->edge_start, num_nodes + 1);
+	for (i = 0; i < num_nodes; i++)
+		e += tal_count(rstate->node_index[i]->chans);
+
+	tal_resize(&graph->src, e);
+	tal_resize(&graph->chan, e);
+	tal_resize(&graph->scid, e);
+	tal_resize(&graph->base_fee, e);
+	tal_resize(&graph->proportional_fee, e);
+	tal_resize(&graph->delay, e);
+	tal_resize(&graph->active, e);
+	tal_resize(&graph->htlc_minimum_msat, e);
+	tal_resize(&graph->unroutable_until, e);
+	tal_resize(&graph->changed, e);
+
+	e = 0;
+	for (i = 0; i < num_nodes; i++) {
+		struct node *n = rstate->node_index[i];
+
+		graph->edge_start[i] = e;
+		for (j = 0; j < tal_count(n->chans); j++) {
+			struct chan *chan = n->chans[j];
+			int idx = half_chan_to(n, chan);
+
+			chan->half[idx].graph_edge = e;
+			graph->src[e] = chan->nodes[idx]->index;
+			graph->chan[e] = chan;
+			graph->scid[e] = chan->scid;
+			copy_half_chan(graph, e, &chan->half[idx]);
+			graph->changed[e] = 0;
+			e++;
+		}
+	}
+	graph->edge_start[num_nodes] = e;
+	graph->stale = false;
+	graph->built = ++graph->generation;
+}
+
+void update_route_graph(struct routing_state *rstate,
+			const struct chan *chan, int idx)
+{
+	struct route_graph *graph = rstate->graph;
+	u32 e = chan->half[idx].graph_edge;
+
+	/* Next rebuild will pick it up. */
+	if (graph->stale)
+		return;
+
+	copy_half_chan(graph, e, &chan->half[idx]);
+	graph->changed[e] = ++graph->generation;
+}
+
+/* What get_route() results are cached by.  Zeroed before filling in, so
+ * padding doesn't upset the hash.
+ *
+ * We don't include the fuzz seed.  So for ROUTE_CACHE_TTL, everyone
+ * asking with the same key gets the same fuzzed route, rather than one
+ * randomized per payment: repeat payments to a destination take the same
+ * path, which an observer on that path can link.  That's the trade for
+ * hitting the cache at all, since pay uses a fresh seed every time. */
+struct route_cache_key {
+	struct pubkey source, destination;
+	/* Fees scale with the amount: bucket by its highest bit. */
+	u8 amount_bucket;
+	double riskfactor, fuzz;
+};
+
+struct route_cache_entry {
+	struct route_cache_key key;
+	/* graph->generation when we found it. */
+	u64 stamp;
+	/* Catches unroutable channels coming back, and cheaper routes
+	 * appearing elsewhere. */
+	time_t expires;
+	/* route_graph edges, payer first. */
+	u32 *edges;
+};
+
+static const struct route_cache_key *
+route_cache_keyof(const struct route_cache_entry *entry)
+{
+	return &entry->key;
+}
+
+static size_t route_cache_hash(const struct route_cache_key *key)
+{
+	return siphash24(siphash_seed(), key, sizeof(*key));
+}
+
+static bool route_cache_eq(const struct route_cache_entry *entry,
+			   const struct route_cache_key *key)
+{
+	return memcmp(&entry->key, key, sizeof(*key)) == 0;
+}
+
+HTABLE_DEFINE_TYPE(struct route_cache_entry, route_cache_keyof,
+		   route_cache_hash, route_cache_eq, route_cache_map);
+
+/* How long a cached route is good for, at most. */
+#define ROUTE_CACHE_TTL 60
+/* We flush the cache if it gets this big. */
+#define ROUTE_CACHE_MAX 1024
+
+struct route_cache {
+	struct route_cache_map map;
+	/* Parent of every entry, so we can flush them at once. */
+	tal_t *entries;
+	struct route_cache_stats stats;
+};
+
+static void destroy_route_cache(struct route_cache *cache)
+{
+	route_cache_map_clear(&cache->map);
+}
+
+static struct route_cache *new_route_cache(const tal_t *ctx)
+{
+	struct route_cache *cache = tal(ctx, struct route_cache);
+
+	route_cache_map_init(&cache->map);
+	cache->entries = tal(cache, char);
+	memset(&cache->stats, 0, sizeof(cache->stats));
+	tal_add_destructor(cache, destroy_route_cache);
+	return cache;
+}
+
+static void route_cache_key_init(struct route_cache_key *key,
+				 const struct pubkey *source,
+				 const struct pubkey *destination,
+				 u32 msatoshi, double riskfactor, double fuzz)
+{
+	memset(key, 0, sizeof(*key));
+	key->source = *source;
+	key->destination = *destination;
+	key->amount_bucket = ilog32(msatoshi);
+	key->riskfactor = riskfactor;
+	key->fuzz = fuzz;
+}
+
+static bool route_cache_entry_valid(const struct route_graph *graph,
+				    const struct route_cache_entry *entry,
+				    time_t now)
+{
+	size_t i;
+
+	if (graph->stale || entry->stamp < graph->built || entry->expires <= now)
+		return false;
+
+	for (i = 0; i < tal_count(entry->edges); i++)
+		if (graph->changed[entry->edges[i]] > entry->stamp)
+			return false;
+	return true;
+}
+
+/* Returns route if we have a valid one cached. */
+static struct chan **route_cache_get(const tal_t *ctx,
+				     struct routing_state *rstate,
+				     const struct route_cache_key *key,
+				     time_t now)
+{
+	struct route_cache *cache = rstate->route_cache;
+	const struct route_graph *graph = rstate->graph;
+	struct route_cache_entry *entry;
+	struct chan **route;
+	size_t i;
+
+	entry = route_cache_map_get(&cache->map, key);
+	if (!entry) {
+		cache->stats.misses++;
+		return NULL;
+	}
+
+	if (!route_cache_entry_valid(graph, entry, now)) {
+		cache->stats.misses++;
+		cache->stats.invalidated++;
+		route_cache_map_del(&cache->map, entry);
+		tal_free(entry);
+		return NULL;
+	}
+
+	cache->stats.hits++;
+	route = tal_arr(ctx, struct chan *, tal_count(entry->edges));
+	for (i = 0; i < tal_count(entry->edges); i++)
+		route[i] = graph->chan[entry->edges[i]];
+	return route;
+}
+
+/* Remember route, just returned by find_route(). */
+static void route_cache_add(struct routing_state *rstate,
+			    const struct route_cache_key *key,
+			    struct chan **route, time_t now)
+{
+	struct route_cache *cache = rstate->route_cache;
+	struct route_cache_entry *entry;
+	struct node *n;
+	size_t i;
+
+	if (cache->map.raw.elems >= ROUTE_CACHE_MAX) {
+		route_cache_map_clear(&cache->map);
+		route_cache_map_init(&cache->map);
+		tal_free(cache->entries);
+		cache->entries = tal(cache, char);
+	}
+
+	entry = tal(cache->entries, struct route_cache_entry);
+	entry->key = *key;
+	entry->stamp = rstate->graph->generation;
+	entry->expires = now + ROUTE_CACHE_TTL;
+	entry->edges = tal_arr(entry, u32, tal_count(route));
+	n = get_node(rstate, &key->source);
+	for (i = 0; i < tal_count(route); i++) {
+		entry->edges[i] = half_chan_from(n, route[i])->graph_edge;
+		n = other_node(n, route[i]);
+	}
+	route_cache_map_add(&cache->map, entry);
+}
+
+void route_cache_stats(const struct routing_state *rstate,
+		       struct route_cache_stats *stats)
+{
+	*stats = rstate->route_cache->stats;
+	stats->entries = rstate->route_cache->map.raw.elems;
+}
+
 static struct node_map *empty_node_map(const tal_t *ctx)
 {
 	struct node_map *map = tal(ctx, struct node_map);
@@ -89,12 +426,21 @@ struct routing_state *new_routing_state(const tal_t *ctx,
 {
 	struct routing_state *rstate = tal(ctx, struct routing_state);
 	rstate->nodes = empty_node_map(rstate);
+	rstate->node_index = tal_arr(rstate, struct node *, 0);
+	rstate->search = new_route_search(rstate);
+	rstate->graph = new_route_graph(rstate);
+	rstate->route_cache = new_route_cache(rstate);
+	rstate->preverified = NULL;
+	rstate->num_preverified = 0;
 	rstate->broadcasts = new_broadcast_state(rstate);
+	rstate->store = NULL;
 	rstate->chain_hash = *chain_hash;
 	rstate->local_id = *local_id;
 	rstate->prune_timeout = prune_timeout;
-	list_head_init(&rstate->pending_cannouncement);
+	uintmap_init(&rstate->pending_cannouncements);
+	rstate->num_pending_cannouncements = 0;
 	uintmap_init(&rstate->chanmap);
+	rstate->route_engine = ROUTE_ENGINE_DIJKSTRA;
 
 	rstate->pending_node_map = tal(ctx, struct pending_node_map);
 	pending_node_map_init(rstate->pending_node_map);
@@ -120,7 +466,17 @@ bool node_map_node_eq(const struct node *n, const secp256k1_pubkey *key)
 
 static void destroy_node(struct node *node, struct routing_state *rstate)
 {
+	size_t n = tal_count(rstate->node_index) - 1;
+
 	node_map_del(rstate->nodes, node);
+	broadcast_del(rstate->broadcasts, node->announcement_idx,
+		      node->node_announcement);
+
+	/* Keep indices dense: move last node into our slot. */
+	rstate->node_index[node->index] = rstate->node_index[n];
+	rstate->node_index[node->index]->index = node->index;
+	tal_resize(&rstate->node_index, n);
+	rstate->graph->stale = true;
 
 	/* These remove themselves from the array. */
 	while (tal_count(node->chans))
@@ -147,6 +503,10 @@ static struct node *new_node(struct routing_state *rstate,
 	n->announcement_idx = 0;
 	n->last_timestamp = -1;
 	n->addresses = tal_arr(n, struct wireaddr, 0);
+	n->index = tal_count(rstate->node_index);
+	tal_resize(&rstate->node_index, n->index + 1);
+	rstate->node_index[n->index] = n;
+	rstate->graph->stale = true;
 	node_map_add(rstate->nodes, n);
 	tal_add_destructor2(n, destroy_node, rstate);
 
@@ -177,6 +537,15 @@ static void destroy_chan(struct chan *chan, struct routing_state *rstate)
 		abort();
 
 	uintmap_del(&rstate->chanmap, chan->scid.u64);
+	rstate->graph->stale = true;
+
+	/* The broadcast queue only borrowed these. */
+	broadcast_del(rstate->broadcasts, chan->channel_announce_msgidx,
+		      chan->channel_announcement);
+	broadcast_del(rstate->broadcasts, chan->half[0].channel_update_msgidx,
+		      chan->half[0].channel_update);
+	broadcast_del(rstate->broadcasts, chan->half[1].channel_update_msgidx,
+		      chan->half[1].channel_update);
 
 	if (tal_count(chan->nodes[0]->chans) == 0)
 		tal_free(chan->nodes[0]);
@@ -239,6 +608,7 @@ struct chan *new_chan(struct routing_state *rstate,
 	init_half_chan(rstate, chan, !n1idx);
 
 	uintmap_add(&rstate->chanmap, scid->u64, chan);
+	rstate->graph->stale = true;
 
 	tal_add_destructor2(chan, destroy_chan, rstate);
 	return chan;
@@ -247,30 +617,43 @@ struct chan *new_chan(struct routing_state *rstate,
 /* Too big to reach, but don't overflow if added. */
 #define INFINITE 0x3FFFFFFFFFFFFFFFULL
 
-static void clear_bfg(struct node_map *nodes)
+/* Start a new query: every node's scratch is now stale. */
+static void start_route_search(struct route_search *search,
+			       size_t num_nodes)
 {
-	struct node *n;
-	struct node_map_iter it;
+	/* New entries have generation 0, which is always stale. */
+	if (tal_count(search->scratch) < num_nodes)
+		tal_resizez(&search->scratch, num_nodes);
+	search->generation++;
+}
 
-	for (n = node_map_first(nodes, &it); n; n = node_map_next(nodes, &it)) {
+/* Get scratch for this node, resetting it if this query hasn't yet. */
+static struct route_scratch *scratch_of(struct route_search *search, u32 n)
+{
+	struct route_scratch *s = &search->scratch[n];
+
+	if (s->generation != search->generation) {
 		size_t i;
-		for (i = 0; i < ARRAY_SIZE(n->bfg); i++) {
-			n->bfg[i].total = INFINITE;
-			n->bfg[i].risk = 0;
+		for (i = 0; i < ARRAY_SIZE(s->bfg); i++) {
+			s->bfg[i].total = INFINITE;
+			s->bfg[i].risk = 0;
 		}
+		s->min_settled_hops = ROUTING_MAX_HOPS + 1;
+		s->generation = search->generation;
 	}
+	return s;
 }
 
-static u64 connection_fee(const struct half_chan *c, u64 msatoshi)
+static u64 connection_fee(u32 base_fee, u32 proportional_fee, u64 msatoshi)
 {
 	u64 fee;
 
 	assert(msatoshi < MAX_MSATOSHI);
-	assert(c->proportional_fee < MAX_PROPORTIONAL_FEE);
+	assert(proportional_fee < MAX_PROPORTIONAL_FEE);
 
-	fee = (c->proportional_fee * msatoshi) / 1000000;
-	/* This can't overflow: c->base_fee is a u32 */
-	return c->base_fee + fee;
+	fee = (proportional_fee * msatoshi) / 1000000;
+	/* This can't overflow: base_fee is a u32 */
+	return base_fee + fee;
 }
 
 /* Risk of passing through this channel.  We insert a tiny constant here
@@ -280,68 +663,274 @@ static u64 risk_fee(u64 amount, u32 delay, double riskfactor)
 	return 1 + amount * delay * riskfactor;
 }
 
+/* How much to scale this channel's fees by, to fuzz the route. */
+static double fuzz_fee_scale(const struct short_channel_id *scid,
+			     double fuzz, const struct siphash_seed *base_seed)
+{
+	u64 h;
+
+	if (fuzz == 0.0)
+		return 1.0;
+
+	h = siphash24(base_seed, scid, sizeof(*scid));
+
+	/* Scale fees for this channel */
+	/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
+	 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
+	 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
+	 */
+	return 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
+}
+
+/* Extend node's hoplen h path back along edge e to its source.  Returns
+ * true if that now has a better hoplen h+1 path. */
+static bool relax_edge(struct route_search *search,
+		       const struct route_graph *graph,
+		       u32 node, size_t h, u32 e,
+		       double riskfactor, double fee_scale)
+{
+	struct route_scratch *ns = scratch_of(search, node), *ss;
+	/* FIXME: Bias against smaller channels. */
+	u64 fee;
+	u64 risk, cost, old_cost;
+
+	if (ns->bfg[h].total == INFINITE)
+		return false;
+
+	fee = connection_fee(graph->base_fee[e], graph->proportional_fee[e],
+			     ns->bfg[h].total) * fee_scale;
+	risk = ns->bfg[h].risk + risk_fee(ns->bfg[h].total + fee,
+					  graph->delay[e], riskfactor);
+
+	if (ns->bfg[h].total + fee + risk >= MAX_MSATOSHI) {
+		SUPERVERBOSE("...extreme %"PRIu64
+			     " + fee %"PRIu64
+			     " + risk %"PRIu64" ignored",
+			     ns->bfg[h].total, fee, risk);
+		return false;
+	}
+
+	ss = scratch_of(search, graph->src[e]);
+	cost = ns->bfg[h].total + fee + risk;
+	old_cost = ss->bfg[h+1].total + ss->bfg[h+1].risk;
+	/* On a tie, the lower edge wins, so both engines pick the same
+	 * route whatever order they relax edges in. */
+	if (cost > old_cost || (cost == old_cost && e >= ss->bfg[h+1].prev))
+		return false;
+
+	SUPERVERBOSE("...node %u can reach here in hoplen %zu total %"PRIu64,
+		     graph->src[e], h, ns->bfg[h].total + fee);
+	ss->bfg[h+1].total = ns->bfg[h].total + fee;
+	ss->bfg[h+1].risk = risk;
+	ss->bfg[h+1].prev = e;
+	return true;
+}
+
 /* We track totals, rather than costs.  That's because the fee depends
  * on the current amount passing through. */
-static void bfg_one_edge(struct node *node,
-			 struct chan *chan, int idx,
+static void bfg_one_edge(struct route_search *search,
+			 const struct route_graph *graph,
+			 u32 node, u32 e,
 			 double riskfactor,
 			 double fuzz, const struct siphash_seed *base_seed)
 {
 	size_t h;
-	double fee_scale = 1.0;
-	const struct half_chan *c = &chan->half[idx];
+	double fee_scale = fuzz_fee_scale(&graph->scid[e], fuzz, base_seed);
 
-	if (fuzz != 0.0) {
-		u64 h =	siphash24(base_seed, &chan->scid, sizeof(chan->scid));
+	for (h = 0; h < ROUTING_MAX_HOPS; h++)
+		relax_edge(search, graph, node, h, e, riskfactor, fee_scale);
+}
 
-		/* Scale fees for this channel */
-		/* rand = (h / UINT64_MAX)  random number between 0.0 -> 1.0
-		 * 2*fuzz*rand              random number between 0.0 -> 2*fuzz
-		 * 2*fuzz*rand - fuzz       random number between -fuzz -> +fuzz
-		 */
-		fee_scale = 1.0 + (2.0 * fuzz * h / UINT64_MAX) - fuzz;
+/* Determine if the given edge is routable */
+static bool edge_is_routable(const struct route_search *search,
+			     const struct route_graph *graph, u32 e,
+			     time_t now)
+{
+	if (search->excluded_edges && search->excluded_edges[e])
+		return false;
+	if (search->excluded_nodes && search->excluded_nodes[graph->src[e]])
+		return false;
+	return graph->active[e] && graph->unroutable_until[e] < now;
+}
+
+/* Bellman-Ford-Gibson: like Bellman-Ford, but keep values for
+ * every path length.  Returns best hoplen to reach dst, or 0. */
+static size_t bfg_search(struct route_search *search,
+			 const struct route_graph *graph,
+			 u32 src, u32 dst,
+			 double riskfactor,
+			 double fuzz, const struct siphash_seed *base_seed,
+			 time_t now)
+{
+	struct route_scratch *ds = scratch_of(search, dst);
+	size_t num_nodes = tal_count(graph->edge_start) - 1;
+	int runs;
+	size_t best, i;
+	u32 n, e;
+
+	for (runs = 0; runs < ROUTING_MAX_HOPS; runs++) {
+		SUPERVERBOSE("Run %i", runs);
+		/* Run through every edge. */
+		for (n = 0; n < num_nodes; n++) {
+			for (e = graph->edge_start[n];
+			     e < graph->edge_start[n+1];
+			     e++) {
+				SUPERVERBOSE("Node %u edge %u", n, e);
+
+				if (!edge_is_routable(search, graph, e, now)) {
+					SUPERVERBOSE("...unroutable");
+					continue;
+				}
+				bfg_one_edge(search, graph, n, e,
+					     riskfactor, fuzz, base_seed);
+				SUPERVERBOSE("...done");
+			}
+		}
 	}
 
-	for (h = 0; h < ROUTING_MAX_HOPS; h++) {
-		struct node *src;
-		/* FIXME: Bias against smaller channels. */
-		u64 fee;
-		u64 risk;
+	/* Rank by total + risk, as dijkstra_search() settles dst. */
+	best = 0;
+	for (i = 1; i <= ROUTING_MAX_HOPS; i++) {
+		if (ds->bfg[i].total + ds->bfg[i].risk
+		    < ds->bfg[best].total + ds->bfg[best].risk)
+			best = i;
+	}
 
-		if (node->bfg[h].total == INFINITE)
-			continue;
+	if (ds->bfg[best].total >= INFINITE)
+		return 0;
+	return best;
+}
+
+/* A tentative (node, hoplen) entry in the Dijkstra frontier. */
+struct route_label {
+	/* total + risk of node's bfg[hops] when this was pushed. */
+	u64 cost;
+	u32 node;
+	u32 hops;
+};
 
-		fee = connection_fee(c, node->bfg[h].total) * fee_scale;
-		risk = node->bfg[h].risk + risk_fee(node->bfg[h].total + fee,
-						    c->delay, riskfactor);
+/* Binary min-heap of labels; the tal_arr only ever grows. */
+struct label_heap {
+	struct route_label *labels;
+	size_t num;
+};
+
+/* Cheapest first; on a tie, fewer hops, as bfg_search() picks. */
+static bool label_before(const struct route_label *a,
+			 const struct route_label *b)
+{
+	if (a->cost != b->cost)
+		return a->cost < b->cost;
+	return a->hops < b->hops;
+}
+
+static void label_heap_push(struct label_heap *heap,
+			    const struct route_scratch *s,
+			    u32 node, u32 hops)
+{
+	size_t i = heap->num++;
+	struct route_label l;
+
+	l.cost = s->bfg[hops].total + s->bfg[hops].risk;
+	l.node = node;
+	l.hops = hops;
+
+	if (heap->num > tal_count(heap->labels))
+		tal_resize(&heap->labels, heap->num * 2);
+
+	/* Sift up. */
+	while (i > 0 && label_before(&l, &heap->labels[(i - 1) / 2])) {
+		heap->labels[i] = heap->labels[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap->labels[i] = l;
+}
+
+static struct route_label label_heap_pop(struct label_heap *heap)
+{
+	struct route_label top = heap->labels[0], last;
+	size_t i = 0, n = --heap->num;
+
+	last = heap->labels[n];
+	/* Sift down. */
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n
+		    && label_before(&heap->labels[child + 1],
+				    &heap->labels[child]))
+			child++;
+		if (!label_before(&heap->labels[child], &last))
+			break;
+		heap->labels[i] = heap->labels[child];
+		i = child;
+	}
+	if (n)
+		heap->labels[i] = last;
+	return top;
+}
 
-		if (node->bfg[h].total + fee + risk >= MAX_MSATOSHI) {
-			SUPERVERBOSE("...extreme %"PRIu64
-				     " + fee %"PRIu64
-				     " + risk %"PRIu64" ignored",
-				     node->bfg[h].total, fee, risk);
+/* Dijkstra with hop-count labels: uses the same edge costs as BFG, but
+ * only expands the cheapest frontier entry, and stops as soon as dst is
+ * settled.  A label is dominated (and skipped) if its node was already
+ * settled using no more hops, since it's no cheaper either.  Returns
+ * hoplen of cheapest route to dst (the shortest, on a tie), or 0. */
+static size_t dijkstra_search(struct route_search *search,
+			      const struct route_graph *graph,
+			      u32 src, u32 dst,
+			      double riskfactor,
+			      double fuzz, const struct siphash_seed *base_seed,
+			      time_t now)
+{
+	struct label_heap heap;
+	size_t best = 0;
+
+	heap.labels = tal_arr(NULL, struct route_label, 64);
+	heap.num = 0;
+	label_heap_push(&heap, scratch_of(search, src), src, 0);
+	while (heap.num) {
+		struct route_label l = label_heap_pop(&heap);
+		struct route_scratch *s = scratch_of(search, l.node);
+		u32 e;
+
+		/* Stale: a cheaper path of this hoplen was pushed since. */
+		if (l.cost != s->bfg[l.hops].total + s->bfg[l.hops].risk)
+			continue;
+		if (l.hops >= s->min_settled_hops)
 			continue;
+		s->min_settled_hops = l.hops;
+
+		if (l.node == dst) {
+			best = l.hops;
+			break;
 		}
 
-		/* nodes[0] is src for connections[0] */
-		src = chan->nodes[idx];
-		if (node->bfg[h].total + fee + risk
-		    < src->bfg[h+1].total + src->bfg[h+1].risk) {
-			SUPERVERBOSE("...%s can reach here in hoplen %zu total %"PRIu64,
-				     type_to_string(trc, struct pubkey,
-						    &src->id),
-				     h, node->bfg[h].total + fee);
-			src->bfg[h+1].total = node->bfg[h].total + fee;
-			src->bfg[h+1].risk = risk;
-			src->bfg[h+1].prev = chan;
+		if (l.hops == ROUTING_MAX_HOPS)
+			continue;
+
+		for (e = graph->edge_start[l.node];
+		     e < graph->edge_start[l.node+1];
+		     e++) {
+			struct route_scratch *nexts;
+
+			if (!edge_is_routable(search, graph, e, now))
+				continue;
+
+			if (!relax_edge(search, graph, l.node, l.hops, e,
+					riskfactor,
+					fuzz_fee_scale(&graph->scid[e],
+						       fuzz, base_seed)))
+				continue;
+			nexts = scratch_of(search, graph->src[e]);
+			if (l.hops + 1 < nexts->min_settled_hops)
+				label_heap_push(&heap, nexts, graph->src[e],
+						l.hops + 1);
 		}
 	}
-}
 
-/* Determine if the given half_chan is routable */
-static bool hc_is_routable(const struct half_chan *hc, time_t now)
-{
-	return hc->active && hc->unroutable_until < now;
+	tal_free(heap.labels);
+	return best;
 }
 
 /* riskfactor is already scaled to per-block amount */
@@ -353,9 +942,11 @@ find_route(const tal_t *ctx, struct routing_state *rstate,
 	   u64 *fee)
 {
 	struct chan **route;
-	struct node *n, *src, *dst;
-	struct node_map_iter it;
-	int runs, i, best;
+	struct node *src, *dst;
+	struct route_scratch *ss;
+	const struct route_graph *graph;
+	size_t i, best;
+	u32 n, e;
 	/* Call time_now() once at the start, so that our tight loop
 	 * does not keep calling into operating system for the
 	 * current time */
@@ -386,84 +977,91 @@ find_route(const tal_t *ctx, struct routing_state *rstate,
 		return NULL;
 	}
 
-	/* Reset all the information. */
-	clear_bfg(rstate->nodes);
+	if (rstate->graph->stale)
+		rebuild_route_graph(rstate);
+	graph = rstate->graph;
 
-	/* Bellman-Ford-Gibson: like Bellman-Ford, but keep values for
-	 * every path length. */
-	src->bfg[0].total = msatoshi;
-	src->bfg[0].risk = 0;
+	/* Invalidate all the information. */
+	start_route_search(rstate->search, tal_count(rstate->node_index));
 
-	for (runs = 0; runs < ROUTING_MAX_HOPS; runs++) {
-		SUPERVERBOSE("Run %i", runs);
-		/* Run through every edge. */
-		for (n = node_map_first(rstate->nodes, &it);
-		     n;
-		     n = node_map_next(rstate->nodes, &it)) {
-			size_t num_edges = tal_count(n->chans);
-			for (i = 0; i < num_edges; i++) {
-				struct chan *chan = n->chans[i];
-				int idx = half_chan_to(n, chan);
-
-				SUPERVERBOSE("Node %s edge %i/%zu",
-					     type_to_string(trc, struct pubkey,
-							    &n->id),
-					     i, num_edges);
-
-				if (!hc_is_routable(&chan->half[idx], now)) {
-					SUPERVERBOSE("...unroutable");
-					continue;
-				}
-				bfg_one_edge(n, chan, idx,
-					     riskfactor, fuzz, base_seed);
-				SUPERVERBOSE("...done");
-			}
-		}
-	}
+	ss = scratch_of(rstate->search, src->index);
+	ss->bfg[0].total = msatoshi;
+	ss->bfg[0].risk = 0;
 
-	best = 0;
-	for (i = 1; i <= ROUTING_MAX_HOPS; i++) {
-		if (dst->bfg[i].total < dst->bfg[best].total)
-			best = i;
-	}
+	if (rstate->route_engine == ROUTE_ENGINE_BFG)
+		best = bfg_search(rstate->search, graph,
+				  src->index, dst->index,
+				  riskfactor, fuzz, base_seed, now);
+	else
+		best = dijkstra_search(rstate->search, graph,
+				       src->index, dst->index,
+				       riskfactor, fuzz, base_seed, now);
 
 	/* No route? */
-	if (dst->bfg[best].total >= INFINITE) {
+	if (!best) {
 		status_trace("find_route: No route to %s",
 			     type_to_string(trc, struct pubkey, to));
 		return NULL;
 	}
 
-	/* We (dst) don't charge ourselves fees, so skip first hop */
-	n = other_node(dst, dst->bfg[best].prev);
-	*fee = n->bfg[best-1].total - msatoshi;
-
-	/* Lay out route */
+	/* Lay out route: each edge leads back towards src. */
 	route = tal_arr(ctx, struct chan *, best);
-	for (i = 0, n = dst;
-	     i < best;
-	     n = other_node(n, n->bfg[best-i].prev), i++) {
-		route[i] = n->bfg[best-i].prev;
+	for (i = 0, n = dst->index; i < best; i++) {
+		e = scratch_of(rstate->search, n)->bfg[best-i].prev;
+		route[i] = graph->chan[e];
+		n = other_node(rstate->node_index[n], route[i])->index;
+
+		/* We (dst) don't charge ourselves fees, so skip first hop */
+		if (i == 0)
+			*fee = scratch_of(rstate->search, n)->bfg[best-1].total
+				- msatoshi;
 	}
-	assert(n == src);
+	assert(n == src->index);
 
 	return route;
 }
 
+/* Check a signature, unless sigcheck_batch() already did. */
+static bool check_sig(const struct routing_state *rstate,
+		      const struct sha256_double *hash,
+		      const secp256k1_ecdsa_signature *sig,
+		      const struct pubkey *key)
+{
+	size_t i;
+
+	for (i = 0; i < rstate->num_preverified; i++) {
+		const struct sigcheck *c = &rstate->preverified[i];
+		if (c->valid
+		    && structeq(&c->hash, hash)
+		    && structeq(&c->sig, sig)
+		    && pubkey_eq(&c->key, key))
+			return true;
+	}
+	return check_signed_hash(hash, sig, key);
+}
+
+/* 2 byte msg type + 64 byte signatures */
+#define CHANNEL_UPDATE_SIGNED_OFFSET 66
+/* 2 byte msg type + 256 byte signatures */
+#define CHANNEL_ANNOUNCEMENT_SIGNED_OFFSET 258
+/* 2 byte msg type + 64 byte signature */
+#define NODE_ANNOUNCEMENT_SIGNED_OFFSET 66
+
 /* Verify the signature of a channel_update message */
-static bool check_channel_update(const struct pubkey *node_key,
+static bool check_channel_update(const struct routing_state *rstate,
+				 const struct pubkey *node_key,
 				 const secp256k1_ecdsa_signature *node_sig,
 				 const u8 *update)
 {
-	/* 2 byte msg type + 64 byte signatures */
-	int offset = 66;
+	int offset = CHANNEL_UPDATE_SIGNED_OFFSET;
 	struct sha256_double hash;
 	sha256_double(&hash, update + offset, tal_len(update) - offset);
 
-	return check_signed_hash(&hash, node_sig, node_key);
+	return check_sig(rstate, &hash, node_sig, node_key);
 }
 
 static bool check_channel_announcement(
+    const struct routing_state *rstate,
     const struct pubkey *node1_key, const struct pubkey *node2_key,
     const struct pubkey *bitcoin1_key, const struct pubkey *bitcoin2_key,
     const secp256k1_ecdsa_signature *node1_sig,
@@ -471,27 +1069,62 @@ static bool check_channel_announcement(
     const secp256k1_ecdsa_signature *bitcoin1_sig,
     const secp256k1_ecdsa_signature *bitcoin2_sig, const u8 *announcement)
 {
-	/* 2 byte msg type + 256 byte signatures */
-	int offset = 258;
+	int offset = CHANNEL_ANNOUNCEMENT_SIGNED_OFFSET;
 	struct sha256_double hash;
 	sha256_double(&hash, announcement + offset,
 		      tal_len(announcement) - offset);
 
-	return check_signed_hash(&hash, node1_sig, node1_key) &&
-	       check_signed_hash(&hash, node2_sig, node2_key) &&
-	       check_signed_hash(&hash, bitcoin1_sig, bitcoin1_key) &&
-	       check_signed_hash(&hash, bitcoin2_sig, bitcoin2_key);
+	return check_sig(rstate, &hash, node1_sig, node1_key) &&
+	       check_sig(rstate, &hash, node2_sig, node2_key) &&
+	       check_sig(rstate, &hash, bitcoin1_sig, bitcoin1_key) &&
+	       check_sig(rstate, &hash, bitcoin2_sig, bitcoin2_key);
+}
+
+static void add_sigcheck(struct sigcheck **checks,
+			 const struct sha256_double *hash,
+			 const secp256k1_ecdsa_signature *sig,
+			 const struct pubkey *key)
+{
+	size_t n = tal_count(*checks);
+
+	tal_resize(checks, n + 1);
+	(*checks)[n].hash = *hash;
+	(*checks)[n].sig = *sig;
+	(*checks)[n].key = *key;
+	(*checks)[n].valid = false;
 }
 
 static void add_pending_node_announcement(struct routing_state *rstate, struct pubkey *nodeid)
 {
-	struct pending_node_announce *pna = tal(rstate, struct pending_node_announce);
+	struct pending_node_announce *pna;
+
+	/* Several channels to this node can be pending at once. */
+	pna = pending_node_map_get(rstate->pending_node_map, &nodeid->pubkey);
+	if (pna) {
+		pna->refcount++;
+		return;
+	}
+
+	pna = tal(rstate, struct pending_node_announce);
 	pna->nodeid = *nodeid;
 	pna->node_announcement = NULL;
 	pna->timestamp = 0;
+	pna->refcount = 1;
 	pending_node_map_add(rstate->pending_node_map, pna);
 }
 
+static void del_pending_node_announcement(struct routing_state *rstate,
+					  const struct pubkey *nodeid)
+{
+	struct pending_node_announce *pna = pending_node_map_get(rstate->pending_node_map, &nodeid->pubkey);
+
+	assert(pna && pna->refcount);
+	if (--pna->refcount == 0) {
+		pending_node_map_del(rstate->pending_node_map, pna);
+		tal_free(pna);
+	}
+}
+
 static void process_pending_node_announcement(struct routing_state *rstate,
 					      struct pubkey *nodeid)
 {
@@ -503,29 +1136,101 @@ static void process_pending_node_announcement(struct routing_state *rstate,
 		SUPERVERBOSE(
 		    "Processing deferred node_announcement for node %s",
 		    type_to_string(pna, struct pubkey, nodeid));
+		/* Node exists now, so this won't be deferred again. */
 		handle_node_announcement(rstate, pna->node_announcement);
+		pna->node_announcement = tal_free(pna->node_announcement);
 	}
-	pending_node_map_del(rstate->pending_node_map, pna);
-	tal_free(pna);
 }
 
 static struct pending_cannouncement *
 find_pending_cannouncement(struct routing_state *rstate,
 			   const struct short_channel_id *scid)
 {
-	struct pending_cannouncement *i;
-
-	list_for_each(&rstate->pending_cannouncement, i, list) {
-		if (structeq(scid, &i->short_channel_id))
-			return i;
-	}
-	return NULL;
+	return uintmap_get(&rstate->pending_cannouncements, scid->u64);
 }
 
 static void destroy_pending_cannouncement(struct pending_cannouncement *pending,
 					  struct routing_state *rstate)
 {
-	list_del_from(&rstate->pending_cannouncement, &pending->list);
+	uintmap_del(&rstate->pending_cannouncements,
+		    pending->short_channel_id.u64);
+	rstate->num_pending_cannouncements--;
+}
+
+/* Not in the destructor, since on shutdown the pending_node_announce may
+ * be freed first. */
+static void free_pending_cannouncement(struct routing_state *rstate,
+				       struct pending_cannouncement *pending)
+{
+	del_pending_node_announcement(rstate, &pending->node_id_1);
+	del_pending_node_announcement(rstate, &pending->node_id_2);
+	tal_free(pending);
+}
+
+bool routing_add_channel_announcement(struct routing_state *rstate,
+				      const u8 *announce TAKES,
+				      u64 satoshis)
+{
+	const tal_t *tmpctx = tal_tmpctx(rstate);
+	secp256k1_ecdsa_signature node_signature_1, node_signature_2;
+	secp256k1_ecdsa_signature bitcoin_signature_1, bitcoin_signature_2;
+	u8 *features, *tag;
+	struct bitcoin_blkid chain_hash;
+	struct short_channel_id scid;
+	struct pubkey node_id_1, node_id_2, bitcoin_key_1, bitcoin_key_2;
+	struct chan *chan;
+	const u8 *old;
+
+	if (taken(announce))
+		tal_steal(tmpctx, announce);
+
+	/* Cheap, and catches a gossip_store from another chain. */
+	if (!fromwire_channel_announcement(tmpctx, announce,
+					   &node_signature_1,
+					   &node_signature_2,
+					   &bitcoin_signature_1,
+					   &bitcoin_signature_2,
+					   &features,
+					   &chain_hash,
+					   &scid,
+					   &node_id_1,
+					   &node_id_2,
+					   &bitcoin_key_1,
+					   &bitcoin_key_2)
+	    || !structeq(&chain_hash, &rstate->chain_hash)) {
+		tal_free(tmpctx);
+		return false;
+	}
+
+	/* The channel may already exist if it was non-public from
+	 * local_add_channel(); normally we don't accept new
+	 * channel_announcements.  See handle_channel_announcement. */
+	chan = get_channel(rstate, &scid);
+	if (!chan)
+		chan = new_chan(rstate, &scid, &node_id_1, &node_id_2);
+
+	/* Channel is now public. */
+	chan->public = true;
+	chan->satoshis = satoshis;
+
+	/* Save channel_announcement: the broadcast queue shares it. */
+	old = chan->channel_announcement;
+	chan->channel_announcement = tal_dup_arr(chan, u8, announce,
+						 tal_len(announce), 0);
+
+	tag = tal_arr(tmpctx, u8, 0);
+	towire_short_channel_id(&tag, &scid);
+	if (replace_broadcast(rstate->broadcasts,
+			      &chan->channel_announce_msgidx,
+			      WIRE_CHANNEL_ANNOUNCEMENT,
+			      tag, chan->channel_announcement))
+		status_failed(STATUS_FAIL_INTERNAL_ERROR,
+			      "Announcement %s was replaced?",
+			      tal_hex(trc, chan->channel_announcement));
+
+	tal_free(old);
+	tal_free(tmpctx);
+	return true;
 }
 
 const struct short_channel_id *handle_channel_announcement(
@@ -585,6 +1290,17 @@ const struct short_channel_id *handle_channel_announcement(
 
 	/* FIXME: Handle duplicates as per BOLT #7 */
 
+	/* Each of these waits on master, and holds up to two updates and
+	 * two node_announcements: don't let a peer grow it forever. */
+	if (rstate->num_pending_cannouncements >= ROUTING_MAX_PENDING) {
+		status_trace("Ignoring channel_announcement for %s:"
+			     " %zu already pending",
+			     type_to_string(pending, struct short_channel_id,
+					    &pending->short_channel_id),
+			     rstate->num_pending_cannouncements);
+		return tal_free(pending);
+	}
+
 	/* BOLT #7:
 	 *
 	 * If there is an unknown even bit in the `features` field the
@@ -614,7 +1330,8 @@ const struct short_channel_id *handle_channel_announcement(
 		return NULL;
 	}
 
-	if (!check_channel_announcement(&pending->node_id_1, &pending->node_id_2,
+	if (!check_channel_announcement(rstate,
+					&pending->node_id_1, &pending->node_id_2,
 					&pending->bitcoin_key_1,
 					&pending->bitcoin_key_2,
 					&node_signature_1,
@@ -639,7 +1356,9 @@ const struct short_channel_id *handle_channel_announcement(
 	add_pending_node_announcement(rstate, &pending->node_id_1);
 	add_pending_node_announcement(rstate, &pending->node_id_2);
 
-	list_add_tail(&rstate->pending_cannouncement, &pending->list);
+	uintmap_add(&rstate->pending_cannouncements,
+		    pending->short_channel_id.u64, pending);
+	rstate->num_pending_cannouncements++;
 	tal_add_destructor2(pending, destroy_pending_cannouncement, rstate);
 
 	return &pending->short_channel_id;
@@ -651,18 +1370,13 @@ bool handle_pending_cannouncement(struct routing_state *rstate,
 				  const u8 *outscript)
 {
 	bool local;
-	u8 *tag;
 	const u8 *s;
 	struct pending_cannouncement *pending;
-	struct chan *chan;
 
 	pending = find_pending_cannouncement(rstate, scid);
 	if (!pending)
 		return false;
 
-	tag = tal_arr(pending, u8, 0);
-	towire_short_channel_id(&tag, scid);
-
 	/* BOLT #7:
 	 *
 	 * The receiving node MUST ignore the message if this output is spent.
@@ -671,7 +1385,7 @@ bool handle_pending_cannouncement(struct routing_state *rstate,
 		status_trace("channel_announcement: no unspent txout %s",
 			     type_to_string(pending, struct short_channel_id,
 					    scid));
-		tal_free(pending);
+		free_pending_cannouncement(rstate, pending);
 		return false;
 	}
 
@@ -693,34 +1407,18 @@ bool handle_pending_cannouncement(struct routing_state *rstate,
 			     type_to_string(pending, struct short_channel_id,
 					    scid),
 			     tal_hex(trc, s), tal_hex(trc, outscript));
-		tal_free(pending);
+		free_pending_cannouncement(rstate, pending);
 		return false;
 	}
 
-	/* The channel may already exist if it was non-public from
-	 * local_add_channel(); normally we don't accept new
-	 * channel_announcements.  See handle_channel_announcement. */
-	chan = get_channel(rstate, scid);
-	if (!chan)
-		chan = new_chan(rstate, scid,
-					   &pending->node_id_1,
-					   &pending->node_id_2);
-
-	/* Channel is now public. */
-	chan->public = true;
-	chan->satoshis = satoshis;
-
-	/* Save channel_announcement. */
-	tal_free(chan->channel_announcement);
-	chan->channel_announcement = tal_steal(chan, pending->announce);
-
-	if (replace_broadcast(rstate->broadcasts,
-			      &chan->channel_announce_msgidx,
-			      WIRE_CHANNEL_ANNOUNCEMENT,
-			      tag, pending->announce))
+	gossip_store_add_channel_announcement(rstate->store,
+					      pending->announce, satoshis);
+	if (!routing_add_channel_announcement(rstate, pending->announce,
+					      satoshis))
 		status_failed(STATUS_FAIL_INTERNAL_ERROR,
-			      "Announcement %s was replaced?",
-			      tal_hex(trc, pending->announce));
+			      "Could not add channel_announcement %s",
+			      type_to_string(trc, struct short_channel_id,
+					     scid));
 
 	local = pubkey_eq(&pending->node_id_1, &rstate->local_id) ||
 		pubkey_eq(&pending->node_id_2, &rstate->local_id);
@@ -734,7 +1432,7 @@ bool handle_pending_cannouncement(struct routing_state *rstate,
 	process_pending_node_announcement(rstate, &pending->node_id_1);
 	process_pending_node_announcement(rstate, &pending->node_id_2);
 
-	tal_free(pending);
+	free_pending_cannouncement(rstate, pending);
 	return local;
 }
 
@@ -756,7 +1454,8 @@ static void update_pending(struct pending_cannouncement *pending,
 	}
 }
 
-void set_connection_values(struct chan *chan,
+void set_connection_values(struct routing_state *rstate,
+			   struct chan *chan,
 			   int idx,
 			   u32 base_fee,
 			   u32 proportional_fee,
@@ -791,6 +1490,135 @@ void set_connection_values(struct chan *chan,
 			     c->proportional_fee);
 		c->active = false;
 	}
+
+	update_route_graph(rstate, chan, idx);
+}
+
+void gossip_sigchecks(struct routing_state *rstate, const u8 *msg,
+		      struct sigcheck **checks)
+{
+	const tal_t *tmpctx = tal_tmpctx(rstate);
+	secp256k1_ecdsa_signature sigs[4];
+	struct pubkey keys[4];
+	struct sha256_double hash;
+	struct bitcoin_blkid chain_hash;
+	struct short_channel_id scid;
+	struct chan *chan;
+	u8 *features, *addresses, rgb_color[3], alias[32];
+	u32 timestamp, fee_base_msat, fee_proportional_millionths;
+	u16 flags, expiry;
+	u64 htlc_minimum_msat;
+	size_t i, offset;
+
+	/* Anything which doesn't parse, the handler will reject. */
+	switch (fromwire_peektype(msg)) {
+	case WIRE_CHANNEL_ANNOUNCEMENT:
+		if (!fromwire_channel_announcement(tmpctx, msg,
+						   &sigs[0], &sigs[1],
+						   &sigs[2], &sigs[3],
+						   &features, &chain_hash,
+						   &scid,
+						   &keys[0], &keys[1],
+						   &keys[2], &keys[3]))
+			break;
+		/* Handler ignores these without checking. */
+		chan = get_channel(rstate, &scid);
+		if ((chan && chan->public)
+		    || find_pending_cannouncement(rstate, &scid))
+			break;
+		offset = CHANNEL_ANNOUNCEMENT_SIGNED_OFFSET;
+		sha256_double(&hash, msg + offset, tal_len(msg) - offset);
+		for (i = 0; i < 4; i++)
+			add_sigcheck(checks, &hash, &sigs[i], &keys[i]);
+		break;
+
+	case WIRE_CHANNEL_UPDATE:
+		if (!fromwire_channel_update(msg, &sigs[0], &chain_hash,
+					     &scid, &timestamp, &flags,
+					     &expiry, &htlc_minimum_msat,
+					     &fee_base_msat,
+					     &fee_proportional_millionths))
+			break;
+		/* Only if the handler would check it: if we don't know the
+		 * channel yet, we can't know the key anyway. */
+		chan = get_channel(rstate, &scid);
+		if (!chan
+		    || (!chan->public
+			&& find_pending_cannouncement(rstate, &scid))
+		    || chan->half[flags & 0x1].last_timestamp >= timestamp)
+			break;
+		offset = CHANNEL_UPDATE_SIGNED_OFFSET;
+		sha256_double(&hash, msg + offset, tal_len(msg) - offset);
+		add_sigcheck(checks, &hash, &sigs[0],
+			     &chan->nodes[flags & 0x1]->id);
+		break;
+
+	case WIRE_NODE_ANNOUNCEMENT:
+		if (!fromwire_node_announcement(tmpctx, msg, &sigs[0],
+						&features, &timestamp,
+						&keys[0], rgb_color, alias,
+						&addresses))
+			break;
+		offset = NODE_ANNOUNCEMENT_SIGNED_OFFSET;
+		sha256_double(&hash, msg + offset, tal_len(msg) - offset);
+		add_sigcheck(checks, &hash, &sigs[0], &keys[0]);
+		break;
+	}
+	tal_free(tmpctx);
+}
+
+bool routing_add_channel_update(struct routing_state *rstate,
+				const u8 *update)
+{
+	secp256k1_ecdsa_signature signature;
+	struct bitcoin_blkid chain_hash;
+	struct short_channel_id short_channel_id;
+	u32 timestamp, fee_base_msat, fee_proportional_millionths;
+	u16 flags, expiry;
+	u64 htlc_minimum_msat;
+	struct half_chan *c;
+	struct chan *chan;
+	u8 direction, *tag, *old;
+
+	if (!fromwire_channel_update(update, &signature,
+				     &chain_hash, &short_channel_id,
+				     &timestamp, &flags, &expiry,
+				     &htlc_minimum_msat, &fee_base_msat,
+				     &fee_proportional_millionths))
+		return false;
+	direction = flags & 0x1;
+
+	chan = get_channel(rstate, &short_channel_id);
+	if (!chan)
+		return false;
+
+	c = &chan->half[direction];
+	if (c->last_timestamp >= timestamp)
+		return false;
+
+	set_connection_values(rstate, chan, direction,
+			      fee_base_msat,
+			      fee_proportional_millionths,
+			      expiry,
+			      (flags & ROUTING_FLAGS_DISABLED) == 0,
+			      timestamp,
+			      htlc_minimum_msat);
+
+	/* The broadcast queue shares it. */
+	old = c->channel_update;
+	c->channel_update = tal_dup_arr(chan, u8, update, tal_len(update), 0);
+
+	tag = tal_arr(chan, u8, 0);
+	towire_short_channel_id(&tag, &short_channel_id);
+	towire_u16(&tag, direction);
+	replace_broadcast(rstate->broadcasts,
+			  &c->channel_update_msgidx,
+			  WIRE_CHANNEL_UPDATE,
+			  tag,
+			  c->channel_update);
+	tal_free(tag);
+	tal_free(old);
+	return true;
 }
 
 void handle_channel_update(struct routing_state *rstate, const u8 *update)
@@ -866,7 +1694,7 @@ void handle_channel_update(struct routing_state *rstate, const u8 *update)
 		return;
 	}
 
-	if (!check_channel_update(&chan->nodes[direction]->id,
+	if (!check_channel_update(rstate, &chan->nodes[direction]->id,
 				  &signature, serialized)) {
 		status_trace("Signature verification failed.");
 		tal_free(tmpctx);
@@ -879,25 +1707,10 @@ void handle_channel_update(struct routing_state *rstate, const u8 *update)
 		     flags & 0x01,
 		     flags & ROUTING_FLAGS_DISABLED ? "DISABLED" : "ACTIVE");
 
-	set_connection_values(chan, direction,
-			      fee_base_msat,
-			      fee_proportional_millionths,
-			      expiry,
-			      (flags & ROUTING_FLAGS_DISABLED) == 0,
-			      timestamp,
-			      htlc_minimum_msat);
-
-	u8 *tag = tal_arr(tmpctx, u8, 0);
-	towire_short_channel_id(&tag, &short_channel_id);
-	towire_u16(&tag, direction);
-	replace_broadcast(rstate->broadcasts,
-			  &chan->half[direction].channel_update_msgidx,
-			WIRE_CHANNEL_UPDATE,
-			tag,
-			serialized);
-
-	tal_free(c->channel_update);
-	c->channel_update = tal_steal(chan, serialized);
+	routing_add_channel_update(rstate, serialized);
+	/* Local channels' updates come back from channeld on restart. */
+	if (chan->public)
+		gossip_store_add_channel_update(rstate->store, serialized);
 	tal_free(tmpctx);
 }
 
@@ -935,6 +1748,62 @@ static struct wireaddr *read_addresses(const tal_t *ctx, const u8 *ser)
 	return wireaddrs;
 }
 
+bool routing_add_node_announcement(struct routing_state *rstate,
+				   const u8 *node_ann)
+{
+	const tal_t *tmpctx = tal_tmpctx(rstate);
+	secp256k1_ecdsa_signature signature;
+	u32 timestamp;
+	struct pubkey node_id;
+	u8 rgb_color[3];
+	u8 alias[32];
+	u8 *features, *addresses, *tag, *old;
+	struct wireaddr *wireaddrs;
+	struct node *node;
+
+	if (!fromwire_node_announcement(tmpctx, node_ann,
+					&signature, &features, &timestamp,
+					&node_id, rgb_color, alias,
+					&addresses))
+		goto fail;
+
+	node = get_node(rstate, &node_id);
+	if (!node || node->last_timestamp >= timestamp)
+		goto fail;
+
+	wireaddrs = read_addresses(tmpctx, addresses);
+	if (!wireaddrs)
+		goto fail;
+	tal_free(node->addresses);
+	node->addresses = tal_steal(node, wireaddrs);
+
+	node->last_timestamp = timestamp;
+
+	memcpy(node->rgb_color, rgb_color, 3);
+	tal_free(node->alias);
+	node->alias = tal_dup_arr(node, u8, alias, 32, 0);
+
+	/* The broadcast queue shares it. */
+	old = node->node_announcement;
+	node->node_announcement = tal_dup_arr(node, u8, node_ann,
+					      tal_len(node_ann), 0);
+
+	tag = tal_arr(tmpctx, u8, 0);
+	towire_pubkey(&tag, &node_id);
+	replace_broadcast(rstate->broadcasts,
+			  &node->announcement_idx,
+			  WIRE_NODE_ANNOUNCEMENT,
+			  tag,
+			  node->node_announcement);
+	tal_free(old);
+	tal_free(tmpctx);
+	return true;
+
+fail:
+	tal_free(tmpctx);
+	return false;
+}
+
 void handle_node_announcement(
 	struct routing_state *rstate, const u8 *node_ann)
 {
@@ -948,7 +1817,6 @@ void handle_node_announcement(
 	u8 alias[32];
 	u8 *features, *addresses;
 	const tal_t *tmpctx = tal_tmpctx(rstate);
-	struct wireaddr *wireaddrs;
 	struct pending_node_announce *pna;
 	size_t len = tal_len(node_ann);
 
@@ -975,8 +1843,9 @@ void handle_node_announcement(
 		return;
 	}
 
-	sha256_double(&hash, serialized + 66, tal_count(serialized) - 66);
-	if (!check_signed_hash(&hash, &signature, &node_id)) {
+	sha256_double(&hash, serialized + NODE_ANNOUNCEMENT_SIGNED_OFFSET,
+		      tal_count(serialized) - NODE_ANNOUNCEMENT_SIGNED_OFFSET);
+	if (!check_sig(rstate, &hash, &signature, &node_id)) {
 		status_trace("Ignoring node announcement, signature verification failed.");
 		tal_free(tmpctx);
 		return;
@@ -1016,57 +1885,29 @@ void handle_node_announcement(
 	status_trace("Received node_announcement for node %s",
 		     type_to_string(tmpctx, struct pubkey, &node_id));
 
-	wireaddrs = read_addresses(tmpctx, addresses);
-	if (!wireaddrs) {
+	if (!routing_add_node_announcement(rstate, serialized)) {
 		status_trace("Unable to parse addresses.");
-		tal_free(serialized);
+		tal_free(tmpctx);
 		return;
 	}
-	tal_free(node->addresses);
-	node->addresses = tal_steal(node, wireaddrs);
-
-	node->last_timestamp = timestamp;
-
-	memcpy(node->rgb_color, rgb_color, 3);
-	tal_free(node->alias);
-	node->alias = tal_dup_arr(node, u8, alias, 32, 0);
-
-	u8 *tag = tal_arr(tmpctx, u8, 0);
-	towire_pubkey(&tag, &node_id);
-	replace_broadcast(rstate->broadcasts,
-			  &node->announcement_idx,
-			  WIRE_NODE_ANNOUNCEMENT,
-			  tag,
-			  serialized);
-	tal_free(node->node_announcement);
-	node->node_announcement = tal_steal(node, serialized);
+	gossip_store_add_node_announcement(rstate->store, serialized);
 	tal_free(tmpctx);
 }
 
-struct route_hop *get_route(tal_t *ctx, struct routing_state *rstate,
-			    const struct pubkey *source,
-			    const struct pubkey *destination,
-			    const u32 msatoshi, double riskfactor,
-			    u32 final_cltv,
-			    double fuzz, const struct siphash_seed *base_seed)
+/* Fees, delays need to be calculated backwards along route. */
+static struct route_hop *route_to_hops(const tal_t *ctx,
+				       struct routing_state *rstate,
+				       struct chan **route,
+				       const struct pubkey *source,
+				       const struct pubkey *destination,
+				       u32 msatoshi, u32 final_cltv)
 {
-	struct chan **route;
 	u64 total_amount;
 	unsigned int total_delay;
-	u64 fee;
 	struct route_hop *hops;
 	int i;
 	struct node *n;
 
-	route = find_route(ctx, rstate, source, destination, msatoshi,
-			   riskfactor / BLOCKS_PER_YEAR / 10000,
-			   fuzz, base_seed, &fee);
-
-	if (!route) {
-		return NULL;
-	}
-
-	/* Fees, delays need to be calculated backwards along route. */
 	hops = tal_arr(ctx, struct route_hop, tal_count(route));
 	total_amount = msatoshi;
 	total_delay = final_cltv;
@@ -1081,22 +1922,127 @@ struct route_hop *get_route(tal_t *ctx, struct routing_state *rstate,
 		hops[i].nodeid = n->id;
 		hops[i].amount = total_amount;
 		hops[i].delay = total_delay;
-		total_amount += connection_fee(c, total_amount);
+		total_amount += connection_fee(c->base_fee, c->proportional_fee,
+					       total_amount);
 		total_delay += c->delay;
 		n = other_node(n, route[i]);
 	}
 	assert(pubkey_eq(&n->id, source));
 
-	/* FIXME: Shadow route! */
 	return hops;
 }
 
+struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
+			    const struct pubkey *source,
+			    const struct pubkey *destination,
+			    const u32 msatoshi, double riskfactor,
+			    u32 final_cltv,
+			    double fuzz, const struct siphash_seed *base_seed)
+{
+	struct chan **route;
+	u64 fee;
+	struct route_cache_key key;
+	time_t now = time_now().ts.tv_sec;
+
+	route_cache_key_init(&key, source, destination, msatoshi,
+			     riskfactor, fuzz);
+	route = route_cache_get(ctx, rstate, &key, now);
+	if (!route) {
+		route = find_route(ctx, rstate, source, destination, msatoshi,
+				   riskfactor / BLOCKS_PER_YEAR / 10000,
+				   fuzz, base_seed, &fee);
+
+		if (!route) {
+			return NULL;
+		}
+		route_cache_add(rstate, &key, route, now);
+	}
+
+	/* FIXME: Shadow route! */
+	return route_to_hops(ctx, rstate, route, source, destination,
+			     msatoshi, final_cltv);
+}
+
+struct route_hop **get_routes(const tal_t *ctx, struct routing_state *rstate,
+			      const struct pubkey *source,
+			      const struct pubkey *destination,
+			      const u32 msatoshi, double riskfactor,
+			      u32 final_cltv,
+			      double fuzz, const struct siphash_seed *base_seed,
+			      size_t max_routes, bool node_disjoint)
+{
+	struct route_hop **routes = tal_arr(ctx, struct route_hop *, 0);
+	const tal_t *tmpctx = tal_tmpctx(ctx);
+	struct route_search *search = rstate->search;
+	bool *excluded_edges, *excluded_nodes;
+	size_t i, n = 0;
+	u64 fee;
+	struct route_cache_key key;
+	time_t now = time_now().ts.tv_sec;
+
+	/* Each search below must see the same edge numbering. */
+	if (rstate->graph->stale)
+		rebuild_route_graph(rstate);
+	excluded_edges = tal_arrz(tmpctx, bool,
+				  tal_count(rstate->graph->chan));
+	excluded_nodes = tal_arrz(tmpctx, bool,
+				  tal_count(rstate->node_index));
+
+	/* A full search per route: with a hop-bounded Dijkstra, finding k
+	 * disjoint paths in one pass isn't practical, and k is small. */
+	search->excluded_edges = excluded_edges;
+	search->excluded_nodes = node_disjoint ? excluded_nodes : NULL;
+	while (n < max_routes) {
+		struct chan **route = NULL;
+		struct node *node;
+
+		/* Nothing's excluded yet, so the first is what get_route()
+		 * would find: share its cache. */
+		if (n == 0) {
+			route_cache_key_init(&key, source, destination,
+					     msatoshi, riskfactor, fuzz);
+			route = route_cache_get(tmpctx, rstate, &key, now);
+		}
+		if (!route) {
+			route = find_route(tmpctx, rstate, source, destination,
+					   msatoshi,
+					   riskfactor / BLOCKS_PER_YEAR / 10000,
+					   fuzz, base_seed, &fee);
+			if (!route)
+				break;
+			if (n == 0)
+				route_cache_add(rstate, &key, route, now);
+		}
+
+		tal_resize(&routes, n + 1);
+		routes[n++] = route_to_hops(routes, rstate, route,
+					    source, destination,
+					    msatoshi, final_cltv);
+
+		/* Later routes can't use these channels (either way), nor
+		 * go through these nodes. */
+		node = get_node(rstate, source);
+		for (i = 0; i < tal_count(route); i++) {
+			excluded_edges[route[i]->half[0].graph_edge] = true;
+			excluded_edges[route[i]->half[1].graph_edge] = true;
+			if (i != 0)
+				excluded_nodes[node->index] = true;
+			node = other_node(node, route[i]);
+		}
+	}
+	search->excluded_edges = search->excluded_nodes = NULL;
+
+	tal_free(tmpctx);
+	return routes;
+}
+
 /**
  * routing_failure_channel_out - Handle routing failure on a specific channel
  *
  * If we want to delete the channel, we reparent it to disposal_context.
  */
-static void routing_failure_channel_out(const tal_t *disposal_context,
+static void routing_failure_channel_out(struct routing_state *rstate,
+					const tal_t *disposal_context,
 					struct node *node,
 					enum onion_type failcode,
 					struct chan *chan,
@@ -1109,12 +2055,18 @@ static void routing_failure_channel_out(const tal_t *disposal_context,
 	 * - if the PERM bit is NOT set:
 	 *   - SHOULD restore the channels as it receives new `channel_update`s.
 	 */
-	if (!(failcode & PERM))
+	if (!(failcode & PERM)) {
 		/* Prevent it for 20 seconds. */
 		hc->unroutable_until = now + 20;
-	else
+		update_route_graph(rstate, chan, hc - chan->half);
+	} else {
 		/* Set it up to be pruned. */
 		tal_steal(disposal_context, chan);
+		/* ...and don't bring it back when we replay the store. */
+		if (chan->public)
+			gossip_store_add_channel_delete(rstate->store,
+							&chan->scid);
+	}
 }
 
 void routing_failure(struct routing_state *rstate,
@@ -1155,7 +2107,8 @@ void routing_failure(struct routing_state *rstate,
 	 */
 	if (failcode & NODE) {
 		for (i = 0; i < tal_count(node->chans); ++i) {
-			routing_failure_channel_out(tmpctx, node, failcode,
+			routing_failure_channel_out(rstate, tmpctx,
+						    node, failcode,
 						    node->chans[i],
 						    now);
 		}
@@ -1177,7 +2130,7 @@ void routing_failure(struct routing_state *rstate,
 				       type_to_string(tmpctx, struct pubkey,
 						      erring_node_pubkey));
 		else
-			routing_failure_channel_out(tmpctx,
+			routing_failure_channel_out(rstate, tmpctx,
 						    node, failcode, chan, now);
 	}
 
@@ -1240,6 +2193,8 @@ void mark_channel_unroutable(struct routing_state *rstate,
 	}
 	chan->half[0].unroutable_until = now + 20;
 	chan->half[1].unroutable_until = now + 20;
+	update_route_graph(rstate, chan, 0);
+	update_route_graph(rstate, chan, 1);
 	tal_free(tmpctx);
 }
 
@@ -1271,6 +2226,8 @@ void route_prune(struct routing_state *rstate)
 
 			/* This may perturb iteration so do outside loop. */
 			tal_steal(pruned, chan);
+			gossip_store_add_channel_delete(rstate->store,
+							&chan->scid);
 		}
 	}
 
@@ -6,11 +6,16 @@
 #include <ccan/htable/htable_type.h>
 #include <ccan/time/time.h>
 #include <gossipd/broadcast.h>
+#include <gossipd/sigcheck.h>
 #include <wire/gen_onion_wire.h>
 #include <wire/wire.h>
 
 #define ROUTING_MAX_HOPS 20
+/* Most routes get_routes() will return for one query. */
+#define ROUTING_MAX_ALTERNATES 10
 #define ROUTING_FLAGS_DISABLED 2
+/* Most channel_announcements we'll have waiting on txout lookups. */
+#define ROUTING_MAX_PENDING 10000
 
 struct half_chan {
 	/* millisatoshi. */
@@ -40,6 +45,9 @@ struct half_chan {
 	/* If greater than current time, this connection should not
 	 * be used for routing. */
 	time_t unroutable_until;
+
+	/* Our edge in routing_state->graph (unless that's stale) */
+	u32 graph_edge;
 };
 
 struct chan {
@@ -77,15 +85,8 @@ struct node {
 	/* Channels connecting us to other nodes */
 	struct chan **chans;
 
-	/* Temporary data for routefinding. */
-	struct {
-		/* Total to get to here from target. */
-		u64 total;
-		/* Total risk premium of this route. */
-		u64 risk;
-		/* Where that came from. */
-		struct chan *prev;
-	} bfg[ROUTING_MAX_HOPS+1];
+	/* Our slot in routing_state->node_index (and route scratch). */
+	u32 index;
 
 	/* UTF-8 encoded alias as tal_arr, not zero terminated */
 	u8 *alias;
@@ -105,8 +106,12 @@ size_t node_map_hash_key(const secp256k1_pubkey *key);
 bool node_map_node_eq(const struct node *n, const secp256k1_pubkey *key);
 HTABLE_DEFINE_TYPE(struct node, node_map_keyof_node, node_map_hash_key, node_map_node_eq, node_map);
 
+struct gossip_store;
 struct pending_node_map;
 struct pending_cannouncement;
+struct route_search;
+struct route_graph;
+struct route_cache;
 
 /* If the two nodes[] are id1 and id2, which index would id1 be? */
 static inline int pubkey_idx(const struct pubkey *id1, const struct pubkey *id2)
@@ -142,19 +147,42 @@ static inline int half_chan_to(const struct node *n, struct chan *chan)
 	return !idx;
 }
 
+/* Which algorithm find_route() uses. */
+enum route_engine {
+	/* Hop-bounded Dijkstra over a heap: stops once source is settled. */
+	ROUTE_ENGINE_DIJKSTRA,
+	/* Bellman-Ford-Gibson: ROUTING_MAX_HOPS passes over every edge. */
+	ROUTE_ENGINE_BFG,
+};
+
 struct routing_state {
 	/* All known nodes. */
 	struct node_map *nodes;
 
+	/* The same nodes, densely indexed by node->index. */
+	struct node **node_index;
+
+	/* Per-query route-finding scratch space, reused across queries. */
+	struct route_search *search;
+
+	/* Compact snapshot of nodes and half_chans which routing uses. */
+	struct route_graph *graph;
+
+	/* Recent get_route() results, while still valid. */
+	struct route_cache *route_cache;
+
 	/* node_announcements which are waiting on pending_cannouncement */
 	struct pending_node_map *pending_node_map;
 
-	/* FIXME: Make this a htable! */
 	/* channel_announcement which are pending short_channel_id lookup */
-	struct list_head pending_cannouncement;
+	UINTMAP(struct pending_cannouncement *) pending_cannouncements;
+	size_t num_pending_cannouncements;
 
 	struct broadcast_state *broadcasts;
 
+	/* Where we persist the gossip we accept (NULL until set up). */
+	struct gossip_store *store;
+
 	struct bitcoin_blkid chain_hash;
 
 	/* Our own ID so we can identify local channels */
@@ -165,6 +193,14 @@ struct routing_state {
 
         /* A map of channels indexed by short_channel_ids */
 	UINTMAP(struct chan *) chanmap;
+
+	/* Route-finding algorithm to use (BFG kept for comparison). */
+	enum route_engine route_engine;
+
+	/* Signatures sigcheck_batch() checked for the message we're
+	 * handling (if any): the handlers don't need to redo these. */
+	const struct sigcheck *preverified;
+	size_t num_preverified;
 };
 
 static inline struct chan *
@@ -215,10 +251,27 @@ bool handle_pending_cannouncement(struct routing_state *rstate,
 				  const u64 satoshis,
 				  const u8 *txscript);
 void handle_channel_update(struct routing_state *rstate, const u8 *update);
+
+/* Append the signatures the handler will check for msg to *checks, so
+ * they can be checked in advance: see rstate->preverified. */
+void gossip_sigchecks(struct routing_state *rstate, const u8 *msg,
+		      struct sigcheck **checks);
 void handle_node_announcement(struct routing_state *rstate, const u8 *node);
 
+/* Add already-validated gossip (eg. from the gossip_store), without
+ * checking signatures or txouts.  Return false if it's unusable or
+ * outdated. */
+bool routing_add_channel_announcement(struct routing_state *rstate,
+				      const u8 *announce TAKES,
+				      u64 satoshis);
+bool routing_add_channel_update(struct routing_state *rstate,
+				const u8 *update);
+bool routing_add_node_announcement(struct routing_state *rstate,
+				   const u8 *node);
+
 /* Set values on the struct node_connection */
-void set_connection_values(struct chan *chan,
+void set_connection_values(struct routing_state *rstate,
+			   struct chan *chan,
 			   int idx,
 			   u32 base_fee,
 			   u32 proportional_fee,
@@ -227,17 +280,43 @@ void set_connection_values(struct chan *chan,
 			   u64 timestamp,
 			   u32 htlc_minimum_msat);
 
+/* Call after changing chan->half[idx] routing fields directly. */
+void update_route_graph(struct routing_state *rstate,
+			const struct chan *chan, int idx);
+
 /* Get a node: use this instead of node_map_get() */
 struct node *get_node(struct routing_state *rstate, const struct pubkey *id);
 
 /* Compute a route to a destination, for a given amount and riskfactor. */
-struct route_hop *get_route(tal_t *ctx, struct routing_state *rstate,
+struct route_hop *get_route(const tal_t *ctx, struct routing_state *rstate,
 			    const struct pubkey *source,
 			    const struct pubkey *destination,
 			    const u32 msatoshi, double riskfactor,
 			    u32 final_cltv,
 			    double fuzz,
 			    const struct siphash_seed *base_seed);
+/* Compute up to max_routes alternate routes, cheapest first.  No two
+ * share a channel; if node_disjoint, nor any intermediate node.  This is
+ * one find_route() per route found (plus one which fails), each excluding
+ * what the previous ones used: not a single traversal. */
+struct route_hop **get_routes(const tal_t *ctx, struct routing_state *rstate,
+			      const struct pubkey *source,
+			      const struct pubkey *destination,
+			      const u32 msatoshi, double riskfactor,
+			      u32 final_cltv,
+			      double fuzz,
+			      const struct siphash_seed *base_seed,
+			      size_t max_routes, bool node_disjoint);
+/* How get_route()'s cache is doing. */
+struct route_cache_stats {
+	u64 hits, misses;
+	/* Misses where we had an entry, but the route had changed. */
+	u64 invalidated;
+	size_t entries;
+};
+void route_cache_stats(const struct routing_state *rstate,
+		       struct route_cache_stats *stats);
+
 /* Disable channel(s) based on the given routing failure. */
 void routing_failure(struct routing_state *rstate,
 		     const struct pubkey *erring_node,
@@ -0,0 +1,21 @@
+#include <bitcoin/signature.h>
+#include <common/parallel.h>
+#include <gossipd/sigcheck.h>
+
+/* Starting a thread costs about as much as a few verifies: don't bother
+ * unless each has at least this many to do. */
+#define SIGCHECK_MIN_PER_THREAD 16
+
+static void check_one(size_t i, struct sigcheck *checks)
+{
+	/* Only reads the global secp256k1_ctx, so this is thread-safe. */
+	checks[i].valid = check_signed_hash(&checks[i].hash,
+					    &checks[i].sig,
+					    &checks[i].key);
+}
+
+void sigcheck_batch(struct sigcheck *checks, size_t num_threads)
+{
+	parallel_for(tal_count(checks), num_threads, SIGCHECK_MIN_PER_THREAD,
+		     check_one, checks);
+}
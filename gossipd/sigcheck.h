@@ -0,0 +1,25 @@
+#ifndef LIGHTNING_GOSSIPD_SIGCHECK_H
+#define LIGHTNING_GOSSIPD_SIGCHECK_H
+#include "config.h"
+#include <bitcoin/pubkey.h>
+#include <bitcoin/shadouble.h>
+#include <ccan/tal/tal.h>
+#include <secp256k1.h>
+#include <stdbool.h>
+
+/* One signature we need to check: incoming gossip is batched up, and all
+ * its signatures checked at once before the messages are handled. */
+struct sigcheck {
+	struct sha256_double hash;
+	secp256k1_ecdsa_signature sig;
+	struct pubkey key;
+
+	/* Filled in by sigcheck_batch(). */
+	bool valid;
+};
+
+/* Check every signature in checks (a tal_arr), using up to num_threads
+ * threads (including this one). */
+void sigcheck_batch(struct sigcheck *checks, size_t num_threads);
+
+#endif /* LIGHTNING_GOSSIPD_SIGCHECK_H */
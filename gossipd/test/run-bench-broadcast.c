@@ -0,0 +1,134 @@
+#include "../broadcast.c"
+#include <assert.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <wire/gen_peer_wire.h>
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+/* Tags as routing.c makes them: short_channel_id (plus direction for
+ * updates), or node id. */
+static u8 *channel_tag(const tal_t *ctx, size_t chan, int direction)
+{
+	u8 *tag = tal_arrz(ctx, u8, direction < 0 ? 8 : 10);
+
+	memcpy(tag, &chan, sizeof(chan));
+	if (direction > 0)
+		tag[9] = direction;
+	return tag;
+}
+
+static u8 *node_tag(const tal_t *ctx, size_t node)
+{
+	u8 *tag = tal_arrz(ctx, u8, 33);
+
+	tag[0] = 0x02;
+	memcpy(tag + 1, &node, sizeof(node));
+	return tag;
+}
+
+static bool queue(struct broadcast_state *bstate, int type, u8 *tag,
+		  const u8 *payload)
+{
+	bool evicted = queue_broadcast(bstate, type, tag, payload);
+	tal_free(tag);
+	return evicted;
+}
+
+static u64 usec_since(struct timemono start)
+{
+	return time_to_usec(timemono_between(time_mono(), start));
+}
+
+static void report(const char *what, size_t num, u64 usec)
+{
+	printf("%s: %zu messages in %"PRIu64" msec: %"PRIu64" messages/sec\n",
+	       what, num, usec / 1000, usec ? num * 1000000 / usec : 0);
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+	size_t num_channels = 40000, num_nodes = 10000, num_rounds = 4;
+	struct broadcast_state *bstate;
+	struct queued_message *m;
+	u8 *announce, *update, *nannounce, *tag;
+	struct timemono start;
+	size_t i, r, num;
+	u64 index;
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_channels = atoi(argv[1]);
+	if (argc > 2)
+		num_nodes = atoi(argv[2]);
+	if (argc > 3)
+		num_rounds = atoi(argv[3]);
+	if (argc > 4)
+		opt_usage_and_exit("[num_channels [num_nodes [update_rounds]]]");
+
+	/* Roughly the right sizes. */
+	announce = tal_arrz(ctx, u8, 430);
+	update = tal_arrz(ctx, u8, 130);
+	nannounce = tal_arrz(ctx, u8, 150);
+
+	bstate = new_broadcast_state(NULL);
+
+	/* Initial load: an announcement and two updates per channel, and
+	 * the node_announcements. */
+	start = time_mono();
+	for (i = 0; i < num_channels; i++) {
+		if (queue(bstate, WIRE_CHANNEL_ANNOUNCEMENT,
+			  channel_tag(NULL, i, -1), announce))
+			errx(1, "Announcement %zu was replaced?", i);
+		if (queue(bstate, WIRE_CHANNEL_UPDATE,
+			  channel_tag(NULL, i, 0), update))
+			errx(1, "Update %zu/0 was replaced?", i);
+		if (queue(bstate, WIRE_CHANNEL_UPDATE,
+			  channel_tag(NULL, i, 1), update))
+			errx(1, "Update %zu/1 was replaced?", i);
+	}
+	for (i = 0; i < num_nodes; i++)
+		if (queue(bstate, WIRE_NODE_ANNOUNCEMENT,
+			  node_tag(NULL, i), nannounce))
+			errx(1, "Node announcement %zu was replaced?", i);
+	num = num_channels * 3 + num_nodes;
+	report("initial", num, usec_since(start));
+
+	/* Then the steady state: every channel_update gets replaced. */
+	start = time_mono();
+	for (r = 0; r < num_rounds; r++) {
+		for (i = 0; i < num_channels * 2; i++) {
+			if (!queue(bstate, WIRE_CHANNEL_UPDATE,
+				   channel_tag(NULL, i / 2, i % 2),
+				   update))
+				errx(1, "Update %zu was not replaced?", i);
+		}
+	}
+	report("replacing", num_rounds * num_channels * 2, usec_since(start));
+
+	/* Nothing is duplicated. */
+	index = 0;
+	for (i = 0; (m = next_broadcast_message(bstate, &index)) != NULL; i++)
+		assert(m->index == index);
+	assert(i == num);
+
+	/* replace_broadcast only counts the one at *index as replaced. */
+	index = 0;
+	tag = node_tag(ctx, 0);
+	assert(!replace_broadcast(bstate, &index, WIRE_NODE_ANNOUNCEMENT,
+				  tag, nannounce));
+	assert(replace_broadcast(bstate, &index, WIRE_NODE_ANNOUNCEMENT,
+				 tag, nannounce));
+	assert(bstate->index->raw.elems == num);
+
+	tal_free(bstate);
+	tal_free(ctx);
+	opt_free_table();
+	return 0;
+}
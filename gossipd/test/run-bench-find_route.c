@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <bitcoin/pubkey.h>
 #include <ccan/err/err.h>
+#include <ccan/mem/mem.h>
 #include <ccan/opt/opt.h>
 #include <ccan/tal/str/str.h>
 #include <ccan/time/time.h>
@@ -54,6 +55,12 @@ struct broadcast_state *new_broadcast_state(tal_t *ctx UNNEEDED)
 	return NULL;
 }
 
+/* Channels are freed on cleanup. */
+void broadcast_del(struct broadcast_state *bstate UNNEEDED, u64 index UNNEEDED,
+		   const u8 *payload UNNEEDED)
+{
+}
+
 /* AUTOGENERATED MOCKS START */
 /* Generated stub for fromwire_channel_announcement */
 bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *node_id_1 UNNEEDED, struct pubkey *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
@@ -73,6 +80,23 @@ u8 fromwire_u8(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
 /* Generated stub for fromwire_wireaddr */
 bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
 { fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for gossip_store_add_channel_announcement */
+void gossip_store_add_channel_announcement(struct gossip_store *gs UNNEEDED,
+					   const u8 *announce UNNEEDED,
+					   u64 satoshis UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_channel_announcement called!\n"); abort(); }
+/* Generated stub for gossip_store_add_channel_delete */
+void gossip_store_add_channel_delete(struct gossip_store *gs UNNEEDED,
+				     const struct short_channel_id *scid UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_channel_delete called!\n"); abort(); }
+/* Generated stub for gossip_store_add_channel_update */
+void gossip_store_add_channel_update(struct gossip_store *gs UNNEEDED,
+				     const u8 *update UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_channel_update called!\n"); abort(); }
+/* Generated stub for gossip_store_add_node_announcement */
+void gossip_store_add_node_announcement(struct gossip_store *gs UNNEEDED,
+					const u8 *announce UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_node_announcement called!\n"); abort(); }
 /* Generated stub for onion_type_name */
 const char *onion_type_name(int e UNNEEDED)
 { fprintf(stderr, "onion_type_name called!\n"); abort(); }
@@ -112,7 +136,10 @@ static struct half_chan *add_connection(struct routing_state *rstate,
 	struct half_chan *c;
 	struct chan *chan;
 
+	/* Make a unique scid for each pair of nodes. */
 	memset(&scid, 0, sizeof(scid));
+	scid.u64 = siphash24(siphash_seed(), from, sizeof(*from))
+		^ siphash24(siphash_seed(), to, sizeof(*to));
 	chan = get_channel(rstate, &scid);
 	if (!chan)
 		chan = new_chan(rstate, &scid, from, to);
@@ -174,23 +201,139 @@ static void run(const char *name)
 	}
 }
 
-int main(int argc, char *argv[])
+static const char *engine_name(enum route_engine engine)
+{
+	switch (engine) {
+	case ROUTE_ENGINE_DIJKSTRA:
+		return "dijkstra";
+	case ROUTE_ENGINE_BFG:
+		return "bfg";
+	}
+	abort();
+}
+
+struct query {
+	struct pubkey from, to;
+	u64 msatoshi;
+};
+
+/* Returns the route for each query (NULL if none), allocated off ctx. */
+static struct chan ***bench_engine(const tal_t *ctx,
+				   struct routing_state *rstate,
+				   enum route_engine engine,
+				   const struct query *queries,
+				   size_t num_nodes,
+				   const struct siphash_seed *base_seed,
+				   bool perfme)
+{
+	const double riskfactor = 0.01 / BLOCKS_PER_YEAR / 10000;
+	size_t num_runs = tal_count(queries), num_success = 0;
+	struct chan ***routes = tal_arr(ctx, struct chan **, num_runs);
+	struct timemono start, end;
+
+	rstate->route_engine = engine;
+
+	if (perfme)
+		run("perfme-start");
+
+	start = time_mono();
+	for (size_t i = 0; i < num_runs; i++) {
+		u64 fee;
+
+		routes[i] = find_route(routes, rstate,
+				       &queries[i].from, &queries[i].to,
+				       queries[i].msatoshi,
+				       riskfactor,
+				       0.75, base_seed,
+				       &fee);
+		num_success += (routes[i] != NULL);
+	}
+	end = time_mono();
+
+	if (perfme)
+		run("perfme-stop");
+
+	printf("%s: %zu (%zu succeeded) routes in %zu nodes in %"PRIu64" msec (%"PRIu64" nanoseconds per route)\n",
+	       engine_name(engine),
+	       num_runs, num_success, num_nodes,
+	       time_to_msec(timemono_between(end, start)),
+	       time_to_nsec(time_divide(timemono_between(end, start), num_runs)));
+	return routes;
+}
+
+/* Both engines rank by total + risk and break ties alike: must agree. */
+static void check_same_routes(const struct query *queries,
+			      struct chan ***dijkstra, struct chan ***bfg)
+{
+	for (size_t i = 0; i < tal_count(queries); i++) {
+		if (!dijkstra[i] && !bfg[i])
+			continue;
+		if (!dijkstra[i] || !bfg[i]
+		    || tal_count(dijkstra[i]) != tal_count(bfg[i])
+		    || !memeq(dijkstra[i], tal_len(dijkstra[i]),
+			      bfg[i], tal_len(bfg[i])))
+			errx(1, "query %zu: dijkstra route of %zu hops,"
+			     " bfg route of %zu hops differ", i,
+			     dijkstra[i] ? tal_count(dijkstra[i]) : 0,
+			     bfg[i] ? tal_count(bfg[i]) : 0);
+	}
+}
+
+static void bench_graph(const tal_t *ctx, size_t num_nodes, size_t num_runs,
+			bool perfme)
 {
 	static const struct bitcoin_blkid zerohash;
-	const tal_t *ctx = trc = tal_tmpctx(NULL);
+	struct pubkey me = nodeid(0);
 	struct routing_state *rstate;
-	size_t num_nodes = 100, num_runs = 1;
+	struct siphash_seed base_seed;
+	struct query *queries;
+	struct chan ***found_dijkstra, ***found_bfg;
 	struct timemono start, end;
-	size_t num_success;
-	struct pubkey me = nodeid(0);
+
+	in_bench = false;
+	rstate = new_routing_state(ctx, &zerohash, &me, 0);
+	memset(&base_seed, 0, sizeof(base_seed));
+	for (size_t i = 0; i < num_nodes; i++)
+		populate_random_node(rstate, i);
+
+	/* Both engines answer the same queries. */
+	queries = tal_arr(rstate, struct query, num_runs);
+	for (size_t i = 0; i < num_runs; i++) {
+		queries[i].from = nodeid(pseudorand(num_nodes));
+		queries[i].to = nodeid(pseudorand(num_nodes));
+		queries[i].msatoshi = pseudorand(100000);
+	}
+
+	in_bench = true;
+	start = time_mono();
+	rebuild_route_graph(rstate);
+	end = time_mono();
+	printf("%zu nodes: route graph of %zu edges built in %"PRIu64" usec\n",
+	       num_nodes, tal_count(rstate->graph->src),
+	       time_to_usec(timemono_between(end, start)));
+
+	found_dijkstra = bench_engine(rstate, rstate, ROUTE_ENGINE_DIJKSTRA,
+				      queries, num_nodes, &base_seed, perfme);
+	found_bfg = bench_engine(rstate, rstate, ROUTE_ENGINE_BFG,
+				 queries, num_nodes, &base_seed, perfme);
+	check_same_routes(queries, found_dijkstra, found_bfg);
+
+	printf("%zu nodes: struct node %zu bytes, route scratch %zu bytes (%zu allocated)\n",
+	       num_nodes, sizeof(struct node), sizeof(struct route_scratch),
+	       tal_len(rstate->search->scratch));
+
+	tal_free(rstate);
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = trc = tal_tmpctx(NULL);
+	size_t num_nodes = 0, num_runs = 10;
 	bool perfme = false;
-	const double riskfactor = 0.01 / BLOCKS_PER_YEAR / 10000;
-	struct siphash_seed base_seed;
 
 	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
 						 | SECP256K1_CONTEXT_SIGN);
 
-	rstate = new_routing_state(ctx, &zerohash, &me, 0);
 	opt_register_noarg("--perfme", opt_set_bool, &perfme,
 			   "Run perfme-start and perfme-stop around benchmark");
 
@@ -203,39 +346,14 @@ int main(int argc, char *argv[])
 	if (argc > 3)
 		opt_usage_and_exit("[num_nodes [num_runs]]");
 
-	memset(&base_seed, 0, sizeof(base_seed));
-	for (size_t i = 0; i < num_nodes; i++)
-		populate_random_node(rstate, i);
-
-	in_bench = true;
-	if (perfme)
-		run("perfme-start");
-
-	start = time_mono();
-	num_success = 0;
-	for (size_t i = 0; i < num_runs; i++) {
-		struct pubkey from = nodeid(pseudorand(num_nodes));
-		struct pubkey to = nodeid(pseudorand(num_nodes));
-		u64 fee;
-		struct chan **route;
-
-		route = find_route(ctx, rstate, &from, &to,
-				  pseudorand(100000),
-				  riskfactor,
-				  0.75, &base_seed,
-				  &fee);
-		num_success += (route != NULL);
-		tal_free(route);
+	/* Default is the usual spread of graph sizes. */
+	if (num_nodes)
+		bench_graph(ctx, num_nodes, num_runs, perfme);
+	else {
+		bench_graph(ctx, 10000, num_runs, perfme);
+		bench_graph(ctx, 50000, num_runs, perfme);
+		bench_graph(ctx, 100000, num_runs, perfme);
 	}
-	end = time_mono();
-
-	if (perfme)
-		run("perfme-stop");
-
-	printf("%zu (%zu succeeded) routes in %zu nodes in %"PRIu64" msec (%"PRIu64" nanoseconds per route)",
-	       num_runs, num_success, num_nodes,
-	       time_to_msec(timemono_between(end, start)),
-	       time_to_nsec(time_divide(timemono_between(end, start), num_runs)));
 
 	tal_free(ctx);
 	secp256k1_context_destroy(secp256k1_ctx);
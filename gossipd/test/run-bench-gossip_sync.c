@@ -0,0 +1,161 @@
+#include "../broadcast.c"
+#include <assert.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <wire/gen_peer_wire.h>
+
+/* What cryptomsg_encrypt_msg() adds: encrypted length, two MACs. */
+#define ENCRYPT_OVERHEAD (2 + 16 + 16)
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+/* Stands in for struct chan: owns the payloads the queue borrows. */
+struct fake_chan {
+	u8 *announce;
+	u64 announce_idx;
+	u8 *update[2];
+	u64 update_idx[2];
+};
+
+static u8 *channel_tag(const tal_t *ctx, size_t chan, int direction)
+{
+	u8 *tag = tal_arrz(ctx, u8, direction < 0 ? 8 : 10);
+
+	memcpy(tag, &chan, sizeof(chan));
+	if (direction > 0)
+		tag[9] = direction;
+	return tag;
+}
+
+/* As routing.c does it: new payload, replace, then free the old one. */
+static void update_chan(struct broadcast_state *bstate,
+			struct fake_chan *chans, size_t i, int dir)
+{
+	u8 *old = chans[i].update[dir];
+	u8 *tag = channel_tag(NULL, i, dir);
+
+	chans[i].update[dir] = tal_arrz(chans, u8, 130);
+	replace_broadcast(bstate, &chans[i].update_idx[dir],
+			  WIRE_CHANNEL_UPDATE, tag, chans[i].update[dir]);
+	tal_free(tag);
+	tal_free(old);
+}
+
+/* How we used to walk the queue: index++ after each message, so a
+ * message after a gap of N was sent N times. */
+static size_t old_sync_count(struct broadcast_state *bstate)
+{
+	u64 index = 0, last;
+	size_t sent = 0;
+
+	for (;;) {
+		last = index;
+		if (!next_broadcast_message(bstate, &last))
+			return sent;
+		sent++;
+		index++;
+	}
+}
+
+static u64 maxrss_kb(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+	size_t num_channels = 40000, num_peers = 50, num_rounds = 4;
+	struct broadcast_state *bstate;
+	struct fake_chan *chans;
+	struct queued_message *m;
+	struct timemono start;
+	u64 index, *indexes, usec;
+	size_t i, r, p, queued, payload_bytes, sent, sent_bytes, done;
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_channels = atoi(argv[1]);
+	if (argc > 2)
+		num_peers = atoi(argv[2]);
+	if (argc > 3)
+		num_rounds = atoi(argv[3]);
+	if (argc > 4)
+		opt_usage_and_exit("[num_channels [num_peers [update_rounds]]]");
+
+	bstate = new_broadcast_state(NULL);
+	chans = tal_arrz(ctx, struct fake_chan, num_channels);
+	for (i = 0; i < num_channels; i++) {
+		u8 *tag = channel_tag(NULL, i, -1);
+		chans[i].announce = tal_arrz(chans, u8, 430);
+		replace_broadcast(bstate, &chans[i].announce_idx,
+				  WIRE_CHANNEL_ANNOUNCEMENT, tag,
+				  chans[i].announce);
+		tal_free(tag);
+		update_chan(bstate, chans, i, 0);
+		update_chan(bstate, chans, i, 1);
+	}
+	/* Updates keep coming, leaving gaps in the queue. */
+	for (r = 0; r < num_rounds; r++)
+		for (i = 0; i < num_channels * 2; i++)
+			update_chan(bstate, chans, i / 2, i % 2);
+
+	queued = payload_bytes = 0;
+	index = 0;
+	while ((m = next_broadcast_message(bstate, &index)) != NULL) {
+		queued++;
+		payload_bytes += tal_len(m->payload);
+	}
+	printf("%zu channels: %zu queued messages, %zu payload bytes"
+	       " (a private copy in the queue would add %zu more)\n",
+	       num_channels, queued, payload_bytes, payload_bytes);
+
+	/* All the peers connect at once, and take turns to be written. */
+	indexes = tal_arrz(ctx, u64, num_peers);
+	sent = sent_bytes = done = 0;
+	start = time_mono();
+	while (done < num_peers) {
+		done = 0;
+		for (p = 0; p < num_peers; p++) {
+			u8 *out;
+
+			m = next_broadcast_message(bstate, &indexes[p]);
+			if (!m) {
+				done++;
+				continue;
+			}
+			/* The one copy we can't avoid: it's encrypted
+			 * differently for each peer. */
+			out = tal_arr(NULL, u8,
+				      tal_len(m->payload) + ENCRYPT_OVERHEAD);
+			memcpy(out + 18, m->payload, tal_len(m->payload));
+			sent_bytes += tal_len(out);
+			tal_free(out);
+			sent++;
+		}
+	}
+	usec = time_to_usec(timemono_between(time_mono(), start));
+	assert(sent == queued * num_peers);
+
+	printf("%zu peers: %zu messages (%zu bytes) in %"PRIu64" msec:"
+	       " %"PRIu64" messages/sec\n",
+	       num_peers, sent, sent_bytes, usec / 1000,
+	       usec ? sent * 1000000 / usec : 0);
+	printf("Old index++ walk would have sent %zu messages per peer,"
+	       " not %zu\n", old_sync_count(bstate), queued);
+	printf("Max RSS: %"PRIu64" kB\n", maxrss_kb());
+
+	tal_free(bstate);
+	tal_free(ctx);
+	opt_free_table();
+	return 0;
+}
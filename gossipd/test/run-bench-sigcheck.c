@@ -0,0 +1,132 @@
+#include "../../common/parallel.c"
+#include "../sigcheck.c"
+#include <assert.h>
+#include <bitcoin/privkey.h>
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <common/utils.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+/* Matches gossipd's GOSSIP_BATCH_MAX. */
+#define BATCH_MESSAGES 256
+
+/* AUTOGENERATED MOCKS START */
+/* AUTOGENERATED MOCKS END */
+
+static struct privkey privkey(size_t n)
+{
+	struct privkey p;
+
+	memset(&p, 0, sizeof(p));
+	/* Zero isn't a valid secret key. */
+	n++;
+	memcpy(&p, &n, sizeof(n));
+	return p;
+}
+
+static void add_check(struct sigcheck **checks, size_t n, const char *what,
+		      size_t key)
+{
+	struct privkey p = privkey(key);
+	size_t i = tal_count(*checks);
+	char msg[64];
+
+	tal_resize(checks, i + 1);
+	snprintf(msg, sizeof(msg), "%s for channel %zu", what, n);
+	sha256_double(&(*checks)[i].hash, msg, strlen(msg));
+	if (!pubkey_from_privkey(&p, &(*checks)[i].key))
+		abort();
+	sign_hash(&p, &(*checks)[i].hash, &(*checks)[i].sig);
+	(*checks)[i].valid = false;
+}
+
+/* Initial sync is mainly a channel_announcement (four signatures) and two
+ * channel_updates (one each) per channel: we batch them as gossipd does.
+ * Returns total messages. */
+static size_t make_batches(const tal_t *ctx, size_t num_channels,
+			   struct sigcheck ***batches)
+{
+	size_t i, msgs = 0;
+
+	*batches = tal_arr(ctx, struct sigcheck *, 0);
+	for (i = 0; i < num_channels; i++) {
+		size_t b = msgs / BATCH_MESSAGES;
+		if (b == tal_count(*batches)) {
+			tal_resize(batches, b + 1);
+			(*batches)[b] = tal_arr(*batches, struct sigcheck, 0);
+		}
+		add_check(&(*batches)[b], i, "node1", i * 2);
+		add_check(&(*batches)[b], i, "node2", i * 2 + 1);
+		add_check(&(*batches)[b], i, "bitcoin1", i * 2 + 1000000);
+		add_check(&(*batches)[b], i, "bitcoin2", i * 2 + 1000001);
+		add_check(&(*batches)[b], i, "update1", i * 2);
+		add_check(&(*batches)[b], i, "update2", i * 2 + 1);
+		msgs += 3;
+	}
+	return msgs;
+}
+
+static void bench_threads(struct sigcheck **batches, size_t msgs,
+			  size_t num_threads)
+{
+	struct timemono start, end;
+	size_t i, j, sigs = 0;
+	u64 usec;
+
+	start = time_mono();
+	for (i = 0; i < tal_count(batches); i++)
+		sigcheck_batch(batches[i], num_threads);
+	end = time_mono();
+
+	for (i = 0; i < tal_count(batches); i++) {
+		for (j = 0; j < tal_count(batches[i]); j++) {
+			if (!batches[i][j].valid)
+				errx(1, "Signature %zu/%zu failed", i, j);
+			batches[i][j].valid = false;
+		}
+		sigs += tal_count(batches[i]);
+	}
+
+	usec = time_to_usec(timemono_between(end, start));
+	printf("%zu threads: %zu messages (%zu signatures) in %"PRIu64" msec: %"PRIu64" messages/sec\n",
+	       num_threads, msgs, sigs, usec / 1000,
+	       usec ? msgs * 1000000 / usec : 0);
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+	size_t num_channels = 1000, max_threads = parallel_default_threads();
+	struct sigcheck **batches;
+	size_t msgs, t;
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num_channels = atoi(argv[1]);
+	if (argc > 2)
+		max_threads = atoi(argv[2]);
+	if (argc > 3)
+		opt_usage_and_exit("[num_channels [max_threads]]");
+
+	msgs = make_batches(ctx, num_channels, &batches);
+
+	/* A single thread is what we used to do, inline. */
+	for (t = 1; t <= max_threads; t *= 2)
+		bench_threads(batches, msgs, t);
+
+	/* A bad signature must not pass. */
+	batches[0][0].sig = batches[0][1].sig;
+	sigcheck_batch(batches[0], max_threads);
+	assert(!batches[0][0].valid);
+	assert(batches[0][1].valid);
+
+	tal_free(ctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	opt_free_table();
+	return 0;
+}
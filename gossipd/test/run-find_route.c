@@ -6,6 +6,12 @@ struct broadcast_state *new_broadcast_state(tal_t *ctx UNNEEDED)
 	return NULL;
 }
 
+/* Channels are freed on cleanup. */
+void broadcast_del(struct broadcast_state *bstate UNNEEDED, u64 index UNNEEDED,
+		   const u8 *payload UNNEEDED)
+{
+}
+
 void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
 {
 	va_list ap;
@@ -35,6 +41,23 @@ u8 fromwire_u8(const u8 **cursor UNNEEDED, size_t *max UNNEEDED)
 /* Generated stub for fromwire_wireaddr */
 bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
 { fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for gossip_store_add_channel_announcement */
+void gossip_store_add_channel_announcement(struct gossip_store *gs UNNEEDED,
+					   const u8 *announce UNNEEDED,
+					   u64 satoshis UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_channel_announcement called!\n"); abort(); }
+/* Generated stub for gossip_store_add_channel_delete */
+void gossip_store_add_channel_delete(struct gossip_store *gs UNNEEDED,
+				     const struct short_channel_id *scid UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_channel_delete called!\n"); abort(); }
+/* Generated stub for gossip_store_add_channel_update */
+void gossip_store_add_channel_update(struct gossip_store *gs UNNEEDED,
+				     const u8 *update UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_channel_update called!\n"); abort(); }
+/* Generated stub for gossip_store_add_node_announcement */
+void gossip_store_add_node_announcement(struct gossip_store *gs UNNEEDED,
+					const u8 *announce UNNEEDED)
+{ fprintf(stderr, "gossip_store_add_node_announcement called!\n"); abort(); }
 /* Generated stub for onion_type_name */
 const char *onion_type_name(int e UNNEEDED)
 { fprintf(stderr, "onion_type_name called!\n"); abort(); }
@@ -151,7 +174,10 @@ int main(void)
 	struct pubkey a, b, c, d;
 	struct privkey tmp;
 	u64 fee;
-	struct chan **route;
+	struct chan **route, *chan;
+	struct route_hop **routes, *hops;
+	struct route_cache_stats stats;
+	int idx;
 	const double riskfactor = 1.0 / BLOCKS_PER_YEAR / 10000;
 
 	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
@@ -211,14 +237,57 @@ int main(void)
 	assert(channel_is_between(route[1], &b, &c));
 	assert(fee == 1 + 3);
 
+	/* Alternates share no channels: via B, then via D. */
+	routes = get_routes(ctx, rstate, &a, &c, 3000000, 1, 9, 0.0, NULL,
+			    3, false);
+	assert(tal_count(routes) == 2);
+	assert(tal_count(routes[0]) == 2);
+	assert(pubkey_eq(&routes[0][0].nodeid, &b));
+	assert(tal_count(routes[1]) == 2);
+	assert(pubkey_eq(&routes[1][0].nodeid, &d));
+	assert(routes[1][0].amount == 3000000 + 6);
+	route_cache_stats(rstate, &stats);
+	assert(stats.misses == 1);
+	assert(stats.hits == 0);
+	assert(stats.entries == 1);
+
+	/* The first route comes from the cache next time. */
+	routes = get_routes(ctx, rstate, &a, &c, 3000000, 1, 9, 0.0, NULL,
+			    1, true);
+	assert(tal_count(routes) == 1);
+	assert(pubkey_eq(&routes[0][0].nodeid, &b));
+	route_cache_stats(rstate, &stats);
+	assert(stats.misses == 1);
+	assert(stats.hits == 1);
+
+	/* get_route() shares it. */
+	hops = get_route(ctx, rstate, &a, &c, 3000000, 1, 9, 0.0, NULL);
+	assert(pubkey_eq(&hops[0].nodeid, &b));
+	hops = get_route(ctx, rstate, &a, &c, 3000000, 1, 9, 0.0, NULL);
+	assert(pubkey_eq(&hops[0].nodeid, &b));
+	route_cache_stats(rstate, &stats);
+	assert(stats.misses == 1);
+	assert(stats.hits == 3);
+	assert(stats.entries == 1);
+
 	/* Make B->C inactive, force it back via D */
 	get_connection(rstate, &b, &c)->active = false;
+	chan = find_channel(rstate, get_node(rstate, &b), get_node(rstate, &c),
+			    &idx);
+	update_route_graph(rstate, chan, idx);
 	route = find_route(ctx, rstate, &a, &c, 3000000, riskfactor, 0.0, NULL, &fee);
 	assert(tal_count(route) == 2);
 	assert(channel_is_between(route[0], &a, &d));
 	assert(channel_is_between(route[1], &d, &c));
 	assert(fee == 0 + 6);
 
+	/* Cached route used B->C, so it's gone. */
+	hops = get_route(ctx, rstate, &a, &c, 3000000, 1, 9, 0.0, NULL);
+	assert(pubkey_eq(&hops[0].nodeid, &d));
+	route_cache_stats(rstate, &stats);
+	assert(stats.misses == 2);
+	assert(stats.invalidated == 1);
+
 	tal_free(ctx);
 	secp256k1_context_destroy(secp256k1_ctx);
 	return 0;
@@ -0,0 +1,127 @@
+#include "../routing.c"
+#include "../gossip_store.c"
+#include "../gen_gossip_store.c"
+#include "../../wire/fromwire.c"
+#include "../../wire/towire.c"
+#include <stdio.h>
+
+struct broadcast_state *new_broadcast_state(tal_t *ctx UNNEEDED)
+{
+	return NULL;
+}
+
+/* Channels are freed on cleanup. */
+void broadcast_del(struct broadcast_state *bstate UNNEEDED, u64 index UNNEEDED,
+		   const u8 *payload UNNEEDED)
+{
+}
+
+void status_fmt(enum log_level level UNUSED, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+const char *onion_type_name(int e UNNEEDED)
+{
+	return "";
+}
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for fromwire_channel_announcement */
+bool fromwire_channel_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *node_signature_1 UNNEEDED, secp256k1_ecdsa_signature *node_signature_2 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_1 UNNEEDED, secp256k1_ecdsa_signature *bitcoin_signature_2 UNNEEDED, u8 **features UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, struct pubkey *node_id_1 UNNEEDED, struct pubkey *node_id_2 UNNEEDED, struct pubkey *bitcoin_key_1 UNNEEDED, struct pubkey *bitcoin_key_2 UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_channel_update */
+bool fromwire_channel_update(const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, struct bitcoin_blkid *chain_hash UNNEEDED, struct short_channel_id *short_channel_id UNNEEDED, u32 *timestamp UNNEEDED, u16 *flags UNNEEDED, u16 *cltv_expiry_delta UNNEEDED, u64 *htlc_minimum_msat UNNEEDED, u32 *fee_base_msat UNNEEDED, u32 *fee_proportional_millionths UNNEEDED)
+{ fprintf(stderr, "fromwire_channel_update called!\n"); abort(); }
+/* Generated stub for fromwire_node_announcement */
+bool fromwire_node_announcement(const tal_t *ctx UNNEEDED, const void *p UNNEEDED, secp256k1_ecdsa_signature *signature UNNEEDED, u8 **features UNNEEDED, u32 *timestamp UNNEEDED, struct pubkey *node_id UNNEEDED, u8 rgb_color[3] UNNEEDED, u8 alias[32] UNNEEDED, u8 **addresses UNNEEDED)
+{ fprintf(stderr, "fromwire_node_announcement called!\n"); abort(); }
+/* Generated stub for fromwire_wireaddr */
+bool fromwire_wireaddr(const u8 **cursor UNNEEDED, size_t *max UNNEEDED, struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "fromwire_wireaddr called!\n"); abort(); }
+/* Generated stub for replace_broadcast */
+bool replace_broadcast(struct broadcast_state *bstate UNNEEDED,
+		       u64 *index UNNEEDED,
+		       const int type UNNEEDED,
+		       const u8 *tag UNNEEDED,
+		       const u8 *payload UNNEEDED)
+{ fprintf(stderr, "replace_broadcast called!\n"); abort(); }
+/* Generated stub for status_failed */
+void status_failed(enum status_failreason code UNNEEDED,
+		   const char *fmt UNNEEDED, ...)
+{ fprintf(stderr, "status_failed called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+const void *trc;
+
+static void node_id(struct pubkey *id, u8 n)
+{
+	struct privkey p;
+
+	memset(&p, n, sizeof(p));
+	pubkey_from_privkey(&p, id);
+}
+
+/* As if it had been announced: only public channels go in the store. */
+static struct chan *public_chan(struct routing_state *rstate,
+				const struct short_channel_id *scid,
+				const struct pubkey *a, const struct pubkey *b)
+{
+	struct chan *chan = new_chan(rstate, scid, a, b);
+
+	chan->public = true;
+	return chan;
+}
+
+int main(void)
+{
+	static const struct bitcoin_blkid zerohash;
+	const tal_t *ctx = trc = tal_tmpctx(NULL);
+	struct routing_state *rstate;
+	struct short_channel_id scid;
+	struct pubkey a, b;
+	char dir[] = "/tmp/run-gossip_store.XXXXXX";
+
+	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
+						 | SECP256K1_CONTEXT_SIGN);
+
+	/* The store lives in the current directory. */
+	if (!mkdtemp(dir) || chdir(dir) != 0)
+		abort();
+
+	node_id(&a, 1);
+	node_id(&b, 2);
+	mk_short_channel_id(&scid, 1, 1, 1);
+
+	rstate = new_routing_state(ctx, &zerohash, &a, 0);
+	rstate->store = gossip_store_new(rstate);
+	gossip_store_load(rstate->store, rstate);
+	public_chan(rstate, &scid, &a, &b);
+
+	/* A permanent failure drops the channel... */
+	routing_failure(rstate, &b, &scid, WIRE_PERMANENT_CHANNEL_FAILURE, NULL);
+	assert(!get_channel(rstate, &scid));
+	tal_free(rstate);
+
+	/* ...and it stays dropped when we replay its announcement and the
+	 * rest of the store. */
+	rstate = new_routing_state(ctx, &zerohash, &a, 0);
+	rstate->store = gossip_store_new(rstate);
+	public_chan(rstate, &scid, &a, &b);
+	gossip_store_load(rstate->store, rstate);
+	assert(!get_channel(rstate, &scid));
+	tal_free(rstate);
+
+	unlink(GOSSIP_STORE_FILENAME);
+	if (chdir("/") != 0 || rmdir(dir) != 0)
+		abort();
+
+	tal_free(ctx);
+	secp256k1_context_destroy(secp256k1_ctx);
+	return 0;
+}
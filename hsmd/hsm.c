@@ -147,6 +147,41 @@ static struct io_plan *handle_ecdh(struct io_conn *conn, struct daemon_conn *dc)
 	return daemon_conn_read_next(conn, dc);
 }
 
+static struct io_plan *handle_ecdh_batch(struct io_conn *conn,
+					 struct daemon_conn *dc)
+{
+	struct client *c = container_of(dc, struct client, dc);
+	const tal_t *tmpctx = tal_tmpctx(c);
+	struct privkey privkey;
+	struct pubkey *points;
+	struct secret *ss;
+
+	if (!fromwire_hsm_ecdh_batch_req(tmpctx, dc->msg_in, &points)) {
+		daemon_conn_send(c->master,
+				 take(towire_hsmstatus_client_bad_request(c,
+								&c->id,
+								dc->msg_in)));
+		tal_free(tmpctx);
+		return io_close(conn);
+	}
+
+	node_key(&privkey, NULL);
+	ss = tal_arr(tmpctx, struct secret, tal_count(points));
+	for (size_t i = 0; i < tal_count(points); i++) {
+		/* One bad point shouldn't fail the rest of the batch. */
+		if (secp256k1_ecdh(secp256k1_ctx, ss[i].data, &points[i].pubkey,
+				   privkey.secret.data) != 1) {
+			status_unusual("secp256k1_ecdh fail for client %s",
+				       type_to_string(trc, struct pubkey, &c->id));
+			memset(&ss[i], 0, sizeof(ss[i]));
+		}
+	}
+
+	daemon_conn_send(dc, take(towire_hsm_ecdh_batch_resp(c, ss)));
+	tal_free(tmpctx);
+	return daemon_conn_read_next(conn, dc);
+}
+
 static struct io_plan *handle_cannouncement_sig(struct io_conn *conn,
 						struct daemon_conn *dc)
 {
@@ -243,6 +278,7 @@ static bool check_client_capabilities(struct client *client,
 {
 	switch (t) {
 	case WIRE_HSM_ECDH_REQ:
+	case WIRE_HSM_ECDH_BATCH_REQ:
 		return (client->capabilities & HSM_CAP_ECDH) != 0;
 
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REQ:
@@ -260,6 +296,7 @@ static bool check_client_capabilities(struct client *client,
       /* These are messages sent by the HSM so we should never receive
        * them */
 	case WIRE_HSM_ECDH_RESP:
+	case WIRE_HSM_ECDH_BATCH_RESP:
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REPLY:
 	case WIRE_HSM_CUPDATE_SIG_REPLY:
 	case WIRE_HSM_CLIENT_HSMFD_REPLY:
@@ -305,6 +342,9 @@ static struct io_plan *handle_client(struct io_conn *conn,
 	case WIRE_HSM_ECDH_REQ:
 		return handle_ecdh(conn, dc);
 
+	case WIRE_HSM_ECDH_BATCH_REQ:
+		return handle_ecdh_batch(conn, dc);
+
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REQ:
 		return handle_cannouncement_sig(conn, dc);
 
@@ -328,6 +368,7 @@ static struct io_plan *handle_client(struct io_conn *conn,
 		return daemon_conn_read_next(conn, dc);
 
 	case WIRE_HSM_ECDH_RESP:
+	case WIRE_HSM_ECDH_BATCH_RESP:
 	case WIRE_HSM_CANNOUNCEMENT_SIG_REPLY:
 	case WIRE_HSM_CUPDATE_SIG_REPLY:
 	case WIRE_HSM_CLIENT_HSMFD_REPLY:
@@ -22,34 +22,12 @@ void channel_set_owner(struct channel *channel, struct subd *owner)
 
 struct htlc_out *channel_has_htlc_out(struct channel *channel)
 {
-	struct htlc_out_map_iter outi;
-	struct htlc_out *hout;
-	struct lightningd *ld = channel->peer->ld;
-
-	for (hout = htlc_out_map_first(&ld->htlcs_out, &outi);
-	     hout;
-	     hout = htlc_out_map_next(&ld->htlcs_out, &outi)) {
-		if (hout->key.channel == channel)
-			return hout;
-	}
-
-	return NULL;
+	return list_top(&channel->htlcs_out, struct htlc_out, list);
 }
 
 struct htlc_in *channel_has_htlc_in(struct channel *channel)
 {
-	struct htlc_in_map_iter ini;
-	struct htlc_in *hin;
-	struct lightningd *ld = channel->peer->ld;
-
-	for (hin = htlc_in_map_first(&ld->htlcs_in, &ini);
-	     hin;
-	     hin = htlc_in_map_next(&ld->htlcs_in, &ini)) {
-		if (hin->key.channel == channel)
-			return hin;
-	}
-
-	return NULL;
+	return list_top(&channel->htlcs_in, struct htlc_in, list);
 }
 
 static void destroy_channel(struct channel *channel)
@@ -71,6 +49,7 @@ static void destroy_channel(struct channel *channel)
 	/* Free any old owner still hanging around. */
 	channel_set_owner(channel, NULL);
 
+	htlc_out_ripemd_map_clear(&channel->htlcs_out_by_ripemd);
 	list_del_from(&channel->peer->channels, &channel->list);
 }
 
@@ -203,6 +182,11 @@ struct channel *new_channel(struct peer *peer, u64 dbid,
 	channel->last_was_revoke = last_was_revoke;
 	channel->last_sent_commit = tal_steal(channel, last_sent_commit);
 	channel->first_blocknum = first_blocknum;
+	/* Nothing's in the db yet (wallet clears this when loading). */
+	channel->dirty = CHANNEL_DIRTY_ALL;
+	list_head_init(&channel->htlcs_in);
+	list_head_init(&channel->htlcs_out);
+	htlc_out_ripemd_map_init(&channel->htlcs_out_by_ripemd);
 	derive_channel_seed(peer->ld, &channel->seed, &peer->id, channel->dbid);
 
 	list_add_tail(&peer->channels, &channel->list);
@@ -263,6 +247,7 @@ void channel_set_last_tx(struct channel *channel,
 	channel->last_sig = *sig;
 	tal_free(channel->last_tx);
 	channel->last_tx = tal_steal(channel, tx);
+	channel->dirty |= CHANNEL_DIRTY_LAST_TX;
 }
 
 void channel_set_state(struct channel *channel,
@@ -276,8 +261,8 @@ void channel_set_state(struct channel *channel,
 		      channel_state_name(channel), channel_state_str(old_state));
 
 	channel->state = state;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 
-	/* TODO(cdecker) Selectively save updated fields to DB */
 	wallet_channel_save(channel->peer->ld->wallet, channel);
 }
 
@@ -14,6 +14,21 @@ struct billboard {
 	const char *transient;
 };
 
+/* Which parts of a channel wallet_channel_save needs to write out. */
+enum channel_dirty {
+	/* state, scid, indices, balance, feerates, per-commit points. */
+	CHANNEL_DIRTY_STATE = 1,
+	/* last_tx and last_sig. */
+	CHANNEL_DIRTY_LAST_TX = 2,
+	/* Both channel_configs, and what we agreed on at open. */
+	CHANNEL_DIRTY_CONFIG = 4,
+	/* Their funding pubkey and basepoints. */
+	CHANNEL_DIRTY_BASEPOINTS = 8,
+	/* Their shutdown scriptpubkey, and our final key. */
+	CHANNEL_DIRTY_SHUTDOWN = 16,
+};
+#define CHANNEL_DIRTY_ALL 31
+
 struct channel {
 	/* Inside peer->channels. */
 	struct list_node list;
@@ -90,6 +105,13 @@ struct channel {
 	/* Blockheight at creation, scans for funding confirmations
 	 * will start here */
 	u64 first_blocknum;
+
+	/* Our HTLCs (also in ld->htlcs_in and ld->htlcs_out). */
+	struct list_head htlcs_in, htlcs_out;
+	struct htlc_out_ripemd_map htlcs_out_by_ripemd;
+
+	/* enum channel_dirty bits: what's changed since we last saved. */
+	u8 dirty;
 };
 
 struct channel *new_channel(struct peer *peer, u64 dbid,
@@ -40,6 +40,7 @@ static void peer_got_funding_locked(struct channel *channel, const u8 *msg)
 
 	log_debug(channel->log, "Got funding_locked");
 	channel->remote_funding_locked = true;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 }
 
 static void peer_got_shutdown(struct channel *channel, const u8 *msg)
@@ -56,6 +57,7 @@ static void peer_got_shutdown(struct channel *channel, const u8 *msg)
 	/* FIXME: Add to spec that we must allow repeated shutdown! */
 	tal_free(channel->remote_shutdown_scriptpubkey);
 	channel->remote_shutdown_scriptpubkey = scriptpubkey;
+	channel->dirty |= CHANNEL_DIRTY_SHUTDOWN;
 
 	/* BOLT #2:
 	 *
@@ -81,7 +83,6 @@ static void peer_got_shutdown(struct channel *channel, const u8 *msg)
 		channel_set_state(channel,
 				  CHANNELD_NORMAL, CHANNELD_SHUTTING_DOWN);
 
-	/* TODO(cdecker) Selectively save updated fields to DB */
 	wallet_channel_save(ld->wallet, channel);
 }
 
@@ -151,10 +152,12 @@ static unsigned channel_msg(struct subd *sd, const u8 *msg, const int *fds)
 	case WIRE_CHANNEL_SEND_SHUTDOWN:
 	case WIRE_CHANNEL_DEV_REENABLE_COMMIT:
 	case WIRE_CHANNEL_FEERATES:
+	case WIRE_CHANNEL_COMMIT_STATS:
 	/* Replies go to requests. */
 	case WIRE_CHANNEL_OFFER_HTLC_REPLY:
 	case WIRE_CHANNEL_PING_REPLY:
 	case WIRE_CHANNEL_DEV_REENABLE_COMMIT_REPLY:
+	case WIRE_CHANNEL_COMMIT_STATS_REPLY:
 		break;
 	}
 
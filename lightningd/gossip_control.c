@@ -119,6 +119,8 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIPCTL_INIT:
 	case WIRE_GOSSIP_GETNODES_REQUEST:
 	case WIRE_GOSSIP_GETROUTE_REQUEST:
+	case WIRE_GOSSIP_GETROUTES_REQUEST:
+	case WIRE_GOSSIP_ROUTECACHE_STATS:
 	case WIRE_GOSSIP_GETCHANNELS_REQUEST:
 	case WIRE_GOSSIP_GETPEERS_REQUEST:
 	case WIRE_GOSSIP_PING:
@@ -138,6 +140,8 @@ static unsigned gossip_msg(struct subd *gossip, const u8 *msg, const int *fds)
 	case WIRE_GOSSIP_GET_UPDATE_REPLY:
 	case WIRE_GOSSIP_GETNODES_REPLY:
 	case WIRE_GOSSIP_GETROUTE_REPLY:
+	case WIRE_GOSSIP_GETROUTES_REPLY:
+	case WIRE_GOSSIP_ROUTECACHE_STATS_REPLY:
 	case WIRE_GOSSIP_GETCHANNELS_REPLY:
 	case WIRE_GOSSIP_GETPEERS_REPLY:
 	case WIRE_GOSSIP_PING_REPLY:
@@ -206,7 +210,8 @@ void gossip_init(struct lightningd *ld)
 	    &get_chainparams(ld)->genesis_blockhash, &ld->id, ld->portnum,
 	    get_supported_global_features(tmpctx),
 	    get_supported_local_features(tmpctx), ld->wireaddrs, ld->rgb,
-	    ld->alias, ld->config.channel_update_interval);
+	    ld->alias, ld->config.channel_update_interval,
+	    ld->config.bfg_routing);
 	subd_send_msg(ld->gossip, msg);
 	tal_free(tmpctx);
 }
@@ -286,12 +291,29 @@ static const struct json_command listnodes_command = {
 };
 AUTODATA(json_command, &listnodes_command);
 
+static void json_add_route(struct json_result *response, const char *fieldname,
+			   const struct route_hop *hops)
+{
+	size_t i;
+
+	json_array_start(response, fieldname);
+	for (i = 0; i < tal_count(hops); i++) {
+		json_object_start(response, NULL);
+		json_add_pubkey(response, "id", &hops[i].nodeid);
+		json_add_short_channel_id(response, "channel",
+					  &hops[i].channel_id);
+		json_add_u64(response, "msatoshi", hops[i].amount);
+		json_add_num(response, "delay", hops[i].delay);
+		json_object_end(response);
+	}
+	json_array_end(response);
+}
+
 static void json_getroute_reply(struct subd *gossip UNUSED, const u8 *reply, const int *fds UNUSED,
 				struct command *cmd)
 {
 	struct json_result *response;
 	struct route_hop *hops;
-	size_t i;
 
 	fromwire_gossip_getroute_reply(reply, reply, &hops);
 
@@ -302,108 +324,127 @@ static void json_getroute_reply(struct subd *gossip UNUSED, const u8 *reply, con
 
 	response = new_json_result(cmd);
 	json_object_start(response, NULL);
-	json_array_start(response, "route");
-	for (i = 0; i < tal_count(hops); i++) {
-		json_object_start(response, NULL);
-		json_add_pubkey(response, "id", &hops[i].nodeid);
-		json_add_short_channel_id(response, "channel",
-					  &hops[i].channel_id);
-		json_add_u64(response, "msatoshi", hops[i].amount);
-		json_add_num(response, "delay", hops[i].delay);
-		json_object_end(response);
-	}
-	json_array_end(response);
+	json_add_route(response, "route", hops);
 	json_object_end(response);
 	command_success(cmd, response);
 }
 
-static void json_getroute(struct command *cmd, const char *buffer, const jsmntok_t *params)
-{
-	struct lightningd *ld = cmd->ld;
-	struct pubkey source = ld->id, destination;
-	jsmntok_t *idtok, *msatoshitok, *riskfactortok, *cltvtok, *fromidtok;
-	jsmntok_t *fuzztok;
-	jsmntok_t *seedtok;
+/* Parameters common to getroute and getroutes. */
+struct route_query {
+	struct pubkey source, destination;
 	u64 msatoshi;
-	unsigned cltv = 9;
+	unsigned cltv;
 	double riskfactor;
+	double fuzz;
+	struct siphash_seed seed;
+};
+
+static bool json_route_query(struct command *cmd, const char *buffer,
+			     const jsmntok_t *idtok,
+			     const jsmntok_t *msatoshitok,
+			     const jsmntok_t *riskfactortok,
+			     const jsmntok_t *cltvtok,
+			     const jsmntok_t *fromidtok,
+			     const jsmntok_t *fuzztok,
+			     const jsmntok_t *seedtok,
+			     struct route_query *q)
+{
+	q->source = cmd->ld->id;
+	q->cltv = 9;
 	/* Higher fuzz means that some high-fee paths can be discounted
 	 * for an even larger value, increasing the scope for route
 	 * randomization (the higher-fee paths become more likely to
 	 * be selected) at the cost of increasing the probability of
 	 * selecting the higher-fee paths. */
-	double fuzz = 75.0;
-	struct siphash_seed seed;
-
-	if (!json_get_params(cmd, buffer, params,
-			     "id", &idtok,
-			     "msatoshi", &msatoshitok,
-			     "riskfactor", &riskfactortok,
-			     "?cltv", &cltvtok,
-			     "?fromid", &fromidtok,
-			     "?fuzzpercent", &fuzztok,
-			     "?seed", &seedtok,
-			     NULL)) {
-		return;
-	}
+	q->fuzz = 75.0;
 
-	if (!json_tok_pubkey(buffer, idtok, &destination)) {
+	if (!json_tok_pubkey(buffer, idtok, &q->destination)) {
 		command_fail(cmd, "Invalid id");
-		return;
+		return false;
 	}
 
-	if (cltvtok && !json_tok_number(buffer, cltvtok, &cltv)) {
+	if (cltvtok && !json_tok_number(buffer, cltvtok, &q->cltv)) {
 		command_fail(cmd, "Invalid cltv");
-		return;
+		return false;
 	}
 
-	if (!json_tok_u64(buffer, msatoshitok, &msatoshi)) {
+	if (!json_tok_u64(buffer, msatoshitok, &q->msatoshi)) {
 		command_fail(cmd, "'%.*s' is not a valid number",
 			     msatoshitok->end - msatoshitok->start,
 			     buffer + msatoshitok->start);
-		return;
+		return false;
 	}
 
-	if (!json_tok_double(buffer, riskfactortok, &riskfactor)) {
+	if (!json_tok_double(buffer, riskfactortok, &q->riskfactor)) {
 		command_fail(cmd, "'%.*s' is not a valid double",
 			     riskfactortok->end - riskfactortok->start,
 			     buffer + riskfactortok->start);
-		return;
+		return false;
 	}
 
-	if (fromidtok && !json_tok_pubkey(buffer, fromidtok, &source)) {
+	if (fromidtok && !json_tok_pubkey(buffer, fromidtok, &q->source)) {
 		command_fail(cmd, "Invalid from id");
-		return;
+		return false;
 	}
 
 	if (fuzztok &&
-	    !json_tok_double(buffer, fuzztok, &fuzz)) {
+	    !json_tok_double(buffer, fuzztok, &q->fuzz)) {
 		command_fail(cmd, "'%.*s' is not a valid double",
 			     (int)(fuzztok->end - fuzztok->start),
 			     buffer + fuzztok->start);
-		return;
+		return false;
 	}
-	if (!(0.0 <= fuzz && fuzz <= 100.0)) {
+	if (!(0.0 <= q->fuzz && q->fuzz <= 100.0)) {
 		command_fail(cmd,
 			     "fuzz must be in range 0.0 <= %f <= 100.0",
-			     fuzz);
-		return;
+			     q->fuzz);
+		return false;
 	}
 	/* Convert from percentage */
-	fuzz = fuzz / 100.0;
+	q->fuzz = q->fuzz / 100.0;
 
 	if (seedtok) {
-		if (seedtok->end - seedtok->start > sizeof(seed))
+		if (seedtok->end - seedtok->start > sizeof(q->seed)) {
 			command_fail(cmd,
-				     "seed must be < %zu bytes", sizeof(seed));
+				     "seed must be < %zu bytes",
+				     sizeof(q->seed));
+			return false;
+		}
 
-		memset(&seed, 0, sizeof(seed));
-		memcpy(&seed, buffer + seedtok->start,
+		memset(&q->seed, 0, sizeof(q->seed));
+		memcpy(&q->seed, buffer + seedtok->start,
 		       seedtok->end - seedtok->start);
 	} else
-		randombytes_buf(&seed, sizeof(seed));
+		randombytes_buf(&q->seed, sizeof(q->seed));
+
+	return true;
+}
+
+static void json_getroute(struct command *cmd, const char *buffer, const jsmntok_t *params)
+{
+	struct lightningd *ld = cmd->ld;
+	jsmntok_t *idtok, *msatoshitok, *riskfactortok, *cltvtok, *fromidtok;
+	jsmntok_t *fuzztok;
+	jsmntok_t *seedtok;
+	struct route_query q;
+
+	if (!json_get_params(cmd, buffer, params,
+			     "id", &idtok,
+			     "msatoshi", &msatoshitok,
+			     "riskfactor", &riskfactortok,
+			     "?cltv", &cltvtok,
+			     "?fromid", &fromidtok,
+			     "?fuzzpercent", &fuzztok,
+			     "?seed", &seedtok,
+			     NULL)) {
+		return;
+	}
 
-	u8 *req = towire_gossip_getroute_request(cmd, &source, &destination, msatoshi, riskfactor*1000, cltv, &fuzz, &seed);
+	if (!json_route_query(cmd, buffer, idtok, msatoshitok, riskfactortok,
+			      cltvtok, fromidtok, fuzztok, seedtok, &q))
+		return;
+
+	u8 *req = towire_gossip_getroute_request(cmd, &q.source, &q.destination, q.msatoshi, q.riskfactor*1000, q.cltv, &q.fuzz, &q.seed);
 	subd_req(ld->gossip, ld->gossip, req, -1, 0, json_getroute_reply, cmd);
 	command_still_pending(cmd);
 }
@@ -418,6 +459,163 @@ static const struct json_command getroute_command = {
 };
 AUTODATA(json_command, &getroute_command);
 
+struct route_hop **gossip_getroutes_reply_routes(const tal_t *ctx,
+						 const u8 *reply)
+{
+	u16 *route_lens;
+	struct route_hop *hops, **routes;
+	size_t i, off = 0;
+
+	if (!fromwire_gossip_getroutes_reply(ctx, reply, &route_lens, &hops))
+		return NULL;
+
+	routes = tal_arr(ctx, struct route_hop *, tal_count(route_lens));
+	for (i = 0; i < tal_count(route_lens); i++) {
+		if (off + route_lens[i] > tal_count(hops))
+			return tal_free(routes);
+		routes[i] = tal_dup_arr(routes, struct route_hop,
+					hops + off, route_lens[i], 0);
+		off += route_lens[i];
+	}
+	tal_free(route_lens);
+	tal_free(hops);
+	return routes;
+}
+
+static void json_getroutes_reply(struct subd *gossip UNUSED, const u8 *reply,
+				 const int *fds UNUSED, struct command *cmd)
+{
+	struct json_result *response;
+	struct route_hop **routes;
+	size_t i;
+
+	routes = gossip_getroutes_reply_routes(cmd, reply);
+	if (!routes) {
+		command_fail(cmd, "Invalid getroutes reply from gossipd");
+		return;
+	}
+
+	if (tal_count(routes) == 0) {
+		command_fail(cmd, "Could not find a route");
+		return;
+	}
+
+	response = new_json_result(cmd);
+	json_object_start(response, NULL);
+	json_array_start(response, "routes");
+	for (i = 0; i < tal_count(routes); i++) {
+		json_object_start(response, NULL);
+		json_add_route(response, "route", routes[i]);
+		json_object_end(response);
+	}
+	json_array_end(response);
+	json_object_end(response);
+	command_success(cmd, response);
+}
+
+static void json_getroutes(struct command *cmd, const char *buffer, const jsmntok_t *params)
+{
+	struct lightningd *ld = cmd->ld;
+	jsmntok_t *idtok, *msatoshitok, *riskfactortok, *cltvtok, *fromidtok;
+	jsmntok_t *fuzztok, *seedtok, *maxroutestok, *nodedisjointtok;
+	struct route_query q;
+	unsigned int maxroutes = 3;
+	bool nodedisjoint = false;
+	u8 *req;
+
+	if (!json_get_params(cmd, buffer, params,
+			     "id", &idtok,
+			     "msatoshi", &msatoshitok,
+			     "riskfactor", &riskfactortok,
+			     "?maxroutes", &maxroutestok,
+			     "?nodedisjoint", &nodedisjointtok,
+			     "?cltv", &cltvtok,
+			     "?fromid", &fromidtok,
+			     "?fuzzpercent", &fuzztok,
+			     "?seed", &seedtok,
+			     NULL)) {
+		return;
+	}
+
+	if (maxroutestok
+	    && (!json_tok_number(buffer, maxroutestok, &maxroutes)
+		|| maxroutes == 0 || maxroutes > ROUTING_MAX_ALTERNATES)) {
+		command_fail(cmd, "maxroutes must be between 1 and %u",
+			     ROUTING_MAX_ALTERNATES);
+		return;
+	}
+
+	if (nodedisjointtok
+	    && !json_tok_bool(buffer, nodedisjointtok, &nodedisjoint)) {
+		command_fail(cmd, "nodedisjoint must be true or false");
+		return;
+	}
+
+	if (!json_route_query(cmd, buffer, idtok, msatoshitok, riskfactortok,
+			      cltvtok, fromidtok, fuzztok, seedtok, &q))
+		return;
+
+	req = towire_gossip_getroutes_request(cmd, &q.source, &q.destination,
+					      q.msatoshi, q.riskfactor*1000,
+					      q.cltv, &q.fuzz, &q.seed,
+					      maxroutes, nodedisjoint);
+	subd_req(ld->gossip, ld->gossip, req, -1, 0, json_getroutes_reply, cmd);
+	command_still_pending(cmd);
+}
+
+static const struct json_command getroutes_command = {
+	"getroutes",
+	json_getroutes,
+	"Show up to {maxroutes} (default 3) alternate routes to {id} for {msatoshi}, "
+	"cheapest first, which share no channels (and if {nodedisjoint}, no intermediate nodes). "
+	"Other parameters are as for getroute."
+};
+AUTODATA(json_command, &getroutes_command);
+
+#if DEVELOPER
+static void json_routecache_reply(struct subd *gossip UNUSED, const u8 *reply,
+				  const int *fds UNUSED, struct command *cmd)
+{
+	struct json_result *response;
+	u64 hits, misses, invalidated;
+	u32 entries;
+
+	if (!fromwire_gossip_routecache_stats_reply(reply, &hits, &misses,
+						    &invalidated, &entries)) {
+		command_fail(cmd, "Invalid routecache reply from gossipd");
+		return;
+	}
+
+	response = new_json_result(cmd);
+	json_object_start(response, NULL);
+	json_add_u64(response, "hits", hits);
+	json_add_u64(response, "misses", misses);
+	json_add_u64(response, "invalidated", invalidated);
+	json_add_num(response, "entries", entries);
+	json_object_end(response);
+	command_success(cmd, response);
+}
+
+static void json_dev_routecache(struct command *cmd,
+				const char *buffer UNUSED,
+				const jsmntok_t *params UNUSED)
+{
+	struct lightningd *ld = cmd->ld;
+	u8 *req = towire_gossip_routecache_stats(cmd);
+
+	subd_req(ld->gossip, ld->gossip, req, -1, 0,
+		 json_routecache_reply, cmd);
+	command_still_pending(cmd);
+}
+
+static const struct json_command dev_routecache_command = {
+	"dev-routecache",
+	json_dev_routecache,
+	"Show hits and misses of gossipd's route cache (getroute, getroutes and pay)"
+};
+AUTODATA(json_command, &dev_routecache_command);
+#endif /* DEVELOPER */
+
 /* Called upon receiving a getchannels_reply from `gossipd` */
 static void json_listchannels_reply(struct subd *gossip UNUSED, const u8 *reply,
 				   const int *fds UNUSED, struct command *cmd)
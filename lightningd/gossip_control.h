@@ -2,9 +2,15 @@
 #define LIGHTNING_LIGHTNINGD_GOSSIP_CONTROL_H
 #include "config.h"
 #include <ccan/short_types/short_types.h>
+#include <ccan/tal/tal.h>
 #include <stdbool.h>
 
 struct lightningd;
+struct route_hop;
 
 void gossip_init(struct lightningd *ld);
+
+/* Split a gossip_getroutes_reply into its routes; NULL if malformed. */
+struct route_hop **gossip_getroutes_reply_routes(const tal_t *ctx,
+						 const u8 *reply);
 #endif /* LIGHTNING_LIGHTNINGD_GOSSIP_CONTROL_H */
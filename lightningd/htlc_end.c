@@ -5,6 +5,7 @@
 #include <common/htlc.h>
 #include <common/memleak.h>
 #include <common/pseudorand.h>
+#include <lightningd/channel.h>
 #include <lightningd/htlc_end.h>
 #include <lightningd/log.h>
 #include <stdio.h>
@@ -20,6 +21,11 @@ size_t hash_htlc_key(const struct htlc_key *k)
 	return siphash24_done(&ctx);
 }
 
+size_t hash_ripemd(const struct ripemd160 *ripemd)
+{
+	return siphash24(siphash_seed(), ripemd, sizeof(*ripemd));
+}
+
 struct htlc_in *find_htlc_in(const struct htlc_in_map *map,
 			       const struct channel *channel,
 			       u64 htlc_id)
@@ -31,12 +37,16 @@ struct htlc_in *find_htlc_in(const struct htlc_in_map *map,
 static void destroy_htlc_in(struct htlc_in *hend, struct htlc_in_map *map)
 {
 	htlc_in_map_del(map, hend);
+	list_del_from(&hend->key.channel->htlcs_in, &hend->list);
+	htlc_deadline_del(&hend->deadline);
 }
 
 void connect_htlc_in(struct htlc_in_map *map, struct htlc_in *hend)
 {
+	hend->deadline.heap = NULL;
 	tal_add_destructor2(hend, destroy_htlc_in, map);
 	htlc_in_map_add(map, hend);
+	list_add_tail(&hend->key.channel->htlcs_in, &hend->list);
 }
 
 struct htlc_out *find_htlc_out(const struct htlc_out_map *map,
@@ -49,13 +59,106 @@ struct htlc_out *find_htlc_out(const struct htlc_out_map *map,
 
 static void destroy_htlc_out(struct htlc_out *hend, struct htlc_out_map *map)
 {
+	struct channel *channel = hend->key.channel;
+
 	htlc_out_map_del(map, hend);
+	list_del_from(&channel->htlcs_out, &hend->list);
+	htlc_out_ripemd_map_del(&channel->htlcs_out_by_ripemd, hend);
+	htlc_deadline_del(&hend->deadline);
 }
 
 void connect_htlc_out(struct htlc_out_map *map, struct htlc_out *hend)
 {
+	struct channel *channel = hend->key.channel;
+
+	hend->deadline.heap = NULL;
 	tal_add_destructor2(hend, destroy_htlc_out, map);
 	htlc_out_map_add(map, hend);
+	list_add_tail(&channel->htlcs_out, &hend->list);
+	ripemd160(&hend->payment_ripemd,
+		  &hend->payment_hash, sizeof(hend->payment_hash));
+	htlc_out_ripemd_map_add(&channel->htlcs_out_by_ripemd, hend);
+}
+
+static void heap_set(struct htlc_deadline **heap, size_t i,
+		     struct htlc_deadline *d)
+{
+	heap[i] = d;
+	d->idx = i;
+}
+
+static void heap_up(struct htlc_deadline **heap, size_t i)
+{
+	struct htlc_deadline *d = heap[i];
+
+	while (i > 0 && heap[(i - 1) / 2]->height > d->height) {
+		heap_set(heap, i, heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(heap, i, d);
+}
+
+static void heap_down(struct htlc_deadline **heap, size_t i)
+{
+	struct htlc_deadline *d = heap[i];
+	size_t n = tal_count(heap), child;
+
+	while ((child = i * 2 + 1) < n) {
+		if (child + 1 < n
+		    && heap[child + 1]->height < heap[child]->height)
+			child++;
+		if (heap[child]->height >= d->height)
+			break;
+		heap_set(heap, i, heap[child]);
+		i = child;
+	}
+	heap_set(heap, i, d);
+}
+
+void htlc_deadline_add(struct htlc_deadlines *deadlines,
+		       struct htlc_deadline *deadline, u32 height)
+{
+	size_t n;
+
+	htlc_deadline_del(deadline);
+
+	n = tal_count(deadlines->heap);
+	tal_resize(&deadlines->heap, n + 1);
+	deadline->heap = deadlines;
+	deadline->height = height;
+	heap_set(deadlines->heap, n, deadline);
+	heap_up(deadlines->heap, n);
+}
+
+void htlc_deadline_del(struct htlc_deadline *deadline)
+{
+	struct htlc_deadline **heap;
+	size_t i, n;
+
+	if (!deadline->heap)
+		return;
+
+	heap = deadline->heap->heap;
+	i = deadline->idx;
+	n = tal_count(heap) - 1;
+
+	/* Move the last one into the hole, and put it where it belongs. */
+	if (i != n) {
+		heap_set(heap, i, heap[n]);
+		if (i > 0 && heap[(i - 1) / 2]->height > heap[i]->height)
+			heap_up(heap, i);
+		else
+			heap_down(heap, i);
+	}
+	tal_resize(&deadline->heap->heap, n);
+	deadline->heap = NULL;
+}
+
+struct htlc_deadline *htlc_deadline_first(const struct htlc_deadlines *d)
+{
+	if (tal_count(d->heap) == 0)
+		return NULL;
+	return d->heap[0];
 }
 
 static void *PRINTF_FMT(2,3)
@@ -1,8 +1,11 @@
 #ifndef LIGHTNING_LIGHTNINGD_HTLC_END_H
 #define LIGHTNING_LIGHTNINGD_HTLC_END_H
 #include "config.h"
+#include <ccan/crypto/ripemd160/ripemd160.h>
 #include <ccan/htable/htable_type.h>
+#include <ccan/list/list.h>
 #include <ccan/short_types/short_types.h>
+#include <ccan/structeq/structeq.h>
 #include <common/htlc_state.h>
 #include <common/sphinx.h>
 #include <wire/gen_onion_wire.h>
@@ -15,8 +18,23 @@ struct htlc_key {
 
 #define HTLC_INVALID_ID (-1ULL)
 
+/* Min-heap of HTLCs by the block at which they're overdue. */
+struct htlc_deadlines {
+	struct htlc_deadline **heap;
+};
+
+/* Where an HTLC is in htlc_deadlines (if heap is non-NULL). */
+struct htlc_deadline {
+	struct htlc_deadlines *heap;
+	size_t idx;
+	u32 height;
+};
+
 /* Incoming HTLC */
 struct htlc_in {
+	/* Inside key.channel->htlcs_in, once connected. */
+	struct list_node list;
+
 	/* The database primary key for this htlc. Must be 0 until it
 	 * is saved to the database, must be >0 after saving to the
 	 * database. */
@@ -46,9 +64,14 @@ struct htlc_in {
 	/* If they fulfilled, here's the preimage. */
 	struct preimage *preimage;
 
+	/* Once fulfilled, in ld->htlc_in_deadlines. */
+	struct htlc_deadline deadline;
 };
 
 struct htlc_out {
+	/* Inside key.channel->htlcs_out, once connected. */
+	struct list_node list;
+
 	/* The database primary key for this htlc. Must be 0 until it
 	 * is saved to the database, must be >0 after saving to the
 	 * database. */
@@ -59,6 +82,10 @@ struct htlc_out {
 	u32 cltv_expiry;
 	struct sha256 payment_hash;
 
+	/* What onchain HTLC scripts contain: key.channel->htlcs_out_by_ripemd
+	 * finds us by this. */
+	struct ripemd160 payment_ripemd;
+
 	enum htlc_state hstate;
 
 	/* Onion information */
@@ -75,6 +102,9 @@ struct htlc_out {
 
 	/* Where it's from, if not going to us. */
 	struct htlc_in *in;
+
+	/* In ld->htlc_out_deadlines. */
+	struct htlc_deadline deadline;
 };
 
 static inline const struct htlc_key *keyof_htlc_in(const struct htlc_in *in)
@@ -87,7 +117,14 @@ static inline const struct htlc_key *keyof_htlc_out(const struct htlc_out *out)
 	return &out->key;
 }
 
+static inline const struct ripemd160 *
+keyof_htlc_out_ripemd(const struct htlc_out *out)
+{
+	return &out->payment_ripemd;
+}
+
 size_t hash_htlc_key(const struct htlc_key *htlc_key);
+size_t hash_ripemd(const struct ripemd160 *ripemd);
 
 static inline bool htlc_in_eq(const struct htlc_in *in, const struct htlc_key *k)
 {
@@ -104,9 +141,19 @@ static inline bool htlc_out_eq(const struct htlc_out *out,
 HTABLE_DEFINE_TYPE(struct htlc_in, keyof_htlc_in, hash_htlc_key, htlc_in_eq,
 		   htlc_in_map);
 
+static inline bool htlc_out_ripemd_eq(const struct htlc_out *out,
+				      const struct ripemd160 *ripemd)
+{
+	return structeq(&out->payment_ripemd, ripemd);
+}
+
 HTABLE_DEFINE_TYPE(struct htlc_out, keyof_htlc_out, hash_htlc_key, htlc_out_eq,
 		   htlc_out_map);
 
+/* Several can have the same payment_hash. */
+HTABLE_DEFINE_TYPE(struct htlc_out, keyof_htlc_out_ripemd, hash_ripemd,
+		   htlc_out_ripemd_eq, htlc_out_ripemd_map);
+
 struct htlc_in *find_htlc_in(const struct htlc_in_map *map,
 			     const struct channel *channel,
 			     u64 htlc_id);
@@ -131,9 +178,27 @@ struct htlc_out *new_htlc_out(const tal_t *ctx,
 			      const u8 *onion_routing_packet,
 			      struct htlc_in *in);
 
+/* These also add them to the channel's lists (and htlcs_out_by_ripemd):
+ * the destructor removes them from all of them. */
 void connect_htlc_in(struct htlc_in_map *map, struct htlc_in *hin);
 void connect_htlc_out(struct htlc_out_map *map, struct htlc_out *hout);
 
+static inline void htlc_deadlines_init(const tal_t *ctx,
+				       struct htlc_deadlines *deadlines)
+{
+	deadlines->heap = tal_arr(ctx, struct htlc_deadline *, 0);
+}
+
+/* Add to (or move within) @deadlines: overdue once we reach @height. */
+void htlc_deadline_add(struct htlc_deadlines *deadlines,
+		       struct htlc_deadline *deadline, u32 height);
+
+/* Remove from its heap, if any. */
+void htlc_deadline_del(struct htlc_deadline *deadline);
+
+/* The earliest deadline, or NULL. */
+struct htlc_deadline *htlc_deadline_first(const struct htlc_deadlines *d);
+
 struct htlc_out *htlc_out_check(const struct htlc_out *hout,
 				const char *abortstr);
 struct htlc_in *htlc_in_check(const struct htlc_in *hin, const char *abortstr);
@@ -168,6 +168,30 @@ static const struct json_command getinfo_command = {
 };
 AUTODATA(json_command, &getinfo_command);
 
+static void json_dbstats(struct command *cmd,
+			 const char *buffer UNUSED, const jsmntok_t *params UNUSED)
+{
+	struct json_result *response = new_json_result(cmd);
+	const struct db *db = cmd->ld->wallet->db;
+
+	json_object_start(response, NULL);
+	json_add_u64(response, "commits", db->commits);
+	json_add_u64(response, "transactions", db->transactions);
+	json_add_u64(response, "commit_usec", db->commit_usec);
+	json_add_u64(response, "max_commit_usec", db->max_commit_usec);
+	json_add_u64(response, "checkpoints", db->checkpoints);
+	json_add_num(response, "wal_pages", db->wal_pages);
+	json_object_end(response);
+	command_success(cmd, response);
+}
+
+static const struct json_command dbstats_command = {
+	"dbstats",
+	json_dbstats,
+	"Show how many database transactions are sharing each commit, and how long commits take"
+};
+AUTODATA(json_command, &dbstats_command);
+
 static size_t num_cmdlist;
 
 static struct json_command **get_cmdlist(void)
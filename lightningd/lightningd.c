@@ -43,6 +43,37 @@ struct backtrace_state *backtrace_state;
 
 int pid_fd;
 
+/* ccan/io's poll override takes no argument: this is ld->wallet->db once
+ * we're in the main loop. */
+static struct db *group_commit_db;
+
+/* Everything we queued to write in this wakeup only goes out after poll,
+ * so commit the handlers' shared db transaction first: that way nobody
+ * hears about anything before it's on disk. */
+static int lightningd_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	struct db *db = group_commit_db;
+
+	if (db) {
+		db_flush(db);
+
+		/* A WAL that big can't wait for the timer; otherwise
+		 * checkpoint when it's due and nothing's ready for us now. */
+		if (db->wal_pages >= DB_WAL_MAX_PAGES
+		    || (db->checkpoint_due && db->wal_pages
+			&& poll(fds, nfds, 0) == 0))
+			db_checkpoint(db);
+	}
+	return debug_poll(fds, nfds, timeout);
+}
+
+static void db_checkpoint_timer(struct lightningd *ld)
+{
+	ld->wallet->db->checkpoint_due = true;
+	new_reltimer(&ld->timers, ld, ld->config.db_checkpoint_time,
+		     db_checkpoint_timer, ld);
+}
+
 static struct lightningd *new_lightningd(const tal_t *ctx)
 {
 	struct lightningd *ld = tal(ctx, struct lightningd);
@@ -61,6 +92,8 @@ static struct lightningd *new_lightningd(const tal_t *ctx)
 	list_head_init(&ld->peers);
 	htlc_in_map_init(&ld->htlcs_in);
 	htlc_out_map_init(&ld->htlcs_out);
+	htlc_deadlines_init(ld, &ld->htlc_in_deadlines);
+	htlc_deadlines_init(ld, &ld->htlc_out_deadlines);
 	ld->log_book = new_log_book(20*1024*1024, LOG_INFORM);
 	ld->log = new_log(ld, ld->log_book, "lightningd(%u):", (int)getpid());
 	ld->logfile = NULL;
@@ -296,7 +329,7 @@ int main(int argc, char *argv[])
 	secp256k1_ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY
 						 | SECP256K1_CONTEXT_SIGN);
 
-	io_poll_override(debug_poll);
+	io_poll_override(lightningd_poll);
 
 	/* Figure out where our daemons are first. */
 	ld->daemon_dir = find_daemon_dir(ld, argv[0]);
@@ -365,6 +398,7 @@ int main(int argc, char *argv[])
 	}
 	if (!wallet_htlcs_reconnect(ld->wallet, &ld->htlcs_in, &ld->htlcs_out))
 		fatal("could not reconnect htlcs loaded from wallet, wallet may be inconsistent.");
+	queue_htlc_deadlines(ld);
 
 	/* Worst case, scan back to the first lightning deployment */
 	first_blocknum = wallet_first_blocknum(ld->wallet,
@@ -400,6 +434,12 @@ int main(int argc, char *argv[])
 	/* Activate crash log now we're not reporting startup failures. */
 	crashlog_activate(argv[0], ld->log);
 
+	/* Each time around io_loop, everyone shares one commit. */
+	group_commit_db = ld->wallet->db;
+	db_set_group_commit(ld->wallet->db, true);
+	if (ld->config.db_wal)
+		db_checkpoint_timer(ld);
+
 	for (;;) {
 		struct timer *expired;
 		void *v = io_loop(&ld->timers, &expired);
@@ -415,6 +455,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	db_set_group_commit(ld->wallet->db, false);
+	group_commit_db = NULL;
+
 	shutdown_subdaemons(ld);
 	close(pid_fd);
 	remove(ld->pidfile);
@@ -71,6 +71,22 @@ struct config {
 
 	/* Do we let the funder set any fee rate they want */
 	bool ignore_fee_limits;
+
+	/* Should gossipd use the old Bellman-Ford-Gibson route finder? */
+	bool bfg_routing;
+
+	/* Use a write-ahead log for the database, rather than a journal? */
+	bool db_wal;
+
+	/* sqlite's synchronous setting: off, normal, full or extra. */
+	const char *db_synchronous;
+
+	/* How much of the database to mmap, and page cache (0 = default) */
+	u32 db_mmap_mb;
+	u32 db_cache_kb;
+
+	/* How often to checkpoint the write-ahead log (when idle). */
+	struct timerel db_checkpoint_time;
 };
 
 struct lightningd {
@@ -131,6 +147,9 @@ struct lightningd {
 	struct htlc_in_map htlcs_in;
 	struct htlc_out_map htlcs_out;
 
+	/* When HTLCs above become overdue (see notify_new_block). */
+	struct htlc_deadlines htlc_in_deadlines, htlc_out_deadlines;
+
 	struct wallet *wallet;
 
 	/* Outstanding sendpay commands. */
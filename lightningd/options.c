@@ -225,6 +225,25 @@ static char *opt_set_fee_rates(const char *arg, struct chain_topology *topo)
 	return NULL;
 }
 
+static char *opt_set_db_synchronous(const char *arg, const char **sync)
+{
+	static const char *levels[] = { "off", "normal", "full", "extra" };
+
+	for (size_t i = 0; i < ARRAY_SIZE(levels); i++) {
+		if (streq(arg, levels[i])) {
+			*sync = levels[i];
+			return NULL;
+		}
+	}
+	return tal_fmt(NULL, "Unknown synchronous level '%s'", arg);
+}
+
+static void opt_show_db_synchronous(char buf[OPT_SHOW_LEN],
+				    const char *const *sync)
+{
+	snprintf(buf, OPT_SHOW_LEN, "%s", *sync);
+}
+
 static char *opt_set_offline(struct lightningd *ld)
 {
 	ld->portnum = 0;
@@ -283,13 +302,29 @@ static void config_register_opts(struct lightningd *ld)
 			 "Time between polling for new transactions");
 	opt_register_arg("--commit-time", opt_set_time, opt_show_time,
 			 &ld->config.commit_time,
-			 "Time after changes before sending out COMMIT");
+			 "Longest time after changes before sending out COMMIT");
 	opt_register_arg("--fee-base", opt_set_u32, opt_show_u32,
 			 &ld->config.fee_base,
 			 "Millisatoshi minimum to charge for HTLC");
 	opt_register_arg("--fee-per-satoshi", opt_set_s32, opt_show_s32,
 			 &ld->config.fee_per_satoshi,
 			 "Microsatoshi fee for every satoshi in HTLC");
+	opt_register_arg("--db-wal", opt_set_bool_arg, opt_show_bool,
+			 &ld->config.db_wal,
+			 "Use a write-ahead log for the database");
+	opt_register_arg("--db-synchronous=<level>",
+			 opt_set_db_synchronous, opt_show_db_synchronous,
+			 &ld->config.db_synchronous,
+			 "How hard the database tries to be on disk (off, normal, full, extra)");
+	opt_register_arg("--db-mmap-mb", opt_set_u32, opt_show_u32,
+			 &ld->config.db_mmap_mb,
+			 "Megabytes of the database to access by mmap (0 to use read)");
+	opt_register_arg("--db-cache-kb", opt_set_u32, opt_show_u32,
+			 &ld->config.db_cache_kb,
+			 "Kilobytes of database page cache (0 for sqlite's default)");
+	opt_register_arg("--db-checkpoint-time", opt_set_time, opt_show_time,
+			 &ld->config.db_checkpoint_time,
+			 "Time between checkpointing the database write-ahead log, if idle");
 	opt_register_arg("--ipaddr", opt_add_ipaddr, NULL,
 			 ld,
 			 "Set the IP address (v4 or v6) to announce to the network for incoming connections");
@@ -337,6 +372,9 @@ static void dev_register_opts(struct lightningd *ld)
 			 NULL, ld, "File containing disconnection points");
 	opt_register_arg("--dev-hsm-seed=<seed>", opt_set_hsm_seed,
 			 NULL, ld, "Hex-encoded seed for HSM");
+	opt_register_noarg("--dev-bfg-routing", opt_set_bool,
+			   &ld->config.bfg_routing,
+			   "Use Bellman-Ford-Gibson instead of Dijkstra for routes");
 }
 #endif
 
@@ -390,6 +428,20 @@ static const struct config testnet_config = {
 
 	/* Testnet sucks */
 	.ignore_fee_limits = true,
+
+	/* Dijkstra finds the same routes, much faster. */
+	.bfg_routing = false,
+
+	/* One fsync per commit, and we must not lose any. */
+	.db_wal = true,
+	.db_synchronous = "full",
+
+	/* sqlite's defaults. */
+	.db_mmap_mb = 0,
+	.db_cache_kb = 0,
+
+	/* Not so often we get in the way, not so rarely the WAL gets big. */
+	.db_checkpoint_time = TIME_FROM_SEC(1),
 };
 
 /* aka. "Dude, where's my coins?" */
@@ -451,6 +503,20 @@ static const struct config mainnet_config = {
 
 	/* Mainnet should have more stable fees */
 	.ignore_fee_limits = false,
+
+	/* Dijkstra finds the same routes, much faster. */
+	.bfg_routing = false,
+
+	/* One fsync per commit, and we must not lose any. */
+	.db_wal = true,
+	.db_synchronous = "full",
+
+	/* sqlite's defaults. */
+	.db_mmap_mb = 0,
+	.db_cache_kb = 0,
+
+	/* Not so often we get in the way, not so rarely the WAL gets big. */
+	.db_checkpoint_time = TIME_FROM_SEC(1),
 };
 
 static void check_config(struct lightningd *ld)
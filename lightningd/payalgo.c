@@ -8,6 +8,7 @@
 #include <common/type_to_string.h>
 #include <gossipd/gen_gossip_wire.h>
 #include <gossipd/routing.h>
+#include <lightningd/gossip_control.h>
 #include <lightningd/jsonrpc.h>
 #include <lightningd/jsonrpc_errors.h>
 #include <lightningd/lightningd.h>
@@ -15,6 +16,9 @@
 #include <lightningd/subd.h>
 #include <sodium/randombytes.h>
 
+/* How many alternate routes to ask gossipd for at once. */
+#define PAY_ALTERNATE_ROUTES 4
+
 struct pay {
 	/* Parent command. */
 	struct command *cmd;
@@ -37,6 +41,11 @@ struct pay {
 	/* Current fuzz we pass into getroute. */
 	double fuzz;
 
+	/* Alternate routes from our last getroutes, cheapest first.
+	 * We try each in turn before asking gossipd again. */
+	struct route_hop **routes;
+	size_t next_route;
+
 	/* Parent of the current pay attempt. This object is
 	 * freed, then allocated at the start of each pay
 	 * attempt to ensure no leaks across long pay attempts */
@@ -154,6 +163,35 @@ static const char *should_delay_retry(const tal_t *ctx,
 /* Start a payment attempt. */
 static bool json_pay_try(struct pay *pay);
 
+static bool route_visits(const struct route_hop *route,
+			 const struct pubkey *node)
+{
+	size_t i;
+
+	for (i = 0; i < tal_count(route); i++)
+		if (pubkey_eq(&route[i].nodeid, node))
+			return true;
+	return false;
+}
+
+/* Drop any untried routes through this (intermediate) node. */
+static void discard_routes_via(struct pay *pay, const struct pubkey *node)
+{
+	size_t i, n = pay->next_route;
+
+	/* The receiver is on every route. */
+	if (!pay->routes || pubkey_eq(node, &pay->receiver_id))
+		return;
+
+	for (i = pay->next_route; i < tal_count(pay->routes); i++) {
+		if (route_visits(pay->routes[i], node))
+			tal_free(pay->routes[i]);
+		else
+			pay->routes[n++] = pay->routes[i];
+	}
+	tal_resize(&pay->routes, n);
+}
+
 /* Used when delaying. */
 static void do_pay_try(struct pay *pay)
 {
@@ -185,6 +223,11 @@ static void json_pay_sendpay_resolve(const struct sendpay_result *r,
 		return;
 	}
 
+	/* Routes which share the failing channel were already pruned by
+	 * getroutes, but a failing node could be on any of them. */
+	if (r->errorcode == PAY_TRY_OTHER_ROUTE)
+		discard_routes_via(pay, &r->routing_failure->erring_node);
+
 	/* Should retry here, question is whether to retry now or later */
 
 	why = should_delay_retry(pay->try_parent, r);
@@ -224,9 +267,8 @@ static void log_route(struct pay *pay, struct route_hop *route)
 	tal_free(tmpctx);
 }
 
-static void json_pay_getroute_reply(struct subd *gossip UNUSED,
-				    const u8 *reply, const int *fds UNUSED,
-				    struct pay *pay)
+/* Send along the next of pay->routes. */
+static void json_pay_use_route(struct pay *pay)
 {
 	struct route_hop *route;
 	u64 msatoshi_sent;
@@ -234,19 +276,10 @@ static void json_pay_getroute_reply(struct subd *gossip UNUSED,
 	double feepercent;
 	bool fee_too_high;
 	struct json_result *data;
+	/* Others are dearer alternates to a route which failed. */
+	bool cheapest = (pay->next_route == 0);
 
-	fromwire_gossip_getroute_reply(reply, reply, &route);
-
-	if (tal_count(route) == 0) {
-		data = new_json_result(pay);
-		json_object_start(data, NULL);
-		json_add_num(data, "getroute_tries", pay->getroute_tries);
-		json_add_num(data, "sendpay_tries", pay->sendpay_tries);
-		json_object_end(data);
-		command_fail_detailed(pay->cmd, PAY_ROUTE_NOT_FOUND, data,
-				      "Could not find a route");
-		return;
-	}
+	route = tal_steal(pay->try_parent, pay->routes[pay->next_route++]);
 
 	msatoshi_sent = route[0].amount;
 	fee = msatoshi_sent - pay->msatoshi;
@@ -259,6 +292,12 @@ static void json_pay_getroute_reply(struct subd *gossip UNUSED,
 	 * payments are limited to 4294967295 msatoshi. */
 	feepercent = ((double) fee) * 100.0 / ((double) pay->msatoshi);
 	fee_too_high = (feepercent > pay->maxfeepercent);
+	/* gossipd may find a cheaper one now it knows about the failure. */
+	if (fee_too_high && !cheapest) {
+		pay->routes = tal_free(pay->routes);
+		json_pay_try(pay);
+		return;
+	}
 	/* compare fuzz to range */
 	if (fee_too_high && pay->fuzz < 0.01) {
 		data = new_json_result(pay);
@@ -283,6 +322,7 @@ static void json_pay_getroute_reply(struct subd *gossip UNUSED,
 	}
 	if (fee_too_high) {
 		/* Retry with lower fuzz */
+		pay->routes = tal_free(pay->routes);
 		pay->fuzz -= 0.15;
 		if (pay->fuzz <= 0.0)
 			pay->fuzz = 0.0;
@@ -298,6 +338,30 @@ static void json_pay_getroute_reply(struct subd *gossip UNUSED,
 		     &json_pay_sendpay_resolve, pay);
 }
 
+static void json_pay_getroutes_reply(struct subd *gossip UNUSED,
+				     const u8 *reply, const int *fds UNUSED,
+				     struct pay *pay)
+{
+	struct json_result *data;
+
+	tal_free(pay->routes);
+	pay->routes = gossip_getroutes_reply_routes(pay, reply);
+	pay->next_route = 0;
+
+	if (tal_count(pay->routes) == 0) {
+		data = new_json_result(pay);
+		json_object_start(data, NULL);
+		json_add_num(data, "getroute_tries", pay->getroute_tries);
+		json_add_num(data, "sendpay_tries", pay->sendpay_tries);
+		json_object_end(data);
+		command_fail_detailed(pay->cmd, PAY_ROUTE_NOT_FOUND, data,
+				      "Could not find a route");
+		return;
+	}
+
+	json_pay_use_route(pay);
+}
+
 /* Start a payment attempt. Return true if deferred,
  * false if resolved now. */
 static bool json_pay_try(struct pay *pay)
@@ -326,21 +390,29 @@ static bool json_pay_try(struct pay *pay)
 	pay->try_parent = tal_free(pay->try_parent);
 	pay->try_parent = tal(pay, char);
 
+	/* Still have an untried route from last time? */
+	if (pay->next_route < tal_count(pay->routes)) {
+		json_pay_use_route(pay);
+		return true;
+	}
+
 	/* Generate random seed */
 	randombytes_buf(&seed, sizeof(seed));
 
 	++pay->getroute_tries;
 
 	/* FIXME: use b11->routes */
-	req = towire_gossip_getroute_request(pay->try_parent,
-					     &cmd->ld->id,
-					     &pay->receiver_id,
-					     pay->msatoshi,
-					     pay->riskfactor,
-					     pay->min_final_cltv_expiry,
-					     &pay->fuzz,
-					     &seed);
-	subd_req(pay->try_parent, cmd->ld->gossip, req, -1, 0, json_pay_getroute_reply, pay);
+	req = towire_gossip_getroutes_request(pay->try_parent,
+					      &cmd->ld->id,
+					      &pay->receiver_id,
+					      pay->msatoshi,
+					      pay->riskfactor,
+					      pay->min_final_cltv_expiry,
+					      &pay->fuzz,
+					      &seed,
+					      PAY_ALTERNATE_ROUTES,
+					      false);
+	subd_req(pay->try_parent, cmd->ld->gossip, req, -1, 0, json_pay_getroutes_reply, pay);
 
 	return true;
 }
@@ -449,6 +521,8 @@ static void json_pay(struct command *cmd,
 	 * improve privacy somewhat. */
 	pay->fuzz = 0.75;
 	pay->try_parent = NULL;
+	pay->routes = NULL;
+	pay->next_route = 0;
 
 	/* Initiate payment */
 	if (json_pay_try(pay))
@@ -524,6 +524,7 @@ static enum watch_result funding_lockin_cb(struct channel *channel,
 		mk_short_channel_id(channel->scid,
 				    loc->blkheight, loc->index,
 				    channel->funding_outnum);
+		channel->dirty |= CHANNEL_DIRTY_STATE;
 	}
 	tal_free(loc);
 
@@ -922,6 +923,78 @@ static const struct json_command disconnect_command = {
 };
 AUTODATA(json_command, &disconnect_command);
 
+static void commit_stats_reply(struct subd *channeld UNUSED, const u8 *resp,
+			       const int *fds UNUSED, struct command *cmd)
+{
+	struct json_result *response;
+	u64 commits, updates, latency_usec, revoke_wait_usec, rtt_usec;
+	u32 delay_msec;
+
+	if (!fromwire_channel_commit_stats_reply(resp, &commits, &updates,
+						 &latency_usec,
+						 &revoke_wait_usec,
+						 &rtt_usec, &delay_msec)) {
+		command_fail(cmd, "Invalid commit_stats reply from channeld");
+		return;
+	}
+
+	response = new_json_result(cmd);
+	json_object_start(response, NULL);
+	json_add_u64(response, "commitments", commits);
+	json_add_u64(response, "updates", updates);
+	if (commits) {
+		json_add_double(response, "updates_per_commitment",
+				(double)updates / commits);
+		json_add_u64(response, "avg_commit_latency_usec",
+			     latency_usec / commits);
+		json_add_u64(response, "avg_revoke_wait_usec",
+			     revoke_wait_usec / commits);
+	}
+	json_add_u64(response, "round_trip_usec", rtt_usec);
+	json_add_num(response, "batch_delay_msec", delay_msec);
+	json_object_end(response);
+	command_success(cmd, response);
+}
+
+static void json_commitstats(struct command *cmd,
+			     const char *buffer, const jsmntok_t *params)
+{
+	jsmntok_t *peertok;
+	struct peer *peer;
+	struct channel *channel;
+
+	if (!json_get_params(cmd, buffer, params,
+			     "id", &peertok,
+			     NULL)) {
+		return;
+	}
+
+	peer = peer_from_json(cmd->ld, buffer, peertok);
+	if (!peer) {
+		command_fail(cmd, "Could not find peer with that id");
+		return;
+	}
+
+	channel = peer_active_channel(peer);
+	if (!channel || !channel->owner
+	    || !streq(channel->owner->name, "lightning_channeld")) {
+		command_fail(cmd, "Peer has no channel in normal operation");
+		return;
+	}
+
+	subd_req(peer, channel->owner,
+		 take(towire_channel_commit_stats(NULL)), -1, 0,
+		 commit_stats_reply, cmd);
+	command_still_pending(cmd);
+}
+
+static const struct json_command commitstats_command = {
+	"commitstats",
+	json_commitstats,
+	"Show how updates with peer {id} are being batched into commitments"
+};
+AUTODATA(json_command, &commitstats_command);
+
 #if DEVELOPER
 static void json_sign_last_tx(struct command *cmd,
 			      const char *buffer, const jsmntok_t *params)
@@ -197,12 +197,76 @@ static bool check_cltv(struct htlc_in *hin,
 	return false;
 }
 
+/* BOLT #2:
+ *
+ * For HTLCs we offer: the timeout deadline when we have to fail the channel
+ * and time it out on-chain.  This is `G` blocks after the HTLC
+ * `cltv_expiry`; 1 block is reasonable.
+ */
+static u32 htlc_out_deadline(const struct htlc_out *hout)
+{
+	return hout->cltv_expiry + 1;
+}
+
+/* BOLT #2:
+ *
+ * For HTLCs we accept and have a preimage: the fulfillment deadline when we
+ * have to fail the channel and fulfill the HTLC onchain before its
+ * `cltv_expiry`.  This is steps 4-7 above, which means a deadline of `2R+G+S`
+ * blocks before `cltv_expiry`; 7 blocks is reasonable.
+ */
+/* We approximate this, by using half the cltv_expiry_delta (3R+2G+2S),
+ * rounded up. */
+static u32 htlc_in_deadline(const struct lightningd *ld,
+			    const struct htlc_in *hin)
+{
+	return hin->cltv_expiry - (ld->config.cltv_expiry_delta + 1)/2;
+}
+
+/* We check these on every block: see notify_new_block. */
+static void queue_htlc_out_deadline(struct lightningd *ld,
+				    struct htlc_out *hout)
+{
+	htlc_deadline_add(&ld->htlc_out_deadlines, &hout->deadline,
+			  htlc_out_deadline(hout));
+}
+
+/* If overdue but not fulfilled, that's their problem, so only once
+ * we have a preimage. */
+static void queue_htlc_in_deadline(struct lightningd *ld,
+				   struct htlc_in *hin)
+{
+	htlc_deadline_add(&ld->htlc_in_deadlines, &hin->deadline,
+			  htlc_in_deadline(ld, hin));
+}
+
+void queue_htlc_deadlines(struct lightningd *ld)
+{
+	struct htlc_in_map_iter ini;
+	struct htlc_out_map_iter outi;
+	struct htlc_in *hin;
+	struct htlc_out *hout;
+
+	for (hout = htlc_out_map_first(&ld->htlcs_out, &outi);
+	     hout;
+	     hout = htlc_out_map_next(&ld->htlcs_out, &outi))
+		queue_htlc_out_deadline(ld, hout);
+
+	for (hin = htlc_in_map_first(&ld->htlcs_in, &ini);
+	     hin;
+	     hin = htlc_in_map_next(&ld->htlcs_in, &ini)) {
+		if (hin->preimage)
+			queue_htlc_in_deadline(ld, hin);
+	}
+}
+
 static void fulfill_htlc(struct htlc_in *hin, const struct preimage *preimage)
 {
 	u8 *msg;
 
 	hin->preimage = tal_dup(hin, struct preimage, preimage);
 	htlc_in_check(hin, __func__);
+	queue_htlc_in_deadline(hin->key.channel->peer->ld, hin);
 
 	/* We update state now to signal it's in progress, for persistence. */
 	htlc_in_update_state(hin->key.channel, hin, SENT_REMOVE_HTLC);
@@ -382,6 +446,7 @@ static void rcvd_htlc_reply(struct subd *subd, const u8 *msg, const int *fds UNU
 
 	/* Add it to lookup table now we know id. */
 	connect_htlc_out(&subd->ld->htlcs_out, hout);
+	queue_htlc_out_deadline(subd->ld, hout);
 
 	/* When channeld includes it in commitment, we'll make it persistent. */
 }
@@ -704,20 +769,12 @@ static bool peer_fulfilled_our_htlc(struct channel *channel,
 void onchain_fulfilled_htlc(struct channel *channel,
 			    const struct preimage *preimage)
 {
-	struct htlc_out_map_iter outi;
 	struct htlc_out *hout;
 	struct sha256 payment_hash;
-	struct lightningd *ld = channel->peer->ld;
 
 	sha256(&payment_hash, preimage, sizeof(*preimage));
 
-	/* FIXME: use db to look this up! */
-	for (hout = htlc_out_map_first(&ld->htlcs_out, &outi);
-	     hout;
-	     hout = htlc_out_map_next(&ld->htlcs_out, &outi)) {
-		if (hout->key.channel != channel)
-			continue;
-
+	list_for_each(&channel->htlcs_out, hout, list) {
 		/* It's possible that we failed some and succeeded one,
 		 * if we got multiple errors. */
 		if (hout->failcode != 0 || hout->failuremsg)
@@ -767,28 +824,10 @@ static bool peer_failed_our_htlc(struct channel *channel,
 	return true;
 }
 
-/* FIXME: Crazy slow! */
 struct htlc_out *find_htlc_out_by_ripemd(const struct channel *channel,
 					 const struct ripemd160 *ripemd)
 {
-	struct htlc_out_map_iter outi;
-	struct htlc_out *hout;
-	struct lightningd *ld = channel->peer->ld;
-
-	for (hout = htlc_out_map_first(&ld->htlcs_out, &outi);
-	     hout;
-	     hout = htlc_out_map_next(&ld->htlcs_out, &outi)) {
-		struct ripemd160 hash;
-
-		if (hout->key.channel != channel)
-			continue;
-
-		ripemd160(&hash,
-			  &hout->payment_hash, sizeof(hout->payment_hash));
-		if (structeq(&hash, ripemd))
-			return hout;
-	}
-	return NULL;
+	return htlc_out_ripemd_map_get(&channel->htlcs_out_by_ripemd, ripemd);
 }
 
 void onchain_failed_our_htlc(const struct channel *channel,
@@ -833,6 +872,7 @@ static void remove_htlc_in(struct channel *channel, struct htlc_in *hin)
 			  channel->our_msatoshi,
 			  channel->our_msatoshi + hin->msatoshi);
 		channel->our_msatoshi += hin->msatoshi;
+		channel->dirty |= CHANNEL_DIRTY_STATE;
 	}
 
 	tal_free(hin);
@@ -857,6 +897,7 @@ static void remove_htlc_out(struct channel *channel, struct htlc_out *hout)
 			  channel->our_msatoshi,
 			  channel->our_msatoshi - hout->msatoshi);
 		channel->our_msatoshi -= hout->msatoshi;
+		channel->dirty |= CHANNEL_DIRTY_STATE;
 	}
 
 	tal_free(hout);
@@ -940,6 +981,7 @@ static bool peer_save_commitsig_received(struct channel *channel, u64 commitnum,
 	}
 
 	channel->next_index[LOCAL]++;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 
 	/* Update channel->last_sig and channel->last_tx before saving to db */
 	channel_set_last_tx(channel, tx, commit_sig);
@@ -960,6 +1002,7 @@ static bool peer_save_commitsig_sent(struct channel *channel, u64 commitnum)
 	}
 
 	channel->next_index[REMOTE]++;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 
 	/* FIXME: Save to database, with sig and HTLCs. */
 	wallet_channel_save(ld->wallet, channel);
@@ -1016,6 +1059,7 @@ void peer_sending_commitsig(struct channel *channel, const u8 *msg)
 
 	/* Update their feerate. */
 	channel->channel_info.feerate_per_kw[REMOTE] = feerate;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 
 	if (!peer_save_commitsig_sent(channel, commitnum))
 		return;
@@ -1024,6 +1068,7 @@ void peer_sending_commitsig(struct channel *channel, const u8 *msg)
 	channel->last_was_revoke = false;
 	tal_free(channel->last_sent_commit);
 	channel->last_sent_commit = tal_steal(channel, changed_htlcs);
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 	wallet_channel_save(ld->wallet, channel);
 
 	/* Tell it we've got it, and to go ahead with commitment_signed. */
@@ -1103,6 +1148,7 @@ static bool peer_sending_revocation(struct channel *channel,
 	}
 
 	channel->last_was_revoke = true;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 	return true;
 }
 
@@ -1175,6 +1221,7 @@ void peer_got_commitsig(struct channel *channel, const u8 *msg)
 	channel->channel_info.feerate_per_kw[LOCAL]
 		= channel->channel_info.feerate_per_kw[REMOTE]
 		= feerate;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 
 	/* Since we're about to send revoke, bump state again. */
 	if (!peer_sending_revocation(channel, added, fulfilled, failed, changed))
@@ -1202,6 +1249,7 @@ void update_per_commit_point(struct channel *channel,
 	struct channel_info *ci = &channel->channel_info;
 	ci->old_remote_per_commit = ci->remote_per_commit;
 	ci->remote_per_commit = *per_commitment_point;
+	channel->dirty |= CHANNEL_DIRTY_STATE;
 }
 
 void peer_got_revoke(struct channel *channel, const u8 *msg)
@@ -1372,11 +1420,8 @@ void peer_htlcs(const tal_t *ctx,
 		const struct failed_htlc ***failed_htlcs,
 		enum side **failed_sides)
 {
-	struct htlc_in_map_iter ini;
-	struct htlc_out_map_iter outi;
 	struct htlc_in *hin;
 	struct htlc_out *hout;
-	struct lightningd *ld = channel->peer->ld;
 
 	*htlcs = tal_arr(ctx, struct added_htlc, 0);
 	*htlc_states = tal_arr(ctx, enum htlc_state, 0);
@@ -1385,12 +1430,7 @@ void peer_htlcs(const tal_t *ctx,
 	*failed_htlcs = tal_arr(ctx, const struct failed_htlc *, 0);
 	*failed_sides = tal_arr(ctx, enum side, 0);
 
-	for (hin = htlc_in_map_first(&ld->htlcs_in, &ini);
-	     hin;
-	     hin = htlc_in_map_next(&ld->htlcs_in, &ini)) {
-		if (hin->key.channel != channel)
-			continue;
-
+	list_for_each(&channel->htlcs_in, hin, list) {
 		add_htlc(htlcs, htlc_states,
 			 hin->key.id, hin->msatoshi, &hin->payment_hash,
 			 hin->cltv_expiry, hin->onion_routing_packet,
@@ -1404,12 +1444,7 @@ void peer_htlcs(const tal_t *ctx,
 				    fulfilled_htlcs, fulfilled_sides);
 	}
 
-	for (hout = htlc_out_map_first(&ld->htlcs_out, &outi);
-	     hout;
-	     hout = htlc_out_map_next(&ld->htlcs_out, &outi)) {
-		if (hout->key.channel != channel)
-			continue;
-
+	list_for_each(&channel->htlcs_out, hout, list) {
 		add_htlc(htlcs, htlc_states,
 			 hout->key.id, hout->msatoshi, &hout->payment_hash,
 			 hout->cltv_expiry, hout->onion_routing_packet,
@@ -1435,13 +1470,22 @@ void free_htlcs(struct lightningd *ld, const struct channel *channel)
 
 	/* FIXME: Implement check_htlcs to ensure no dangling hout->in ptrs! */
 
+	if (channel) {
+		/* Destructors take them out of the lists. */
+		while ((hout = list_top(&channel->htlcs_out,
+					struct htlc_out, list)) != NULL)
+			tal_free(hout);
+		while ((hin = list_top(&channel->htlcs_in,
+				       struct htlc_in, list)) != NULL)
+			tal_free(hin);
+		return;
+	}
+
 	do {
 		deleted = false;
 		for (hout = htlc_out_map_first(&ld->htlcs_out, &outi);
 		     hout;
 		     hout = htlc_out_map_next(&ld->htlcs_out, &outi)) {
-			if (channel && hout->key.channel != channel)
-				continue;
 			tal_free(hout);
 			deleted = true;
 		}
@@ -1449,8 +1493,6 @@ void free_htlcs(struct lightningd *ld, const struct channel *channel)
 		for (hin = htlc_in_map_first(&ld->htlcs_in, &ini);
 		     hin;
 		     hin = htlc_in_map_next(&ld->htlcs_in, &ini)) {
-			if (channel && hin->key.channel != channel)
-				continue;
 			tal_free(hin);
 			deleted = true;
 		}
@@ -1458,35 +1500,20 @@ void free_htlcs(struct lightningd *ld, const struct channel *channel)
 	} while (deleted);
 }
 
-/* BOLT #2:
- *
- * For HTLCs we offer: the timeout deadline when we have to fail the channel
- * and time it out on-chain.  This is `G` blocks after the HTLC
- * `cltv_expiry`; 1 block is reasonable.
- */
-static u32 htlc_out_deadline(const struct htlc_out *hout)
+/* Channels which are already failed or onchain have nothing to check. */
+static bool channel_htlcs_live(const struct channel *channel)
 {
-	return hout->cltv_expiry + 1;
-}
+	/* Peer on chain already? */
+	if (channel_on_chain(channel))
+		return false;
 
-/* BOLT #2:
- *
- * For HTLCs we accept and have a preimage: the fulfillment deadline when we
- * have to fail the channel and fulfill the HTLC onchain before its
- * `cltv_expiry`.  This is steps 4-7 above, which means a deadline of `2R+G+S`
- * blocks before `cltv_expiry`; 7 blocks is reasonable.
- */
-/* We approximate this, by using half the cltv_expiry_delta (3R+2G+2S),
- * rounded up. */
-static u32 htlc_in_deadline(const struct lightningd *ld,
-			    const struct htlc_in *hin)
-{
-	return hin->cltv_expiry - (ld->config.cltv_expiry_delta + 1)/2;
+	/* Peer already failed, or we hit it? */
+	return !channel->error;
 }
 
 void notify_new_block(struct lightningd *ld, u32 height)
 {
-	bool removed;
+	struct htlc_deadline *d;
 
 	/* BOLT #2:
 	 *
@@ -1494,39 +1521,24 @@ void notify_new_block(struct lightningd *ld, u32 height)
 	 * either node's current commitment transaction past this timeout
 	 * deadline.
 	 */
-	/* FIXME: use db to look this up in one go (earliest deadline per-peer) */
-	do {
-		struct htlc_out *hout;
-		struct htlc_out_map_iter outi;
-
-		removed = false;
-
-		for (hout = htlc_out_map_first(&ld->htlcs_out, &outi);
-		     hout;
-		     hout = htlc_out_map_next(&ld->htlcs_out, &outi)) {
-			/* Not timed out yet? */
-			if (height < htlc_out_deadline(hout))
-				continue;
-
-			/* Peer on chain already? */
-			if (channel_on_chain(hout->key.channel))
-				continue;
-
-			/* Peer already failed, or we hit it? */
-			if (hout->key.channel->error)
-				continue;
-
-			channel_fail_permanent(hout->key.channel,
-					    "Offered HTLC %"PRIu64
-					    " %s cltv %u hit deadline",
-					    hout->key.id,
-					    htlc_state_name(hout->hstate),
-					    hout->cltv_expiry);
-			removed = true;
-		}
-	/* Iteration while removing is safe, but can skip entries! */
-	} while (removed);
+	while ((d = htlc_deadline_first(&ld->htlc_out_deadlines)) != NULL
+	       && d->height <= height) {
+		struct htlc_out *hout = container_of(d, struct htlc_out,
+						     deadline);
+
+		/* Failing the channel can free other HTLCs, but it
+		 * takes them out of the heap as it does. */
+		htlc_deadline_del(d);
+		if (!channel_htlcs_live(hout->key.channel))
+			continue;
 
+		channel_fail_permanent(hout->key.channel,
+				       "Offered HTLC %"PRIu64
+				       " %s cltv %u hit deadline",
+				       hout->key.id,
+				       htlc_state_name(hout->hstate),
+				       hout->cltv_expiry);
+	}
 
 	/* BOLT #2:
 	 *
@@ -1535,43 +1547,22 @@ void notify_new_block(struct lightningd *ld, u32 height)
 	 * HTLC it has fulfilled is in either node's current commitment
 	 * transaction past this fulfillment deadline.
 	 */
-	do {
-		struct htlc_in *hin;
-		struct htlc_in_map_iter ini;
+	while ((d = htlc_deadline_first(&ld->htlc_in_deadlines)) != NULL
+	       && d->height <= height) {
+		struct htlc_in *hin = container_of(d, struct htlc_in,
+						   deadline);
 
-		removed = false;
+		htlc_deadline_del(d);
+		if (!channel_htlcs_live(hin->key.channel))
+			continue;
 
-		for (hin = htlc_in_map_first(&ld->htlcs_in, &ini);
-		     hin;
-		     hin = htlc_in_map_next(&ld->htlcs_in, &ini)) {
-			struct channel *channel = hin->key.channel;
-
-			/* Not fulfilled?  If overdue, that's their problem... */
-			if (!hin->preimage)
-				continue;
-
-			/* Not timed out yet? */
-			if (height < htlc_in_deadline(ld, hin))
-				continue;
-
-			/* Peer on chain already? */
-			if (channel_on_chain(channel))
-				continue;
-
-			/* Peer already failed, or we hit it? */
-			if (channel->error)
-				continue;
-
-			channel_fail_permanent(channel,
-					    "Fulfilled HTLC %"PRIu64
-					    " %s cltv %u hit deadline",
-					    hin->key.id,
-					    htlc_state_name(hin->hstate),
-					    hin->cltv_expiry);
-			removed = true;
-		}
-	/* Iteration while removing is safe, but can skip entries! */
-	} while (removed);
+		channel_fail_permanent(hin->key.channel,
+				       "Fulfilled HTLC %"PRIu64
+				       " %s cltv %u hit deadline",
+				       hin->key.id,
+				       htlc_state_name(hin->hstate),
+				       hin->cltv_expiry);
+	}
 }
 
 void notify_feerate_change(struct lightningd *ld)
@@ -37,6 +37,9 @@ void peer_htlcs(const tal_t *ctx,
 
 void free_htlcs(struct lightningd *ld, const struct channel *channel);
 
+/* Once HTLCs are loaded, queue them for notify_new_block to check. */
+void queue_htlc_deadlines(struct lightningd *ld);
+
 void peer_sending_commitsig(struct channel *channel, const u8 *msg);
 void peer_got_commitsig(struct channel *channel, const u8 *msg);
 void peer_got_revoke(struct channel *channel, const u8 *msg);
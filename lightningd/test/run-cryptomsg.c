@@ -79,6 +79,12 @@ static struct io_plan *check_msg_write(struct io_conn *conn UNUSED, struct peer
 	return NULL;
 }
 
+static struct io_plan *check_batch_write(struct io_conn *conn UNUSED,
+					 struct peer *peer UNUSED)
+{
+	return NULL;
+}
+
 static struct io_plan *check_msg_read(struct io_conn *conn UNUSED, struct peer *peer UNUSED,
 				      u8 *msg)
 {
@@ -102,6 +108,7 @@ int main(void)
 	struct peer_crypto_state cs_out, cs_in;
 	struct secret sk, rk, ck;
 	const void *msg = tal_dup_arr(tmpctx, char, "hello", 5, 0);
+	char *expected;
 	size_t i;
 
 	trc = tal_tmpctx(tmpctx);
@@ -128,6 +135,7 @@ int main(void)
 	init_peer_crypto_state(tmpctx, &cs_in);
 	init_peer_crypto_state(tmpctx, &cs_out);
 
+	expected = tal_arr(tmpctx, char, 0);
 	for (i = 0; i < 1002; i++) {
 		write_buf = tal_arr(tmpctx, char, 0);
 
@@ -136,6 +144,7 @@ int main(void)
 			status_trace("output %zu: 0x%s", i,
 				     tal_hex(tmpctx, write_buf));
 
+		tal_expand(&expected, write_buf, tal_count(write_buf));
 		read_buf = write_buf;
 		read_buf_len = tal_count(read_buf);
 		write_buf = tal_arr(tmpctx, char, 0);
@@ -143,6 +152,21 @@ int main(void)
 		peer_read_message(NULL, &cs_in, check_msg_read);
 		assert(read_buf_len == 0);
 	}
+
+	/* Same again, but many to a write: the nonces and key rotation
+	 * must come out the same. */
+	cs_out.cs.sn = 0;
+	cs_out.cs.sk = sk;
+	cs_out.cs.s_ck = ck;
+	write_buf = tal_arr(tmpctx, char, 0);
+	for (i = 0; i < 1002; i++) {
+		if (!peer_queue_message(NULL, &cs_out, msg))
+			peer_write_queued(NULL, &cs_out, check_batch_write);
+	}
+	peer_write_queued(NULL, &cs_out, check_batch_write);
+	assert(cs_out.outlen == 0);
+	assert(tal_count(write_buf) == tal_count(expected));
+	assert(memcmp(write_buf, expected, tal_count(expected)) == 0);
 	tal_free(tmpctx);
 	return 0;
 }
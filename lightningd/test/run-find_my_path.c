@@ -16,18 +16,27 @@ void crashlog_activate(const char *argv0 UNNEEDED, struct log *log UNNEEDED)
 /* Generated stub for db_begin_transaction_ */
 void db_begin_transaction_(struct db *db UNNEEDED, const char *location UNNEEDED)
 { fprintf(stderr, "db_begin_transaction_ called!\n"); abort(); }
+/* Generated stub for db_checkpoint */
+void db_checkpoint(struct db *db UNNEEDED)
+{ fprintf(stderr, "db_checkpoint called!\n"); abort(); }
 /* Generated stub for db_close_for_fork */
 void db_close_for_fork(struct db *db UNNEEDED)
 { fprintf(stderr, "db_close_for_fork called!\n"); abort(); }
 /* Generated stub for db_commit_transaction */
 void db_commit_transaction(struct db *db UNNEEDED)
 { fprintf(stderr, "db_commit_transaction called!\n"); abort(); }
+/* Generated stub for db_flush */
+void db_flush(struct db *db UNNEEDED)
+{ fprintf(stderr, "db_flush called!\n"); abort(); }
 /* Generated stub for db_get_intvar */
 s64 db_get_intvar(struct db *db UNNEEDED, char *varname UNNEEDED, s64 defval UNNEEDED)
 { fprintf(stderr, "db_get_intvar called!\n"); abort(); }
 /* Generated stub for db_reopen_after_fork */
 void db_reopen_after_fork(struct db *db UNNEEDED)
 { fprintf(stderr, "db_reopen_after_fork called!\n"); abort(); }
+/* Generated stub for db_set_group_commit */
+void db_set_group_commit(struct db *db UNNEEDED, bool group_commit UNNEEDED)
+{ fprintf(stderr, "db_set_group_commit called!\n"); abort(); }
 /* Generated stub for debug_poll */
 int debug_poll(struct pollfd *fds UNNEEDED, nfds_t nfds UNNEEDED, int timeout UNNEEDED)
 { fprintf(stderr, "debug_poll called!\n"); abort(); }
@@ -60,9 +69,18 @@ struct log *new_log(const tal_t *ctx UNNEEDED, struct log_book *record UNNEEDED,
 struct log_book *new_log_book(size_t max_mem UNNEEDED,
 			      enum log_level printlevel UNNEEDED)
 { fprintf(stderr, "new_log_book called!\n"); abort(); }
+/* Generated stub for new_reltimer_ */
+struct oneshot *new_reltimer_(struct timers *timers UNNEEDED,
+			      const tal_t *ctx UNNEEDED,
+			      struct timerel expire UNNEEDED,
+			      void (*cb)(void *) UNNEEDED, void *arg UNNEEDED)
+{ fprintf(stderr, "new_reltimer_ called!\n"); abort(); }
 /* Generated stub for new_topology */
 struct chain_topology *new_topology(struct lightningd *ld UNNEEDED, struct log *log UNNEEDED)
 { fprintf(stderr, "new_topology called!\n"); abort(); }
+/* Generated stub for queue_htlc_deadlines */
+void queue_htlc_deadlines(struct lightningd *ld UNNEEDED)
+{ fprintf(stderr, "queue_htlc_deadlines called!\n"); abort(); }
 /* Generated stub for register_opts */
 void register_opts(struct lightningd *ld UNNEEDED)
 { fprintf(stderr, "register_opts called!\n"); abort(); }
@@ -75,6 +75,40 @@ def test_single_hop(node_factory, executor):
     print("Done. %d payments performed in %f seconds (%f payments per second)" % (num_payments, diff, num_payments / diff))
 
 
+def test_htlc_burst(node_factory, executor):
+    """How fast l2 accepts bursts of incoming HTLCs.
+
+    Each commitment_signed covers many adds, so this mostly measures the
+    per-commitment work in channeld (eg. HSM round trips) rather than the
+    per-payment work in lightningd.
+    """
+    burst = 400
+    num_bursts = num_payments // burst
+    l1 = node_factory.get_node()
+    l2 = node_factory.get_node()
+
+    l1.rpc.connect(l2.rpc.getinfo()['id'], 'localhost:%d' % l2.rpc.getinfo()['port'])
+    l1.openchannel(l2, 4000000)
+
+    print("Collecting invoices")
+    invoices = []
+    for i in tqdm(range(num_bursts * burst)):
+        invoices.append(l2.rpc.invoice(1000, 'burst-%d' % (i), 'desc')['payment_hash'])
+
+    route = l1.rpc.getroute(l2.rpc.getinfo()['id'], 1000, 1)['route']
+    print("Sending %d bursts of %d HTLCs" % (num_bursts, burst))
+    elapsed = 0
+    for b in tqdm(range(num_bursts)):
+        start_time = time()
+        fs = [executor.submit(l1.rpc.sendpay, route, h)
+              for h in invoices[b * burst:(b + 1) * burst]]
+        for f in fs:
+            f.result()
+        elapsed += time() - start_time
+
+    print("Done. %d HTLCs accepted in %f seconds (%f HTLCs per second)" % (num_bursts * burst, elapsed, num_bursts * burst / elapsed))
+
+
 def test_single_payment(node_factory, benchmark):
     l1 = node_factory.get_node()
     l2 = node_factory.get_node()
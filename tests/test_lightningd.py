@@ -940,6 +940,64 @@ class LightningDTests(BaseLightningDTests):
         assert len(l1.rpc.listpayments(inv)['payments']) == 1
         assert l1.rpc.listpayments(inv)['payments'][0]['payment_preimage'] == preimage['payment_preimage']
 
+    def test_commit_batching(self):
+        l1, l2 = self.connect()
+
+        chanid = self.fund_channel(l1, l2, 10**6)
+
+        # Wait for route propagation.
+        self.wait_for_routes(l1, [chanid])
+
+        for i in range(6):
+            inv = l2.rpc.invoice(123000, 'test_commit_batching{}'.format(i), 'description')['bolt11']
+            l1.rpc.pay(inv)
+
+        # Each payment took at least one commitment from us, and a
+        # commitment never covers less than one update.
+        stats = l1.rpc.commitstats(l2.info['id'])
+        assert stats['commitments'] >= 6
+        assert stats['updates'] >= stats['commitments']
+
+    def test_db_group_commit(self):
+        l1, l2 = self.connect()
+
+        chanid = self.fund_channel(l1, l2, 10**6)
+
+        # Wait for route propagation.
+        self.wait_for_routes(l1, [chanid])
+
+        inv = l2.rpc.invoice(123000, 'test_db_group_commit', 'description')['bolt11']
+        l1.rpc.pay(inv)
+
+        # Database work is grouped into fewer commits.
+        stats = l1.rpc.dbstats()
+        assert stats['commits'] > 0
+        assert stats['transactions'] >= stats['commits']
+
+        # But it all made it to disk.
+        l1.restart()
+        payments = l1.rpc.listpayments(inv)['payments']
+        assert len(payments) == 1 and payments[0]['status'] == 'complete'
+
+    @unittest.skipIf(not DEVELOPER, "needs DEVELOPER=1")
+    def test_pay_route_cache(self):
+        l1, l2 = self.connect()
+
+        chanid = self.fund_channel(l1, l2, 10**6)
+
+        # Wait for route propagation.
+        self.wait_for_routes(l1, [chanid])
+
+        before = l1.rpc.dev_routecache()
+        for i in range(2):
+            inv = l2.rpc.invoice(123000, 'test_pay_route_cache{}'.format(i), 'description')['bolt11']
+            l1.rpc.pay(inv)
+
+        # Second payment to the same destination reuses the first's route.
+        after = l1.rpc.dev_routecache()
+        assert after['misses'] == before['misses'] + 1
+        assert after['hits'] == before['hits'] + 1
+
     def test_pay_optional_args(self):
         l1, l2 = self.connect()
 
@@ -2044,6 +2102,31 @@ class LightningDTests(BaseLightningDTests):
         assert l3.info['id'] not in [n['nodeid'] for n in l1.rpc.listnodes()['nodes']]
         assert l3.info['id'] not in [n['nodeid'] for n in l2.rpc.listnodes()['nodes']]
 
+    @unittest.skipIf(not DEVELOPER, "needs DEVELOPER=1 for --dev-broadcast-interval")
+    def test_gossip_persistence(self):
+        """Gossip for a while, restart and it should remember.
+        """
+        l1, l2, l3 = self.line_graph(n=3)
+
+        l1.bitcoin.rpc.generate(6)
+
+        # Everyone should know about both channels, in both directions.
+        wait_for(lambda: [c['public'] for c in l1.rpc.listchannels()['channels']] == [True] * 4)
+        wait_for(lambda: len(l1.rpc.listnodes()['nodes']) == 3)
+
+        # Now nobody can tell l1 about them again.
+        l2.stop()
+        l3.stop()
+        l1.restart()
+
+        l1.daemon.wait_for_log('gossip_store: loaded')
+        channels = l1.rpc.listchannels()['channels']
+        assert [c['public'] for c in channels] == [True] * 4
+        assert set([n['nodeid'] for n in l1.rpc.listnodes()['nodes']]) == set([l1.info['id'], l2.info['id'], l3.info['id']])
+
+        # We can still route over what we remembered.
+        l1.rpc.getroute(l3.info['id'], 100, 1)
+
     def ping_tests(self, l1, l2):
         # 0-byte pong gives just type + length field.
         ret = l1.rpc.dev_ping(l2.info['id'], 0, 0)
@@ -351,6 +351,11 @@ class LightningNode(object):
         orig = os.path.join(self.daemon.lightning_dir, "lightningd.sqlite3")
         copy = os.path.join(self.daemon.lightning_dir, "lightningd-copy.sqlite3")
         copyfile(orig, copy)
+        # Recent changes may still be in the write-ahead log.
+        if os.path.exists(orig + "-wal"):
+            copyfile(orig + "-wal", copy + "-wal")
+        elif os.path.exists(copy + "-wal"):
+            os.unlink(copy + "-wal")
 
         db = sqlite3.connect(copy)
         db.row_factory = sqlite3.Row
@@ -1,7 +1,10 @@
 #include "db.h"
 
+#include <ccan/crypto/siphash24/siphash24.h>
 #include <ccan/tal/str/str.h>
 #include <ccan/tal/tal.h>
+#include <ccan/time/time.h>
+#include <common/pseudorand.h>
 #include <common/version.h>
 #include <inttypes.h>
 #include <lightningd/lightningd.h>
@@ -236,6 +239,11 @@ char *dbmigrations[] = {
     NULL,
 };
 
+size_t hash_sql(const char *sql)
+{
+	return siphash24(siphash_seed(), sql, strlen(sql));
+}
+
 sqlite3_stmt *db_prepare_(const char *caller, struct db *db, const char *query)
 {
 	int err;
@@ -243,6 +251,13 @@ sqlite3_stmt *db_prepare_(const char *caller, struct db *db, const char *query)
 
 	assert(db->in_transaction);
 
+	/* It's out of the cache while it's in use, so nobody else gets it. */
+	stmt = stmt_cache_get(&db->stmts, query);
+	if (stmt) {
+		stmt_cache_del(&db->stmts, stmt);
+		return stmt;
+	}
+
 	err = sqlite3_prepare_v2(db->sql, query, -1, &stmt, NULL);
 
 	if (err != SQLITE_OK)
@@ -258,7 +273,32 @@ void db_exec_prepared_(const char *caller, struct db *db, sqlite3_stmt *stmt)
 	if (sqlite3_step(stmt) !=  SQLITE_DONE)
 		fatal("%s: %s", caller, sqlite3_errmsg(db->sql));
 
-	sqlite3_finalize(stmt);
+	db_stmt_done(db, stmt);
+}
+
+void db_stmt_done(struct db *db, sqlite3_stmt *stmt)
+{
+	/* If we prepared another while this was in use, one is enough. */
+	if (stmt_cache_get(&db->stmts, stmt_sql(stmt))) {
+		sqlite3_finalize(stmt);
+		return;
+	}
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	stmt_cache_add(&db->stmts, stmt);
+}
+
+static void db_clear_stmts(struct db *db)
+{
+	struct stmt_cache_iter it;
+	sqlite3_stmt *stmt;
+
+	for (stmt = stmt_cache_first(&db->stmts, &it);
+	     stmt;
+	     stmt = stmt_cache_next(&db->stmts, &it))
+		sqlite3_finalize(stmt);
+	stmt_cache_clear(&db->stmts);
 }
 
 /* This one doesn't check if we're in a transaction. */
@@ -299,10 +339,10 @@ bool db_exec_prepared_mayfail_(const char *caller UNUSED, struct db *db, sqlite3
 		goto fail;
 	}
 
-	sqlite3_finalize(stmt);
+	db_stmt_done(db, stmt);
 	return true;
 fail:
-	sqlite3_finalize(stmt);
+	db_stmt_done(db, stmt);
 	return false;
 }
 
@@ -327,6 +367,7 @@ sqlite3_stmt *PRINTF_FMT(3, 4)
 
 static void destroy_db(struct db *db)
 {
+	db_clear_stmts(db);
 	sqlite3_close(db->sql);
 }
 
@@ -335,17 +376,67 @@ void db_begin_transaction_(struct db *db, const char *location)
 	if (db->in_transaction)
 		fatal("Already in transaction from %s", db->in_transaction);
 
-	db_do_exec(location, db, "BEGIN TRANSACTION;");
+	if (!db->group_open)
+		db_do_exec(location, db, "BEGIN TRANSACTION;");
+	db->group_open = db->group_commit;
 	db->in_transaction = location;
 }
 
+static void db_do_commit(struct db *db)
+{
+	struct timemono start = time_mono();
+	u64 usec;
+
+	db_do_exec(__func__, db, "COMMIT;");
+
+	usec = time_to_usec(timemono_between(time_mono(), start));
+	db->commits++;
+	db->commit_usec += usec;
+	if (usec > db->max_commit_usec)
+		db->max_commit_usec = usec;
+}
+
 void db_commit_transaction(struct db *db)
 {
 	assert(db->in_transaction);
-	db_exec(__func__, db, "COMMIT;");
+	db->transactions++;
+	if (!db->group_open)
+		db_do_commit(db);
 	db->in_transaction = NULL;
 }
 
+void db_flush(struct db *db)
+{
+	assert(!db->in_transaction);
+	if (db->group_open) {
+		db_do_commit(db);
+		db->group_open = false;
+	}
+}
+
+void db_checkpoint(struct db *db)
+{
+	int wal, done;
+
+	assert(!db->in_transaction);
+	assert(!db->group_open);
+
+	db->checkpoint_due = false;
+	/* If readers are in the way, we'll try again next time. */
+	if (sqlite3_wal_checkpoint_v2(db->sql, NULL, SQLITE_CHECKPOINT_PASSIVE,
+				      &wal, &done) != SQLITE_OK)
+		return;
+	db->wal_pages = wal - done;
+	db->checkpoints++;
+}
+
+void db_set_group_commit(struct db *db, bool group_commit)
+{
+	db->group_commit = group_commit;
+	if (!group_commit)
+		db_flush(db);
+}
+
 /**
  * db_open - Open or create a sqlite3 database
  */
@@ -370,8 +461,16 @@ static struct db *db_open(const tal_t *ctx, char *filename)
 	db = tal(ctx, struct db);
 	db->filename = tal_dup_arr(db, char, filename, strlen(filename), 0);
 	db->sql = sql;
+	stmt_cache_init(&db->stmts);
 	tal_add_destructor(db, destroy_db);
 	db->in_transaction = NULL;
+	db->group_commit = db->group_open = false;
+	db->pragmas = NULL;
+	db->wal_pages = 0;
+	db->checkpoint_due = false;
+	db->commits = db->transactions = 0;
+	db->commit_usec = db->max_commit_usec = 0;
+	db->checkpoints = 0;
 	db_do_exec(__func__, db, "PRAGMA foreign_keys = ON;");
 
 	return db;
@@ -457,10 +556,42 @@ static void db_migrate(struct db *db, struct log *log)
 	db_commit_transaction(db);
 }
 
-struct db *db_setup(const tal_t *ctx, struct log *log)
+/* Instead of sqlite checkpointing when a commit makes the WAL big. */
+static int db_wal_hook(void *arg, sqlite3 *sql UNUSED,
+		       const char *name UNUSED, int pages)
+{
+	struct db *db = arg;
+
+	db->wal_pages = pages;
+	return SQLITE_OK;
+}
+
+/* These only last as long as the connection. */
+static void db_set_pragmas(struct db *db)
+{
+	db_do_exec(__func__, db, db->pragmas);
+	sqlite3_wal_hook(db->sql, db_wal_hook, db);
+}
+
+struct db *db_setup(const tal_t *ctx, struct log *log,
+		    const struct config *config)
 {
 	struct db *db = db_open(ctx, DB_FILE);
 
+	/* Journal mode sticks to the file, but it's harmless to repeat. */
+	db->pragmas = tal_fmt(db,
+			      "PRAGMA journal_mode = %s;"
+			      "PRAGMA synchronous = %s;"
+			      "PRAGMA mmap_size = %"PRIu64";",
+			      config->db_wal ? "WAL" : "DELETE",
+			      config->db_synchronous,
+			      (u64)config->db_mmap_mb * 1024 * 1024);
+	/* Negative means KiB, rather than pages. */
+	if (config->db_cache_kb)
+		tal_append_fmt(&db->pragmas, "PRAGMA cache_size = -%u;",
+			       config->db_cache_kb);
+	db_set_pragmas(db);
+
 	db_migrate(db, log);
 	return db;
 }
@@ -471,6 +602,8 @@ void db_close_for_fork(struct db *db)
 	 *
 	 * Under Unix, you should not carry an open SQLite database across a
 	 * fork() system call into the child process. */
+	db_flush(db);
+	db_clear_stmts(db);
 	if (sqlite3_close(db->sql) != SQLITE_OK)
 		fatal("sqlite3_close: %s", sqlite3_errmsg(db->sql));
 	db->sql = NULL;
@@ -485,6 +618,9 @@ void db_reopen_after_fork(struct db *db)
 		fatal("failed to re-open database %s: %s", db->filename,
 		      sqlite3_errstr(err));
 	}
+	db_do_exec(__func__, db, "PRAGMA foreign_keys = ON;");
+	if (db->pragmas)
+		db_set_pragmas(db);
 }
 
 s64 db_get_intvar(struct db *db, char *varname, s64 defval)
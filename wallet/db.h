@@ -6,18 +6,59 @@
 #include <bitcoin/pubkey.h>
 #include <bitcoin/short_channel_id.h>
 #include <bitcoin/tx.h>
+#include <ccan/cast/cast.h>
+#include <ccan/htable/htable_type.h>
 #include <ccan/short_types/short_types.h>
+#include <ccan/str/str.h>
 #include <ccan/tal/tal.h>
 #include <secp256k1_ecdh.h>
 #include <sqlite3.h>
 #include <stdbool.h>
 
+struct config;
 struct log;
 
+/* Even if we're busy, we checkpoint once the WAL is this big (it's what
+ * sqlite does by default, every commit). */
+#define DB_WAL_MAX_PAGES 1000
+
+/* Statements we've prepared before and aren't in use, by their SQL. */
+static inline const char *stmt_sql(const sqlite3_stmt *stmt)
+{
+	return sqlite3_sql(cast_const(sqlite3_stmt *, stmt));
+}
+size_t hash_sql(const char *sql);
+static inline bool stmt_sql_eq(const sqlite3_stmt *stmt, const char *sql)
+{
+	return streq(stmt_sql(stmt), sql);
+}
+HTABLE_DEFINE_TYPE(sqlite3_stmt, stmt_sql, hash_sql, stmt_sql_eq,
+		   stmt_cache);
+
 struct db {
 	char *filename;
 	const char *in_transaction;
 	sqlite3 *sql;
+
+	/* So db_prepare() doesn't have to compile the same SQL every time. */
+	struct stmt_cache stmts;
+
+	/* Do transactions share one sqlite transaction until db_flush()? */
+	bool group_commit;
+	/* Is there a sqlite transaction open for them? */
+	bool group_open;
+
+	/* Settings we have to make again if we reopen. */
+	char *pragmas;
+
+	/* Pages in the write-ahead log not yet checkpointed. */
+	int wal_pages;
+	/* Set by our caller: checkpoint when convenient. */
+	bool checkpoint_due;
+
+	/* For statistics. */
+	u64 commits, transactions, commit_usec, max_commit_usec;
+	u64 checkpoints;
 };
 
 /**
@@ -30,8 +71,10 @@ struct db {
  * Params:
  *  @ctx: the tal_t context to allocate from
  *  @log: where to log messages to
+ *  @config: journal mode, synchronous, mmap and cache settings
  */
-struct db *db_setup(const tal_t *ctx, struct log *log);
+struct db *db_setup(const tal_t *ctx, struct log *log,
+		    const struct config *config);
 
 /**
  * db_query - Prepare and execute a query, and return the result (or NULL)
@@ -56,6 +99,30 @@ void db_begin_transaction_(struct db *db, const char *location);
  */
 void db_commit_transaction(struct db *db);
 
+/**
+ * db_set_group_commit - Share one sqlite transaction between transactions
+ *
+ * Once set, db_commit_transaction() only ends our transaction: the
+ * next db_begin_transaction() carries on in the same sqlite transaction,
+ * until db_flush() commits them all at once.  Unsetting it flushes.
+ */
+void db_set_group_commit(struct db *db, bool group_commit);
+
+/**
+ * db_flush - Commit the shared sqlite transaction, if there is one
+ *
+ * Must not be in a transaction.
+ */
+void db_flush(struct db *db);
+
+/**
+ * db_checkpoint - Copy what's in the write-ahead log into the database
+ *
+ * We don't let sqlite do this itself as part of a commit: we do it when
+ * we're not busy.  Must not be in a transaction, or a group commit.
+ */
+void db_checkpoint(struct db *db);
+
 /**
  * db_set_intvar - Set an integer variable in the database
  *
@@ -81,6 +148,9 @@ s64 db_get_intvar(struct db *db, char *varname, s64 defval);
  * statement, `NULL` otherwise. On failure `db->err` will be set with
  * the human readable error.
  *
+ * If we've prepared @query before, this reuses that statement: hand it
+ * back with `db_exec_prepared` or `db_stmt_done`, not `sqlite3_finalize`.
+ *
  * @db: Database to query/exec
  * @query: The SQL statement to compile
  */
@@ -103,6 +173,13 @@ sqlite3_stmt *db_prepare_(const char *caller, struct db *db, const char *query);
 #define db_exec_prepared(db,stmt) db_exec_prepared_(__func__,db,stmt)
 void db_exec_prepared_(const char *caller, struct db *db, sqlite3_stmt *stmt);
 
+/**
+ * db_stmt_done -- Finished with a statement from db_prepare.
+ *
+ * Resets it and clears its bindings, so db_prepare() can reuse it.
+ */
+void db_stmt_done(struct db *db, sqlite3_stmt *stmt);
+
 /**
  * db_exec_prepared_mayfail - db_exec_prepared, but don't fatal() it fails.
  */
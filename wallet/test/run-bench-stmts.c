@@ -0,0 +1,250 @@
+#include <lightningd/log.h>
+
+static void wallet_fatal(const char *fmt, ...);
+#define fatal wallet_fatal
+#include "test_utils.h"
+
+static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, const char *fmt UNUSED, ...)
+{
+}
+#define log_ db_log_
+
+#include "wallet/wallet.c"
+#include "wallet/txfilter.c"
+
+#include "wallet/db.c"
+
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for connect_htlc_in */
+void connect_htlc_in(struct htlc_in_map *map UNNEEDED, struct htlc_in *hin UNNEEDED)
+{ fprintf(stderr, "connect_htlc_in called!\n"); abort(); }
+/* Generated stub for connect_htlc_out */
+void connect_htlc_out(struct htlc_out_map *map UNNEEDED, struct htlc_out *hout UNNEEDED)
+{ fprintf(stderr, "connect_htlc_out called!\n"); abort(); }
+/* Generated stub for find_peer_by_dbid */
+struct peer *find_peer_by_dbid(struct lightningd *ld UNNEEDED, u64 dbid UNNEEDED)
+{ fprintf(stderr, "find_peer_by_dbid called!\n"); abort(); }
+/* Generated stub for htlc_in_check */
+struct htlc_in *htlc_in_check(const struct htlc_in *hin UNNEEDED, const char *abortstr UNNEEDED)
+{ fprintf(stderr, "htlc_in_check called!\n"); abort(); }
+/* Generated stub for invoices_create */
+bool invoices_create(struct invoices *invoices UNNEEDED,
+		     struct invoice *pinvoice UNNEEDED,
+		     u64 *msatoshi TAKES UNNEEDED,
+		     const char *label TAKES UNNEEDED,
+		     u64 expiry UNNEEDED,
+		     const char *b11enc UNNEEDED,
+		     const struct preimage *r UNNEEDED,
+		     const struct sha256 *rhash UNNEEDED)
+{ fprintf(stderr, "invoices_create called!\n"); abort(); }
+/* Generated stub for invoices_delete */
+bool invoices_delete(struct invoices *invoices UNNEEDED,
+		     struct invoice invoice UNNEEDED)
+{ fprintf(stderr, "invoices_delete called!\n"); abort(); }
+/* Generated stub for invoices_find_by_label */
+bool invoices_find_by_label(struct invoices *invoices UNNEEDED,
+			    struct invoice *pinvoice UNNEEDED,
+			    const char *label UNNEEDED)
+{ fprintf(stderr, "invoices_find_by_label called!\n"); abort(); }
+/* Generated stub for invoices_find_unpaid */
+bool invoices_find_unpaid(struct invoices *invoices UNNEEDED,
+			  struct invoice *pinvoice UNNEEDED,
+			  const struct sha256 *rhash UNNEEDED)
+{ fprintf(stderr, "invoices_find_unpaid called!\n"); abort(); }
+/* Generated stub for invoices_get_details */
+void invoices_get_details(const tal_t *ctx UNNEEDED,
+			  struct invoices *invoices UNNEEDED,
+			  struct invoice invoice UNNEEDED,
+			  struct invoice_details *details UNNEEDED)
+{ fprintf(stderr, "invoices_get_details called!\n"); abort(); }
+/* Generated stub for invoices_iterate */
+bool invoices_iterate(struct invoices *invoices UNNEEDED,
+		      struct invoice_iterator *it UNNEEDED)
+{ fprintf(stderr, "invoices_iterate called!\n"); abort(); }
+/* Generated stub for invoices_iterator_deref */
+void invoices_iterator_deref(const tal_t *ctx UNNEEDED,
+			     struct invoices *invoices UNNEEDED,
+			     const struct invoice_iterator *it UNNEEDED,
+			     struct invoice_details *details UNNEEDED)
+{ fprintf(stderr, "invoices_iterator_deref called!\n"); abort(); }
+/* Generated stub for invoices_load */
+bool invoices_load(struct invoices *invoices UNNEEDED)
+{ fprintf(stderr, "invoices_load called!\n"); abort(); }
+/* Generated stub for invoices_new */
+struct invoices *invoices_new(const tal_t *ctx UNNEEDED,
+			      struct db *db UNNEEDED,
+			      struct log *log UNNEEDED,
+			      struct timers *timers UNNEEDED)
+{ fprintf(stderr, "invoices_new called!\n"); abort(); }
+/* Generated stub for invoices_resolve */
+void invoices_resolve(struct invoices *invoices UNNEEDED,
+		      struct invoice invoice UNNEEDED,
+		      u64 msatoshi_received UNNEEDED)
+{ fprintf(stderr, "invoices_resolve called!\n"); abort(); }
+/* Generated stub for invoices_waitany */
+void invoices_waitany(const tal_t *ctx UNNEEDED,
+		      struct invoices *invoices UNNEEDED,
+		      u64 lastpay_index UNNEEDED,
+		      void (*cb)(const struct invoice * UNNEEDED, void*) UNNEEDED,
+		      void *cbarg UNNEEDED)
+{ fprintf(stderr, "invoices_waitany called!\n"); abort(); }
+/* Generated stub for invoices_waitone */
+void invoices_waitone(const tal_t *ctx UNNEEDED,
+		      struct invoices *invoices UNNEEDED,
+		      struct invoice invoice UNNEEDED,
+		      void (*cb)(const struct invoice * UNNEEDED, void*) UNNEEDED,
+		      void *cbarg UNNEEDED)
+{ fprintf(stderr, "invoices_waitone called!\n"); abort(); }
+/* Generated stub for new_channel */
+struct channel *new_channel(struct peer *peer UNNEEDED, u64 dbid UNNEEDED,
+			    /* NULL or stolen */
+			    struct wallet_shachain *their_shachain UNNEEDED,
+			    enum channel_state state UNNEEDED,
+			    enum side funder UNNEEDED,
+			    /* NULL or stolen */
+			    struct log *log UNNEEDED,
+			    const char *transient_billboard TAKES UNNEEDED,
+			    u8 channel_flags UNNEEDED,
+			    const struct channel_config *our_config UNNEEDED,
+			    u32 minimum_depth UNNEEDED,
+			    u64 next_index_local UNNEEDED,
+			    u64 next_index_remote UNNEEDED,
+			    u64 next_htlc_id UNNEEDED,
+			    const struct bitcoin_txid *funding_txid UNNEEDED,
+			    u16 funding_outnum UNNEEDED,
+			    u64 funding_satoshi UNNEEDED,
+			    u64 push_msat UNNEEDED,
+			    bool remote_funding_locked UNNEEDED,
+			    /* NULL or stolen */
+			    struct short_channel_id *scid UNNEEDED,
+			    u64 our_msatoshi UNNEEDED,
+			    /* Stolen */
+			    struct bitcoin_tx *last_tx UNNEEDED,
+			    const secp256k1_ecdsa_signature *last_sig UNNEEDED,
+			    /* NULL or stolen */
+			    secp256k1_ecdsa_signature *last_htlc_sigs UNNEEDED,
+			    const struct channel_info *channel_info UNNEEDED,
+			    /* NULL or stolen */
+			    u8 *remote_shutdown_scriptpubkey UNNEEDED,
+			    u64 final_key_idx UNNEEDED,
+			    bool last_was_revoke UNNEEDED,
+			    /* NULL or stolen */
+			    struct changed_htlc *last_sent_commit UNNEEDED,
+			    u32 first_blocknum UNNEEDED)
+{ fprintf(stderr, "new_channel called!\n"); abort(); }
+/* Generated stub for new_peer */
+struct peer *new_peer(struct lightningd *ld UNNEEDED, u64 dbid UNNEEDED,
+		      const struct pubkey *id UNNEEDED,
+		      const struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "new_peer called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static void wallet_fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	verrx(1, fmt, ap);
+	va_end(ap);
+}
+
+static struct wallet *create_bench_wallet(struct lightningd *ld,
+					  const tal_t *ctx)
+{
+	char filename[] = "/tmp/ldb-XXXXXX";
+	int fd = mkstemp(filename);
+	struct wallet *w = tal(ctx, struct wallet);
+
+	if (fd == -1)
+		err(1, "Creating temp file");
+	close(fd);
+
+	w->db = db_open(w, filename);
+	list_head_init(&w->unstored_payments);
+	w->ld = ld;
+	ld->wallet = w;
+	db_migrate(w->db, w->log);
+	w->max_channel_dbid = 0;
+	return w;
+}
+
+/* The statements lightningd runs all the time, one transaction's worth. */
+static void hot_paths(struct wallet *w, struct channel_config *cc,
+		      u64 htlc_dbid, size_t i, bool cached)
+{
+	struct channel_config loaded;
+	struct preimage preimage;
+
+	memset(&preimage, i, sizeof(preimage));
+
+	wallet_htlc_update(w, htlc_dbid, RCVD_ADD_HTLC, NULL);
+	if (!cached)
+		db_clear_stmts(w->db);
+	wallet_htlc_update(w, htlc_dbid, SENT_REMOVE_HTLC, &preimage);
+	if (!cached)
+		db_clear_stmts(w->db);
+	cc->htlc_minimum_msat = i;
+	wallet_channel_config_save(w, cc);
+	if (!cached)
+		db_clear_stmts(w->db);
+	wallet_channel_config_load(w, cc->id, &loaded);
+	if (!cached)
+		db_clear_stmts(w->db);
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+	struct lightningd *ld = talz(ctx, struct lightningd);
+	struct wallet *w = create_bench_wallet(ld, ctx);
+	struct channel_config *cc = talz(ctx, struct channel_config);
+	struct channel *chan = talz(ctx, struct channel);
+	struct htlc_in in;
+	struct timemono start;
+	u64 usec[2];
+	size_t i, j, num = 20000;
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 1)
+		num = atoi(argv[1]);
+	if (argc > 2)
+		opt_usage_and_exit("[num_loops]");
+
+	memset(&in, 0, sizeof(in));
+	chan->dbid = 1;
+	in.key.channel = chan;
+	db_begin_transaction(w->db);
+	db_exec(__func__, w->db, "INSERT INTO channels (id) VALUES (1);");
+	wallet_channel_config_insert(w, cc);
+	wallet_htlc_save_in(w, chan, &in);
+	db_commit_transaction(w->db);
+
+	/* Commits would swamp it: that's what group commit is for. */
+	for (j = 0; j < 2; j++) {
+		db_clear_stmts(w->db);
+		db_begin_transaction(w->db);
+		start = time_mono();
+		for (i = 0; i < num; i++)
+			hot_paths(w, cc, in.dbid, i, j == 1);
+		usec[j] = time_to_usec(timemono_between(time_mono(), start));
+		db_commit_transaction(w->db);
+	}
+
+	for (j = 0; j < 2; j++)
+		printf("%zu x 4 statements, %s: %"PRIu64" msec,"
+		       " %"PRIu64" statements/sec\n",
+		       num, j == 0 ? "prepared each time" : "cached",
+		       usec[j] / 1000,
+		       usec[j] ? num * 4 * 1000000 / usec[j] : 0);
+
+	tal_free(ctx);
+	opt_free_table();
+	return 0;
+}
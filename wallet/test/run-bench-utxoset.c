@@ -0,0 +1,344 @@
+#include <lightningd/log.h>
+
+static void wallet_fatal(const char *fmt, ...);
+#define fatal wallet_fatal
+#include "test_utils.h"
+
+static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, const char *fmt UNUSED, ...)
+{
+}
+#define log_ db_log_
+
+#include "wallet/wallet.c"
+#include "wallet/txfilter.c"
+
+#include "wallet/db.c"
+
+#include <ccan/err/err.h>
+#include <ccan/opt/opt.h>
+#include <ccan/time/time.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* AUTOGENERATED MOCKS START */
+/* Generated stub for connect_htlc_in */
+void connect_htlc_in(struct htlc_in_map *map UNNEEDED, struct htlc_in *hin UNNEEDED)
+{ fprintf(stderr, "connect_htlc_in called!\n"); abort(); }
+/* Generated stub for connect_htlc_out */
+void connect_htlc_out(struct htlc_out_map *map UNNEEDED, struct htlc_out *hout UNNEEDED)
+{ fprintf(stderr, "connect_htlc_out called!\n"); abort(); }
+/* Generated stub for find_peer_by_dbid */
+struct peer *find_peer_by_dbid(struct lightningd *ld UNNEEDED, u64 dbid UNNEEDED)
+{ fprintf(stderr, "find_peer_by_dbid called!\n"); abort(); }
+/* Generated stub for htlc_in_check */
+struct htlc_in *htlc_in_check(const struct htlc_in *hin UNNEEDED, const char *abortstr UNNEEDED)
+{ fprintf(stderr, "htlc_in_check called!\n"); abort(); }
+/* Generated stub for invoices_create */
+bool invoices_create(struct invoices *invoices UNNEEDED,
+		     struct invoice *pinvoice UNNEEDED,
+		     u64 *msatoshi TAKES UNNEEDED,
+		     const char *label TAKES UNNEEDED,
+		     u64 expiry UNNEEDED,
+		     const char *b11enc UNNEEDED,
+		     const struct preimage *r UNNEEDED,
+		     const struct sha256 *rhash UNNEEDED)
+{ fprintf(stderr, "invoices_create called!\n"); abort(); }
+/* Generated stub for invoices_delete */
+bool invoices_delete(struct invoices *invoices UNNEEDED,
+		     struct invoice invoice UNNEEDED)
+{ fprintf(stderr, "invoices_delete called!\n"); abort(); }
+/* Generated stub for invoices_find_by_label */
+bool invoices_find_by_label(struct invoices *invoices UNNEEDED,
+			    struct invoice *pinvoice UNNEEDED,
+			    const char *label UNNEEDED)
+{ fprintf(stderr, "invoices_find_by_label called!\n"); abort(); }
+/* Generated stub for invoices_find_unpaid */
+bool invoices_find_unpaid(struct invoices *invoices UNNEEDED,
+			  struct invoice *pinvoice UNNEEDED,
+			  const struct sha256 *rhash UNNEEDED)
+{ fprintf(stderr, "invoices_find_unpaid called!\n"); abort(); }
+/* Generated stub for invoices_get_details */
+void invoices_get_details(const tal_t *ctx UNNEEDED,
+			  struct invoices *invoices UNNEEDED,
+			  struct invoice invoice UNNEEDED,
+			  struct invoice_details *details UNNEEDED)
+{ fprintf(stderr, "invoices_get_details called!\n"); abort(); }
+/* Generated stub for invoices_iterate */
+bool invoices_iterate(struct invoices *invoices UNNEEDED,
+		      struct invoice_iterator *it UNNEEDED)
+{ fprintf(stderr, "invoices_iterate called!\n"); abort(); }
+/* Generated stub for invoices_iterator_deref */
+void invoices_iterator_deref(const tal_t *ctx UNNEEDED,
+			     struct invoices *invoices UNNEEDED,
+			     const struct invoice_iterator *it UNNEEDED,
+			     struct invoice_details *details UNNEEDED)
+{ fprintf(stderr, "invoices_iterator_deref called!\n"); abort(); }
+/* Generated stub for invoices_load */
+bool invoices_load(struct invoices *invoices UNNEEDED)
+{ fprintf(stderr, "invoices_load called!\n"); abort(); }
+/* Generated stub for invoices_new */
+struct invoices *invoices_new(const tal_t *ctx UNNEEDED,
+			      struct db *db UNNEEDED,
+			      struct log *log UNNEEDED,
+			      struct timers *timers UNNEEDED)
+{ fprintf(stderr, "invoices_new called!\n"); abort(); }
+/* Generated stub for invoices_resolve */
+void invoices_resolve(struct invoices *invoices UNNEEDED,
+		      struct invoice invoice UNNEEDED,
+		      u64 msatoshi_received UNNEEDED)
+{ fprintf(stderr, "invoices_resolve called!\n"); abort(); }
+/* Generated stub for invoices_waitany */
+void invoices_waitany(const tal_t *ctx UNNEEDED,
+		      struct invoices *invoices UNNEEDED,
+		      u64 lastpay_index UNNEEDED,
+		      void (*cb)(const struct invoice * UNNEEDED, void*) UNNEEDED,
+		      void *cbarg UNNEEDED)
+{ fprintf(stderr, "invoices_waitany called!\n"); abort(); }
+/* Generated stub for invoices_waitone */
+void invoices_waitone(const tal_t *ctx UNNEEDED,
+		      struct invoices *invoices UNNEEDED,
+		      struct invoice invoice UNNEEDED,
+		      void (*cb)(const struct invoice * UNNEEDED, void*) UNNEEDED,
+		      void *cbarg UNNEEDED)
+{ fprintf(stderr, "invoices_waitone called!\n"); abort(); }
+/* Generated stub for new_channel */
+struct channel *new_channel(struct peer *peer UNNEEDED, u64 dbid UNNEEDED,
+			    /* NULL or stolen */
+			    struct wallet_shachain *their_shachain UNNEEDED,
+			    enum channel_state state UNNEEDED,
+			    enum side funder UNNEEDED,
+			    /* NULL or stolen */
+			    struct log *log UNNEEDED,
+			    const char *transient_billboard TAKES UNNEEDED,
+			    u8 channel_flags UNNEEDED,
+			    const struct channel_config *our_config UNNEEDED,
+			    u32 minimum_depth UNNEEDED,
+			    u64 next_index_local UNNEEDED,
+			    u64 next_index_remote UNNEEDED,
+			    u64 next_htlc_id UNNEEDED,
+			    const struct bitcoin_txid *funding_txid UNNEEDED,
+			    u16 funding_outnum UNNEEDED,
+			    u64 funding_satoshi UNNEEDED,
+			    u64 push_msat UNNEEDED,
+			    bool remote_funding_locked UNNEEDED,
+			    /* NULL or stolen */
+			    struct short_channel_id *scid UNNEEDED,
+			    u64 our_msatoshi UNNEEDED,
+			    /* Stolen */
+			    struct bitcoin_tx *last_tx UNNEEDED,
+			    const secp256k1_ecdsa_signature *last_sig UNNEEDED,
+			    /* NULL or stolen */
+			    secp256k1_ecdsa_signature *last_htlc_sigs UNNEEDED,
+			    const struct channel_info *channel_info UNNEEDED,
+			    /* NULL or stolen */
+			    u8 *remote_shutdown_scriptpubkey UNNEEDED,
+			    u64 final_key_idx UNNEEDED,
+			    bool last_was_revoke UNNEEDED,
+			    /* NULL or stolen */
+			    struct changed_htlc *last_sent_commit UNNEEDED,
+			    u32 first_blocknum UNNEEDED)
+{ fprintf(stderr, "new_channel called!\n"); abort(); }
+/* Generated stub for new_peer */
+struct peer *new_peer(struct lightningd *ld UNNEEDED, u64 dbid UNNEEDED,
+		      const struct pubkey *id UNNEEDED,
+		      const struct wireaddr *addr UNNEEDED)
+{ fprintf(stderr, "new_peer called!\n"); abort(); }
+/* AUTOGENERATED MOCKS END */
+
+static void wallet_fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	verrx(1, fmt, ap);
+	va_end(ap);
+}
+
+/* A block: each tx spends a P2WSH output from the previous block, and
+ * something we don't know about.  The last one also spends an output
+ * created earlier in the same block. */
+static struct block *synthetic_block(const tal_t *ctx, struct block *prev,
+				     size_t num_txs)
+{
+	struct block *b = talz(ctx, struct block);
+	u8 *wscript = tal_arr(b, u8, 1), *p2wsh, *other;
+	size_t i;
+
+	b->prev = prev;
+	b->height = prev ? prev->height + 1 : 1;
+	memset(&b->blkid, b->height, sizeof(b->blkid));
+	wscript[0] = b->height;
+	p2wsh = scriptpubkey_p2wsh(b, wscript);
+	other = tal_arrz(b, u8, 22);
+	b->full_txs = tal_arr(b, struct bitcoin_tx *, num_txs);
+	for (i = 0; i < num_txs; i++) {
+		struct bitcoin_tx *tx = bitcoin_tx(b->full_txs, 2, 3);
+
+		tx->lock_time = b->height;
+		if (prev && i < tal_count(prev->full_txs))
+			bitcoin_txid(prev->full_txs[i], &tx->input[0].txid);
+		else
+			memset(&tx->input[0].txid, 0xFF, sizeof(tx->input[0].txid));
+		tx->input[0].index = (i % 2) * 2;
+		memset(&tx->input[1].txid, 0, sizeof(tx->input[1].txid));
+		tx->input[1].index = i;
+		tx->output[0].script = p2wsh;
+		tx->output[0].amount = i;
+		tx->output[1].script = other;
+		tx->output[1].amount = i;
+		tx->output[2].script = p2wsh;
+		tx->output[2].amount = i + 1;
+		b->full_txs[i] = tx;
+	}
+	if (num_txs > 1) {
+		struct bitcoin_tx *tx = b->full_txs[num_txs - 1];
+		bitcoin_txid(b->full_txs[num_txs - 2], &tx->input[1].txid);
+		tx->input[1].index = 2;
+	}
+	return b;
+}
+
+/* Raw hex blocks, one per line, as from `bitcoin-cli getblock <hash> 0`. */
+static struct block **read_blocks(const tal_t *ctx, const char *blockfile)
+{
+	struct block **blocks = tal_arr(ctx, struct block *, 0);
+	FILE *f = fopen(blockfile, "r");
+	char *line = NULL;
+	size_t len = 0, n;
+	ssize_t r;
+
+	if (!f)
+		err(1, "Opening %s", blockfile);
+	while ((r = getline(&line, &len, f)) > 0) {
+		struct bitcoin_block *blk;
+		struct block *b = talz(blocks, struct block);
+
+		if (line[r-1] == '\n')
+			r--;
+		blk = bitcoin_block_from_hex(b, line, r);
+		if (!blk)
+			errx(1, "Bad block %zu in %s",
+			     tal_count(blocks), blockfile);
+		n = tal_count(blocks);
+		b->prev = n ? blocks[n-1] : NULL;
+		b->height = n + 1;
+		sha256_double(&b->blkid.shad, &blk->hdr, sizeof(blk->hdr));
+		b->full_txs = blk->tx;
+		tal_resize(&blocks, n + 1);
+		blocks[n] = b;
+	}
+	free(line);
+	fclose(f);
+	return blocks;
+}
+
+/* How chaintopology used to do it: a statement per output and input. */
+static void utxoset_add_block_unbatched(struct wallet *w, const struct block *b)
+{
+	for (size_t i = 0; i < tal_count(b->full_txs); i++) {
+		const struct bitcoin_tx *tx = b->full_txs[i];
+		for (size_t j = 0; j < tal_count(tx->output); j++) {
+			const struct bitcoin_tx_output *output = &tx->output[j];
+			if (is_p2wsh(output->script, NULL))
+				wallet_utxoset_add(w, tx, j, b->height, i,
+						   output->script,
+						   output->amount);
+		}
+	}
+	for (size_t i = 0; i < tal_count(b->full_txs); i++) {
+		const struct bitcoin_tx *tx = b->full_txs[i];
+		for (size_t j = 0; j < tal_count(tx->input); j++)
+			wallet_outpoint_spend(w, b->height,
+					      &tx->input[j].txid,
+					      tx->input[j].index);
+	}
+}
+
+/* What add_tip does to the db, inside its own transaction.  add_tip itself
+ * is static in chaintopology.c and wants a whole lightningd around it. */
+static void add_block(struct wallet *w, struct block *b, bool batched)
+{
+	db_begin_transaction(w->db);
+	wallet_block_add(w, b);
+	if (batched)
+		wallet_utxoset_add_block(w, b);
+	else
+		utxoset_add_block_unbatched(w, b);
+	db_commit_transaction(w->db);
+}
+
+static struct wallet *create_utxoset_wallet(struct lightningd *ld,
+					    const tal_t *ctx)
+{
+	char filename[] = "/tmp/ldb-XXXXXX";
+	int fd = mkstemp(filename);
+	struct wallet *w = tal(ctx, struct wallet);
+
+	if (fd == -1)
+		err(1, "Creating temp file");
+	close(fd);
+
+	w->db = db_open(w, filename);
+	list_head_init(&w->unstored_payments);
+	w->ld = ld;
+	ld->wallet = w;
+	db_migrate(w->db, w->log);
+	w->max_channel_dbid = 0;
+	w->owned_outpoints = outpointfilter_new(w);
+	w->utxoset_outpoints = outpointfilter_new(w);
+	return w;
+}
+
+int main(int argc, char *argv[])
+{
+	const tal_t *ctx = tal_tmpctx(NULL);
+	struct lightningd *ld = talz(ctx, struct lightningd);
+	struct block **blocks;
+	struct timemono start;
+	u64 usec[2];
+	size_t i, j, outputs = 0, num_txs = 1000;
+
+	opt_parse(&argc, argv, opt_log_stderr_exit);
+	if (argc > 2)
+		opt_usage_and_exit("[num_txs|file-of-raw-blocks]");
+
+	/* A number makes synthetic blocks of that many txs; anything else
+	 * is a file of real ones. */
+	if (argc > 1 && strspn(argv[1], "0123456789") != strlen(argv[1]))
+		blocks = read_blocks(ctx, argv[1]);
+	else {
+		if (argc > 1)
+			num_txs = atoi(argv[1]);
+		blocks = tal_arr(ctx, struct block *, 50);
+		for (i = 0; i < tal_count(blocks); i++)
+			blocks[i] = synthetic_block(blocks,
+						    i ? blocks[i-1] : NULL,
+						    num_txs);
+	}
+
+	for (i = 0; i < tal_count(blocks); i++)
+		for (j = 0; j < tal_count(blocks[i]->full_txs); j++)
+			outputs += tal_count(blocks[i]->full_txs[j]->output);
+
+	for (j = 0; j < 2; j++) {
+		struct wallet *w = create_utxoset_wallet(ld, ctx);
+		start = time_mono();
+		for (i = 0; i < tal_count(blocks); i++)
+			add_block(w, blocks[i], j == 1);
+		usec[j] = time_to_usec(timemono_between(time_mono(), start));
+		tal_free(w);
+	}
+
+	for (j = 0; j < 2; j++)
+		printf("%zu blocks (%zu outputs), %s: %"PRIu64" msec,"
+		       " %"PRIu64" blocks/sec\n",
+		       tal_count(blocks), outputs,
+		       j == 0 ? "statement each" : "batched",
+		       usec[j] / 1000,
+		       usec[j] ? tal_count(blocks) * 1000000 / usec[j] : 0);
+
+	tal_free(ctx);
+	opt_free_table();
+	return 0;
+}
@@ -110,6 +110,103 @@ static bool test_vars(void)
 	return true;
 }
 
+/* What another connection (ie. after a crash) would see. */
+static s64 stored_intvar(struct db *db, const char *varname, s64 defval)
+{
+	sqlite3 *sql;
+	sqlite3_stmt *stmt;
+	s64 val = defval;
+
+	if (sqlite3_open(db->filename, &sql) != SQLITE_OK)
+		abort();
+	if (sqlite3_prepare_v2(sql, "SELECT val FROM vars WHERE name=?;", -1,
+			       &stmt, NULL) != SQLITE_OK)
+		abort();
+	sqlite3_bind_text(stmt, 1, varname, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		val = atol((const char *)sqlite3_column_text(stmt, 0));
+	sqlite3_finalize(stmt);
+	sqlite3_close(sql);
+	return val;
+}
+
+static bool test_group_commit(void)
+{
+	struct db *db = create_test_db();
+	CHECK(db);
+	db_migrate(db, NULL);
+	db->commits = db->transactions = 0;
+
+	db_set_group_commit(db, true);
+	db_begin_transaction(db);
+	db_set_intvar(db, "testvar", 1);
+	db_commit_transaction(db);
+	db_begin_transaction(db);
+	CHECK(db_get_intvar(db, "testvar", 42) == 1);
+	db_set_intvar(db, "testvar", 2);
+	db_commit_transaction(db);
+
+	/* Both still in one sqlite transaction. */
+	CHECK(!sqlite3_get_autocommit(db->sql));
+	CHECK(db->transactions == 2);
+	CHECK(db->commits == 0);
+	CHECK(stored_intvar(db, "testvar", 42) == 42);
+
+	db_flush(db);
+	CHECK(sqlite3_get_autocommit(db->sql));
+	CHECK(db->commits == 1);
+	CHECK(stored_intvar(db, "testvar", 42) == 2);
+
+	/* Nothing to do. */
+	db_flush(db);
+	CHECK(db->commits == 1);
+
+	/* Unsetting it flushes, then we commit each one again. */
+	db_begin_transaction(db);
+	db_commit_transaction(db);
+	db_set_group_commit(db, false);
+	CHECK(db->commits == 2);
+	db_begin_transaction(db);
+	CHECK(db_get_intvar(db, "testvar", 42) == 2);
+	db_commit_transaction(db);
+	CHECK(sqlite3_get_autocommit(db->sql));
+	CHECK(db->commits == 3);
+	CHECK(db->transactions == 4);
+
+	tal_free(db);
+	return true;
+}
+
+static bool test_wal_checkpoint(void)
+{
+	struct db *db = create_test_db();
+	CHECK(db);
+	db->pragmas = tal_strdup(db, "PRAGMA journal_mode = WAL;");
+	db_set_pragmas(db);
+	db_migrate(db, NULL);
+
+	/* sqlite leaves it in the WAL for us to checkpoint. */
+	CHECK(db->wal_pages > 0);
+	db->checkpoint_due = true;
+	db_checkpoint(db);
+	CHECK(db->wal_pages == 0);
+	CHECK(db->checkpoints == 1);
+	CHECK(!db->checkpoint_due);
+
+	/* Still the same after reopening. */
+	db_close_for_fork(db);
+	db_reopen_after_fork(db);
+	db_begin_transaction(db);
+	db_set_intvar(db, "testvar", 1);
+	db_commit_transaction(db);
+	CHECK(db->wal_pages > 0);
+	db_checkpoint(db);
+	CHECK(db->wal_pages == 0);
+
+	tal_free(db);
+	return true;
+}
+
 int main(void)
 {
 	bool ok = true;
@@ -117,6 +214,8 @@ int main(void)
 	ok &= test_empty_db_migrate();
 	ok &= test_vars();
 	ok &= test_primitives();
+	ok &= test_group_commit();
+	ok &= test_wal_checkpoint();
 
 	return !ok;
 }
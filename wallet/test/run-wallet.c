@@ -10,6 +10,7 @@ static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, const c
 #define log_ db_log_
 
 #include "wallet/wallet.c"
+#include "wallet/txfilter.c"
 #include "lightningd/htlc_end.c"
 #include "lightningd/peer_control.c"
 #include "lightningd/channel.c"
@@ -20,6 +21,7 @@ static void db_log_(struct log *log UNUSED, enum log_level level UNUSED, const c
 #include <ccan/tal/str/str.h>
 #include <ccan/structeq/structeq.h>
 #include <common/memleak.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -260,17 +262,6 @@ struct json_result *new_json_result(const tal_t *ctx UNNEEDED)
 /* Generated stub for null_response */
 struct json_result *null_response(const tal_t *ctx UNNEEDED)
 { fprintf(stderr, "null_response called!\n"); abort(); }
-/* Generated stub for outpointfilter_add */
-void outpointfilter_add(struct outpointfilter *of UNNEEDED,
-			const struct bitcoin_txid *txid UNNEEDED, const u32 outnum UNNEEDED)
-{ fprintf(stderr, "outpointfilter_add called!\n"); abort(); }
-/* Generated stub for outpointfilter_matches */
-bool outpointfilter_matches(struct outpointfilter *of UNNEEDED,
-			    const struct bitcoin_txid *txid UNNEEDED, const u32 outnum UNNEEDED)
-{ fprintf(stderr, "outpointfilter_matches called!\n"); abort(); }
-/* Generated stub for outpointfilter_new */
-struct outpointfilter *outpointfilter_new(tal_t *ctx UNNEEDED)
-{ fprintf(stderr, "outpointfilter_new called!\n"); abort(); }
 /* Generated stub for peer_accept_channel */
 u8 *peer_accept_channel(struct lightningd *ld UNNEEDED,
 			const struct pubkey *peer_id UNNEEDED,
@@ -438,12 +429,6 @@ const char *log_prefix(const struct log *log UNNEEDED)
 	return "";
 }
 
-void txfilter_add_scriptpubkey(struct txfilter *filter UNNEEDED, const u8 *script TAKES)
-{
-	if (taken(script))
-		tal_free(script);
-}
-
 /**
  * mempat -- Set the memory to a pattern
  *
@@ -764,6 +749,7 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 	/* Variant 2: update with scid set */
 	c1.scid = talz(w, struct short_channel_id);
 	c1.last_was_revoke = !c1.last_was_revoke;
+	c1.dirty |= CHANNEL_DIRTY_STATE;
 	wallet_channel_save(w, &c1);
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
@@ -780,6 +766,7 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 
 	/* Variant 3: update with last_commit_sent */
 	c1.last_sent_commit = &last_commit;
+	c1.dirty |= CHANNEL_DIRTY_STATE;
 	wallet_channel_save(w, &c1);
 	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
 	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
@@ -790,12 +777,33 @@ static bool test_channel_crud(struct lightningd *ld, const tal_t *ctx)
 
 	/* Variant 4: update and add remote_shutdown_scriptpubkey */
 	c1.remote_shutdown_scriptpubkey = scriptpubkey;
+	c1.dirty |= CHANNEL_DIRTY_SHUTDOWN;
 	wallet_channel_save(w, &c1);
 	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
 	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
 	CHECK_MSG(!wallet_err,
 		  tal_fmt(w, "Insert into DB: %s", wallet_err));
 	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v8)");
+	CHECK(c1.dirty == 0);
+	CHECK(c2->dirty == 0);
+	tal_free(c2);
+
+	/* Variant 5: only what's marked dirty gets written */
+	c1.our_msatoshi++;
+	c1.final_key_idx++;
+	c1.dirty |= CHANNEL_DIRTY_STATE;
+	wallet_channel_save(w, &c1);
+	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK(c2->our_msatoshi == c1.our_msatoshi);
+	CHECK(c2->final_key_idx == c1.final_key_idx - 1);
+	tal_free(c2);
+
+	c1.dirty |= CHANNEL_DIRTY_SHUTDOWN;
+	wallet_channel_save(w, &c1);
+	CHECK_MSG(!wallet_err, tal_fmt(w, "Insert into DB: %s", wallet_err));
+	CHECK_MSG(c2 = wallet_channel_load(w, c1.dbid), tal_fmt(w, "Load from DB"));
+	CHECK_MSG(channelseq(&c1, c2), "Compare loaded with saved (v9)");
 	tal_free(c2);
 
 	db_commit_transaction(w->db);
@@ -836,17 +844,22 @@ static bool test_htlc_crud(struct lightningd *ld, const tal_t *ctx)
 	struct htlc_in in, *hin;
 	struct htlc_out out, *hout;
 	struct preimage payment_key;
+	struct ripemd160 ripemd;
 	struct channel *chan = tal(ctx, struct channel);
 	struct peer *peer = talz(ctx, struct peer);
 	struct wallet *w = create_test_wallet(ld, ctx);
 	struct htlc_in_map *htlcs_in = tal(ctx, struct htlc_in_map);
 	struct htlc_out_map *htlcs_out = tal(ctx, struct htlc_out_map);
+	struct htlc_deadlines deadlines;
 
 	/* Make sure we have our references correct */
 	CHECK(transaction_wrap(w->db,
 			       db_exec(__func__, w->db, "INSERT INTO channels (id) VALUES (1);")));
 	chan->dbid = 1;
 	chan->peer = peer;
+	list_head_init(&chan->htlcs_in);
+	list_head_init(&chan->htlcs_out);
+	htlc_out_ripemd_map_init(&chan->htlcs_out_by_ripemd);
 
 	memset(&in, 0, sizeof(in));
 	memset(&out, 0, sizeof(out));
@@ -909,12 +922,32 @@ static bool test_htlc_crud(struct lightningd *ld, const tal_t *ctx)
 	CHECK(hin != NULL);
 	CHECK(hout != NULL);
 
+	/* Channel has them, and can find hout by what's in scripts. */
+	CHECK(list_top(&chan->htlcs_in, struct htlc_in, list) == hin);
+	CHECK(list_top(&chan->htlcs_out, struct htlc_out, list) == hout);
+	ripemd160(&ripemd, &out.payment_hash, sizeof(out.payment_hash));
+	CHECK(htlc_out_ripemd_map_get(&chan->htlcs_out_by_ripemd, &ripemd)
+	      == hout);
+
+	/* Deadlines come out earliest first, and go when they do. */
+	htlc_deadlines_init(ctx, &deadlines);
+	htlc_deadline_add(&deadlines, &hout->deadline, 200);
+	htlc_deadline_add(&deadlines, &hin->deadline, 100);
+	CHECK(htlc_deadline_first(&deadlines) == &hin->deadline);
+	htlc_deadline_add(&deadlines, &hin->deadline, 300);
+	CHECK(htlc_deadline_first(&deadlines) == &hout->deadline);
+
 	/* Have to free manually, otherwise we get our dependencies
 	 * twisted */
 	tal_free(hin);
 	tal_free(hout);
+	CHECK(list_empty(&chan->htlcs_in));
+	CHECK(list_empty(&chan->htlcs_out));
+	CHECK(!htlc_out_ripemd_map_get(&chan->htlcs_out_by_ripemd, &ripemd));
+	CHECK(!htlc_deadline_first(&deadlines));
 	htlc_in_map_clear(htlcs_in);
 	htlc_out_map_clear(htlcs_out);
+	htlc_out_ripemd_map_clear(&chan->htlcs_out_by_ripemd);
 
 	return true;
 }
@@ -959,6 +992,221 @@ static bool test_payment_crud(struct lightningd *ld, const tal_t *ctx)
 	return true;
 }
 
+/* The statements lightningd runs all the time, one transaction's worth. */
+static bool hot_paths(struct wallet *w, struct channel_config *cc,
+		      u64 htlc_dbid, size_t i, bool cached)
+{
+	struct channel_config loaded;
+	struct preimage preimage, stored;
+	sqlite3_stmt *stmt;
+
+	memset(&preimage, i, sizeof(preimage));
+
+	wallet_htlc_update(w, htlc_dbid, RCVD_ADD_HTLC, NULL);
+	if (!cached)
+		db_clear_stmts(w->db);
+	wallet_htlc_update(w, htlc_dbid, SENT_REMOVE_HTLC, &preimage);
+	if (!cached)
+		db_clear_stmts(w->db);
+	cc->htlc_minimum_msat = i;
+	wallet_channel_config_save(w, cc);
+	if (!cached)
+		db_clear_stmts(w->db);
+	CHECK(wallet_channel_config_load(w, cc->id, &loaded));
+	if (!cached)
+		db_clear_stmts(w->db);
+
+	CHECK(loaded.htlc_minimum_msat == i);
+	stmt = db_query(__func__, w->db,
+			"SELECT hstate, payment_key FROM channel_htlcs"
+			" WHERE id=%"PRIu64";", htlc_dbid);
+	CHECK(stmt && sqlite3_step(stmt) == SQLITE_ROW);
+	CHECK(sqlite3_column_int(stmt, 0) == SENT_REMOVE_HTLC);
+	CHECK(sqlite3_column_preimage(stmt, 1, &stored));
+	CHECK(structeq(&stored, &preimage));
+	sqlite3_finalize(stmt);
+	return true;
+}
+
+/* A reused statement must give the same answers as a fresh one, whatever
+ * it was last bound to. */
+static bool test_stmt_reuse(struct lightningd *ld, const tal_t *ctx)
+{
+	struct wallet *w = create_test_wallet(ld, ctx);
+	struct channel_config *cc = talz(ctx, struct channel_config);
+	struct channel *chan = talz(ctx, struct channel);
+	struct htlc_in in;
+	size_t i;
+
+	memset(&in, 0, sizeof(in));
+	chan->dbid = 1;
+	in.key.channel = chan;
+	db_begin_transaction(w->db);
+	db_exec(__func__, w->db, "INSERT INTO channels (id) VALUES (1);");
+	wallet_channel_config_insert(w, cc);
+	wallet_htlc_save_in(w, chan, &in);
+
+	for (i = 0; i < 10; i++)
+		CHECK(hot_paths(w, cc, in.dbid, i, i % 3 != 0));
+	db_commit_transaction(w->db);
+
+	tal_free(w);
+	return true;
+}
+
+/* A block: each tx spends a P2WSH output from the previous block, and
+ * something we don't know about.  The last one also spends an output
+ * created earlier in the same block. */
+static struct block *test_block(const tal_t *ctx, struct block *prev,
+				size_t num_txs)
+{
+	struct block *b = talz(ctx, struct block);
+	u8 *wscript = tal_arr(b, u8, 1), *p2wsh, *other;
+	size_t i;
+
+	b->prev = prev;
+	b->height = prev ? prev->height + 1 : 1;
+	memset(&b->blkid, b->height, sizeof(b->blkid));
+	wscript[0] = b->height;
+	p2wsh = scriptpubkey_p2wsh(b, wscript);
+	other = tal_arrz(b, u8, 22);
+	b->full_txs = tal_arr(b, struct bitcoin_tx *, num_txs);
+	for (i = 0; i < num_txs; i++) {
+		struct bitcoin_tx *tx = bitcoin_tx(b->full_txs, 2, 3);
+
+		tx->lock_time = b->height;
+		if (prev && i < tal_count(prev->full_txs))
+			bitcoin_txid(prev->full_txs[i], &tx->input[0].txid);
+		else
+			memset(&tx->input[0].txid, 0xFF, sizeof(tx->input[0].txid));
+		tx->input[0].index = (i % 2) * 2;
+		memset(&tx->input[1].txid, 0, sizeof(tx->input[1].txid));
+		tx->input[1].index = i;
+		tx->output[0].script = p2wsh;
+		tx->output[0].amount = i;
+		tx->output[1].script = other;
+		tx->output[1].amount = i;
+		tx->output[2].script = p2wsh;
+		tx->output[2].amount = i + 1;
+		b->full_txs[i] = tx;
+	}
+	if (num_txs > 1) {
+		struct bitcoin_tx *tx = b->full_txs[num_txs - 1];
+		bitcoin_txid(b->full_txs[num_txs - 2], &tx->input[1].txid);
+		tx->input[1].index = 2;
+	}
+	return b;
+}
+
+/* How chaintopology used to do it: a statement per output and input. */
+static void utxoset_add_block_unbatched(struct wallet *w, const struct block *b)
+{
+	for (size_t i = 0; i < tal_count(b->full_txs); i++) {
+		const struct bitcoin_tx *tx = b->full_txs[i];
+		for (size_t j = 0; j < tal_count(tx->output); j++) {
+			const struct bitcoin_tx_output *output = &tx->output[j];
+			if (is_p2wsh(output->script, NULL))
+				wallet_utxoset_add(w, tx, j, b->height, i,
+						   output->script,
+						   output->amount);
+		}
+	}
+	for (size_t i = 0; i < tal_count(b->full_txs); i++) {
+		const struct bitcoin_tx *tx = b->full_txs[i];
+		for (size_t j = 0; j < tal_count(tx->input); j++)
+			wallet_outpoint_spend(w, b->height,
+					      &tx->input[j].txid,
+					      tx->input[j].index);
+	}
+}
+
+/* Add a block as add_tip does, inside its own transaction. */
+static void add_block(struct wallet *w, struct block *b, bool batched)
+{
+	db_begin_transaction(w->db);
+	wallet_block_add(w, b);
+	if (batched)
+		wallet_utxoset_add_block(w, b);
+	else
+		utxoset_add_block_unbatched(w, b);
+	db_commit_transaction(w->db);
+}
+
+static struct wallet *create_utxoset_wallet(struct lightningd *ld,
+					    const tal_t *ctx)
+{
+	struct wallet *w = create_test_wallet(ld, ctx);
+
+	w->owned_outpoints = outpointfilter_new(w);
+	w->utxoset_outpoints = outpointfilter_new(w);
+	return w;
+}
+
+static char *utxoset_dump(const tal_t *ctx, struct wallet *w)
+{
+	char *dump = tal_strdup(ctx, "");
+	sqlite3_stmt *stmt;
+
+	stmt = db_prepare(w->db, "SELECT hex(txid), outnum, blockheight,"
+			  " spendheight, txindex, hex(scriptpubkey), satoshis"
+			  " FROM utxoset ORDER BY txid, outnum");
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		for (int i = 0; i < 7; i++) {
+			const char *v = (const char *)sqlite3_column_text(stmt, i);
+			tal_append_fmt(&dump, "%s,", v ? v : "NULL");
+		}
+		tal_append_fmt(&dump, "\n");
+	}
+	db_stmt_done(w->db, stmt);
+	return dump;
+}
+
+static size_t utxoset_count(struct wallet *w, const char *where)
+{
+	sqlite3_stmt *stmt;
+	size_t count;
+
+	stmt = db_prepare(w->db, tal_fmt(w, "SELECT COUNT(*) FROM utxoset%s",
+					 where));
+	CHECK(sqlite3_step(stmt) == SQLITE_ROW);
+	count = sqlite3_column_int64(stmt, 0);
+	db_stmt_done(w->db, stmt);
+	return count;
+}
+
+static bool test_utxoset_add_block(struct lightningd *ld, const tal_t *ctx)
+{
+	struct wallet *w[2];
+	struct block *b[3];
+	size_t i, j;
+
+	/* 240 outputs per block: two full batches and some left over. */
+	for (i = 0; i < ARRAY_SIZE(b); i++)
+		b[i] = test_block(ctx, i ? b[i-1] : NULL, 120);
+
+	for (j = 0; j < 2; j++) {
+		w[j] = create_utxoset_wallet(ld, ctx);
+		for (i = 0; i < ARRAY_SIZE(b); i++)
+			add_block(w[j], b[i], j == 1);
+		CHECK(!wallet_err);
+	}
+
+	db_begin_transaction(w[0]->db);
+	db_begin_transaction(w[1]->db);
+	CHECK(utxoset_count(w[1], "") == 3 * 240);
+	/* One spend per tx from the block before, one within the block. */
+	CHECK(utxoset_count(w[1], " WHERE spendheight = 1") == 1);
+	CHECK(utxoset_count(w[1], " WHERE spendheight = 2") == 121);
+	CHECK(utxoset_count(w[1], " WHERE spendheight = 3") == 121);
+	CHECK(streq(utxoset_dump(ctx, w[0]), utxoset_dump(ctx, w[1])));
+	db_commit_transaction(w[0]->db);
+	db_commit_transaction(w[1]->db);
+
+	tal_free(w[0]);
+	tal_free(w[1]);
+	return true;
+}
+
 int main(void)
 {
 	bool ok = true;
@@ -971,6 +1219,7 @@ int main(void)
 	/* Accessed in peer destructor sanity check */
 	htlc_in_map_init(&ld->htlcs_in);
 	htlc_out_map_init(&ld->htlcs_out);
+	ld->owned_txfilter = txfilter_new(ld);
 
 	ok &= test_wallet_outputs();
 	ok &= test_shachain_crud();
@@ -978,6 +1227,8 @@ int main(void)
 	ok &= test_channel_config_crud(ld, tmpctx);
 	ok &= test_htlc_crud(ld, tmpctx);
 	ok &= test_payment_crud(ld, tmpctx);
+	ok &= test_stmt_reuse(ld, tmpctx);
+	ok &= test_utxoset_add_block(ld, tmpctx);
 
 	take_cleanup();
 	tal_free(tmpctx);
@@ -2,6 +2,7 @@
 #include "wallet.h"
 
 #include <bitcoin/script.h>
+#include <ccan/asort/asort.h>
 #include <ccan/structeq/structeq.h>
 #include <ccan/tal/str/str.h>
 #include <common/key_derive.h>
@@ -42,7 +43,7 @@ static void outpointfilters_init(struct wallet *w)
 		outpointfilter_add(w->utxoset_outpoints, &txid, outnum);
 	}
 
-	sqlite3_finalize(stmt);
+	db_stmt_done(w->db, stmt);
 }
 
 struct wallet *wallet_new(struct lightningd *ld,
@@ -50,7 +51,7 @@ struct wallet *wallet_new(struct lightningd *ld,
 {
 	struct wallet *wallet = tal(ld, struct wallet);
 	wallet->ld = ld;
-	wallet->db = db_setup(wallet, log);
+	wallet->db = db_setup(wallet, log, &ld->config);
 	wallet->log = log;
 	wallet->bip32_base = NULL;
 	wallet->invoices = invoices_new(wallet, wallet->db, log, timers);
@@ -193,7 +194,7 @@ struct utxo **wallet_get_utxos(const tal_t *ctx, struct wallet *w, const enum ou
 		results[i] = tal(results, struct utxo);
 		wallet_stmt2output(stmt, results[i]);
 	}
-	sqlite3_finalize(stmt);
+	db_stmt_done(w->db, stmt);
 
 	return results;
 }
@@ -465,13 +466,13 @@ bool wallet_shachain_load(struct wallet *wallet, u64 id,
 
 	err = sqlite3_step(stmt);
 	if (err != SQLITE_ROW) {
-		sqlite3_finalize(stmt);
+		db_stmt_done(wallet->db, stmt);
 		return false;
 	}
 
 	chain->chain.min_index = sqlite3_column_int64(stmt, 0);
 	chain->chain.num_valid = sqlite3_column_int64(stmt, 1);
-	sqlite3_finalize(stmt);
+	db_stmt_done(wallet->db, stmt);
 
 	/* Load shachain known entries */
 	stmt = db_prepare(wallet->db, "SELECT idx, hash, pos FROM shachain_known WHERE shachain_id=?");
@@ -483,7 +484,7 @@ bool wallet_shachain_load(struct wallet *wallet, u64 id,
 		memcpy(&chain->chain.known[pos].hash, sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1));
 	}
 
-	sqlite3_finalize(stmt);
+	db_stmt_done(wallet->db, stmt);
 	return true;
 }
 
@@ -544,7 +545,7 @@ bool wallet_peer_by_nodeid(struct wallet *w, const struct pubkey *nodeid,
 		/* Make sure we mark this as a new peer */
 		peer->dbid = 0;
 	}
-	sqlite3_finalize(stmt);
+	db_stmt_done(w->db, stmt);
 	tal_free(tmpctx);
 	return ok;
 }
@@ -562,7 +563,7 @@ wallet_htlc_sigs_load(const tal_t *ctx, struct wallet *w, u64 channelid)
 		sqlite3_column_signature(stmt, 0, &htlc_sigs[n]);
 		n++;
 	}
-	sqlite3_finalize(stmt);
+	db_stmt_done(w->db, stmt);
 	log_debug(w->log, "Loaded %zu HTLC signatures from DB", n);
 	return htlc_sigs;
 }
@@ -677,6 +678,8 @@ static struct channel *wallet_stmt2channel(const tal_t *ctx, struct wallet *w, s
 			   sqlite3_column_int(stmt, 34) != 0,
 			   last_sent_commit,
 			   sqlite3_column_int64(stmt, 35));
+	/* It's just what's in the db. */
+	chan->dirty = 0;
 
 	tal_free(tmpctx);
 	return chan;
@@ -863,107 +866,138 @@ u64 wallet_get_channel_dbid(struct wallet *wallet)
 
 void wallet_channel_save(struct wallet *w, struct channel *chan)
 {
-	tal_t *tmpctx = tal_tmpctx(w);
 	sqlite3_stmt *stmt;
 	assert(chan->first_blocknum);
 
-	wallet_channel_config_save(w, &chan->our_config);
-
-	stmt = db_prepare(w->db, "UPDATE channels SET"
-			  "  shachain_remote_id=?,"
-			  "  short_channel_id=?,"
-			  "  state=?,"
-			  "  funder=?,"
-			  "  channel_flags=?,"
-			  "  minimum_depth=?,"
-			  "  next_index_local=?,"
-			  "  next_index_remote=?,"
-			  "  next_htlc_id=?,"
-			  "  funding_tx_id=?,"
-			  "  funding_tx_outnum=?,"
-			  "  funding_satoshi=?,"
-			  "  funding_locked_remote=?,"
-			  "  push_msatoshi=?,"
-			  "  msatoshi_local=?,"
-			  "  shutdown_scriptpubkey_remote=?,"
-			  "  shutdown_keyidx_local=?,"
-			  "  channel_config_local=?,"
-			  "  last_tx=?, last_sig=?,"
-			  "  last_was_revoke=?"
-			  " WHERE id=?");
-	sqlite3_bind_int64(stmt, 1, chan->their_shachain.id);
-	if (chan->scid)
-		sqlite3_bind_short_channel_id(stmt, 2, chan->scid);
-	sqlite3_bind_int(stmt, 3, chan->state);
-	sqlite3_bind_int(stmt, 4, chan->funder);
-	sqlite3_bind_int(stmt, 5, chan->channel_flags);
-	sqlite3_bind_int(stmt, 6, chan->minimum_depth);
-
-	sqlite3_bind_int64(stmt, 7, chan->next_index[LOCAL]);
-	sqlite3_bind_int64(stmt, 8, chan->next_index[REMOTE]);
-	sqlite3_bind_int64(stmt, 9, chan->next_htlc_id);
-
-	sqlite3_bind_sha256_double(stmt, 10, &chan->funding_txid.shad);
-
-	sqlite3_bind_int(stmt, 11, chan->funding_outnum);
-	sqlite3_bind_int64(stmt, 12, chan->funding_satoshi);
-	sqlite3_bind_int(stmt, 13, chan->remote_funding_locked);
-	sqlite3_bind_int64(stmt, 14, chan->push_msat);
-	sqlite3_bind_int64(stmt, 15, chan->our_msatoshi);
-
-	if (chan->remote_shutdown_scriptpubkey)
-		sqlite3_bind_blob(stmt, 16, chan->remote_shutdown_scriptpubkey,
-				  tal_len(chan->remote_shutdown_scriptpubkey),
-				  SQLITE_TRANSIENT);
-
-	sqlite3_bind_int64(stmt, 17, chan->final_key_idx);
-	sqlite3_bind_int64(stmt, 18, chan->our_config.id);
-	sqlite3_bind_tx(stmt, 19, chan->last_tx);
-	sqlite3_bind_signature(stmt, 20, &chan->last_sig);
-	sqlite3_bind_int(stmt, 21, chan->last_was_revoke);
-	sqlite3_bind_int64(stmt, 22, chan->dbid);
-	db_exec_prepared(w->db, stmt);
+	/* This changes on every commitment, so it's kept small. */
+	if (chan->dirty & CHANNEL_DIRTY_STATE) {
+		stmt = db_prepare(w->db, "UPDATE channels SET"
+				  "  short_channel_id=?,"
+				  "  state=?,"
+				  "  next_index_local=?,"
+				  "  next_index_remote=?,"
+				  "  next_htlc_id=?,"
+				  "  funding_locked_remote=?,"
+				  "  msatoshi_local=?,"
+				  "  per_commit_remote=?,"
+				  "  old_per_commit_remote=?,"
+				  "  local_feerate_per_kw=?,"
+				  "  remote_feerate_per_kw=?,"
+				  "  last_was_revoke=?"
+				  " WHERE id=?");
+		if (chan->scid)
+			sqlite3_bind_short_channel_id(stmt, 1, chan->scid);
+		else
+			sqlite3_bind_null(stmt, 1);
+		sqlite3_bind_int(stmt, 2, chan->state);
+		sqlite3_bind_int64(stmt, 3, chan->next_index[LOCAL]);
+		sqlite3_bind_int64(stmt, 4, chan->next_index[REMOTE]);
+		sqlite3_bind_int64(stmt, 5, chan->next_htlc_id);
+		sqlite3_bind_int(stmt, 6, chan->remote_funding_locked);
+		sqlite3_bind_int64(stmt, 7, chan->our_msatoshi);
+		sqlite3_bind_pubkey(stmt, 8,
+				    &chan->channel_info.remote_per_commit);
+		sqlite3_bind_pubkey(stmt, 9,
+				    &chan->channel_info.old_remote_per_commit);
+		sqlite3_bind_int(stmt, 10,
+				 chan->channel_info.feerate_per_kw[LOCAL]);
+		sqlite3_bind_int(stmt, 11,
+				 chan->channel_info.feerate_per_kw[REMOTE]);
+		sqlite3_bind_int(stmt, 12, chan->last_was_revoke);
+		sqlite3_bind_int64(stmt, 13, chan->dbid);
+		db_exec_prepared(w->db, stmt);
 
-	wallet_channel_config_save(w, &chan->channel_info.their_config);
-	stmt = db_prepare(w->db, "UPDATE channels SET"
-			  "  fundingkey_remote=?,"
-			  "  revocation_basepoint_remote=?,"
-			  "  payment_basepoint_remote=?,"
-			  "  htlc_basepoint_remote=?,"
-			  "  delayed_payment_basepoint_remote=?,"
-			  "  per_commit_remote=?,"
-			  "  old_per_commit_remote=?,"
-			  "  local_feerate_per_kw=?,"
-			  "  remote_feerate_per_kw=?,"
-			  "  channel_config_remote=?"
-			  " WHERE id=?");
-	sqlite3_bind_pubkey(stmt, 1,  &chan->channel_info.remote_fundingkey);
-	sqlite3_bind_pubkey(stmt, 2,  &chan->channel_info.theirbase.revocation);
-	sqlite3_bind_pubkey(stmt, 3,  &chan->channel_info.theirbase.payment);
-	sqlite3_bind_pubkey(stmt, 4,  &chan->channel_info.theirbase.htlc);
-	sqlite3_bind_pubkey(stmt, 5,  &chan->channel_info.theirbase.delayed_payment);
-	sqlite3_bind_pubkey(stmt, 6,  &chan->channel_info.remote_per_commit);
-	sqlite3_bind_pubkey(stmt, 7,  &chan->channel_info.old_remote_per_commit);
-	sqlite3_bind_int(stmt, 8, chan->channel_info.feerate_per_kw[LOCAL]);
-	sqlite3_bind_int(stmt, 9, chan->channel_info.feerate_per_kw[REMOTE]);
-	sqlite3_bind_int64(stmt, 10, chan->channel_info.their_config.id);
-	sqlite3_bind_int64(stmt, 11, chan->dbid);
-	db_exec_prepared(w->db, stmt);
+		/* If we have a last_sent_commit, store it */
+		if (chan->last_sent_commit) {
+			stmt = db_prepare(w->db,
+					  "UPDATE channels SET"
+					  "  last_sent_commit_state=?,"
+					  "  last_sent_commit_id=?"
+					  " WHERE id=?");
+			sqlite3_bind_int(stmt, 1,
+					 chan->last_sent_commit->newstate);
+			sqlite3_bind_int64(stmt, 2, chan->last_sent_commit->id);
+			sqlite3_bind_int64(stmt, 3, chan->dbid);
+			db_exec_prepared(w->db, stmt);
+		}
+	}
 
-	/* If we have a last_sent_commit, store it */
-	if (chan->last_sent_commit) {
-		stmt = db_prepare(w->db,
-				  "UPDATE channels SET"
-				  "  last_sent_commit_state=?,"
-				  "  last_sent_commit_id=?"
+	if (chan->dirty & CHANNEL_DIRTY_LAST_TX) {
+		stmt = db_prepare(w->db, "UPDATE channels SET"
+				  "  last_tx=?, last_sig=?"
 				  " WHERE id=?");
-		sqlite3_bind_int(stmt, 1, chan->last_sent_commit->newstate);
-		sqlite3_bind_int64(stmt, 2, chan->last_sent_commit->id);
+		sqlite3_bind_tx(stmt, 1, chan->last_tx);
+		sqlite3_bind_signature(stmt, 2, &chan->last_sig);
 		sqlite3_bind_int64(stmt, 3, chan->dbid);
 		db_exec_prepared(w->db, stmt);
 	}
 
-	tal_free(tmpctx);
+	/* These are only set when the channel is opened. */
+	if (chan->dirty & CHANNEL_DIRTY_CONFIG) {
+		wallet_channel_config_save(w, &chan->our_config);
+		wallet_channel_config_save(w, &chan->channel_info.their_config);
+		stmt = db_prepare(w->db, "UPDATE channels SET"
+				  "  shachain_remote_id=?,"
+				  "  funder=?,"
+				  "  channel_flags=?,"
+				  "  minimum_depth=?,"
+				  "  funding_tx_id=?,"
+				  "  funding_tx_outnum=?,"
+				  "  funding_satoshi=?,"
+				  "  push_msatoshi=?,"
+				  "  channel_config_local=?,"
+				  "  channel_config_remote=?"
+				  " WHERE id=?");
+		sqlite3_bind_int64(stmt, 1, chan->their_shachain.id);
+		sqlite3_bind_int(stmt, 2, chan->funder);
+		sqlite3_bind_int(stmt, 3, chan->channel_flags);
+		sqlite3_bind_int(stmt, 4, chan->minimum_depth);
+		sqlite3_bind_sha256_double(stmt, 5, &chan->funding_txid.shad);
+		sqlite3_bind_int(stmt, 6, chan->funding_outnum);
+		sqlite3_bind_int64(stmt, 7, chan->funding_satoshi);
+		sqlite3_bind_int64(stmt, 8, chan->push_msat);
+		sqlite3_bind_int64(stmt, 9, chan->our_config.id);
+		sqlite3_bind_int64(stmt, 10,
+				   chan->channel_info.their_config.id);
+		sqlite3_bind_int64(stmt, 11, chan->dbid);
+		db_exec_prepared(w->db, stmt);
+	}
+
+	if (chan->dirty & CHANNEL_DIRTY_BASEPOINTS) {
+		stmt = db_prepare(w->db, "UPDATE channels SET"
+				  "  fundingkey_remote=?,"
+				  "  revocation_basepoint_remote=?,"
+				  "  payment_basepoint_remote=?,"
+				  "  htlc_basepoint_remote=?,"
+				  "  delayed_payment_basepoint_remote=?"
+				  " WHERE id=?");
+		sqlite3_bind_pubkey(stmt, 1,  &chan->channel_info.remote_fundingkey);
+		sqlite3_bind_pubkey(stmt, 2,  &chan->channel_info.theirbase.revocation);
+		sqlite3_bind_pubkey(stmt, 3,  &chan->channel_info.theirbase.payment);
+		sqlite3_bind_pubkey(stmt, 4,  &chan->channel_info.theirbase.htlc);
+		sqlite3_bind_pubkey(stmt, 5,  &chan->channel_info.theirbase.delayed_payment);
+		sqlite3_bind_int64(stmt, 6, chan->dbid);
+		db_exec_prepared(w->db, stmt);
+	}
+
+	if (chan->dirty & CHANNEL_DIRTY_SHUTDOWN) {
+		stmt = db_prepare(w->db, "UPDATE channels SET"
+				  "  shutdown_scriptpubkey_remote=?,"
+				  "  shutdown_keyidx_local=?"
+				  " WHERE id=?");
+		if (chan->remote_shutdown_scriptpubkey)
+			sqlite3_bind_blob(stmt, 1,
+					  chan->remote_shutdown_scriptpubkey,
+					  tal_len(chan->remote_shutdown_scriptpubkey),
+					  SQLITE_TRANSIENT);
+		else
+			sqlite3_bind_null(stmt, 1);
+		sqlite3_bind_int64(stmt, 2, chan->final_key_idx);
+		sqlite3_bind_int64(stmt, 3, chan->dbid);
+		db_exec_prepared(w->db, stmt);
+	}
+
+	chan->dirty = 0;
 }
 
 void wallet_channel_insert(struct wallet *w, struct channel *chan)
@@ -998,6 +1032,7 @@ void wallet_channel_insert(struct wallet *w, struct channel *chan)
 	wallet_shachain_init(w, &chan->their_shachain);
 
 	/* Now save path as normal */
+	chan->dirty = CHANNEL_DIRTY_ALL;
 	wallet_channel_save(w, chan);
 	tal_free(tmpctx);
 }
@@ -1480,7 +1515,7 @@ struct htlc_stub *wallet_htlc_stubs(const tal_t *ctx, struct wallet *wallet,
 		sqlite3_column_sha256(stmt, 3, &payment_hash);
 		ripemd160(&stubs[n].ripemd, payment_hash.u.u8, sizeof(payment_hash.u));
 	}
-	sqlite3_finalize(stmt);
+	db_stmt_done(wallet->db, stmt);
 	return stubs;
 }
 
@@ -1623,7 +1658,7 @@ wallet_payment_by_hash(const tal_t *ctx, struct wallet *wallet,
 	if (sqlite3_step(stmt) == SQLITE_ROW) {
 		payment = wallet_stmt2payment(ctx, stmt);
 	}
-	sqlite3_finalize(stmt);
+	db_stmt_done(wallet->db, stmt);
 	return payment;
 }
 
@@ -1643,7 +1678,7 @@ struct secret *wallet_payment_get_secrets(const tal_t *ctx,
 	if (sqlite3_step(stmt) == SQLITE_ROW) {
 		path_secrets = sqlite3_column_secrets(ctx, stmt, 0);
 	}
-	sqlite3_finalize(stmt);
+	db_stmt_done(wallet->db, stmt);
 	return path_secrets;
 }
 
@@ -1716,7 +1751,7 @@ wallet_payment_list(const tal_t *ctx,
 		payments[i] = wallet_stmt2payment(payments, stmt);
 	}
 
-	sqlite3_finalize(stmt);
+	db_stmt_done(wallet->db, stmt);
 
 	/* Now attach payments not yet in db. */
 	list_for_each(&wallet->unstored_payments, p, list) {
@@ -1818,7 +1853,7 @@ void wallet_block_remove(struct wallet *w, struct block *b)
 	stmt = db_prepare(w->db, "SELECT * FROM blocks WHERE height >= ?;");
 	sqlite3_bind_int(stmt, 1, b->height);
 	assert(sqlite3_step(stmt) == SQLITE_DONE);
-	sqlite3_finalize(stmt);
+	db_stmt_done(w->db, stmt);
 }
 
 void wallet_blocks_rollback(struct wallet *w, u32 height)
@@ -1829,23 +1864,30 @@ void wallet_blocks_rollback(struct wallet *w, u32 height)
 	db_exec_prepared(w->db, stmt);
 }
 
-void wallet_outpoint_spend(struct wallet *w, const u32 blockheight,
-			   const struct bitcoin_txid *txid, const u32 outnum)
+static void wallet_output_spend(struct wallet *w, const u32 blockheight,
+				const struct bitcoin_txid *txid,
+				const u32 outnum)
 {
 	sqlite3_stmt *stmt;
-	if (outpointfilter_matches(w->owned_outpoints, txid, outnum)) {
-		stmt = db_prepare(w->db,
-				  "UPDATE outputs "
-				  "SET spend_height = ? "
-				  "WHERE prev_out_tx = ?"
-				  " AND prev_out_index = ?");
+	stmt = db_prepare(w->db,
+			  "UPDATE outputs "
+			  "SET spend_height = ? "
+			  "WHERE prev_out_tx = ?"
+			  " AND prev_out_index = ?");
 
-		sqlite3_bind_int(stmt, 1, blockheight);
-		sqlite3_bind_sha256_double(stmt, 2, &txid->shad);
-		sqlite3_bind_int(stmt, 3, outnum);
+	sqlite3_bind_int(stmt, 1, blockheight);
+	sqlite3_bind_sha256_double(stmt, 2, &txid->shad);
+	sqlite3_bind_int(stmt, 3, outnum);
 
-		db_exec_prepared(w->db, stmt);
-	}
+	db_exec_prepared(w->db, stmt);
+}
+
+void wallet_outpoint_spend(struct wallet *w, const u32 blockheight,
+			   const struct bitcoin_txid *txid, const u32 outnum)
+{
+	sqlite3_stmt *stmt;
+	if (outpointfilter_matches(w->owned_outpoints, txid, outnum))
+		wallet_output_spend(w, blockheight, txid, outnum);
 
 	if (outpointfilter_matches(w->utxoset_outpoints, txid, outnum)) {
 		stmt = db_prepare(w->db,
@@ -1892,6 +1934,172 @@ void wallet_utxoset_add(struct wallet *w, const struct bitcoin_tx *tx,
 	outpointfilter_add(w->utxoset_outpoints, &txid, outnum);
 }
 
+/* sqlite allows 999 parameters: that's 7 per utxoset row, 2 per spend. */
+#define UTXOSET_BATCH 100
+
+struct utxoset_add {
+	struct bitcoin_txid txid;
+	u32 outnum, txindex;
+	const struct bitcoin_tx_output *output;
+};
+
+static int utxoset_add_cmp(const struct utxoset_add *a,
+			   const struct utxoset_add *b, void *unused UNUSED)
+{
+	int ret = memcmp(&a->txid, &b->txid, sizeof(a->txid));
+	if (ret)
+		return ret;
+	return (int)a->outnum - (int)b->outnum;
+}
+
+static int utxoset_spend_cmp(const struct bitcoin_tx_input *const *a,
+			     const struct bitcoin_tx_input *const *b,
+			     void *unused UNUSED)
+{
+	int ret = memcmp(&(*a)->txid, &(*b)->txid, sizeof((*a)->txid));
+	if (ret)
+		return ret;
+	return (int)(*a)->index - (int)(*b)->index;
+}
+
+/* @num copies of @group, separated by @sep. */
+static char *sql_repeat(const tal_t *ctx, size_t num,
+			const char *group, const char *sep)
+{
+	char *sql = tal_strdup(ctx, "");
+
+	for (size_t i = 0; i < num; i++)
+		tal_append_fmt(&sql, "%s%s", i ? sep : "", group);
+	return sql;
+}
+
+static void utxoset_insert(struct wallet *w, const u32 blockheight,
+			   const struct utxoset_add *adds, size_t num)
+{
+	tal_t *tmpctx = tal_tmpctx(w);
+	sqlite3_stmt *stmt;
+	int col = 1;
+
+	stmt = db_prepare(w->db, tal_fmt(tmpctx, "INSERT INTO utxoset ("
+		      " txid,"
+		      " outnum,"
+		      " blockheight,"
+		      " spendheight,"
+		      " txindex,"
+		      " scriptpubkey,"
+		      " satoshis"
+		      ") VALUES %s;",
+		      sql_repeat(tmpctx, num,
+				 "(?, ?, ?, ?, ?, ?, ?)", ", ")));
+	for (size_t i = 0; i < num; i++) {
+		const u8 *script = adds[i].output->script;
+		sqlite3_bind_sha256_double(stmt, col++, &adds[i].txid.shad);
+		sqlite3_bind_int(stmt, col++, adds[i].outnum);
+		sqlite3_bind_int(stmt, col++, blockheight);
+		sqlite3_bind_null(stmt, col++);
+		sqlite3_bind_int(stmt, col++, adds[i].txindex);
+		sqlite3_bind_blob(stmt, col++, script, tal_len(script),
+				  SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, col++, adds[i].output->amount);
+	}
+	db_exec_prepared(w->db, stmt);
+	tal_free(tmpctx);
+}
+
+static void utxoset_spend(struct wallet *w, const u32 blockheight,
+			  const struct bitcoin_tx_input **spends, size_t num)
+{
+	tal_t *tmpctx = tal_tmpctx(w);
+	sqlite3_stmt *stmt;
+	int col = 1;
+
+	/* Each term is a lookup on the primary key. */
+	stmt = db_prepare(w->db, tal_fmt(tmpctx, "UPDATE utxoset "
+					 "SET spendheight = ? "
+					 "WHERE %s",
+					 sql_repeat(tmpctx, num,
+						    "(txid = ? AND outnum = ?)",
+						    " OR ")));
+	sqlite3_bind_int(stmt, col++, blockheight);
+	for (size_t i = 0; i < num; i++) {
+		sqlite3_bind_sha256_double(stmt, col++, &spends[i]->txid.shad);
+		sqlite3_bind_int(stmt, col++, spends[i]->index);
+	}
+	db_exec_prepared(w->db, stmt);
+	tal_free(tmpctx);
+}
+
+void wallet_utxoset_add_block(struct wallet *w, const struct block *b)
+{
+	tal_t *tmpctx = tal_tmpctx(w);
+	struct utxoset_add *adds = tal_arr(tmpctx, struct utxoset_add, 0);
+	const struct bitcoin_tx_input **spends
+		= tal_arr(tmpctx, const struct bitcoin_tx_input *, 0);
+	size_t i, j, n;
+
+	for (i = 0; i < tal_count(b->full_txs); i++) {
+		const struct bitcoin_tx *tx = b->full_txs[i];
+		struct bitcoin_txid txid;
+		bool have_txid = false;
+
+		for (j = 0; j < tal_count(tx->output); j++) {
+			if (!is_p2wsh(tx->output[j].script, NULL))
+				continue;
+			if (!have_txid) {
+				bitcoin_txid(tx, &txid);
+				have_txid = true;
+			}
+			n = tal_count(adds);
+			tal_resize(&adds, n + 1);
+			adds[n].txid = txid;
+			adds[n].outnum = j;
+			adds[n].txindex = i;
+			adds[n].output = &tx->output[j];
+			/* So spends later in this block match. */
+			outpointfilter_add(w->utxoset_outpoints, &txid, j);
+		}
+	}
+
+	for (i = 0; i < tal_count(b->full_txs); i++) {
+		const struct bitcoin_tx *tx = b->full_txs[i];
+
+		for (j = 0; j < tal_count(tx->input); j++) {
+			const struct bitcoin_tx_input *in = &tx->input[j];
+
+			if (outpointfilter_matches(w->owned_outpoints,
+						   &in->txid, in->index))
+				wallet_output_spend(w, b->height,
+						    &in->txid, in->index);
+			if (!outpointfilter_matches(w->utxoset_outpoints,
+						    &in->txid, in->index))
+				continue;
+			n = tal_count(spends);
+			tal_resize(&spends, n + 1);
+			spends[n] = in;
+		}
+	}
+
+	/* txids are random: in key order, each batch touches fewer pages. */
+	asort(adds, tal_count(adds), utxoset_add_cmp, NULL);
+	asort(spends, tal_count(spends), utxoset_spend_cmp, NULL);
+
+	/* Full batches share one statement; the rest go one at a time, so
+	 * we don't cache a statement for every possible remainder. */
+	n = tal_count(adds);
+	for (i = 0; i + UTXOSET_BATCH <= n; i += UTXOSET_BATCH)
+		utxoset_insert(w, b->height, adds + i, UTXOSET_BATCH);
+	for (; i < n; i++)
+		utxoset_insert(w, b->height, adds + i, 1);
+
+	n = tal_count(spends);
+	for (i = 0; i + UTXOSET_BATCH <= n; i += UTXOSET_BATCH)
+		utxoset_spend(w, b->height, spends + i, UTXOSET_BATCH);
+	for (; i < n; i++)
+		utxoset_spend(w, b->height, spends + i, 1);
+
+	tal_free(tmpctx);
+}
+
 struct outpoint *wallet_outpoint_for_scid(struct wallet *w, tal_t *ctx,
 					  const struct short_channel_id *scid)
 {
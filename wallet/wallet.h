@@ -234,6 +234,8 @@ u64 wallet_get_channel_dbid(struct wallet *wallet);
  * @wallet: the wallet to save into
  * @chan: the instance to store (not const so we can update the unique_id upon
  *   insert)
+ *
+ * Only writes the parts marked in @chan->dirty, and clears it.
  */
 void wallet_channel_save(struct wallet *w, struct channel *chan);
 
@@ -728,4 +730,12 @@ void wallet_utxoset_add(struct wallet *w, const struct bitcoin_tx *tx,
 			const u32 outnum, const u32 blockheight,
 			const u32 txindex, const u8 *scriptpubkey,
 			const u64 satoshis);
+
+/**
+ * wallet_utxoset_add_block - Add a new block's outputs, and mark its spends
+ *
+ * Does wallet_utxoset_add() for each P2WSH output in @b, then
+ * wallet_outpoint_spend() for each input, but in multi-row batches.
+ */
+void wallet_utxoset_add_block(struct wallet *w, const struct block *b);
 #endif /* WALLET_WALLET_H */